@@ -11,7 +11,7 @@ build_server() {
 			 -S udp_server \
 			 -B "${SERVER_BUILD_DIR}";
 
- cmake --build "${SERVER_BUILD_DIR}" --target udp_server -j 4;
+ cmake --build "${SERVER_BUILD_DIR}" --target udp_server udp_replay udp_server_bench udp_loopback_bench udp_shm_reader -j 4;
 }
 
 build_client() {
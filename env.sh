@@ -6,3 +6,5 @@ CLIENT_BUILD_DIR="`pwd`/udp_client_build"
 SERVER="${SERVER_BUILD_DIR}/udp_server"
 
 PORT=9999
+CONTENT_INDEX="${SERVER_BUILD_DIR}/content.index"
+JOURNAL_DIR="${SERVER_BUILD_DIR}/journal"
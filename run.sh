@@ -21,7 +21,7 @@ run_client() {
  ("${client}" --port $PORT $(get_files)) | xargs -I % echo "Client said: %";
 }
 
-"${SERVER}" $PORT &
+"${SERVER}" --index-capacity 4096 --index "${CONTENT_INDEX}" --journal "${JOURNAL_DIR}" $PORT &
 server_pid=$!;
 
 run_client;
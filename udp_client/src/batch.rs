@@ -0,0 +1,372 @@
+//! Batched sending of PUT datagrams. Header and payload of a datagram are
+//! gathered with iovecs straight from the mmapped file, so nothing is copied
+//! in user space. Many datagrams are passed to the kernel by one `sendmmsg`
+//! call, and runs of full size datagrams are sent as one UDP_SEGMENT (GSO)
+//! message where the kernel supports it. Replies are received in batches
+//! as well.
+
+use std::{io, net::UdpSocket, time::Duration};
+
+use crate::consts;
+use crate::packet::{Data, Header, Packet};
+
+pub const HEADER_SIZE: usize = Header::serialized_size();
+/// Replies are small, but a PACKED_ACK may take a whole datagram
+pub const RECV_BUFFER_SIZE: usize = consts::MAX_DATAGRAM_SIZE;
+const RECV_BATCH_SIZE: usize = 64;
+
+fn is_timeout(e: &io::Error) -> bool {
+    matches!(
+        e.kind(),
+        io::ErrorKind::WouldBlock | io::ErrorKind::TimedOut | io::ErrorKind::Interrupted
+    )
+}
+
+/// Sends and receives datagrams in batches: `BatchSocket` over UDP or
+/// `LocalSocket` over the shared memory rings of a server on the same host.
+pub trait DatagramSocket {
+    /// Returns number of datagrams which were sent, it is less than
+    /// `datagrams.len()` only if there is no room for the rest.
+    fn send(&mut self, datagrams: &[Datagram]) -> io::Result<usize>;
+    /// Receives datagrams which are already queued. If there are none, waits
+    /// up to `wait` for the first one, `None` doesn't wait at all.
+    fn recv(&mut self, wait: Option<Duration>) -> io::Result<impl Iterator<Item = &[u8]> + '_>;
+}
+
+/// Datagram which is sent as serialized header followed by the payload.
+#[derive(Clone, Copy)]
+pub struct Datagram<'a> {
+    pub header: [u8; HEADER_SIZE],
+    pub payload: &'a [u8],
+}
+
+impl Datagram<'_> {
+    pub fn len(&self) -> usize {
+        HEADER_SIZE + self.payload.len()
+    }
+}
+
+impl<'a> From<&Packet<'a>> for Datagram<'a> {
+    fn from(packet: &Packet<'a>) -> Self {
+        Self {
+            header: packet.header.to_bytes(),
+            payload: match packet.data {
+                Data::Ref(payload) => payload,
+                _ => &[],
+            },
+        }
+    }
+}
+
+#[cfg(target_os = "linux")]
+mod imp {
+    use super::*;
+    use std::{mem, os::unix::io::AsRawFd, ptr};
+
+    // Not every libc target exports these
+    const SOL_UDP: libc::c_int = 17;
+    const UDP_SEGMENT: libc::c_int = 103;
+
+    /// Kernel doesn't split a message into more segments than that
+    const MAX_GSO_SEGMENTS: usize = 64;
+    /// And a message still has to fit into a single IP packet before it is split
+    const MAX_GSO_BYTES: usize = 65507;
+
+    /// Space for a cmsg with u16 payload, u64 keeps it aligned for cmsghdr
+    type CmsgBuffer = [u64; 4];
+
+    pub struct BatchSocket {
+        socket: UdpSocket,
+        gso: bool,
+
+        // Reused between calls, pointers in them are valid only during send()
+        iovecs: Vec<libc::iovec>,
+        messages: Vec<libc::mmsghdr>,
+        cmsgs: Vec<CmsgBuffer>,
+        /// Number of datagrams in each message
+        datagrams_in_message: Vec<usize>,
+
+        // Messages point to the buffers once and for all
+        recv_buffers: Vec<[u8; RECV_BUFFER_SIZE]>,
+        #[allow(dead_code)] // only keeps iovecs of the messages alive
+        recv_iovecs: Vec<libc::iovec>,
+        recv_messages: Vec<libc::mmsghdr>,
+    }
+
+    // Raw pointers in the reused buffers never outlive a send() call
+    unsafe impl Send for BatchSocket {}
+
+    impl BatchSocket {
+        /// `use_gso` is only a wish: GSO is used if the kernel accepts UDP_SEGMENT.
+        pub fn new(socket: UdpSocket, use_gso: bool) -> Self {
+            let gso = use_gso && Self::probe_gso(&socket);
+
+            let mut recv_buffers = vec![[0; RECV_BUFFER_SIZE]; RECV_BATCH_SIZE];
+            let mut recv_iovecs = recv_buffers
+                .iter_mut()
+                .map(|buffer| libc::iovec {
+                    iov_base: buffer.as_mut_ptr() as *mut libc::c_void,
+                    iov_len: RECV_BUFFER_SIZE,
+                })
+                .collect::<Vec<libc::iovec>>();
+            let recv_messages = recv_iovecs
+                .iter_mut()
+                .map(|iovec| {
+                    let mut header: libc::msghdr = unsafe { mem::zeroed() };
+                    header.msg_iov = iovec;
+                    header.msg_iovlen = 1;
+                    libc::mmsghdr { msg_hdr: header, msg_len: 0 }
+                })
+                .collect();
+
+            Self {
+                socket,
+                gso,
+                iovecs: Vec::new(),
+                messages: Vec::new(),
+                cmsgs: Vec::new(),
+                datagrams_in_message: Vec::new(),
+                recv_buffers,
+                recv_iovecs,
+                recv_messages,
+            }
+        }
+
+        pub fn gso(&self) -> bool {
+            self.gso
+        }
+
+        fn probe_gso(socket: &UdpSocket) -> bool {
+            // Segment size 0 means "no segmentation unless asked per message",
+            // old kernels reject the option
+            let value: libc::c_int = 0;
+            let result = unsafe {
+                libc::setsockopt(
+                    socket.as_raw_fd(),
+                    SOL_UDP,
+                    UDP_SEGMENT,
+                    &value as *const libc::c_int as *const libc::c_void,
+                    mem::size_of::<libc::c_int>() as libc::socklen_t,
+                )
+            };
+            result == 0
+        }
+
+        /// Sends the datagrams in as few system calls as possible.
+        /// Returns number of datagrams which were sent, it is less than
+        /// `datagrams.len()` only if the kernel is out of buffers.
+        pub fn send(&mut self, datagrams: &[Datagram]) -> io::Result<usize> {
+            let mut sent = 0;
+            while sent < datagrams.len() {
+                match self.send_some(&datagrams[sent..]) {
+                    Ok(0) => break,
+                    Ok(n) => sent += n,
+                    Err(e) if self.gso && is_gso_error(&e) => {
+                        // e.g. the device can't offload checksums, never try again
+                        self.gso = false;
+                    }
+                    Err(e) if e.raw_os_error() == Some(libc::ENOBUFS) => break,
+                    Err(e) if e.kind() == io::ErrorKind::Interrupted => {}
+                    Err(e) => return Err(e),
+                }
+            }
+            Ok(sent)
+        }
+
+        /// Receives datagrams which are already queued. If there are none, waits
+        /// up to `wait` for the first one, `None` doesn't wait at all.
+        pub fn recv(&mut self, wait: Option<Duration>) -> io::Result<impl Iterator<Item = &[u8]>> {
+            let flags = match wait {
+                None => libc::MSG_DONTWAIT,
+                Some(wait) => {
+                    self.socket.set_read_timeout(Some(wait.max(Duration::from_micros(1))))?;
+                    libc::MSG_WAITFORONE
+                }
+            };
+
+            let result = unsafe {
+                libc::recvmmsg(
+                    self.socket.as_raw_fd(),
+                    self.recv_messages.as_mut_ptr(),
+                    self.recv_messages.len() as libc::c_uint,
+                    flags,
+                    ptr::null_mut(),
+                )
+            };
+            let received = if result >= 0 {
+                result as usize
+            } else {
+                let e = io::Error::last_os_error();
+                if !is_timeout(&e) {
+                    return Err(e);
+                }
+                0
+            };
+
+            Ok(self.recv_messages[..received]
+                .iter()
+                .zip(self.recv_buffers.iter())
+                .map(|(message, buffer)| &buffer[..(message.msg_len as usize).min(RECV_BUFFER_SIZE)]))
+        }
+
+        fn send_some(&mut self, datagrams: &[Datagram]) -> io::Result<usize> {
+            self.prepare(datagrams);
+
+            let result = unsafe {
+                libc::sendmmsg(
+                    self.socket.as_raw_fd(),
+                    self.messages.as_mut_ptr(),
+                    self.messages.len() as libc::c_uint,
+                    0,
+                )
+            };
+            if result < 0 {
+                return Err(io::Error::last_os_error());
+            }
+
+            Ok(self.datagrams_in_message[..result as usize].iter().sum())
+        }
+
+        /// Groups datagrams into messages and fills iovecs, cmsgs and
+        /// message headers for them.
+        fn prepare(&mut self, datagrams: &[Datagram]) {
+            self.iovecs.clear();
+            self.messages.clear();
+            self.cmsgs.clear();
+            self.datagrams_in_message.clear();
+
+            for datagram in datagrams {
+                self.iovecs.push(libc::iovec {
+                    iov_base: datagram.header.as_ptr() as *mut libc::c_void,
+                    iov_len: HEADER_SIZE,
+                });
+                self.iovecs.push(libc::iovec {
+                    iov_base: datagram.payload.as_ptr() as *mut libc::c_void,
+                    iov_len: datagram.payload.len(),
+                });
+            }
+
+            let mut first = 0;
+            while first < datagrams.len() {
+                let count = if self.gso { gso_run(&datagrams[first..]) } else { 1 };
+                self.datagrams_in_message.push(count);
+                self.cmsgs.push([0; 4]);
+                first += count;
+            }
+
+            // Vectors don't grow below, so the pointers stay valid
+            let mut iovec_pos = 0;
+            for (idx, &count) in self.datagrams_in_message.iter().enumerate() {
+                let mut header: libc::msghdr = unsafe { mem::zeroed() };
+                header.msg_name = ptr::null_mut();
+                header.msg_namelen = 0;
+                header.msg_iov = unsafe { self.iovecs.as_mut_ptr().add(iovec_pos) };
+                header.msg_iovlen = 2 * count;
+
+                if count > 1 {
+                    let segment_size = datagrams_first_len(&self.iovecs[iovec_pos..]) as u16;
+                    let buffer = &mut self.cmsgs[idx];
+                    header.msg_control = buffer.as_mut_ptr() as *mut libc::c_void;
+                    header.msg_controllen =
+                        unsafe { libc::CMSG_SPACE(mem::size_of::<u16>() as u32) } as usize;
+                    unsafe {
+                        let cmsg = libc::CMSG_FIRSTHDR(&header);
+                        (*cmsg).cmsg_level = SOL_UDP;
+                        (*cmsg).cmsg_type = UDP_SEGMENT;
+                        (*cmsg).cmsg_len = libc::CMSG_LEN(mem::size_of::<u16>() as u32) as usize;
+                        ptr::write_unaligned(libc::CMSG_DATA(cmsg) as *mut u16, segment_size);
+                    }
+                }
+
+                self.messages.push(libc::mmsghdr { msg_hdr: header, msg_len: 0 });
+                iovec_pos += 2 * count;
+            }
+        }
+    }
+
+    fn datagrams_first_len(iovecs: &[libc::iovec]) -> usize {
+        iovecs[0].iov_len + iovecs[1].iov_len
+    }
+
+    /// Returns how many datagrams from the start can go into one GSO message:
+    /// all of them have the size of the first one, only the last one may be shorter.
+    fn gso_run(datagrams: &[Datagram]) -> usize {
+        let segment_size = datagrams[0].len();
+        let max_segments = MAX_GSO_SEGMENTS.min(MAX_GSO_BYTES / segment_size).max(1);
+
+        let mut count = 1;
+        while count < datagrams.len() && count < max_segments {
+            let len = datagrams[count].len();
+            if len > segment_size {
+                break;
+            }
+            count += 1;
+            if len < segment_size {
+                break;
+            }
+        }
+        count
+    }
+
+    fn is_gso_error(e: &io::Error) -> bool {
+        matches!(e.raw_os_error(), Some(libc::EIO) | Some(libc::EINVAL) | Some(libc::EOPNOTSUPP))
+    }
+}
+
+#[cfg(not(target_os = "linux"))]
+mod imp {
+    use super::*;
+
+    /// Portable fallback: one system call per datagram through reused buffers.
+    pub struct BatchSocket {
+        socket: UdpSocket,
+        buffer: Vec<u8>,
+        recv_buffer: [u8; RECV_BUFFER_SIZE],
+    }
+
+    impl BatchSocket {
+        pub fn new(socket: UdpSocket, _use_gso: bool) -> Self {
+            Self { socket, buffer: Vec::new(), recv_buffer: [0; RECV_BUFFER_SIZE] }
+        }
+
+        pub fn recv(&mut self, wait: Option<Duration>) -> io::Result<impl Iterator<Item = &[u8]>> {
+            self.socket.set_nonblocking(wait.is_none())?;
+            if let Some(wait) = wait {
+                self.socket.set_read_timeout(Some(wait.max(Duration::from_micros(1))))?;
+            }
+
+            let received = match self.socket.recv(&mut self.recv_buffer) {
+                Ok(len) => Some(&self.recv_buffer[..len]),
+                Err(e) if is_timeout(&e) => None,
+                Err(e) => return Err(e),
+            };
+            Ok(received.into_iter())
+        }
+
+        pub fn gso(&self) -> bool {
+            false
+        }
+
+        pub fn send(&mut self, datagrams: &[Datagram]) -> io::Result<usize> {
+            for datagram in datagrams {
+                self.buffer.clear();
+                self.buffer.extend_from_slice(&datagram.header);
+                self.buffer.extend_from_slice(datagram.payload);
+                self.socket.send(&self.buffer)?;
+            }
+            Ok(datagrams.len())
+        }
+    }
+}
+
+pub use imp::BatchSocket;
+
+impl DatagramSocket for BatchSocket {
+    fn send(&mut self, datagrams: &[Datagram]) -> io::Result<usize> {
+        BatchSocket::send(self, datagrams)
+    }
+
+    fn recv(&mut self, wait: Option<Duration>) -> io::Result<impl Iterator<Item = &[u8]> + '_> {
+        BatchSocket::recv(self, wait)
+    }
+}
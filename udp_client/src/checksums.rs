@@ -0,0 +1,165 @@
+//! Per-segment crc32c. The client announces checksums of every segment
+//! before sending a file, the server checks each segment as it arrives and
+//! NACKs the corrupted ones, so only they are sent again. If crc32 of the
+//! whole file still differs, VERIFY gets checksums of the server's copy to
+//! tell which segments are suspect.
+
+use crc::{Crc, CRC_32_ISCSI};
+use std::{
+    collections::{HashMap, HashSet},
+    io,
+    net::UdpSocket,
+    time::{Duration, Instant},
+};
+
+use crate::consts;
+use crate::packet::{Data, EncodeToVec, Header, Packet, PacketType};
+use crate::packets_view::PacketsSource;
+use crate::query::recv_until;
+
+/// Checksums which fit into one packet
+const MAX_CHECKSUMS: usize = consts::MAX_PACKET_DATA_SIZE / 4;
+
+pub fn segment_checksums(file: &PacketsSource, segment_size: usize) -> Vec<u32> {
+    let crc = Crc::<u32>::new(&CRC_32_ISCSI);
+    file.data().chunks(segment_size).map(|segment| crc.checksum(segment)).collect()
+}
+
+fn packet(type_: PacketType, file_id: u64, first: u32, seq_total: u32, data: Data) -> Packet {
+    Packet {
+        header: Header { seq_number: first, seq_total, type_, file_id },
+        data,
+    }
+}
+
+/// Announces segment checksums of `files` to the server. Files which are
+/// not confirmed after `attempts` rounds are sent without them.
+/// Returns ids of files whose checksums are all announced.
+pub fn announce_checksums(
+    socket: &UdpSocket,
+    files: &[PacketsSource],
+    segment_size: usize,
+    timeout: Duration,
+    attempts: usize,
+) -> io::Result<HashSet<u64>> {
+    let checksums = files
+        .iter()
+        .map(|file| segment_checksums(file, segment_size))
+        .collect::<Vec<Vec<u32>>>();
+
+    // (index of the file, first segment) of every unconfirmed packet
+    let mut pending = checksums
+        .iter()
+        .enumerate()
+        .flat_map(|(file, checksums)| (0..checksums.len()).step_by(MAX_CHECKSUMS).map(move |first| (file, first as u32)))
+        .collect::<HashSet<(usize, u32)>>();
+
+    let file_index = files
+        .iter()
+        .enumerate()
+        .map(|(idx, file)| (file.id(), idx))
+        .collect::<HashMap<u64, usize>>();
+
+    for _ in 0..attempts {
+        if pending.is_empty() {
+            break;
+        }
+
+        for &(file, first) in pending.iter() {
+            let source = &files[file];
+            let data = checksums[file][first as usize..]
+                .iter()
+                .take(MAX_CHECKSUMS)
+                .flat_map(|crc32| crc32.to_be_bytes())
+                .collect::<Vec<u8>>();
+            let checksums_packet = packet(PacketType::CHECKSUMS, source.id(), first, source.seq_total(), Data::Copy(data));
+            socket.send(&checksums_packet.encode_to_vec().unwrap())?;
+        }
+
+        let deadline = Instant::now() + timeout;
+        let mut buf = vec![0; consts::MAX_DATAGRAM_SIZE];
+        while !pending.is_empty() {
+            let Some(bytes_received) = recv_until(socket, &mut buf, deadline)? else {
+                break; // timeout
+            };
+            let Ok(answer) = Packet::decode_from_slice(&buf[..bytes_received]) else {
+                continue;
+            };
+            if !matches!(answer.header.type_, PacketType::CHECKSUMS) {
+                continue;
+            }
+            if let Some(&file) = file_index.get(&answer.header.file_id) {
+                pending.remove(&(file, answer.header.seq_number));
+            }
+        }
+    }
+
+    let unconfirmed = pending.iter().map(|&(file, _)| files[file].id()).collect::<HashSet<u64>>();
+    Ok(files
+        .iter()
+        .map(|file| file.id())
+        .filter(|file_id| !unconfirmed.contains(file_id))
+        .collect())
+}
+
+/// Compares segment checksums of the server's copy of the file with the
+/// local ones. Returns segments which differ, or None if the server
+/// doesn't answer or has no such file.
+pub fn find_suspect_segments(
+    socket: &UdpSocket,
+    file: &PacketsSource,
+    segment_size: usize,
+    timeout: Duration,
+    attempts: usize,
+) -> io::Result<Option<Vec<u32>>> {
+    let local = segment_checksums(file, segment_size);
+    let mut remote: Vec<u32> = Vec::with_capacity(local.len());
+
+    while remote.len() < local.len() {
+        let first = remote.len() as u32;
+        let mut answered = false;
+        for _ in 0..attempts {
+            let verify_packet = packet(PacketType::VERIFY, file.id(), first, file.seq_total(), Data::Empty);
+            socket.send(&verify_packet.encode_to_vec().unwrap())?;
+
+            let deadline = Instant::now() + timeout;
+            let mut buf = vec![0; consts::MAX_DATAGRAM_SIZE];
+            while let Some(bytes_received) = recv_until(socket, &mut buf, deadline)? {
+                let Ok(answer) = Packet::decode_from_slice(&buf[..bytes_received]) else {
+                    continue;
+                };
+                let (PacketType::VERIFY, Data::Copy(data)) = (&answer.header.type_, &answer.data) else {
+                    continue;
+                };
+                if answer.header.file_id != file.id() || answer.header.seq_number != first {
+                    continue; // duplicate or late answer
+                }
+
+                if answer.header.seq_total != file.seq_total() || data.is_empty() {
+                    return Ok(None);
+                }
+                remote.extend(data.chunks_exact(4).map(|crc32| u32::from_be_bytes(crc32.try_into().unwrap())));
+                answered = true;
+                break;
+            }
+
+            if answered {
+                break;
+            }
+        }
+
+        if !answered {
+            return Ok(None);
+        }
+    }
+
+    Ok(Some(
+        local
+            .iter()
+            .zip(remote.iter())
+            .enumerate()
+            .filter(|(_, (local, remote))| local != remote)
+            .map(|(segment, _)| segment as u32)
+            .collect(),
+    ))
+}
@@ -1,7 +1,6 @@
 use crate::packet::Header;
 
-use bytesize;
-
 pub const MAX_DATAGRAM_SIZE: usize = 1472;
 pub const MAX_PACKET_DATA_SIZE: usize = MAX_DATAGRAM_SIZE - Header::serialized_size();
-pub const DEFAULT_SPEED_LIMIT: u64 = 10 * bytesize::MIB;
\ No newline at end of file
+/// Large enough to fill a fast local link, the window grows to it only if nothing is lost
+pub const DEFAULT_MAX_WINDOW: usize = 4096;
\ No newline at end of file
@@ -0,0 +1,277 @@
+//! Delta uploads of a new version of a file which the server already has
+//! (the base), rsync style. The server splits the base into blocks of one
+//! segment and gives their signatures: weak rolling checksum and the first
+//! 8 bytes of sha256. The client rolls the weak checksum over every offset
+//! of the new version and checks weak matches with the strong checksum.
+//! Segments which are made of base blocks only are sent as COPY (pieces of
+//! the base) instead of PUT, everything else is sent as usual.
+
+use sha2::{Digest, Sha256};
+use std::{
+    collections::HashMap,
+    io,
+    net::UdpSocket,
+    time::{Duration, Instant},
+};
+
+use crate::consts;
+use crate::packet::{Data, EncodeToVec, Header, Packet, PacketType};
+use crate::query::recv_until;
+
+pub struct BlockSignature {
+    pub weak: u32,
+    pub strong: u64,
+}
+
+fn update(data: &[u8], s1: &mut u32, s2: &mut u32) {
+    for &byte in data {
+        *s1 = s1.wrapping_add(byte as u32);
+        *s2 = s2.wrapping_add(*s1);
+    }
+}
+
+fn combine(s1: u32, s2: u32) -> u32 {
+    (s1 & 0xffff) | (s2 << 16)
+}
+
+/// Weak checksum of a block x[0..n): low 16 bits are the sum of x[i], high
+/// 16 bits are the sum of (n - i) * x[i]. Same as the server calculates.
+pub fn weak_checksum(block: &[u8]) -> u32 {
+    #[cfg(target_arch = "x86_64")]
+    if is_x86_feature_detected!("avx2") {
+        return unsafe { weak_checksum_avx2(block) };
+    }
+
+    let (mut s1, mut s2) = (0, 0);
+    update(block, &mut s1, &mut s2);
+    combine(s1, s2)
+}
+
+/// 32 bytes at a time: every chunk adds the sum of the previous bytes 32 times
+/// to s2 and its own bytes with weights 32..1.
+#[cfg(target_arch = "x86_64")]
+#[target_feature(enable = "avx2")]
+unsafe fn weak_checksum_avx2(block: &[u8]) -> u32 {
+    use std::arch::x86_64::*;
+
+    unsafe fn horizontal_sum(sums: __m256i) -> u32 {
+        let mut lanes = [0u32; 8];
+        _mm256_storeu_si256(lanes.as_mut_ptr() as *mut __m256i, sums);
+        lanes.iter().fold(0, |sum, &lane| sum.wrapping_add(lane))
+    }
+
+    let zero = _mm256_setzero_si256();
+    let ones = _mm256_set1_epi16(1);
+    let weights = _mm256_setr_epi8(
+        32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17,
+        16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1,
+    );
+
+    let mut s1_sums = zero;
+    let mut prefix_sums = zero;
+    let mut s2_sums = zero;
+    let chunks = block.chunks_exact(32);
+    let rest = chunks.remainder();
+    for chunk in chunks {
+        let bytes = _mm256_loadu_si256(chunk.as_ptr() as *const __m256i);
+        prefix_sums = _mm256_add_epi32(prefix_sums, s1_sums);
+        s1_sums = _mm256_add_epi32(s1_sums, _mm256_sad_epu8(bytes, zero));
+        s2_sums = _mm256_add_epi32(s2_sums, _mm256_madd_epi16(_mm256_maddubs_epi16(bytes, weights), ones));
+    }
+
+    let mut s1 = horizontal_sum(s1_sums);
+    let mut s2 = horizontal_sum(prefix_sums).wrapping_mul(32).wrapping_add(horizontal_sum(s2_sums));
+    update(rest, &mut s1, &mut s2);
+    combine(s1, s2)
+}
+
+/// Weak checksum of a window which slides one byte at a time.
+struct RollingChecksum {
+    s1: u32,
+    s2: u32,
+    len: u32,
+}
+
+impl RollingChecksum {
+    fn new(window: &[u8]) -> Self {
+        let weak = weak_checksum(window);
+        // Only the low halves of the sums are known, the result doesn't depend on the rest
+        RollingChecksum { s1: weak & 0xffff, s2: weak >> 16, len: window.len() as u32 }
+    }
+
+    fn roll(&mut self, out: u8, in_: u8) {
+        self.s1 = self.s1.wrapping_sub(out as u32).wrapping_add(in_ as u32);
+        self.s2 = self.s2.wrapping_sub(self.len.wrapping_mul(out as u32)).wrapping_add(self.s1);
+    }
+
+    fn value(&self) -> u32 {
+        combine(self.s1, self.s2)
+    }
+}
+
+pub fn strong_checksum(block: &[u8]) -> u64 {
+    u64::from_be_bytes(Sha256::digest(block)[..8].try_into().unwrap())
+}
+
+fn signatures_packet(base_id: u64, from: u32) -> Packet<'static> {
+    Packet {
+        header: Header {
+            seq_number: from,
+            seq_total: 0,
+            type_: PacketType::SIGNATURES,
+            file_id: base_id,
+        },
+        data: Data::Empty,
+    }
+}
+
+/// Asks the server for block signatures of the base file, one answer after
+/// another. Returns None if the server has no such complete file or doesn't
+/// answer in `attempts` tries, then the file is uploaded in full.
+pub fn query_signatures(
+    socket: &UdpSocket,
+    base_id: u64,
+    timeout: Duration,
+    attempts: usize,
+) -> io::Result<Option<Vec<BlockSignature>>> {
+    let mut signatures = Vec::new();
+    let mut blocks = None;
+
+    while blocks.map_or(true, |blocks| signatures.len() < blocks) {
+        let from = signatures.len() as u32;
+        let mut answered = false;
+        for _ in 0..attempts {
+            socket.send(&signatures_packet(base_id, from).encode_to_vec().unwrap())?;
+
+            let deadline = Instant::now() + timeout;
+            let mut buf = vec![0; consts::MAX_DATAGRAM_SIZE];
+            while let Some(bytes_received) = recv_until(socket, &mut buf, deadline)? {
+                let Ok(packet) = Packet::decode_from_slice(&buf[..bytes_received]) else {
+                    continue;
+                };
+                let (PacketType::SIGNATURES, Data::Copy(data)) = (&packet.header.type_, &packet.data) else {
+                    continue;
+                };
+                if packet.header.file_id != base_id || packet.header.seq_number != from {
+                    continue; // duplicate or late answer
+                }
+
+                if packet.header.seq_total == 0 || (data.is_empty() && from < packet.header.seq_total) {
+                    return Ok(None);
+                }
+                blocks = Some(packet.header.seq_total as usize);
+                signatures.extend(data.chunks_exact(12).map(|signature| BlockSignature {
+                    weak: u32::from_be_bytes(signature[..4].try_into().unwrap()),
+                    strong: u64::from_be_bytes(signature[4..].try_into().unwrap()),
+                }));
+                answered = true;
+                break;
+            }
+
+            if answered {
+                break;
+            }
+        }
+
+        if !answered {
+            return Ok(None);
+        }
+    }
+
+    Ok(Some(signatures))
+}
+
+/// Finds blocks of the base in `data`: at every offset where the rolling
+/// checksum and then the strong checksum match a block, the block is taken
+/// and the scan jumps over it. Returns (offset in `data`, offset in the base)
+/// of every taken block.
+fn find_blocks(data: &[u8], signatures: &[BlockSignature], block_size: usize) -> Vec<(usize, u64)> {
+    // The last block of the base may be shorter, its size isn't known
+    let full_blocks = signatures.len().saturating_sub(1);
+    let mut by_weak: HashMap<u32, Vec<usize>> = HashMap::new();
+    for (block, signature) in signatures[..full_blocks].iter().enumerate() {
+        by_weak.entry(signature.weak).or_default().push(block);
+    }
+
+    let mut found = Vec::new();
+    let mut next_block = 0;
+    let mut pos = 0;
+    let mut rolling: Option<RollingChecksum> = None;
+    while pos + block_size <= data.len() {
+        let window = &data[pos..pos + block_size];
+        let checksum = rolling.get_or_insert_with(|| RollingChecksum::new(window));
+
+        if let Some(blocks) = by_weak.get(&checksum.value()) {
+            let strong = strong_checksum(window);
+            let mut matching = blocks.iter().filter(|&&block| signatures[block].strong == strong);
+            // Blocks with the same content: prefer the one which continues the previous match
+            let block = matching.clone().find(|&&block| block == next_block).or_else(|| matching.next());
+            if let Some(&block) = block {
+                found.push((pos, (block * block_size) as u64));
+                next_block = block + 1;
+                pos += block_size;
+                rolling = None;
+                continue;
+            }
+        }
+
+        if pos + block_size < data.len() {
+            checksum.roll(data[pos], data[pos + block_size]);
+        }
+        pos += 1;
+    }
+
+    found
+}
+
+/// Returns seq_number => COPY data for every segment of `data` which is
+/// entirely made of base blocks.
+pub fn find_copies(
+    data: &[u8],
+    signatures: &[BlockSignature],
+    base_id: u64,
+    crc32: u32,
+    segment_size: usize,
+) -> HashMap<u32, Vec<u8>> {
+    let found = find_blocks(data, signatures, segment_size);
+    let mut copies = HashMap::new();
+
+    for (seq_number, segment) in data.chunks(segment_size).enumerate() {
+        let start = seq_number * segment_size;
+        let end = start + segment.len();
+
+        // Taken blocks don't overlap, so pieces of the segment go in order
+        let mut pieces: Vec<(u64, u32)> = Vec::new();
+        let mut covered_until = start;
+        let first = found.partition_point(|&(offset, _)| offset + segment_size <= start);
+        for &(offset, base_offset) in found[first..].iter().take_while(|&&(offset, _)| offset < end) {
+            if offset > covered_until {
+                break; // literal bytes in between
+            }
+            let piece_end = end.min(offset + segment_size);
+            let piece_base_offset = base_offset + (covered_until - offset) as u64;
+            let piece_len = (piece_end - covered_until) as u32;
+            match pieces.last_mut() {
+                Some((last_offset, last_len)) if *last_offset + *last_len as u64 == piece_base_offset => {
+                    *last_len += piece_len;
+                }
+                _ => pieces.push((piece_base_offset, piece_len)),
+            }
+            covered_until = piece_end;
+        }
+        if covered_until < end {
+            continue;
+        }
+
+        let mut copy = Vec::with_capacity(12 + pieces.len() * 12);
+        copy.extend_from_slice(&base_id.to_be_bytes());
+        copy.extend_from_slice(&crc32.to_be_bytes());
+        for (offset, len) in pieces {
+            copy.extend_from_slice(&offset.to_be_bytes());
+            copy.extend_from_slice(&len.to_be_bytes());
+        }
+        copies.insert(seq_number as u32, copy);
+    }
+
+    copies
+}
@@ -0,0 +1,338 @@
+//! Client side of the server's shared memory transport (`--local` on the
+//! server): when both run on the same host, datagrams go through a pair of
+//! rings in memory shared with the server instead of the UDP stack.
+//!
+//! The client connects to the Unix socket of the server and gets a hello
+//! with the memfd of the rings, the server's eventfd and its own eventfd.
+//! Each ring has one producer and one consumer. A consumer which runs out
+//! of frames sets the `idle` flag of its ring and sleeps on its eventfd,
+//! a producer writes the eventfd only when the flag is set. The layout is
+//! `udp_server/shm/rings.h` of the server.
+
+use std::{
+    io, mem,
+    os::unix::{ffi::OsStrExt, io::RawFd},
+    path::Path,
+    ptr,
+    sync::atomic::{fence, AtomicU32, AtomicU64, Ordering},
+    time::Duration,
+};
+
+use crate::batch::{Datagram, DatagramSocket, HEADER_SIZE, RECV_BUFFER_SIZE};
+use crate::consts::MAX_DATAGRAM_SIZE;
+
+const RINGS_MAGIC: u64 = 0x31304752504455; // "UDPRG01"
+const RINGS_BLOCK_SIZE: usize = 448;
+const FRAME_SIZE: usize = 1536;
+const TO_SERVER_OFFSET: usize = 64;
+const TO_CLIENT_OFFSET: usize = 256;
+// Offsets in a ring control, every field has a cache line of its own
+const HEAD_OFFSET: usize = 0;
+const TAIL_OFFSET: usize = 64;
+const IDLE_OFFSET: usize = 128;
+const RECV_BATCH_SIZE: usize = 64;
+
+#[repr(C)]
+#[derive(Default)]
+struct RingsHello {
+    magic: u64,
+    capacity: u32,
+    reserved: u32,
+    size: u64,
+}
+
+/// One direction of the rings, frames are `u32` size followed by the datagram.
+struct Ring {
+    control: *mut u8,
+    frames: *mut u8,
+    mask: u64,
+}
+
+impl Ring {
+    fn head(&self) -> &AtomicU64 {
+        unsafe { &*(self.control.add(HEAD_OFFSET) as *const AtomicU64) }
+    }
+
+    fn tail(&self) -> &AtomicU64 {
+        unsafe { &*(self.control.add(TAIL_OFFSET) as *const AtomicU64) }
+    }
+
+    fn idle(&self) -> &AtomicU32 {
+        unsafe { &*(self.control.add(IDLE_OFFSET) as *const AtomicU32) }
+    }
+
+    fn frame(&self, position: u64) -> *mut u8 {
+        unsafe { self.frames.add((position & self.mask) as usize * FRAME_SIZE) }
+    }
+
+    /// Returns false if the ring is full.
+    fn push(&self, datagram: &Datagram) -> bool {
+        let head = self.head().load(Ordering::Relaxed);
+        if head - self.tail().load(Ordering::Acquire) > self.mask {
+            return false;
+        }
+
+        let frame = self.frame(head);
+        unsafe {
+            ptr::write(frame as *mut u32, datagram.len() as u32);
+            ptr::copy_nonoverlapping(datagram.header.as_ptr(), frame.add(4), HEADER_SIZE);
+            ptr::copy_nonoverlapping(datagram.payload.as_ptr(), frame.add(4 + HEADER_SIZE), datagram.payload.len());
+        }
+        self.head().store(head + 1, Ordering::Release);
+        true
+    }
+
+    /// Copies the next frame into the buffer and returns its size.
+    fn pop(&self, buffer: &mut [u8]) -> Option<usize> {
+        let tail = self.tail().load(Ordering::Relaxed);
+        if tail == self.head().load(Ordering::Acquire) {
+            return None;
+        }
+
+        let frame = self.frame(tail);
+        let size = unsafe { ptr::read(frame as *const u32) as usize }.min(buffer.len());
+        unsafe { ptr::copy_nonoverlapping(frame.add(4), buffer.as_mut_ptr(), size) };
+        self.tail().store(tail + 1, Ordering::Release);
+        Some(size)
+    }
+
+    fn is_empty(&self) -> bool {
+        self.tail().load(Ordering::Relaxed) == self.head().load(Ordering::Acquire)
+    }
+
+    /// Producer side: writes the eventfd if the consumer sleeps.
+    fn wake_consumer(&self, eventfd: RawFd) {
+        fence(Ordering::SeqCst);
+        if self.idle().load(Ordering::Relaxed) != 0 && self.idle().swap(0, Ordering::Relaxed) != 0 {
+            let one: u64 = 1;
+            unsafe { libc::write(eventfd, &one as *const u64 as *const libc::c_void, mem::size_of::<u64>()) };
+        }
+    }
+
+    /// Consumer side: returns false if a frame has come meanwhile.
+    fn prepare_to_sleep(&self) -> bool {
+        self.idle().store(1, Ordering::Relaxed);
+        fence(Ordering::SeqCst);
+        if !self.is_empty() {
+            self.idle().store(0, Ordering::Relaxed);
+            return false;
+        }
+        true
+    }
+
+    fn wake_up(&self) {
+        self.idle().store(0, Ordering::Relaxed);
+    }
+}
+
+/// Connection to the server over the rings, used in place of a `BatchSocket`.
+pub struct LocalSocket {
+    fd: RawFd,
+    server_wake_fd: RawFd,
+    wake_fd: RawFd,
+    block: *mut u8,
+    size: usize,
+    to_server: Ring,
+    to_client: Ring,
+    recv_buffers: Vec<[u8; RECV_BUFFER_SIZE]>,
+}
+
+// The mapping is owned by the socket, rings are used from one thread at a time
+unsafe impl Send for LocalSocket {}
+
+impl LocalSocket {
+    pub fn connect(path: &Path) -> io::Result<Self> {
+        let mut address: libc::sockaddr_un = unsafe { mem::zeroed() };
+        address.sun_family = libc::AF_UNIX as libc::sa_family_t;
+        let path_bytes = path.as_os_str().as_bytes();
+        if path_bytes.len() >= address.sun_path.len() {
+            return Err(io::Error::new(io::ErrorKind::InvalidInput, "socket path is too long"));
+        }
+        for (dst, &src) in address.sun_path.iter_mut().zip(path_bytes) {
+            *dst = src as libc::c_char;
+        }
+
+        let fd = unsafe { libc::socket(libc::AF_UNIX, libc::SOCK_SEQPACKET | libc::SOCK_CLOEXEC, 0) };
+        if fd < 0 {
+            return Err(io::Error::last_os_error());
+        }
+        let connected = unsafe {
+            libc::connect(
+                fd,
+                &address as *const libc::sockaddr_un as *const libc::sockaddr,
+                mem::size_of::<libc::sockaddr_un>() as libc::socklen_t,
+            )
+        };
+        if connected != 0 {
+            let e = io::Error::last_os_error();
+            unsafe { libc::close(fd) };
+            return Err(e);
+        }
+
+        let (hello, fds) = match receive_hello(fd) {
+            Ok(received) => received,
+            Err(e) => {
+                unsafe { libc::close(fd) };
+                return Err(e);
+            }
+        };
+        let [memfd, server_wake_fd, wake_fd] = fds;
+        let capacity = hello.capacity as usize;
+        let size = RINGS_BLOCK_SIZE + 2 * capacity * FRAME_SIZE;
+        if hello.magic != RINGS_MAGIC || !capacity.is_power_of_two() || hello.size as usize != size {
+            unsafe {
+                libc::close(memfd);
+                libc::close(server_wake_fd);
+                libc::close(wake_fd);
+                libc::close(fd);
+            }
+            return Err(io::Error::new(io::ErrorKind::InvalidData, "not a shared memory transport"));
+        }
+
+        let block = unsafe {
+            libc::mmap(ptr::null_mut(), size, libc::PROT_READ | libc::PROT_WRITE, libc::MAP_SHARED, memfd, 0)
+        };
+        unsafe { libc::close(memfd) };
+        if block == libc::MAP_FAILED {
+            let e = io::Error::last_os_error();
+            unsafe {
+                libc::close(server_wake_fd);
+                libc::close(wake_fd);
+                libc::close(fd);
+            }
+            return Err(e);
+        }
+
+        let block = block as *mut u8;
+        let frames = unsafe { block.add(RINGS_BLOCK_SIZE) };
+        let mask = capacity as u64 - 1;
+        Ok(Self {
+            fd,
+            server_wake_fd,
+            wake_fd,
+            block,
+            size,
+            to_server: Ring { control: unsafe { block.add(TO_SERVER_OFFSET) }, frames, mask },
+            to_client: Ring {
+                control: unsafe { block.add(TO_CLIENT_OFFSET) },
+                frames: unsafe { frames.add(capacity * FRAME_SIZE) },
+                mask,
+            },
+            recv_buffers: vec![[0; RECV_BUFFER_SIZE]; RECV_BATCH_SIZE],
+        })
+    }
+
+    /// Sleeps until the server pushes a reply or the time is out.
+    fn wait(&self, wait: Duration) -> io::Result<()> {
+        if !self.to_client.prepare_to_sleep() {
+            return Ok(());
+        }
+
+        let mut fds = [
+            libc::pollfd { fd: self.wake_fd, events: libc::POLLIN, revents: 0 },
+            libc::pollfd { fd: self.fd, events: libc::POLLIN, revents: 0 },
+        ];
+        let timeout_ms = wait.as_millis().clamp(1, libc::c_int::MAX as u128) as libc::c_int;
+        unsafe { libc::poll(fds.as_mut_ptr(), fds.len() as libc::nfds_t, timeout_ms) };
+        self.to_client.wake_up();
+
+        if fds[0].revents & libc::POLLIN != 0 {
+            let mut wakeups: u64 = 0;
+            unsafe { libc::read(self.wake_fd, &mut wakeups as *mut u64 as *mut libc::c_void, mem::size_of::<u64>()) };
+        }
+        // Server never sends anything after hello, so readable socket is a closed one
+        if fds[1].revents != 0 {
+            return Err(io::Error::new(io::ErrorKind::ConnectionReset, "server has closed the rings"));
+        }
+        Ok(())
+    }
+}
+
+impl DatagramSocket for LocalSocket {
+    /// Pushes datagrams until the ring is full and wakes the server once.
+    fn send(&mut self, datagrams: &[Datagram]) -> io::Result<usize> {
+        let mut sent = 0;
+        for datagram in datagrams {
+            debug_assert!(datagram.len() <= MAX_DATAGRAM_SIZE);
+            if !self.to_server.push(datagram) {
+                break;
+            }
+            sent += 1;
+        }
+        if sent > 0 {
+            self.to_server.wake_consumer(self.server_wake_fd);
+        }
+        Ok(sent)
+    }
+
+    fn recv(&mut self, wait: Option<Duration>) -> io::Result<impl Iterator<Item = &[u8]> + '_> {
+        if self.to_client.is_empty() {
+            if let Some(wait) = wait {
+                self.wait(wait)?;
+            }
+        }
+
+        let mut sizes = Vec::new();
+        for buffer in self.recv_buffers.iter_mut() {
+            match self.to_client.pop(buffer) {
+                Some(size) => sizes.push(size),
+                None => break,
+            }
+        }
+        Ok(sizes.into_iter().zip(self.recv_buffers.iter()).map(|(size, buffer)| &buffer[..size]))
+    }
+}
+
+impl Drop for LocalSocket {
+    fn drop(&mut self) {
+        unsafe {
+            libc::munmap(self.block as *mut libc::c_void, self.size);
+            libc::close(self.wake_fd);
+            libc::close(self.server_wake_fd);
+            libc::close(self.fd);
+        }
+    }
+}
+
+/// Receives the hello with memfd, eventfd of the server and eventfd of the client.
+fn receive_hello(fd: RawFd) -> io::Result<(RingsHello, [RawFd; 3])> {
+    let mut hello = RingsHello::default();
+    let mut iov = libc::iovec {
+        iov_base: &mut hello as *mut RingsHello as *mut libc::c_void,
+        iov_len: mem::size_of::<RingsHello>(),
+    };
+    // Space for a cmsg with three descriptors, u64 keeps it aligned for cmsghdr
+    let mut control = [0u64; 8];
+    let fds_size = (3 * mem::size_of::<RawFd>()) as u32;
+
+    let mut message: libc::msghdr = unsafe { mem::zeroed() };
+    message.msg_iov = &mut iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control.as_mut_ptr() as *mut libc::c_void;
+    message.msg_controllen = unsafe { libc::CMSG_SPACE(fds_size) } as usize;
+
+    let received = unsafe { libc::recvmsg(fd, &mut message, libc::MSG_CMSG_CLOEXEC) };
+    if received < 0 {
+        return Err(io::Error::last_os_error());
+    }
+
+    let cmsg = unsafe { libc::CMSG_FIRSTHDR(&message) };
+    let invalid = || io::Error::new(io::ErrorKind::InvalidData, "no descriptors in hello");
+    if cmsg.is_null() {
+        return Err(invalid());
+    }
+    let (level, type_, len) = unsafe { ((*cmsg).cmsg_level, (*cmsg).cmsg_type, (*cmsg).cmsg_len) };
+    if level != libc::SOL_SOCKET || type_ != libc::SCM_RIGHTS || len != unsafe { libc::CMSG_LEN(fds_size) } as usize {
+        return Err(invalid());
+    }
+
+    let mut fds = [-1; 3];
+    unsafe { ptr::copy_nonoverlapping(libc::CMSG_DATA(cmsg) as *const RawFd, fds.as_mut_ptr(), 3) };
+    if received as usize != mem::size_of::<RingsHello>() {
+        for fd in fds {
+            unsafe { libc::close(fd) };
+        }
+        return Err(io::Error::new(io::ErrorKind::InvalidData, "short hello"));
+    }
+    Ok((hello, fds))
+}
@@ -1,25 +1,34 @@
+mod batch;
+mod checksums;
+mod delta;
+mod local;
+mod packed;
 mod packet;
 mod packets_view;
+mod query;
 mod sender;
+mod window;
 mod consts;
 
+use crate::batch::BatchSocket;
+use crate::checksums::{announce_checksums, find_suspect_segments};
+use crate::delta::{find_copies, query_signatures};
+use crate::local::LocalSocket;
 use crate::packets_view::{Packets, PacketsSource};
-use crate::packet::Packet;
+use crate::query::{query_missing_segments, query_present_files};
 use crate::sender::PacketsSender;
 
-use async_std::net::UdpSocket;
-
 use clap::Parser;
-use rand::{thread_rng, seq::SliceRandom};
 use std::{
-    cmp,
+    collections::HashMap,
     fs::File,
-    num::NonZeroU32,
+    io,
+    net::UdpSocket,
+    path::PathBuf,
     time::Duration,
 };
 use itertools::Itertools;
 
-use governor::Quota;
 use crate::consts::*;
 
 
@@ -30,20 +39,58 @@ struct Cli {
     host: String,
     #[arg(long)]
     port: u16,
-    #[arg(long, default_value_t = DEFAULT_SPEED_LIMIT.try_into().unwrap())]
-    speed_limit: u32,
+    /// Timeout of queries and initial retransmission timeout in ms,
+    /// the latter adapts to the measured round trip time
     #[arg(long, default_value_t = 1000)]
     timeout: u64,
+    /// Number of attempts to ask the server which files (or segments of files)
+    /// it already has, 0 disables the queries
+    #[arg(long, default_value_t = 3)]
+    query_attempts: usize,
+    /// Number of sockets, files are spread over them and every socket
+    /// is served by its own threads
+    #[arg(long, default_value_t = 4)]
+    sockets: usize,
+    /// Maximum number of datagrams which are passed to the kernel at once
+    #[arg(long, default_value_t = 64)]
+    batch_size: usize,
+    /// Don't let the kernel split batches of datagrams (UDP_SEGMENT)
+    #[arg(long)]
+    no_gso: bool,
+    /// Upper limit of the congestion window, in datagrams per socket
+    #[arg(long, default_value_t = DEFAULT_MAX_WINDOW)]
+    max_window: usize,
+    /// Id of the first file, the others get the following ids
+    #[arg(long, default_value_t = 0)]
+    first_id: u64,
+    /// Upload files as deltas against files which the server has received
+    /// before: the first file against this id, the others against the following ids
+    #[arg(long)]
+    delta_base: Option<u64>,
+    /// Announce crc32c of every segment, so the server rejects corrupted
+    /// segments at once and only they are sent again
+    #[arg(long)]
+    segment_crc: bool,
+    /// Send every segment in a datagram of its own, small segments of
+    /// different files aren't packed together
+    #[arg(long)]
+    no_packing: bool,
+    /// Send segments over shared memory rings of a server on the same
+    /// host which listens for local clients on this Unix socket (`--local`
+    /// of the server), every socket gets rings of its own. Queries still
+    /// go over UDP
+    #[arg(long)]
+    local: Option<PathBuf>,
 
     files: Vec<String>,
 }
 
-fn open_files(paths: &Vec<String>) -> Vec<PacketsSource> {
+fn open_files(paths: &Vec<String>, first_id: u64) -> Vec<PacketsSource> {
     paths
         .iter()
         .enumerate()
-        .map(|(id, path)| match File::open(path) {
-            Ok(file) => (path, file.to_packets_source(id as u64, MAX_PACKET_DATA_SIZE)),
+        .map(|(idx, path)| match File::open(path) {
+            Ok(file) => (path, file.to_packets_source(first_id + idx as u64, MAX_PACKET_DATA_SIZE)),
             Err(e) => {
                 println!("Can't open file '{}', error: {}", path, e);
                 (path, Err(e))
@@ -58,15 +105,17 @@ fn open_files(paths: &Vec<String>) -> Vec<PacketsSource> {
         }).collect()
 }
 
-fn collect_packets(files: &'_ Vec<PacketsSource>) -> Vec<Packet<'_>> {
-    files
-        .iter()
-        .flat_map(|file| file.packets())
-        .collect::<Vec<Packet<'_>>>()
+fn connect_sockets(addr: &str, number_of_sockets: usize) -> io::Result<Vec<UdpSocket>> {
+    (0..number_of_sockets)
+        .map(|_| {
+            let socket = UdpSocket::bind("0.0.0.0:0")?;
+            socket.connect(addr)?;
+            Ok(socket)
+        })
+        .collect()
 }
 
-#[async_std::main]
-async fn main() {
+fn main() {
     let cli = Cli::parse();
     let files_to_send_str = cli.files
         .iter()
@@ -74,23 +123,120 @@ async fn main() {
         .join(", ");
     println!("Sending files: {}...", files_to_send_str);
 
-    let files = open_files(&cli.files);
-
-    let mut packets = collect_packets(&files);
-    if packets.len() == 0 {
+    let files = open_files(&cli.files, cli.first_id);
+    if files.len() == 0 {
         return;
     }
 
-    packets.shuffle(&mut thread_rng());
-
-    let socket = UdpSocket::bind("0.0.0.0:0").await.unwrap();
     let connect_to_addr = format!("{host}:{port}", host = cli.host, port = cli.port);
     println!("Connecting to server {}...", connect_to_addr);
-    socket.connect(connect_to_addr).await.unwrap();
+    let number_of_sockets = cli.sockets.clamp(1, files.len());
+    let sockets = connect_sockets(&connect_to_addr, number_of_sockets).unwrap();
 
-    let speed_limit = cmp::max(cli.speed_limit, MAX_DATAGRAM_SIZE.try_into().unwrap());
-    let quota = Quota::per_second(NonZeroU32::new(speed_limit).unwrap());
     let timeout = Duration::from_millis(cli.timeout);
-    let sender = PacketsSender::new(packets, quota, timeout);
-    sender.send(socket).await;
+    let present = query_present_files(&sockets[0], &files, timeout, cli.query_attempts).unwrap();
+    for file in files.iter() {
+        if let Some(received_crc32) = present.get(&file.id()) {
+            println!(
+                "file_id == {}, calculated crc == {}, received_crc == {} (already on server)",
+                file.id(),
+                file.crc32(),
+                received_crc32
+            );
+        }
+    }
+
+    let files = files
+        .into_iter()
+        .filter(|file| !present.contains_key(&file.id()))
+        .collect::<Vec<PacketsSource>>();
+
+    let mut missing = query_missing_segments(&sockets[0], &files, timeout, cli.query_attempts).unwrap();
+    for (file_id, ranges) in missing.iter_mut() {
+        ranges.sort_by_key(|range| range.start);
+        let number_of_missing: u32 = ranges.iter().map(|range| range.len() as u32).sum();
+        let seq_total = files.iter().find(|file| file.id() == *file_id).unwrap().seq_total();
+        if number_of_missing < seq_total {
+            println!(
+                "file_id == {}, resuming transfer, {} of {} segments are missing",
+                file_id, number_of_missing, seq_total
+            );
+        }
+    }
+
+    let crc32 = files
+        .iter()
+        .map(|file| (file.id(), file.crc32()))
+        .collect::<HashMap<u64, u32>>();
+
+    let mut files = files;
+    if let Some(delta_base) = cli.delta_base {
+        for file in files.iter_mut() {
+            let base_id = delta_base + (file.id() - cli.first_id);
+            let Some(signatures) = query_signatures(&sockets[0], base_id, timeout, cli.query_attempts).unwrap() else {
+                println!("file_id == {}, server has no file_id == {}, sending in full", file.id(), base_id);
+                continue;
+            };
+
+            let copies = find_copies(file.data(), &signatures, base_id, crc32[&file.id()], MAX_PACKET_DATA_SIZE);
+            println!(
+                "file_id == {}, {} of {} segments are copied from file_id == {}",
+                file.id(),
+                copies.len(),
+                file.seq_total(),
+                base_id
+            );
+            file.set_copies(copies);
+        }
+    }
+
+    if cli.segment_crc {
+        let announced = announce_checksums(&sockets[0], &files, MAX_PACKET_DATA_SIZE, timeout, cli.query_attempts).unwrap();
+        if announced.len() < files.len() {
+            println!(
+                "Segment checksums of {} of {} files are not announced, they are checked only as a whole",
+                files.len() - announced.len(),
+                files.len()
+            );
+        }
+    }
+
+    let sender = PacketsSender::new(
+        &files,
+        missing,
+        crc32,
+        timeout,
+        cli.batch_size,
+        cli.max_window,
+        !cli.no_packing,
+    );
+    let mismatched = match &cli.local {
+        Some(path) => {
+            let local_sockets = (0..sockets.len())
+                .map(|_| LocalSocket::connect(path))
+                .collect::<io::Result<Vec<LocalSocket>>>()
+                .unwrap();
+            sender.send(local_sockets)
+        }
+        None => sender.send(
+            sockets
+                .into_iter()
+                .map(|socket| BatchSocket::new(socket, !cli.no_gso))
+                .collect(),
+        ),
+    };
+
+    if cli.segment_crc && !mismatched.is_empty() {
+        let socket = connect_sockets(&connect_to_addr, 1).unwrap().remove(0);
+        for file in files.iter().filter(|file| mismatched.contains(&file.id())) {
+            match find_suspect_segments(&socket, file, MAX_PACKET_DATA_SIZE, timeout, cli.query_attempts).unwrap() {
+                Some(segments) => println!(
+                    "file_id == {}, crc mismatch, suspect segments: {:?}",
+                    file.id(),
+                    segments
+                ),
+                None => println!("file_id == {}, crc mismatch, server can't verify segments", file.id()),
+            }
+        }
+    }
 }
\ No newline at end of file
@@ -0,0 +1,109 @@
+//! Packed datagrams: PUT packets of small segments, usually whole small
+//! files, share PACKED_PUT datagrams instead of taking a datagram each. The
+//! header of a packed datagram has only the type, the data is records of
+//! a packet size (u16) followed by the packet. The server answers with
+//! a PACKED_ACK which carries the replies to the records the same way.
+
+use crate::consts::MAX_PACKET_DATA_SIZE;
+use crate::packet::{Data, Header, Packet, PacketType};
+
+const RECORD_HEADER_SIZE: usize = std::mem::size_of::<u16>();
+/// Server handles at most that many records of a datagram, so that
+/// the replies (final ACKs with crc32) fit one PACKED_ACK
+pub const MAX_RECORDS: usize = MAX_PACKET_DATA_SIZE / (RECORD_HEADER_SIZE + Header::serialized_size() + 4);
+
+fn record_size(packet: &Packet) -> Option<usize> {
+    match (&packet.header.type_, &packet.data) {
+        (PacketType::PUT, Data::Ref(payload)) => Some(RECORD_HEADER_SIZE + Header::serialized_size() + payload.len()),
+        _ => None,
+    }
+}
+
+/// PUT packets which are small enough to share a datagram with at least one more.
+fn is_packable(packet: &Packet) -> bool {
+    record_size(packet).is_some_and(|size| size <= MAX_PACKET_DATA_SIZE / 2)
+}
+
+struct PackedDatagram {
+    bytes: Vec<u8>,
+    packets: Vec<usize>,
+}
+
+impl PackedDatagram {
+    fn new() -> Self {
+        let header = Header {
+            seq_number: 0,
+            seq_total: 0,
+            type_: PacketType::PACKED_PUT,
+            file_id: 0,
+        };
+        let mut bytes = Vec::with_capacity(Header::serialized_size() + MAX_PACKET_DATA_SIZE);
+        bytes.extend_from_slice(&header.to_bytes());
+        Self { bytes, packets: Vec::new() }
+    }
+
+    fn fits(&self, record_size: usize) -> bool {
+        self.packets.len() < MAX_RECORDS && self.bytes.len() + record_size <= Header::serialized_size() + MAX_PACKET_DATA_SIZE
+    }
+
+    fn push(&mut self, idx: usize, packet: &Packet) {
+        let Data::Ref(payload) = packet.data else {
+            unreachable!("only PUT packets with payload are packed");
+        };
+        let size = (Header::serialized_size() + payload.len()) as u16;
+        self.bytes.extend_from_slice(&size.to_be_bytes());
+        self.bytes.extend_from_slice(&packet.header.to_bytes());
+        self.bytes.extend_from_slice(payload);
+        self.packets.push(idx);
+    }
+}
+
+/// Packs small packets first fit into as few datagrams as possible.
+/// Returns the packed datagrams with indices of the packets in each, and
+/// indices of the packets which go alone: big ones and the ones which
+/// have found no company.
+pub fn pack(packets: &[Packet]) -> (Vec<(Vec<u8>, Vec<usize>)>, Vec<usize>) {
+    let mut packed: Vec<PackedDatagram> = Vec::new();
+    let mut single = Vec::new();
+
+    for (idx, packet) in packets.iter().enumerate() {
+        if !is_packable(packet) {
+            single.push(idx);
+            continue;
+        }
+
+        let size = record_size(packet).unwrap();
+        match packed.iter_mut().find(|datagram| datagram.fits(size)) {
+            Some(datagram) => datagram.push(idx, packet),
+            None => {
+                let mut datagram = PackedDatagram::new();
+                datagram.push(idx, packet);
+                packed.push(datagram);
+            }
+        }
+    }
+
+    let mut result = Vec::new();
+    for datagram in packed {
+        if datagram.packets.len() == 1 {
+            single.push(datagram.packets[0]);
+        } else {
+            result.push((datagram.bytes, datagram.packets));
+        }
+    }
+    (result, single)
+}
+
+/// Packets in the records of a PACKED_ACK, the rest is skipped after a broken record.
+pub fn unpack(data: &[u8]) -> impl Iterator<Item = Packet<'static>> + '_ {
+    let mut rest = data;
+    std::iter::from_fn(move || {
+        if rest.len() < RECORD_HEADER_SIZE {
+            return None;
+        }
+        let size = u16::from_be_bytes([rest[0], rest[1]]) as usize;
+        let record = rest.get(RECORD_HEADER_SIZE..RECORD_HEADER_SIZE + size)?;
+        rest = &rest[RECORD_HEADER_SIZE + size..];
+        Packet::decode_from_slice(record).ok()
+    })
+}
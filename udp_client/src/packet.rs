@@ -1,4 +1,3 @@
-use crc::{Crc, CRC_32_ISCSI};
 use bincode::{
     serde::{decode_from_slice},
     error::{DecodeError, EncodeError},
@@ -9,9 +8,21 @@ use std::{assert_eq, panic, mem::size_of};
 
 #[derive(Clone, Serialize_repr, Deserialize_repr, Debug)]
 #[repr(u8)]
+#[allow(non_camel_case_types)]
 pub enum PacketType {
     ACK = 0,
     PUT = 1,
+    QUERY = 2,
+    HAVE = 3,
+    STATE = 4,
+    SIGNATURES = 5,
+    COPY = 6,
+    CHECKSUMS = 7,
+    NACK = 8,
+    VERIFY = 9,
+    PACKED_PUT = 10,
+    PACKED_ACK = 11,
+    BUSY = 12,
     UNKNOWN = 0xff,
 }
 
@@ -30,6 +41,16 @@ impl Header {
             size_of::<u8>() +
             size_of::<u64>()
     }
+
+    /// Same encoding as `encode_to_vec` without allocation.
+    pub fn to_bytes(&self) -> [u8; Header::serialized_size()] {
+        let mut bytes = [0; Header::serialized_size()];
+        bytes[0..4].copy_from_slice(&self.seq_number.to_be_bytes());
+        bytes[4..8].copy_from_slice(&self.seq_total.to_be_bytes());
+        bytes[8] = self.type_.clone() as u8;
+        bytes[9..17].copy_from_slice(&self.file_id.to_be_bytes());
+        bytes
+    }
 }
 
 pub enum Data<'a> {
@@ -54,7 +75,7 @@ impl Packet<'_> {
             decode_from_slice::<Header, _>(&slice, config.clone())?;
 
         let data = match header.type_ {
-            PacketType::ACK => {
+            PacketType::ACK | PacketType::HAVE => {
                 let have_crc32_in_data = (slice.len() - bytes_decoded) >= size_of::<u32>();
                 if have_crc32_in_data {
                     let (crc32, _) = decode_from_slice::<u32, _>(&slice[bytes_decoded..],
@@ -64,7 +85,11 @@ impl Packet<'_> {
                     Data::Empty
                 }
             }
-            PacketType::PUT => {
+            PacketType::NACK | PacketType::BUSY => Data::Empty,
+            PacketType::PUT | PacketType::QUERY | PacketType::STATE |
+            PacketType::SIGNATURES | PacketType::COPY |
+            PacketType::CHECKSUMS | PacketType::VERIFY |
+            PacketType::PACKED_PUT | PacketType::PACKED_ACK => {
                 let mut data = Vec::new();
                 data.extend_from_slice(&slice[bytes_decoded..]);
                 Data::Copy(data)
@@ -103,29 +128,3 @@ impl EncodeToVec for Packet<'_> {
         Ok(vec_)
     }
 }
-
-pub trait Crc32Sum {
-    fn crc32(&self) -> u32;
-}
-
-impl Crc32Sum for Vec<&Packet<'_>> {
-    fn crc32(&self) -> u32 {
-        let crc_calculator = Crc::<u32>::new(&CRC_32_ISCSI);
-        let mut digest = crc_calculator.digest();
-        self.iter().for_each(|packet| {
-            match &packet.data {
-                Data::Ref(slice) => digest.update(*slice),
-                Data::Copy(vec) => digest.update(vec.as_slice()),
-                Data::Crs32(_) | Data::Empty => {},
-            }
-        });
-
-        digest.finalize()
-    }
-}
-
-impl Crc32Sum for Vec<Packet<'_>> {
-    fn crc32(&self) -> u32 {
-        self.iter().collect::<Vec<&Packet<'_>>>().crc32()
-    }
-}
\ No newline at end of file
@@ -1,11 +1,15 @@
 use crate::packet::{Data, Header, Packet, PacketType};
+use crc::{Crc, CRC_32_ISCSI};
 use memmap::Mmap;
-use std::fs::File;
+use sha2::{Digest, Sha256};
+use std::{collections::HashMap, fs::File, mem::size_of};
 
 pub struct PacketsSource {
     id: u64,
     mmap: Mmap,
     packet_size: usize,
+    /// seq_number => data of COPY packet which is sent instead of the segment
+    copies: HashMap<u32, Vec<u8>>,
 }
 
 impl PacketsSource {
@@ -14,27 +18,90 @@ impl PacketsSource {
             id,
             mmap: unsafe { Mmap::map(&file)? },
             packet_size,
+            copies: HashMap::new(),
         })
     }
 
-    pub fn packets(&self) -> impl Iterator<Item = Packet> {
-        let chunks = self.mmap.chunks(self.packet_size);
-        let num_of_chunks = chunks.len();
-        let id = self.id.clone();
-
-        chunks
-            .enumerate()
-            .map(move |(idx, chunk)|
-                Packet {
-                    header: Header {
-                        seq_number: idx.try_into().unwrap(),
-                        seq_total: num_of_chunks.try_into().unwrap(),
-                        type_: PacketType::PUT,
-                        file_id: id,
-                    },
-                    data: Data::Ref(chunk),
-                }
-            )
+    pub fn id(&self) -> u64 {
+        self.id
+    }
+
+    pub fn seq_total(&self) -> u32 {
+        self.mmap.chunks(self.packet_size).len().try_into().unwrap()
+    }
+
+    pub fn data(&self) -> &[u8] {
+        &self.mmap[..]
+    }
+
+    /// Segments which are sent as COPY packets of a delta upload.
+    pub fn set_copies(&mut self, copies: HashMap<u32, Vec<u8>>) {
+        self.copies = copies;
+    }
+
+    pub fn crc32(&self) -> u32 {
+        Crc::<u32>::new(&CRC_32_ISCSI).checksum(&self.mmap[..])
+    }
+
+    /// Packet which asks the server which segments of this file starting
+    /// from `from` are missing.
+    pub fn state_packet(&self, from: u32) -> Packet {
+        Packet {
+            header: Header {
+                seq_number: from,
+                seq_total: self.seq_total(),
+                type_: PacketType::STATE,
+                file_id: self.id,
+            },
+            data: Data::Empty,
+        }
+    }
+
+    /// Packet which asks the server whether it already has a file with
+    /// the same content (size and sha256) as this one.
+    pub fn query_packet(&self) -> Packet {
+        let mut data = Vec::with_capacity(size_of::<u64>() + Sha256::output_size());
+        data.extend_from_slice(&(self.mmap.len() as u64).to_be_bytes());
+        data.extend_from_slice(Sha256::digest(&self.mmap[..]).as_slice());
+
+        Packet {
+            header: Header {
+                seq_number: 0,
+                seq_total: self.seq_total(),
+                type_: PacketType::QUERY,
+                file_id: self.id,
+            },
+            data: Data::Copy(data),
+        }
+    }
+
+    /// Packet with segment `seq_number` of the file, the data is not copied.
+    /// Segments which the server can copy from the base go as COPY.
+    pub fn put_packet(&self, seq_number: u32) -> Packet {
+        if let Some(copy) = self.copies.get(&seq_number) {
+            return Packet {
+                header: Header {
+                    seq_number,
+                    seq_total: self.seq_total(),
+                    type_: PacketType::COPY,
+                    file_id: self.id,
+                },
+                data: Data::Ref(copy),
+            };
+        }
+
+        let start = seq_number as usize * self.packet_size;
+        let end = (start + self.packet_size).min(self.mmap.len());
+
+        Packet {
+            header: Header {
+                seq_number,
+                seq_total: self.seq_total(),
+                type_: PacketType::PUT,
+                file_id: self.id,
+            },
+            data: Data::Ref(&self.mmap[start..end]),
+        }
     }
 }
 
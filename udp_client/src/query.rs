@@ -0,0 +1,178 @@
+use std::{
+    collections::HashMap,
+    io,
+    net::UdpSocket,
+    ops::Range,
+    time::{Duration, Instant},
+};
+
+use crate::consts;
+use crate::packet::{Data, EncodeToVec, Packet, PacketType};
+use crate::packets_view::PacketsSource;
+
+/// Receives a datagram which arrives before `deadline`, returns None on timeout.
+pub fn recv_until(socket: &UdpSocket, buf: &mut [u8], deadline: Instant) -> io::Result<Option<usize>> {
+    let now = Instant::now();
+    if now >= deadline {
+        return Ok(None);
+    }
+
+    socket.set_read_timeout(Some(deadline - now))?;
+    match socket.recv(buf) {
+        Ok(bytes_received) => Ok(Some(bytes_received)),
+        Err(e) if matches!(e.kind(), io::ErrorKind::WouldBlock | io::ErrorKind::TimedOut) => Ok(None),
+        Err(e) => Err(e),
+    }
+}
+
+/// Asks the server which of `files` it already has.
+/// Files which were not answered after `attempts` rounds are considered missing.
+/// Returns file_id => crc32 of the server's copy for files the server has.
+pub fn query_present_files(
+    socket: &UdpSocket,
+    files: &Vec<PacketsSource>,
+    timeout: Duration,
+    attempts: usize,
+) -> io::Result<HashMap<u64, u32>> {
+    let mut answers: HashMap<u64, Option<u32>> = HashMap::new();
+
+    for _ in 0..attempts {
+        for file in files.iter().filter(|file| !answers.contains_key(&file.id())) {
+            socket.send(&file.query_packet().encode_to_vec().unwrap())?;
+        }
+
+        let deadline = Instant::now() + timeout;
+        while answers.len() < files.len() {
+            let mut buf = vec![0; consts::MAX_DATAGRAM_SIZE];
+            let Some(bytes_received) = recv_until(socket, &mut buf, deadline)? else {
+                break; // timeout
+            };
+
+            let packet = match Packet::decode_from_slice(&buf[..bytes_received]) {
+                Ok(packet) => packet,
+                Err(_) => continue,
+            };
+            if let PacketType::HAVE = packet.header.type_ {
+                let crc32 = match packet.data {
+                    Data::Crs32(crc32) => Some(crc32),
+                    _ => None,
+                };
+                answers.insert(packet.header.file_id, crc32);
+            }
+        }
+
+        if answers.len() == files.len() {
+            break;
+        }
+    }
+
+    Ok(answers
+        .into_iter()
+        .filter_map(|(file_id, crc32)| crc32.map(|crc32| (file_id, crc32)))
+        .collect())
+}
+
+struct ScanProgress {
+    scanned_until: u32,
+    missing: Vec<Range<u32>>,
+}
+
+fn parse_state(data: &[u8]) -> Option<(u32, Vec<Range<u32>>)> {
+    let mut words = data
+        .chunks_exact(4)
+        .map(|word| u32::from_be_bytes(word.try_into().unwrap()));
+    let scanned_until = words.next()?;
+    let words = words.collect::<Vec<u32>>();
+    let ranges = words
+        .chunks_exact(2)
+        .map(|range| range[0]..range[0].saturating_add(range[1]))
+        .collect();
+
+    Some((scanned_until, ranges))
+}
+
+/// Asks the server which segments of `files` are still missing, so an
+/// interrupted transfer resends only segments the server has not got yet.
+/// Segments the server did not report about after `attempts` rounds
+/// without progress are considered missing.
+/// Returns file_id => sorted ranges of missing segments.
+pub fn query_missing_segments(
+    socket: &UdpSocket,
+    files: &Vec<PacketsSource>,
+    timeout: Duration,
+    attempts: usize,
+) -> io::Result<HashMap<u64, Vec<Range<u32>>>> {
+    let mut progress: HashMap<u64, ScanProgress> = files
+        .iter()
+        .map(|file| (file.id(), ScanProgress { scanned_until: 0, missing: Vec::new() }))
+        .collect();
+
+    let mut attempts_left = attempts;
+    while attempts_left > 0 {
+        let unfinished = files
+            .iter()
+            .filter(|file| progress[&file.id()].scanned_until < file.seq_total())
+            .collect::<Vec<&PacketsSource>>();
+        if unfinished.is_empty() {
+            break;
+        }
+
+        for file in unfinished.iter() {
+            let from = progress[&file.id()].scanned_until;
+            socket.send(&file.state_packet(from).encode_to_vec().unwrap())?;
+        }
+
+        let mut answered = 0;
+        let deadline = Instant::now() + timeout;
+        while answered < unfinished.len() {
+            let mut buf = vec![0; consts::MAX_DATAGRAM_SIZE];
+            let Some(bytes_received) = recv_until(socket, &mut buf, deadline)? else {
+                break; // timeout
+            };
+
+            let packet = match Packet::decode_from_slice(&buf[..bytes_received]) {
+                Ok(packet) => packet,
+                Err(_) => continue,
+            };
+            let (PacketType::STATE, Data::Copy(data)) = (&packet.header.type_, &packet.data) else {
+                continue;
+            };
+            let Some(file_progress) = progress.get_mut(&packet.header.file_id) else {
+                continue;
+            };
+            if packet.header.seq_number != file_progress.scanned_until {
+                continue; // duplicate or late answer
+            }
+            let Some((scanned_until, ranges)) = parse_state(data) else {
+                continue;
+            };
+
+            if scanned_until <= file_progress.scanned_until {
+                // the server did not advance, so don't trust it with the rest of the file
+                file_progress.missing.push(file_progress.scanned_until..u32::MAX);
+                file_progress.scanned_until = u32::MAX;
+            } else {
+                file_progress.missing.extend(ranges);
+                file_progress.scanned_until = scanned_until;
+            }
+            answered += 1;
+        }
+
+        if answered == 0 {
+            attempts_left -= 1;
+        }
+    }
+
+    Ok(files
+        .iter()
+        .map(|file| {
+            let file_progress = progress.remove(&file.id()).unwrap();
+            let mut missing = file_progress.missing;
+            missing.iter_mut().for_each(|range| range.end = range.end.min(file.seq_total()));
+            if file_progress.scanned_until < file.seq_total() {
+                missing.push(file_progress.scanned_until..file.seq_total());
+            }
+            (file.id(), missing)
+        })
+        .collect())
+}
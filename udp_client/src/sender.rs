@@ -1,204 +1,583 @@
-use async_std::{channel, future, net::UdpSocket};
-use futures::{
-    future::{join, AbortHandle, Abortable, Aborted},
-    stream::iter,
-    StreamExt,
+use std::{
+    collections::{HashMap, VecDeque},
+    io,
+    ops::Range,
+    thread,
+    time::{Duration, Instant},
 };
-use itertools::Itertools;
-use std::{cell::RefCell, collections::HashMap, num::NonZeroU32, time::Duration};
 
-use governor::{
-    clock::DefaultClock,
-    state::{InMemoryState, NotKeyed},
-    Quota, RateLimiter,
-};
+use crate::batch::{Datagram, DatagramSocket, HEADER_SIZE};
+use crate::packed;
+use crate::packet::{Data, Packet, PacketType};
+use crate::packets_view::PacketsSource;
+use crate::window::{CongestionWindow, RttEstimator};
 
-use crate::consts;
-use crate::packet::{Crc32Sum, Data, EncodeToVec, Packet};
-
-fn calc_hashes_for_files(packets: &Vec<Packet<'_>>) -> HashMap<u64, u32> {
-    let mut ref_to_packets_vec = packets.iter().collect::<Vec<&Packet<'_>>>();
-    ref_to_packets_vec.sort_by(|a, b| a.header.file_id.cmp(&b.header.file_id));
-
-    ref_to_packets_vec
-        .into_iter()
-        .group_by(|packet| packet.header.file_id)
-        .into_iter()
-        .map(|(file_id, packets)| {
-            let mut packets = packets.collect::<Vec<&Packet<'_>>>();
-            packets.sort_by(|a, b| a.header.seq_number.cmp(&b.header.seq_number));
-            (file_id, packets.crc32())
-        })
-        .collect::<HashMap<_, _>>()
-}
+/// Packets which are acknowledged after a later sent packet are considered
+/// reordered rather than lost if they are at most that late
+const MIN_REORDERING_WINDOW: Duration = Duration::from_millis(1);
+/// Files which the server answers with BUSY are put aside for RTO, but at
+/// least for that long
+const MIN_BUSY_DELAY: Duration = Duration::from_millis(10);
 
 pub struct PacketsSender<'a> {
-    crc32: HashMap<u64, u32>,
-    received_crc32: RefCell<HashMap<u64, u32>>, // file_id => crc32
-    rate_limiter: RateLimiter<NotKeyed, InMemoryState, DefaultClock>,
-    senders: HashMap<(u64, u32), OnePacketSender<'a>>,
-    timeout: Duration,
-    number_of_sent_packets: RefCell<usize>,
+    files: &'a [PacketsSource],
+    missing: HashMap<u64, Vec<Range<u32>>>, // file_id => segments to send, all if there is no entry
+    crc32: HashMap<u64, u32>,               // file_id => crc32 of the whole file
+    initial_rto: Duration,
+    batch_size: usize,
+    max_window: usize,
+    /// Small segments of different files share PACKED_PUT datagrams
+    packing: bool,
 }
 
 impl<'a> PacketsSender<'a> {
-    pub fn new(packets: Vec<Packet<'a>>, quota: Quota, timeout: Duration) -> Self {
+    pub fn new(
+        files: &'a [PacketsSource],
+        missing: HashMap<u64, Vec<Range<u32>>>,
+        crc32: HashMap<u64, u32>,
+        initial_rto: Duration,
+        batch_size: usize,
+        max_window: usize,
+        packing: bool,
+    ) -> Self {
         Self {
-            crc32: calc_hashes_for_files(&packets),
-            received_crc32: RefCell::new(HashMap::new()),
-            rate_limiter: RateLimiter::direct(quota),
-            senders: packets
+            files,
+            missing,
+            crc32,
+            initial_rto,
+            batch_size: batch_size.max(1),
+            max_window,
+            packing,
+        }
+    }
+
+    /// Sends all segments. Segments of a file always go over the same socket,
+    /// and every socket is served by its own thread with its own window.
+    /// Returns ids of files whose crc32 on the server differs from the calculated one.
+    pub fn send<S: DatagramSocket + Send>(&self, sockets: Vec<S>) -> Vec<u64> {
+        let number_of_sockets = sockets.len();
+        thread::scope(|scope| {
+            let mut connections = Vec::new();
+            for (socket_no, socket) in sockets.into_iter().enumerate() {
+                let files = self
+                    .files
+                    .iter()
+                    .skip(socket_no)
+                    .step_by(number_of_sockets)
+                    .filter_map(|file| self.file_state(file))
+                    .collect::<Vec<FileState<'a>>>();
+                if files.is_empty() {
+                    continue;
+                }
+
+                connections.push(scope.spawn(move || {
+                    let mut connection = Connection::new(self, socket, files);
+                    if let Err(e) = connection.run() {
+                        println!("Error while sending packets! Error: {}", e);
+                    }
+                    connection.mismatched
+                }));
+            }
+
+            connections
                 .into_iter()
-                .map(|packet| {
-                    let k = (packet.header.file_id, packet.header.seq_number);
-                    (k, OnePacketSender::new(packet))
-                })
-                .collect::<HashMap<_, OnePacketSender<'a>>>(),
+                .flat_map(|connection| connection.join().unwrap())
+                .collect()
+        })
+    }
+
+    fn file_state(&self, source: &'a PacketsSource) -> Option<FileState<'a>> {
+        let unsent = match self.missing.get(&source.id()) {
+            Some(ranges) => ranges.clone(),
+            None => vec![0..source.seq_total()],
+        };
+        let state = FileState::new(source, unsent);
+        (state.unacked > 0).then_some(state)
+    }
+}
 
-            timeout,
-            number_of_sent_packets: RefCell::new(0),
+/// Segment state of a file: one bit per segment plus ranges which are not sent yet.
+struct FileState<'a> {
+    source: &'a PacketsSource,
+    acked: Vec<u64>,
+    unacked: usize,
+    unsent: Vec<Range<u32>>, // in reverse order, so the next one is at the end
+    /// The server was busy with the file, no segments are sent before that
+    deferred_until_us: u64,
+}
+
+impl<'a> FileState<'a> {
+    fn new(source: &'a PacketsSource, mut unsent: Vec<Range<u32>>) -> Self {
+        unsent.retain(|range| range.start < range.end);
+        unsent.reverse();
+
+        let words = (source.seq_total() as usize + 63) / 64;
+        let mut acked = vec![!0u64; words];
+        for range in unsent.iter() {
+            for seq_number in range.clone() {
+                acked[seq_number as usize / 64] &= !(1 << (seq_number % 64));
+            }
+        }
+
+        Self {
+            source,
+            acked,
+            unacked: unsent.iter().map(|range| range.len()).sum(),
+            unsent,
+            deferred_until_us: 0,
+        }
+    }
+
+    fn next_unsent(&mut self) -> Option<u32> {
+        let range = self.unsent.last_mut()?;
+        let seq_number = range.start;
+        range.start += 1;
+        if range.start == range.end {
+            self.unsent.pop();
+        }
+        Some(seq_number)
+    }
+
+    fn is_acked(&self, seq_number: u32) -> bool {
+        self.acked[seq_number as usize / 64] & (1 << (seq_number % 64)) != 0
+    }
+
+    /// Returns false if the segment was acknowledged before.
+    fn ack(&mut self, seq_number: u32) -> bool {
+        if seq_number >= self.source.seq_total() || self.is_acked(seq_number) {
+            return false;
+        }
+
+        self.acked[seq_number as usize / 64] |= 1 << (seq_number % 64);
+        self.unacked -= 1;
+        true
+    }
+}
+
+/// Sorts ACK, NACK and BUSY out of the replies, late answers to queries and
+/// alike are dropped.
+fn collect_reply(
+    packet: Packet,
+    acks: &mut Vec<(u64, u32, Option<u32>)>,
+    nacks: &mut Vec<(u64, u32)>,
+    busy: &mut Vec<(u64, u32)>,
+) {
+    match packet.header.type_ {
+        PacketType::ACK => {
+            let crc32 = match packet.data {
+                Data::Crs32(crc32) => Some(crc32),
+                _ => None,
+            };
+            acks.push((packet.header.file_id, packet.header.seq_number, crc32));
+        }
+        PacketType::NACK => nacks.push((packet.header.file_id, packet.header.seq_number)),
+        PacketType::BUSY => busy.push((packet.header.file_id, packet.header.seq_number)),
+        _ => {}
+    }
+}
+
+/// Segment of the file with index `file` in Connection::files.
+type SegmentKey = (u32, u32);
+
+struct InFlight {
+    sent_at_us: u64,
+    retransmitted: bool,
+}
+
+/// Sliding window sender over one socket.
+struct Connection<'s, 'a, S> {
+    sender: &'s PacketsSender<'a>,
+    socket: S,
+
+    files: Vec<FileState<'a>>,
+    file_index: HashMap<u64, u32>, // file_id => index in files
+    /// Files which still have unsent segments, served round-robin
+    active_files: Vec<u32>,
+    next_active_file: usize,
+    /// No active file may be sent before that, valid while next_segment
+    /// finds nothing to send
+    active_deferred_until_us: u64,
+    unacked: usize,
+
+    in_flight: HashMap<SegmentKey, InFlight>,
+    /// Segments in the order they were sent, entries for segments which
+    /// are not in flight any more or were sent again are skipped
+    timers: VecDeque<(SegmentKey, u64)>,
+    lost: VecDeque<SegmentKey>,
+    /// Segments which the server was too busy to take and the time to send
+    /// them again
+    deferred: VecDeque<(SegmentKey, u64)>,
+    /// Send time of the latest sent segment which is acknowledged
+    latest_acked_sent_at_us: u64,
+
+    rtt: RttEstimator,
+    window: CongestionWindow,
+    start: Instant,
+
+    received_crc32: HashMap<u64, u32>, // file_id => crc32
+    mismatched: Vec<u64>,
+    /// Segments which the server has rejected as corrupted
+    nacked: usize,
+    /// Segments which the overloaded server has shed
+    busy: usize,
+    /// Segments which went in PACKED_PUT datagrams and the number of the datagrams
+    packed_segments: usize,
+    packed_datagrams: usize,
+}
+
+impl<'s, 'a, S: DatagramSocket> Connection<'s, 'a, S> {
+    fn new(sender: &'s PacketsSender<'a>, socket: S, files: Vec<FileState<'a>>) -> Self {
+        Self {
+            sender,
+            socket,
+            file_index: files
+                .iter()
+                .enumerate()
+                .map(|(idx, file)| (file.source.id(), idx as u32))
+                .collect(),
+            active_files: (0..files.len() as u32).collect(),
+            next_active_file: 0,
+            active_deferred_until_us: 0,
+            unacked: files.iter().map(|file| file.unacked).sum(),
+            files,
+            in_flight: HashMap::new(),
+            timers: VecDeque::new(),
+            lost: VecDeque::new(),
+            deferred: VecDeque::new(),
+            latest_acked_sent_at_us: 0,
+            rtt: RttEstimator::new(sender.initial_rto),
+            window: CongestionWindow::new(sender.max_window),
+            start: Instant::now(),
+            received_crc32: HashMap::new(),
+            mismatched: Vec::new(),
+            nacked: 0,
+            busy: 0,
+            packed_segments: 0,
+            packed_datagrams: 0,
+        }
+    }
+
+    fn run(&mut self) -> io::Result<()> {
+        let mut batch: Vec<(SegmentKey, bool)> = Vec::with_capacity(self.sender.batch_size);
+
+        while self.unacked > 0 {
+            while batch.len() < self.sender.batch_size && self.in_flight.len() + batch.len() < self.window.size() {
+                match self.next_segment() {
+                    Some(segment) => batch.push(segment),
+                    None => break,
+                }
+            }
+            if !batch.is_empty() {
+                self.send_batch(&batch)?;
+                batch.clear();
+            }
+
+            // Don't wait for replies while the window lets more segments out
+            let can_send = self.in_flight.len() < self.window.size() && self.has_unsent();
+            let wait = if can_send { None } else { Some(self.time_to_next_timer()) };
+            self.receive(wait)?;
+            self.detect_losses();
+        }
+
+        if self.nacked > 0 {
+            println!("{} corrupted segments were sent again", self.nacked);
+        }
+        if self.busy > 0 {
+            println!("{} segments were deferred by the busy server", self.busy);
+        }
+        if self.packed_datagrams > 0 {
+            println!(
+                "{} segments were sent in {} packed datagrams",
+                self.packed_segments, self.packed_datagrams
+            );
         }
+        Ok(())
     }
 
-    pub async fn send(&self, socket: UdpSocket) {
-        let (send_task_abort_handle, send_task_abort_reg) = AbortHandle::new_pair();
-        let (recv_task_abort_handle, recv_task_abort_reg) = AbortHandle::new_pair();
+    fn has_unsent(&self) -> bool {
+        let now_us = self.now_us();
+        !self.lost.is_empty()
+            || self.deferred.front().is_some_and(|&(_, retry_at_us)| retry_at_us <= now_us)
+            || (!self.active_files.is_empty() && self.active_deferred_until_us <= now_us)
+    }
 
-        let send_task = iter(self.senders.values()).for_each(|sender| async {
-            if let Err(e) = sender.send(&socket, &self.rate_limiter, self.timeout).await {
-                println!("Error while sending packet! Error: {}", e);
-                send_task_abort_handle.abort();
-                recv_task_abort_handle.abort()
+    /// Returns lost segments first, then deferred segments which are due,
+    /// then new segments of the files in turn, skipping deferred files.
+    fn next_segment(&mut self) -> Option<(SegmentKey, bool)> {
+        while let Some((file, seq_number)) = self.lost.pop_front() {
+            if !self.files[file as usize].is_acked(seq_number) {
+                return Some(((file, seq_number), true));
             }
+        }
 
-            self.number_of_sent_packets.replace_with(|&mut old| old + 1);
-            let last_packet_sent = *self.number_of_sent_packets.borrow() == self.senders.len();
+        let now_us = self.now_us();
+        while let Some(&((file, seq_number), retry_at_us)) = self.deferred.front() {
+            if retry_at_us > now_us {
+                break;
+            }
+            self.deferred.pop_front();
+            if !self.files[file as usize].is_acked(seq_number) {
+                return Some(((file, seq_number), true));
+            }
+        }
 
-            if last_packet_sent {
-                recv_task_abort_handle.abort();
+        let mut skipped = 0;
+        let mut deferred_until_us = u64::MAX;
+        while skipped < self.active_files.len() {
+            let pos = self.next_active_file % self.active_files.len();
+            let file = self.active_files[pos];
+            let state = &mut self.files[file as usize];
+            if state.deferred_until_us > now_us {
+                deferred_until_us = deferred_until_us.min(state.deferred_until_us);
+                self.next_active_file = pos + 1;
+                skipped += 1;
+                continue;
             }
-        });
+            match state.next_unsent() {
+                Some(seq_number) => {
+                    self.next_active_file = pos + 1;
+                    self.active_deferred_until_us = 0;
+                    return Some(((file, seq_number), false));
+                }
+                None => {
+                    self.active_files.swap_remove(pos);
+                }
+            }
+        }
+
+        self.active_deferred_until_us = deferred_until_us;
+        None
+    }
 
-        let send_task = Abortable::new(send_task, send_task_abort_reg);
-        let recv_task = Abortable::new(self.receive(&socket), recv_task_abort_reg);
+    fn send_batch(&mut self, batch: &[(SegmentKey, bool)]) -> io::Result<()> {
+        let packets = batch
+            .iter()
+            .map(|&((file, seq_number), _)| self.files[file as usize].source.put_packet(seq_number))
+            .collect::<Vec<Packet<'a>>>();
+        let (packed, single) = if self.sender.packing {
+            packed::pack(&packets)
+        } else {
+            (Vec::new(), (0..packets.len()).collect())
+        };
 
-        let (_, recv_result) = join(send_task, recv_task).await;
-        match recv_result {
-            Ok(finished) => {
-                if let Err(e) = finished {
-                    println!("Error while receiving packet! Error: {}", e);
+        // Segments of every datagram, in the order the datagrams are sent
+        let mut groups = single.iter().map(|&idx| vec![idx]).collect::<Vec<Vec<usize>>>();
+        let mut datagrams = single.iter().map(|&idx| Datagram::from(&packets[idx])).collect::<Vec<Datagram>>();
+        for (bytes, packed_packets) in packed.iter() {
+            datagrams.push(Datagram {
+                header: bytes[..HEADER_SIZE].try_into().unwrap(),
+                payload: &bytes[HEADER_SIZE..],
+            });
+            groups.push(packed_packets.clone());
+        }
+
+        let sent = self.socket.send(&datagrams)?;
+
+        let now_us = self.now_us();
+        for (group_no, group) in groups.iter().enumerate() {
+            if group_no >= single.len() && group_no < sent {
+                self.packed_segments += group.len();
+                self.packed_datagrams += 1;
+            }
+            for &idx in group {
+                let (key, retransmitted) = batch[idx];
+                if group_no < sent {
+                    self.in_flight.insert(key, InFlight { sent_at_us: now_us, retransmitted });
+                    self.timers.push_back((key, now_us));
+                } else {
+                    // Datagrams which don't fit into kernel buffers are lost
+                    // like any other, so they are sent again
+                    self.lost.push_back(key);
                 }
             }
-            Err(Aborted) => {}
         }
+
+        // And they shrink the window
+        if sent < datagrams.len() {
+            self.window.on_loss(now_us, now_us);
+        }
+
+        Ok(())
     }
 
-    async fn receive(&self, socket: &UdpSocket) -> Result<(), async_std::io::Error> {
-        loop {
-            let mut buf = vec![0; consts::MAX_DATAGRAM_SIZE];
-            let bytes_received = socket.recv(&mut buf).await?;
-            let packet = match Packet::decode_from_slice(&buf[..bytes_received]) {
+    fn receive(&mut self, wait: Option<Duration>) -> io::Result<()> {
+        let mut acks = Vec::new();
+        let mut nacks = Vec::new();
+        let mut busy = Vec::new();
+        for datagram in self.socket.recv(wait)? {
+            let packet = match Packet::decode_from_slice(datagram) {
                 Err(_) => {
                     println!("Can't decode packet");
                     continue;
                 }
                 Ok(packet) => packet,
             };
-
-            if let Data::Crs32(crc32) = packet.data {
-                let file_id = &packet.header.file_id;
-                let old = self
-                    .received_crc32
-                    .borrow_mut()
-                    .insert(*file_id, crc32.clone());
-
-                let to_print = match old {
-                    Some(old_crc32) if old_crc32 != crc32 => true,
-                    None => true,
-                    Some(_) => false,
-                };
-
-                if to_print {
-                    println!(
-                        "file_id == {}, calculated crc == {}, received_crc == {}",
-                        file_id,
-                        self.crc32.get(&file_id).unwrap_or(&0),
-                        crc32
-                    );
+            match (&packet.header.type_, &packet.data) {
+                (PacketType::PACKED_ACK, Data::Copy(records)) => {
+                    for reply in packed::unpack(records) {
+                        collect_reply(reply, &mut acks, &mut nacks, &mut busy);
+                    }
                 }
+                _ => collect_reply(packet, &mut acks, &mut nacks, &mut busy),
             }
+        }
 
-            let k = (
-                packet.header.file_id.clone(),
-                packet.header.seq_number.clone(),
-            );
-            if let Some(sender) = self.senders.get(&k) {
-                sender.ack(packet).await;
+        for (file_id, seq_number, crc32) in acks {
+            if let Some(crc32) = crc32 {
+                self.on_crc32(file_id, crc32);
             }
+            self.on_ack(file_id, seq_number);
         }
+        for (file_id, seq_number) in nacks {
+            self.on_nack(file_id, seq_number);
+        }
+        for (file_id, seq_number) in busy {
+            self.on_busy(file_id, seq_number);
+        }
+
+        Ok(())
     }
-}
 
-struct OnePacketSender<'a> {
-    packet: Packet<'a>,
+    fn on_ack(&mut self, file_id: u64, seq_number: u32) {
+        let Some(&file) = self.file_index.get(&file_id) else {
+            return;
+        };
+        // udp packets can have a duplicate, so only the first ACK counts
+        if !self.files[file as usize].ack(seq_number) {
+            return;
+        }
+        self.unacked -= 1;
 
-    s: channel::Sender<Packet<'a>>,
-    r: channel::Receiver<Packet<'a>>,
-}
+        let Some(in_flight) = self.in_flight.remove(&(file, seq_number)) else {
+            return; // ACK of a segment which is considered lost
+        };
+        if !in_flight.retransmitted {
+            let now_us = self.now_us();
+            self.rtt.sample(Duration::from_micros(now_us - in_flight.sent_at_us));
+        }
+        self.latest_acked_sent_at_us = self.latest_acked_sent_at_us.max(in_flight.sent_at_us);
+        self.window.on_ack();
+    }
 
-impl<'a> OnePacketSender<'a> {
-    fn new(packet: Packet<'a>) -> Self {
-        let (s, r) = channel::bounded::<Packet<'a>>(1);
-        Self { packet, s, r }
-    }
-
-    async fn send(
-        &self,
-        socket: &UdpSocket,
-        rate_limiter: &RateLimiter<NotKeyed, InMemoryState, DefaultClock>,
-        timeout: Duration,
-    ) -> Result<(), async_std::io::Error> {
-        let binary_packet = self.packet.encode_to_vec().unwrap();
-        let binary_packet_size = NonZeroU32::new(binary_packet.len().try_into().unwrap()).unwrap();
-
-        loop {
-            rate_limiter
-                .until_n_ready(binary_packet_size)
-                .await
-                .unwrap();
-            socket.send(&binary_packet).await?;
-
-            let ack_packet = match future::timeout(timeout, self.r.recv()).await {
-                Ok(recv_result) => match recv_result {
-                    Ok(packet) => packet,
-                    Err(_) => {
-                        println!("Channel is closed!");
-                        break;
-                    }
-                },
-                Err(_) => {
-                    continue;
-                } // timeout
-            };
+    /// The segment was corrupted on the way, it is sent again right away.
+    /// Corruption isn't congestion, so the window stays as it is.
+    fn on_nack(&mut self, file_id: u64, seq_number: u32) {
+        let Some(&file) = self.file_index.get(&file_id) else {
+            return;
+        };
+        if self.files[file as usize].is_acked(seq_number) {
+            return;
+        }
+        if self.in_flight.remove(&(file, seq_number)).is_none() {
+            return; // considered lost already
+        }
+
+        self.lost.push_front((file, seq_number));
+        self.nacked += 1;
+    }
+
+    /// The server is overloaded and shed the segment. It isn't lost, so the
+    /// window stays as it is, but the file is put aside for a while and the
+    /// server gets on with the files it has almost received.
+    fn on_busy(&mut self, file_id: u64, seq_number: u32) {
+        let Some(&file) = self.file_index.get(&file_id) else {
+            return;
+        };
+        if self.files[file as usize].is_acked(seq_number) {
+            return;
+        }
+        if self.in_flight.remove(&(file, seq_number)).is_none() {
+            return; // considered lost already
+        }
+
+        let retry_at_us = self.now_us() + self.rtt.rto().max(MIN_BUSY_DELAY).as_micros() as u64;
+        let state = &mut self.files[file as usize];
+        state.deferred_until_us = state.deferred_until_us.max(retry_at_us);
+        self.deferred.push_back(((file, seq_number), retry_at_us));
+        self.busy += 1;
+    }
+
+    fn on_crc32(&mut self, file_id: u64, crc32: u32) {
+        let old = self.received_crc32.insert(file_id, crc32);
+        let to_print = match old {
+            Some(old_crc32) if old_crc32 != crc32 => true,
+            None => true,
+            Some(_) => false,
+        };
+
+        let calculated = self.sender.crc32.get(&file_id).copied();
+        if old.is_none() && calculated.is_some_and(|calculated| calculated != crc32) {
+            self.mismatched.push(file_id);
+        }
+
+        if to_print {
+            println!(
+                "file_id == {}, calculated crc == {}, received_crc == {}",
+                file_id,
+                self.sender.crc32.get(&file_id).unwrap_or(&0),
+                crc32
+            );
+        }
+    }
+
+    /// Segment is lost if it isn't acknowledged for RTO, or if a segment
+    /// which was sent noticeably later is acknowledged already.
+    fn detect_losses(&mut self) {
+        let now_us = self.now_us();
+        let rto_us = self.rtt.rto().as_micros() as u64;
+        let reordering_window_us = self
+            .rtt
+            .srtt()
+            .map_or(MIN_REORDERING_WINDOW, |srtt| (srtt / 4).max(MIN_REORDERING_WINDOW))
+            .as_micros() as u64;
+
+        while let Some(&(key, sent_at_us)) = self.timers.front() {
+            let is_current = self
+                .in_flight
+                .get(&key)
+                .is_some_and(|in_flight| in_flight.sent_at_us == sent_at_us);
+            if !is_current {
+                self.timers.pop_front();
+                continue;
+            }
 
-            let ack_packet_k = (ack_packet.header.file_id, ack_packet.header.seq_number);
-            let this_packet_k = (self.packet.header.file_id, self.packet.header.seq_number);
-            if ack_packet_k == this_packet_k {
-                self.s.close();
+            let overtaken = sent_at_us + reordering_window_us < self.latest_acked_sent_at_us;
+            let timed_out = sent_at_us + rto_us <= now_us;
+            if !overtaken && !timed_out {
                 break;
-            } else {
-                println!("Warning! Wrong ack packet!");
+            }
+
+            self.timers.pop_front();
+            self.in_flight.remove(&key);
+            self.lost.push_back(key);
+            if self.window.on_loss(sent_at_us, now_us) && !overtaken {
+                self.rtt.back_off();
             }
         }
+    }
 
-        Ok(())
+    /// Time until a segment times out or a deferred segment or file is due.
+    fn time_to_next_timer(&self) -> Duration {
+        let rto = self.rtt.rto();
+        let now_us = self.now_us();
+        let mut wait_until_us = match self.timers.front() {
+            Some(&(_, sent_at_us)) => sent_at_us + rto.as_micros() as u64,
+            None => now_us + rto.as_micros() as u64,
+        };
+
+        // Only future ones, due ones wait for the window
+        let deferred = self.deferred.front().map(|&(_, retry_at_us)| retry_at_us);
+        let active = (!self.active_files.is_empty()).then_some(self.active_deferred_until_us);
+        for until_us in deferred.into_iter().chain(active) {
+            if until_us > now_us {
+                wait_until_us = wait_until_us.min(until_us);
+            }
+        }
+
+        Duration::from_micros(wait_until_us.saturating_sub(now_us))
     }
 
-    async fn ack(&self, packet: Packet<'a>) {
-        // udp packets can have a duplicate so we ignore
-        // send error for channel::Sender::send method
-        // because it returns an error only if it was closed...
-        // (...and we closing self.s in self.send)
-        let _ = self.s.send(packet).await;
+    fn now_us(&self) -> u64 {
+        self.start.elapsed().as_micros() as u64
     }
 }
@@ -0,0 +1,106 @@
+//! Congestion control of the sender: round trip time estimation and
+//! retransmission timeout as TCP computes them (RFC 6298), and AIMD
+//! congestion window counted in packets.
+
+use std::time::Duration;
+
+/// Timer granularity, RTO is never closer than that to SRTT
+const CLOCK_GRANULARITY: Duration = Duration::from_millis(1);
+const MIN_RTO: Duration = Duration::from_millis(10);
+const MAX_RTO: Duration = Duration::from_secs(60);
+
+const INITIAL_WINDOW: f64 = 10.0;
+const MIN_WINDOW: f64 = 2.0;
+
+pub struct RttEstimator {
+    srtt: Option<Duration>,
+    rttvar: Duration,
+    rto: Duration,
+}
+
+impl RttEstimator {
+    /// `initial_rto` is used until the first sample.
+    pub fn new(initial_rto: Duration) -> Self {
+        Self {
+            srtt: None,
+            rttvar: Duration::ZERO,
+            rto: initial_rto.clamp(MIN_RTO, MAX_RTO),
+        }
+    }
+
+    /// Takes a round trip time of a packet which was sent once (Karn's algorithm).
+    pub fn sample(&mut self, rtt: Duration) {
+        let srtt = match self.srtt {
+            None => {
+                self.rttvar = rtt / 2;
+                rtt
+            }
+            Some(srtt) => {
+                let deviation = if srtt > rtt { srtt - rtt } else { rtt - srtt };
+                self.rttvar = self.rttvar * 3 / 4 + deviation / 4;
+                srtt * 7 / 8 + rtt / 8
+            }
+        };
+
+        self.srtt = Some(srtt);
+        self.rto = (srtt + CLOCK_GRANULARITY.max(self.rttvar * 4)).clamp(MIN_RTO, MAX_RTO);
+    }
+
+    /// Doubles RTO after a timeout, the next sample brings it back.
+    pub fn back_off(&mut self) {
+        self.rto = (self.rto * 2).min(MAX_RTO);
+    }
+
+    pub fn rto(&self) -> Duration {
+        self.rto
+    }
+
+    pub fn srtt(&self) -> Option<Duration> {
+        self.srtt
+    }
+}
+
+pub struct CongestionWindow {
+    cwnd: f64,
+    ssthresh: f64,
+    max: f64,
+    /// Losses of packets sent before that moment belong to the same congestion event
+    recovery_start_us: Option<u64>,
+}
+
+impl CongestionWindow {
+    pub fn new(max_window: usize) -> Self {
+        let max = (max_window as f64).max(MIN_WINDOW);
+        Self {
+            cwnd: INITIAL_WINDOW.min(max),
+            ssthresh: max,
+            max,
+            recovery_start_us: None,
+        }
+    }
+
+    /// Number of packets which can be in flight.
+    pub fn size(&self) -> usize {
+        self.cwnd as usize
+    }
+
+    /// Additive increase: one packet per ACK in slow start,
+    /// one packet per window of ACKs in congestion avoidance.
+    pub fn on_ack(&mut self) {
+        self.cwnd += if self.cwnd < self.ssthresh { 1.0 } else { 1.0 / self.cwnd };
+        self.cwnd = self.cwnd.min(self.max);
+    }
+
+    /// Multiplicative decrease, at most once per round trip.
+    /// Returns true if the loss started a new congestion event.
+    pub fn on_loss(&mut self, sent_at_us: u64, now_us: u64) -> bool {
+        if self.recovery_start_us.is_some_and(|start| sent_at_us <= start) {
+            return false;
+        }
+
+        self.ssthresh = (self.cwnd / 2.0).max(MIN_WINDOW);
+        self.cwnd = self.ssthresh;
+        self.recovery_start_us = Some(now_us);
+        true
+    }
+}
@@ -0,0 +1,242 @@
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <getopt.h>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include "udp_server/packet.h"
+#include "udp_server/server_core.h"
+#include "udp_server/base/buffer_writer.h"
+#include "udp_server/net/ipv4_address.h"
+#include "udp_server/net/sock_addr.h"
+
+/**
+ * Compares server configurations on the same synthetic upload without
+ * networking, so only the cost of the server itself is measured.
+ */
+
+struct Options {
+  uint32_t files = 64;
+  uint32_t segments = 512;
+  int repeat = 5;
+  /// Threads of the concurrent core, 1 skips it
+  size_t threads = 1;
+};
+
+std::optional<Options> ParseOptions(int argc, char* argv[]) {
+  enum { FILES = 1, SEGMENTS, REPEAT, THREADS, };
+  const struct option long_options[] = {
+      { "files",    required_argument, nullptr, FILES },
+      { "segments", required_argument, nullptr, SEGMENTS },
+      { "repeat",   required_argument, nullptr, REPEAT },
+      { "threads",  required_argument, nullptr, THREADS },
+      { nullptr,    0,                 nullptr, 0 },
+  };
+
+  Options options;
+  int option;
+  while ((option = getopt_long(argc, argv, "", long_options, nullptr)) != -1) {
+    switch (option) {
+      case FILES:    options.files = std::stoul(optarg); break;
+      case SEGMENTS: options.segments = std::stoul(optarg); break;
+      case REPEAT:   options.repeat = std::stoi(optarg); break;
+      case THREADS:  options.threads = std::stoul(optarg); break;
+      default:       return std::nullopt;
+    }
+  }
+
+  if (optind != argc) return std::nullopt;
+  return options;
+}
+
+/// PUT datagrams of all files, segments of different files are interleaved
+/// like they are when the client sends files concurrently.
+std::vector<std::vector<uint8_t>> MakeDatagrams(const Options& options) {
+  std::vector<std::vector<uint8_t>> datagrams;
+  datagrams.reserve(static_cast<size_t>(options.files) * options.segments);
+
+  for (uint32_t segment_no = 0; segment_no < options.segments; ++segment_no) {
+    for (uint32_t file_no = 0; file_no < options.files; ++file_no) {
+      std::vector<uint8_t> data(udp_server::Packet::MAX_DATA_SIZE);
+      for (size_t i = 0; i < data.size(); ++i)
+        data[i] = static_cast<uint8_t>(i * 31 + segment_no * 7 + file_no);
+
+      udp_server::base::BufferWriter writer;
+      writer.AppendInt(segment_no);
+      writer.AppendInt(options.segments);
+      writer.AppendInt(static_cast<uint8_t>(udp_server::Packet::Type::PUT));
+      writer.AppendInt(static_cast<uint64_t>(file_no));
+      writer.AppendVector(data);
+      datagrams.push_back(writer.TakeBuf());
+    }
+  }
+
+  return datagrams;
+}
+
+/// Source address as the old UDPSocket::RecvFrom produced it: bytes of
+/// sockaddr in a vector and a heap allocated clone of the bound address.
+struct VirtualAddress {
+  udp_server::net::IPv4Address bound_to;
+
+  udp_server::net::SockAddr operator()(const udp_server::net::SockAddr& from) const {
+    auto bytes = bound_to.SockAddrBytes();
+    std::copy_n(reinterpret_cast<const uint8_t*>(from.sockaddr()),
+                std::min<size_t>(bytes.size(), from.socklen()), bytes.begin());
+
+    std::unique_ptr<udp_server::net::Address> address = bound_to.Clone();
+    address->Assign(bytes);
+    return udp_server::net::SockAddr(*address);
+  }
+};
+
+/// Source address stored by value.
+struct ValueAddress {
+  const udp_server::net::SockAddr& operator()(const udp_server::net::SockAddr& from) const {
+    return from;
+  }
+};
+
+uint64_t completed_crc32_sum = 0;
+
+struct SumCrc32 {
+  void operator()(const udp_server::File& /* file */, uint32_t crc32) const {
+    completed_crc32_sum += crc32;
+  }
+};
+
+/// @param recent_files capacity of the recent files cache, 0 turns off
+/// the single segment fast path
+template <class Address, class Hasher, class Handler>
+std::chrono::duration<double> RunOnce(const std::vector<std::vector<uint8_t>>& datagrams,
+                                      Handler handler, size_t recent_files) {
+  using Clock = std::chrono::steady_clock;
+
+  udp_server::BasicServerCore<udp_server::FileStorage, Hasher, Handler> core;
+  core.OnNewFile(std::move(handler));
+  if (recent_files > 0)
+    core.UseRecentFiles(recent_files);
+
+  const Address address{};
+  const auto from = udp_server::net::SockAddr(udp_server::net::IPv4Address(4242));
+  std::vector<uint8_t> reply(udp_server::Packet::MAX_SIZE);
+  uint64_t replies = 0;
+
+  const auto start = Clock::now();
+  for (const auto& datagram : datagrams)
+    replies += core.HandleDatagram(address(from), datagram.data(), datagram.size(), reply.data()) > 0;
+  const auto elapsed = Clock::now() - start;
+
+  if (replies != datagrams.size())
+    std::cerr << "Only " << replies << " of " << datagrams.size() << " datagrams are ACKed" << std::endl;
+
+  return elapsed;
+}
+
+/// Datagrams are dealt to the threads round-robin, so segments of every
+/// file are added by all of them.
+std::chrono::duration<double> RunConcurrentOnce(const std::vector<std::vector<uint8_t>>& datagrams,
+                                                size_t threads) {
+  using Clock = std::chrono::steady_clock;
+  using Core = udp_server::BasicServerCore<udp_server::FileStorage, udp_server::Crc32Hasher, SumCrc32>;
+
+  Core core;
+  core.UseConcurrentInsert(1);
+  const auto from = udp_server::net::SockAddr(udp_server::net::IPv4Address(4242));
+  std::atomic<uint64_t> replies = 0;
+
+  const auto start = Clock::now();
+  std::vector<std::thread> workers;
+  for (size_t thread_no = 0; thread_no < threads; ++thread_no) {
+    workers.emplace_back([&, thread_no] {
+      Core::Worker worker;
+      std::vector<uint8_t> reply(udp_server::Packet::MAX_SIZE);
+      uint64_t thread_replies = 0;
+      for (auto idx = thread_no; idx < datagrams.size(); idx += threads) {
+        const auto& datagram = datagrams[idx];
+        thread_replies += core.HandleDatagramConcurrently(&worker, from, datagram.data(), datagram.size(),
+                                                          reply.data()) > 0;
+      }
+      replies += thread_replies;
+    });
+  }
+  for (auto& worker : workers)
+    worker.join();
+  const auto elapsed = Clock::now() - start;
+
+  if (replies != datagrams.size())
+    std::cerr << "Only " << replies << " of " << datagrams.size() << " datagrams are ACKed" << std::endl;
+
+  return elapsed;
+}
+
+/// @return best time of the runs
+template <class Address, class Hasher, class Handler>
+double Measure(const char* name, const std::vector<std::vector<uint8_t>>& datagrams,
+               const Options& options, double baseline, size_t recent_files = 0) {
+  std::chrono::duration<double> best = std::chrono::duration<double>::max();
+  for (int run = 0; run < options.repeat; ++run) {
+    best = std::min(best, RunOnce<Address, Hasher, Handler>(datagrams, Handler(SumCrc32()),
+                                                            recent_files));
+  }
+
+  std::cout << name << ": " << best.count() * 1000 << "ms, "
+            << datagrams.size() / best.count() << " datagrams/s";
+  if (options.segments == 1)
+    std::cout << " (files/s)";
+  if (baseline > 0)
+    std::cout << ", x" << baseline / best.count();
+  std::cout << std::endl;
+
+  return best.count();
+}
+
+int main(int argc, char* argv[]) {
+  using namespace udp_server;
+  using FunctionHandler = std::function<void(const File& file, uint32_t crc32)>;
+
+  const auto options = ParseOptions(argc, argv);
+  if (!options || options->files == 0 || options->segments == 0) {
+    const std::filesystem::path this_executable_path(argv[0]);
+    std::cerr << "Usage: " << this_executable_path.filename().string()
+              << " [--files N] [--segments N] [--repeat N] [--threads N]" << std::endl;
+    return 1;
+  }
+
+  const auto datagrams = MakeDatagrams(*options);
+  std::cout << options->files << " files of " << options->segments << " segments, best of "
+            << options->repeat << " runs" << std::endl;
+
+  const auto baseline = Measure<VirtualAddress, BitwiseCrc32Hasher, FunctionHandler>(
+      "virtual address, bitwise crc, std::function", datagrams, *options, 0);
+  Measure<ValueAddress, BitwiseCrc32Hasher, FunctionHandler>(
+      "value address,   bitwise crc, std::function", datagrams, *options, baseline);
+  Measure<ValueAddress, Crc32Hasher, FunctionHandler>(
+      "value address,   table crc,   std::function", datagrams, *options, baseline);
+  Measure<ValueAddress, Crc32Hasher, SumCrc32>(
+      "value address,   table crc,   functor      ", datagrams, *options, baseline);
+  if (options->segments == 1) {
+    Measure<ValueAddress, Crc32Hasher, SumCrc32>(
+        "single segment fast path                   ", datagrams, *options, baseline, options->files);
+  }
+
+  if (options->threads > 1) {
+    for (size_t threads = 1; threads <= options->threads; threads *= 2) {
+      std::chrono::duration<double> best = std::chrono::duration<double>::max();
+      for (int run = 0; run < options->repeat; ++run)
+        best = std::min(best, RunConcurrentOnce(datagrams, threads));
+
+      std::cout << "concurrent core, " << threads << " threads: " << best.count() * 1000 << "ms, "
+                << datagrams.size() / best.count() << " datagrams/s, x" << baseline / best.count()
+                << std::endl;
+    }
+  }
+
+  // Keeps handlers from being optimized out
+  std::cout << "crc32 checksum == " << completed_crc32_sum << std::endl;
+  return 0;
+}
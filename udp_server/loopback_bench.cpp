@@ -0,0 +1,303 @@
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <getopt.h>
+#include <iostream>
+#include <optional>
+#include <poll.h>
+#include <thread>
+#include <vector>
+
+#include "udp_server/packet.h"
+#include "udp_server/server.h"
+#include "udp_server/shm_transport.h"
+#include "udp_server/net/ipv4_address.h"
+#include "udp_server/net/sock_addr.h"
+#include "udp_server/net/udp_socket.h"
+#include "udp_server/shm/local_client.h"
+
+/**
+ * Uploads files to a server on the same host over UDP on loopback and over
+ * the shared memory transport and compares their throughput and the round
+ * trip time of a segment. The server is the same apart from the transport.
+ */
+
+struct Options {
+  int port = 9996;
+  std::filesystem::path local_path = "/tmp/udp_loopback_bench.sock";
+  uint32_t files = 64;
+  uint32_t segments = 256;
+  /// Segments sent but not acknowledged yet
+  uint32_t window = 256;
+  /// Round trips of the latency test
+  uint32_t round_trips = 20000;
+};
+
+std::optional<Options> ParseOptions(int argc, char* argv[]) {
+  enum { PORT = 1, LOCAL, FILES, SEGMENTS, WINDOW, ROUND_TRIPS, };
+  const struct option long_options[] = {
+      { "port",        required_argument, nullptr, PORT },
+      { "local",       required_argument, nullptr, LOCAL },
+      { "files",       required_argument, nullptr, FILES },
+      { "segments",    required_argument, nullptr, SEGMENTS },
+      { "window",      required_argument, nullptr, WINDOW },
+      { "round-trips", required_argument, nullptr, ROUND_TRIPS },
+      { nullptr,       0,                 nullptr, 0 },
+  };
+
+  Options options;
+  int option;
+  while ((option = getopt_long(argc, argv, "", long_options, nullptr)) != -1) {
+    switch (option) {
+      case PORT:        options.port = std::stoi(optarg); break;
+      case LOCAL:       options.local_path = optarg; break;
+      case FILES:       options.files = std::stoul(optarg); break;
+      case SEGMENTS:    options.segments = std::stoul(optarg); break;
+      case WINDOW:      options.window = std::stoul(optarg); break;
+      case ROUND_TRIPS: options.round_trips = std::stoul(optarg); break;
+      default:          return std::nullopt;
+    }
+  }
+
+  if (optind != argc) return std::nullopt;
+  return options;
+}
+
+struct CountCompleted {
+  uint64_t* completed = nullptr;
+
+  void operator()(const udp_server::File& /* file */, uint32_t /* crc32 */) const { ++*completed; }
+};
+
+template <class Transport>
+using BenchServer = udp_server::BasicServer<Transport, udp_server::FileStorage,
+                                            udp_server::Crc32Hasher, CountCompleted>;
+
+/// Client side of the UDP transport.
+class UDPClient {
+public:
+  explicit UDPClient(int port)
+      : socket_(),
+        server_(udp_server::net::IPv4Address({ 127, 0, 0, 1 }, port)) {}
+
+  /// Binds to an ephemeral port, UDPSocket receives only when bound.
+  bool Open() { return socket_.Bind(std::make_unique<udp_server::net::IPv4Address>(0)); }
+
+  bool Send(const uint8_t* data, size_t size) {
+    return socket_.SendTo(server_, data, size, 0) == static_cast<ssize_t>(size);
+  }
+
+  ssize_t Receive(uint8_t* buf, size_t len, std::chrono::milliseconds timeout) {
+    const auto bytes_received = socket_.Recv(buf, len, MSG_DONTWAIT);
+    if (bytes_received >= 0) return bytes_received;
+
+    pollfd fds = { .fd = socket_.fd(), .events = POLLIN, .revents = 0 };
+    if (poll(&fds, 1, static_cast<int>(timeout.count())) <= 0) return 0;
+    return socket_.Recv(buf, len, MSG_DONTWAIT);
+  }
+private:
+  udp_server::net::UDPSocket socket_;
+  const udp_server::net::SockAddr server_;
+};
+
+std::vector<uint8_t> MakePut(uint64_t file_id, uint32_t seq_number, uint32_t seq_total) {
+  std::vector<uint8_t> datagram(udp_server::Packet::HEADER_SIZE + udp_server::Packet::MAX_DATA_SIZE);
+  const udp_server::Packet::Header header = {
+      .seq_number = seq_number,
+      .seq_total = seq_total,
+      .type = udp_server::Packet::Type::PUT,
+      .file_id = file_id,
+  };
+  udp_server::Packet::WriteHeader(header, datagram.data());
+  for (size_t i = udp_server::Packet::HEADER_SIZE; i < datagram.size(); ++i)
+    datagram[i] = static_cast<uint8_t>(i * 31 + seq_number * 7 + file_id);
+  return datagram;
+}
+
+/// Uploads the files with a window of segments in flight, segments which
+/// aren't acknowledged within a timeout are sent again.
+/// @return time of the upload or nullopt if the server stopped answering
+template <class Client>
+std::optional<std::chrono::duration<double>> MeasureThroughput(Client* client, const Options& options,
+                                                               uint64_t first_file_id) {
+  using Clock = std::chrono::steady_clock;
+  const auto timeout = std::chrono::milliseconds(100);
+  const int max_timeouts = 50;
+
+  std::vector<std::vector<uint8_t>> datagrams;
+  for (uint32_t segment_no = 0; segment_no < options.segments; ++segment_no) {
+    for (uint32_t file_no = 0; file_no < options.files; ++file_no)
+      datagrams.push_back(MakePut(first_file_id + file_no, segment_no, options.segments));
+  }
+
+  std::vector<bool> acked(datagrams.size());
+  std::vector<uint8_t> reply(udp_server::Packet::MAX_SIZE);
+  size_t next = 0;
+  size_t acked_count = 0;
+  uint32_t in_flight = 0;
+  int timeouts = 0;
+
+  const auto start = Clock::now();
+  while (acked_count < datagrams.size()) {
+    while (in_flight < options.window && next < datagrams.size()) {
+      if (!acked[next]) {
+        // Full ring or socket buffer, let the server catch up
+        if (!client->Send(datagrams[next].data(), datagrams[next].size())) break;
+        ++in_flight;
+      }
+      ++next;
+    }
+
+    const auto reply_size = client->Receive(reply.data(), reply.size(), timeout);
+    if (reply_size < 0) return std::nullopt;
+    if (reply_size == 0) {
+      if (++timeouts == max_timeouts) return std::nullopt;
+      // Go back to the first segment which is still missing
+      in_flight = 0;
+      next = static_cast<size_t>(std::find(acked.begin(), acked.end(), false) - acked.begin());
+      continue;
+    }
+
+    const auto header = udp_server::Packet::PeekHeader(reply.data(), reply_size);
+    if (!header || header->type != udp_server::Packet::Type::ACK ||
+        header->file_id < first_file_id || header->file_id >= first_file_id + options.files ||
+        header->seq_number >= options.segments) {
+      continue;
+    }
+
+    const auto idx = size_t{header->seq_number} * options.files + (header->file_id - first_file_id);
+    if (!acked[idx]) {
+      acked[idx] = true;
+      ++acked_count;
+      if (in_flight > 0) --in_flight;
+    }
+  }
+
+  return Clock::now() - start;
+}
+
+/// Sends segments of one file one by one and waits for each ACK.
+/// @return round trip times, empty if the server stopped answering
+template <class Client>
+std::vector<double> MeasureLatency(Client* client, const Options& options, uint64_t file_id) {
+  using Clock = std::chrono::steady_clock;
+
+  std::vector<double> round_trips;
+  std::vector<uint8_t> reply(udp_server::Packet::MAX_SIZE);
+  for (uint32_t seq_number = 0; seq_number < options.round_trips; ++seq_number) {
+    const auto datagram = MakePut(file_id, seq_number, options.round_trips);
+    const auto start = Clock::now();
+    if (!client->Send(datagram.data(), datagram.size())) return {};
+
+    // Late replies of the throughput test may still come
+    std::optional<udp_server::Packet::Header> header;
+    while (!header || header->file_id != file_id || header->seq_number != seq_number) {
+      const auto reply_size = client->Receive(reply.data(), reply.size(), std::chrono::milliseconds(1000));
+      if (reply_size <= 0) return {};
+      header = udp_server::Packet::PeekHeader(reply.data(), reply_size);
+    }
+
+    round_trips.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+  }
+
+  return round_trips;
+}
+
+template <class Client>
+void Compare(const char* name, Client* client, const Options& options) {
+  const auto elapsed = MeasureThroughput(client, options, 1);
+  if (!elapsed) {
+    std::cout << name << ": server doesn't answer" << std::endl;
+    return;
+  }
+
+  const auto segments = static_cast<double>(options.files) * options.segments;
+  const auto bytes = segments * (udp_server::Packet::HEADER_SIZE + udp_server::Packet::MAX_DATA_SIZE);
+  std::cout << name << ": " << elapsed->count() * 1000 << "ms, "
+            << segments / elapsed->count() << " datagrams/s, "
+            << bytes / elapsed->count() / (1 << 20) << " MiB/s";
+
+  auto round_trips = MeasureLatency(client, options, options.files + 1);
+  if (round_trips.empty()) {
+    std::cout << ", server doesn't answer" << std::endl;
+    return;
+  }
+  std::sort(round_trips.begin(), round_trips.end());
+  std::cout << ", round trip median == " << round_trips[round_trips.size() / 2]
+            << "us, p99 == " << round_trips[round_trips.size() * 99 / 100] << "us" << std::endl;
+}
+
+/// Runs the server in a thread while the benchmark uses it.
+template <class Transport, class Benchmark>
+void WithServer(BenchServer<Transport>& server, Benchmark benchmark) {
+  uint64_t completed = 0;
+  server.core().OnNewFile(CountCompleted{ .completed = &completed });
+
+  std::thread thread([&server] { server.Run(); });
+  benchmark();
+  server.Stop();
+  server.transport().Shutdown();
+  thread.join();
+}
+
+int main(int argc, char* argv[]) {
+  using namespace udp_server;
+
+  const auto options = ParseOptions(argc, argv);
+  if (!options || options->files == 0 || options->segments == 0 || options->window == 0 ||
+      options->round_trips == 0) {
+    const std::filesystem::path this_executable_path(argv[0]);
+    std::cerr << "Usage: " << this_executable_path.filename().string()
+              << " [--port N] [--local PATH] [--files N] [--segments N] [--window N]"
+                 " [--round-trips N]" << std::endl;
+    return 1;
+  }
+
+  std::cout << options->files << " files of " << options->segments << " segments, window of "
+            << options->window << " segments, " << options->round_trips << " round trips" << std::endl;
+
+  {
+    net::UDPSocket socket;
+    if (!socket.Bind(std::make_unique<net::IPv4Address>(options->port))) {
+      std::cerr << "Can't bind socket to port #" << options->port << std::endl;
+      return 1;
+    }
+    BenchServer<UDPTransport> server(std::move(socket));
+    WithServer(server, [&] {
+      UDPClient client(options->port);
+      if (!client.Open()) {
+        std::cerr << "Can't bind client socket" << std::endl;
+        return;
+      }
+      Compare("UDP on loopback", &client, *options);
+    });
+  }
+
+  {
+    net::UDPSocket socket;
+    if (!socket.Bind(std::make_unique<net::IPv4Address>(options->port + 1))) {
+      std::cerr << "Can't bind socket to port #" << options->port + 1 << std::endl;
+      return 1;
+    }
+    BenchServer<ShmTransport> server(std::move(socket), options->local_path, ShmTransport::Options{});
+    if (!server.transport().Open()) {
+      std::cerr << "Can't listen for local clients on " << options->local_path << std::endl;
+      return 1;
+    }
+    WithServer(server, [&] {
+      auto client = shm::LocalClient::Connect(options->local_path);
+      if (!client) {
+        std::cerr << "Can't connect to " << options->local_path << std::endl;
+        return;
+      }
+      Compare("shared memory  ", &*client, *options);
+    });
+
+    const auto stats = server.transport().stats();
+    std::cout << "Shared memory: server sleeps == " << stats.sleeps
+              << ", client wakeups == " << stats.client_wakeups
+              << ", dropped replies == " << stats.dropped << std::endl;
+  }
+
+  return 0;
+}
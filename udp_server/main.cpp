@@ -1,16 +1,67 @@
+#include <atomic>
 #include <csignal>
 #include <filesystem>
+#include <getopt.h>
 #include <iostream>
+#include <netdb.h>
+#include <optional>
+#include <string>
+#include <vector>
 
 #include "udp_server/net/ipv4_address.h"
 #include "udp_server/net/udp_socket.h"
+#include "udp_server/output_directory.h"
 #include "udp_server/server.h"
+#include "udp_server/shm_transport.h"
 
 
+/// Handlers are known at compile time, so the server calls them directly.
+/// @{
+struct PrintNewFile {
+  udp_server::OutputDirectory* output = nullptr;
+  udp_server::shm::Channel* channel = nullptr;
+
+  void operator()(const udp_server::File& file, uint32_t crc32) const {
+    if (output)
+      output->Close(file);
+    if (channel && !channel->Publish(file, crc32))
+      std::cerr << "File with id == " << file.id() << " is not in shared memory or has holes" << std::endl;
+    std::cout << "Got new file with id == " << file.id()
+              << " and crc32 == " << crc32 << std::endl;
+  }
+};
+
+struct WriteContiguousData {
+  udp_server::OutputDirectory* output = nullptr;
+
+  /// Server doesn't track contiguous data without output
+  explicit operator bool() const { return output != nullptr; }
+
+  void operator()(const udp_server::File& file, uint64_t offset,
+                  std::span<const uint8_t> data) const {
+    if (!output->Write(file, offset, data))
+      std::cerr << "Can't write file with id == " << file.id() << std::endl;
+  }
+};
+/// @}
+
+template <class Transport>
+using PrintingServer = udp_server::BasicServer<Transport, udp_server::FileStorage,
+                                               udp_server::Crc32Hasher, PrintNewFile,
+                                               WriteContiguousData>;
+
+/// Server of either transport which the signal handler stops
+template <class Transport>
+std::atomic<PrintingServer<Transport>*> running_server = nullptr;
+
 void HandleIntSignal(int signal) {
-  if (signal == SIGTERM)
+  if (signal == SIGTERM) {
     std::cout << "Exiting..." << std::endl;
-  else
+    if (auto* server = running_server<udp_server::UDPTransport>.load())
+      server->Stop();
+    if (auto* server = running_server<udp_server::ShmTransport>.load())
+      server->Stop();
+  } else
     std::cerr << "Unexpected signal #" << signal << std::endl;
 }
 
@@ -28,31 +79,500 @@ bool SetupSignals() {
   return success;
 }
 
-int RunServer(int port) {
+struct Options {
+  int port = 0;
+
+  std::filesystem::path index_path;
+  size_t index_capacity = 0;
+
+  std::filesystem::path journal_path;
+  std::filesystem::path capture_path;
+  std::filesystem::path output_path;
+
+  std::optional<udp_server::BusyPoller::Options> busy_poll;
+  udp_server::ReceiveMonitor::Options receive_monitor;
+  std::optional<udp_server::AdmissionControl::Options> admission;
+  std::optional<udp_server::OverloadShedding::Options> overload;
+
+  std::vector<udp_server::net::SockAddr> relay_to;
+  udp_server::Relay::Options relay;
+
+  std::filesystem::path publish_path;
+  udp_server::shm::Channel::Options publish;
+
+  size_t workers = 1;
+  uint32_t concurrent_segments = 4096;
+
+  bool delta = false;
+  size_t delta_capacity = udp_server::DeltaIndex::DEFAULT_CAPACITY;
+
+  size_t recent_files = 65536;
+
+  uint32_t max_segments = 1 << 22;
+
+  bool segment_checksums = false;
+
+  std::filesystem::path local_path;
+  udp_server::ShmTransport::Options local;
+};
+
+void PrintUsage(const char* argv0) {
+  const std::filesystem::path this_executable_path(argv0);
+  std::cerr << "Usage: " << this_executable_path.filename().string() << " [OPTIONS] PORT\n"
+            << "Options:\n"
+            << "  --index-capacity N   remember content of last N received files\n"
+            << "  --index PATH         persist remembered content in the file\n"
+            << "  --journal DIR        persist partially received files in the directory\n"
+            << "  --capture PATH       record received datagrams for udp_replay\n"
+            << "  --output DIR         write files into the directory while receiving them\n"
+            << "  --max-segments N     reject files of more than N segments (4194304)\n"
+            << "  --busy-poll          spin on non-blocking receive\n"
+            << "  --busy-poll-usec N   SO_BUSY_POLL value for busy poll mode\n"
+            << "  --cpu N              pin receive thread to the core in busy poll mode\n"
+            << "  --fifo-priority N    use SCHED_FIFO with the priority in busy poll mode\n"
+            << "  --idle-timeout-us N  block after N microseconds without datagrams\n"
+            << "  --max-rcvbuf N       grow socket receive buffer up to N bytes on drops,\n"
+            << "                       0 only counts drops\n"
+            << "  --client-rate N      limit each client to N bytes per second\n"
+            << "  --client-burst N     allow each client bursts up to N bytes\n"
+            << "  --global-rate N      limit all clients together to N bytes per second\n"
+            << "  --global-burst N     allow all clients bursts up to N bytes\n"
+            << "  --overload-queue N   shed new files and files far from complete while\n"
+            << "                       more than N bytes are queued, 0 ignores the queue\n"
+            << "  --overload-memory N  or while received segments of incomplete files take\n"
+            << "                       more than N bytes, 0 ignores memory\n"
+            << "  --near-complete F    files with that part of segments are never shed (0.9)\n"
+            << "  --overload-idle N    drop files without segments for N seconds during\n"
+            << "                       overload (30), 0 keeps them, never with --relay\n"
+            << "  --relay HOST:PORT    forward received segments to the server, repeatable\n"
+            << "  --relay-window N     segments in flight to each downstream server\n"
+            << "  --relay-wait         send final ACK after downstream servers have the file\n"
+            << "  --publish PATH       publish complete files in shared memory to consumers\n"
+            << "                       which connect to the Unix socket\n"
+            << "  --publish-size N     size of shared memory for files being received\n"
+            << "  --delta              keep block signatures of received files, so clients\n"
+            << "                       can upload new versions of them as deltas\n"
+            << "  --delta-capacity N   keep signatures of last N files with --delta (1024)\n"
+            << "  --recent-files N     complete single segment files right from the datagram\n"
+            << "                       and remember last N of them for retransmissions,\n"
+            << "                       0 keeps them in the storage like other files\n"
+            << "  --segment-crc        verify segments against crc32c announced by clients\n"
+            << "                       and NACK corrupted ones\n"
+            << "  --local PATH         serve clients on this host over shared memory rings,\n"
+            << "                       they connect to the Unix socket\n"
+            << "  --local-ring N       frames in each ring of a local client\n"
+            << "  --workers N          receive with N threads\n"
+            << "  --concurrent-segments N\n"
+            << "                       files of at least N segments are received by all\n"
+            << "                       workers at once, 0 keeps each file on one thread\n"
+            << std::flush;
+}
+
+/// Resolves "host:port" into an IPv4 address.
+std::optional<udp_server::net::SockAddr> ResolveAddress(const std::string& host_port) {
+  const auto colon = host_port.rfind(':');
+  if (colon == std::string::npos) return std::nullopt;
+
+  const auto host = host_port.substr(0, colon);
+  const auto port = host_port.substr(colon + 1);
+  addrinfo hints = {};
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_DGRAM;
+
+  addrinfo* result = nullptr;
+  if (getaddrinfo(host.c_str(), port.c_str(), &hints, &result) != 0 || !result)
+    return std::nullopt;
+
+  const udp_server::net::SockAddr address(result->ai_addr, result->ai_addrlen);
+  freeaddrinfo(result);
+  return address;
+}
+
+udp_server::BusyPoller::Options& BusyPollOptions(Options* options) {
+  if (!options->busy_poll) options->busy_poll.emplace();
+  return *options->busy_poll;
+}
+
+udp_server::AdmissionControl::Options& AdmissionOptions(Options* options) {
+  if (!options->admission) options->admission.emplace();
+  return *options->admission;
+}
+
+udp_server::OverloadShedding::Options& OverloadOptions(Options* options) {
+  if (!options->overload) options->overload.emplace();
+  return *options->overload;
+}
+
+std::optional<Options> ParseOptions(int argc, char* argv[]) {
+  enum {
+    INDEX = 1, INDEX_CAPACITY, JOURNAL, CAPTURE, OUTPUT, MAX_SEGMENTS,
+    BUSY_POLL, BUSY_POLL_USEC, CPU, FIFO_PRIORITY, IDLE_TIMEOUT_US, MAX_RCVBUF,
+    CLIENT_RATE, CLIENT_BURST, GLOBAL_RATE, GLOBAL_BURST,
+    OVERLOAD_QUEUE, OVERLOAD_MEMORY, NEAR_COMPLETE, OVERLOAD_IDLE,
+    RELAY, RELAY_WINDOW, RELAY_WAIT, PUBLISH, PUBLISH_SIZE,
+    WORKERS, CONCURRENT_SEGMENTS, DELTA, DELTA_CAPACITY, RECENT_FILES, SEGMENT_CRC,
+    LOCAL, LOCAL_RING,
+  };
+  const struct option long_options[] = {
+      { "index",           required_argument, nullptr, INDEX },
+      { "index-capacity",  required_argument, nullptr, INDEX_CAPACITY },
+      { "journal",         required_argument, nullptr, JOURNAL },
+      { "capture",         required_argument, nullptr, CAPTURE },
+      { "output",          required_argument, nullptr, OUTPUT },
+      { "max-segments",    required_argument, nullptr, MAX_SEGMENTS },
+      { "busy-poll",       no_argument,       nullptr, BUSY_POLL },
+      { "busy-poll-usec",  required_argument, nullptr, BUSY_POLL_USEC },
+      { "cpu",             required_argument, nullptr, CPU },
+      { "fifo-priority",   required_argument, nullptr, FIFO_PRIORITY },
+      { "idle-timeout-us", required_argument, nullptr, IDLE_TIMEOUT_US },
+      { "max-rcvbuf",      required_argument, nullptr, MAX_RCVBUF },
+      { "client-rate",     required_argument, nullptr, CLIENT_RATE },
+      { "client-burst",    required_argument, nullptr, CLIENT_BURST },
+      { "global-rate",     required_argument, nullptr, GLOBAL_RATE },
+      { "global-burst",    required_argument, nullptr, GLOBAL_BURST },
+      { "overload-queue",  required_argument, nullptr, OVERLOAD_QUEUE },
+      { "overload-memory", required_argument, nullptr, OVERLOAD_MEMORY },
+      { "near-complete",   required_argument, nullptr, NEAR_COMPLETE },
+      { "overload-idle",   required_argument, nullptr, OVERLOAD_IDLE },
+      { "relay",           required_argument, nullptr, RELAY },
+      { "relay-window",    required_argument, nullptr, RELAY_WINDOW },
+      { "relay-wait",      no_argument,       nullptr, RELAY_WAIT },
+      { "publish",         required_argument, nullptr, PUBLISH },
+      { "publish-size",    required_argument, nullptr, PUBLISH_SIZE },
+      { "delta",           no_argument,       nullptr, DELTA },
+      { "delta-capacity",  required_argument, nullptr, DELTA_CAPACITY },
+      { "recent-files",    required_argument, nullptr, RECENT_FILES },
+      { "segment-crc",     no_argument,       nullptr, SEGMENT_CRC },
+      { "local",           required_argument, nullptr, LOCAL },
+      { "local-ring",      required_argument, nullptr, LOCAL_RING },
+      { "workers",         required_argument, nullptr, WORKERS },
+      { "concurrent-segments", required_argument, nullptr, CONCURRENT_SEGMENTS },
+      { nullptr,           0,                 nullptr, 0 },
+  };
+
+  Options options;
+  int option;
+  while ((option = getopt_long(argc, argv, "", long_options, nullptr)) != -1) {
+    switch (option) {
+      case INDEX:          options.index_path = optarg; break;
+      case INDEX_CAPACITY: options.index_capacity = std::stoul(optarg); break;
+      case JOURNAL:        options.journal_path = optarg; break;
+      case CAPTURE:        options.capture_path = optarg; break;
+      case OUTPUT:         options.output_path = optarg; break;
+      case MAX_SEGMENTS:   options.max_segments = std::stoul(optarg); break;
+      case BUSY_POLL:      BusyPollOptions(&options); break;
+      case BUSY_POLL_USEC: BusyPollOptions(&options).busy_poll_usec = std::stoi(optarg); break;
+      case CPU:            BusyPollOptions(&options).cpu = std::stoi(optarg); break;
+      case FIFO_PRIORITY:  BusyPollOptions(&options).fifo_priority = std::stoi(optarg); break;
+      case IDLE_TIMEOUT_US:
+        BusyPollOptions(&options).idle_timeout = std::chrono::microseconds(std::stol(optarg));
+        break;
+      case MAX_RCVBUF:     options.receive_monitor.max_buffer_bytes = std::stoi(optarg); break;
+      case CLIENT_RATE:    AdmissionOptions(&options).client_rate = std::stod(optarg); break;
+      case CLIENT_BURST:   AdmissionOptions(&options).client_burst = std::stod(optarg); break;
+      case GLOBAL_RATE:    AdmissionOptions(&options).global_rate = std::stod(optarg); break;
+      case GLOBAL_BURST:   AdmissionOptions(&options).global_burst = std::stod(optarg); break;
+      case OVERLOAD_QUEUE: OverloadOptions(&options).max_queued_bytes = std::stoull(optarg); break;
+      case OVERLOAD_MEMORY: OverloadOptions(&options).max_memory_bytes = std::stoull(optarg); break;
+      case NEAR_COMPLETE:  OverloadOptions(&options).near_complete = std::stod(optarg); break;
+      case OVERLOAD_IDLE:
+        OverloadOptions(&options).idle_timeout = std::chrono::seconds(std::stoul(optarg));
+        break;
+      case RELAY: {
+        const auto address = ResolveAddress(optarg);
+        if (!address) {
+          std::cerr << "Can't resolve " << optarg << std::endl;
+          return std::nullopt;
+        }
+        options.relay_to.push_back(*address);
+        break;
+      }
+      case RELAY_WINDOW:   options.relay.window = std::stoul(optarg); break;
+      case RELAY_WAIT:     options.relay.wait_for_downstream = true; break;
+      case PUBLISH:        options.publish_path = optarg; break;
+      case PUBLISH_SIZE:   options.publish.arena_size = std::stoull(optarg); break;
+      case DELTA:          options.delta = true; break;
+      case DELTA_CAPACITY: options.delta_capacity = std::stoul(optarg); break;
+      case RECENT_FILES:   options.recent_files = std::stoul(optarg); break;
+      case SEGMENT_CRC:    options.segment_checksums = true; break;
+      case LOCAL:          options.local_path = optarg; break;
+      case LOCAL_RING:     options.local.ring_capacity = std::stoul(optarg); break;
+      case WORKERS:        options.workers = std::stoul(optarg); break;
+      case CONCURRENT_SEGMENTS: options.concurrent_segments = std::stoul(optarg); break;
+      default:             return std::nullopt;
+    }
+  }
+
+  if (optind + 1 != argc) return std::nullopt;
+  options.port = std::stoi(argv[optind]);
+
+  // Published files leave the storage, while journal, relay and deltas refer to them
+  if (!options.publish_path.empty() &&
+      (!options.journal_path.empty() || !options.relay_to.empty() || options.delta)) {
+    std::cerr << "--publish can't be used with --journal, --relay or --delta" << std::endl;
+    return std::nullopt;
+  }
+  // Workers share the socket and the files
+  if (options.workers > 1 &&
+      (options.busy_poll || !options.capture_path.empty() || !options.publish_path.empty())) {
+    std::cerr << "--workers can't be used with --busy-poll, --capture or --publish" << std::endl;
+    return std::nullopt;
+  }
+
+  // Shared memory transport sleeps on the socket and the rings together,
+  // and capture records only IPv4 addresses, local clients have none
+  if (!options.local_path.empty() && (options.busy_poll || !options.capture_path.empty())) {
+    std::cerr << "--local can't be used with --busy-poll or --capture" << std::endl;
+    return std::nullopt;
+  }
+
+  return options;
+}
+
+void PrintTransportStats(const udp_server::UDPTransport& transport) {
+  using std::chrono::duration_cast;
+  using std::chrono::milliseconds;
+
+  if (const auto* busy_poller = transport.busy_poller()) {
+    const auto& stats = busy_poller->stats();
+    std::cout << "Busy poll: spin time == " << duration_cast<milliseconds>(stats.spin_time).count()
+              << "ms, sleep time == " << duration_cast<milliseconds>(stats.sleep_time).count()
+              << "ms, empty polls == " << stats.empty_polls
+              << ", received spinning == " << stats.received_spinning
+              << ", received after sleep == " << stats.received_after_sleep
+              << ", sleeps == " << stats.sleeps << std::endl;
+  }
+
+  if (const auto* receive_monitor = transport.receive_monitor()) {
+    const auto& stats = receive_monitor->stats();
+    std::cout << "Receive queue: kernel drops == " << stats.drops
+              << ", drop events == " << stats.drop_events
+              << ", max queued bytes == " << stats.max_queued_bytes
+              << ", bursts == " << stats.bursts
+              << ", buffer bytes == " << stats.buffer_bytes
+              << ", buffer grows == " << stats.buffer_grows << std::endl;
+  }
+}
+
+void PrintTransportStats(const udp_server::ShmTransport& transport) {
+  const auto stats = transport.stats();
+  std::cout << "Local clients: clients == " << stats.clients
+            << ", received == " << stats.received
+            << ", sent == " << stats.sent
+            << ", dropped == " << stats.dropped
+            << ", sleeps == " << stats.sleeps
+            << ", client wakeups == " << stats.client_wakeups << std::endl;
+}
+
+template <class Transport>
+void PrintStats(const PrintingServer<Transport>& server) {
+  PrintTransportStats(server.transport());
+
+  if (const auto* admission_control = server.core().admission_control()) {
+    const auto stats = admission_control->stats();
+    std::cout << "Admission: admitted == " << stats.admitted
+              << ", dropped by client limit == " << stats.dropped_by_client_limit
+              << ", dropped by global limit == " << stats.dropped_by_global_limit
+              << ", clients == " << stats.clients << std::endl;
+  }
+
+  if (const auto* overload_shedding = server.core().overload_shedding()) {
+    const auto& stats = overload_shedding->stats();
+    std::cout << "Overload: overloads == " << stats.overloads
+              << ", rejected new files == " << stats.rejected_new_files
+              << ", near complete hits == " << stats.near_complete_hits
+              << ", dropped segments == " << stats.dropped_segments
+              << ", dropped idle files == " << stats.dropped_idle_files
+              << ", max queued bytes == " << stats.max_queued_bytes
+              << ", max memory bytes == " << stats.max_memory_bytes << std::endl;
+  }
+
+  if (const auto* relay = server.core().relay()) {
+    const auto stats = relay->stats();
+    std::cout << "Relay: forwarded == " << stats.forwarded
+              << ", sent == " << stats.sent
+              << ", retransmitted == " << stats.retransmitted
+              << ", acked == " << stats.acked
+              << ", confirmed files == " << stats.confirmed_files
+              << ", crc32 mismatches == " << stats.crc32_mismatches
+              << ", abandoned downstreams == " << stats.abandoned_downstreams
+              << ", abandoned segments == " << stats.abandoned_segments << std::endl;
+  }
+
+  if (const auto* recent_files = server.core().recent_files()) {
+    const auto& stats = recent_files->stats();
+    std::cout << "Single segment files: completed == " << stats.files
+              << ", duplicates == " << stats.duplicates
+              << ", evicted == " << stats.evicted << std::endl;
+  }
+
+  if (const auto& packed = server.core().packed_stats(); packed.datagrams > 0) {
+    std::cout << "Packed PUT: datagrams == " << packed.datagrams
+              << ", records == " << packed.records << std::endl;
+  }
+
+  if (const auto* segment_checksums = server.core().segment_checksums()) {
+    const auto& stats = segment_checksums->stats();
+    std::cout << "Segment checksums: announced files == " << stats.announced_files
+              << ", verified segments == " << stats.verified_segments
+              << ", corrupted segments == " << stats.corrupted_segments
+              << ", verify requests == " << stats.verify_requests
+              << ", rejected files == " << stats.rejected_files << std::endl;
+  }
+
+  if (const auto* delta_index = server.core().delta_index()) {
+    const auto& stats = delta_index->stats();
+    std::cout << "Delta: signature requests == " << stats.signature_requests
+              << ", copied segments == " << stats.copied_segments
+              << ", copied bytes == " << stats.copied_bytes
+              << ", verified files == " << stats.verified_files
+              << ", crc32 mismatches == " << stats.crc32_mismatches << std::endl;
+  }
+
+  if (const auto* channel = server.core().storage().channel()) {
+    const auto stats = channel->stats();
+    std::cout << "Shared memory: published == " << stats.published
+              << ", reclaimed == " << stats.reclaimed
+              << ", allocation failures == " << stats.allocation_failures
+              << ", not contiguous == " << stats.not_contiguous
+              << ", pending == " << stats.pending
+              << ", consumers == " << stats.consumers
+              << ", arena used == " << stats.arena_used << std::endl;
+  }
+}
+
+void SetupTransport(udp_server::UDPTransport* transport, const Options& options) {
+  if (options.busy_poll && !transport->UseBusyPoll(*options.busy_poll))
+    std::cerr << "Busy polling is not enabled in the kernel, spinning anyway" << std::endl;
+  if (!transport->UseReceiveMonitor(options.receive_monitor))
+    std::cerr << "Kernel doesn't report dropped datagrams" << std::endl;
+}
+
+void SetupTransport(udp_server::ShmTransport* /* transport */, const Options& /* options */) {}
+
+template <class Transport>
+int ServeFiles(PrintingServer<Transport>& server, const Options& options) {
   using namespace udp_server;
 
-  net::UDPSocket socket;
-  const auto success = socket.Bind(std::make_unique<net::IPv4Address>(port));
-  if (success) {
-    Server server(std::move(socket));
+  if (options.index_capacity > 0) {
+    auto index = std::make_unique<ContentIndex>(options.index_path, options.index_capacity);
+    if (!index->Load()) {
+      std::cerr << "Can't open content index " << options.index_path << std::endl;
+      return 1;
+    }
+    std::cout << "Content index contains " << index->size() << " files" << std::endl;
+    server.core().UseContentIndex(std::move(index));
+  }
+
+  if (!options.journal_path.empty()) {
+    auto journal = std::make_unique<Journal>(options.journal_path);
+    if (!journal->Open()) {
+      std::cerr << "Can't open journal " << options.journal_path << std::endl;
+      return 1;
+    }
+    const auto restored = server.core().storage().UseJournal(std::move(journal));
+    std::cout << "Restored " << restored << " files from the journal" << std::endl;
+  }
+
+  if (options.delta)
+    server.core().UseDeltaIndex(std::make_unique<DeltaIndex>(options.delta_capacity));
+  server.core().LimitSegments(options.max_segments);
+  if (options.segment_checksums) {
+    server.core().UseSegmentChecksums(std::make_unique<SegmentChecksums>(
+        SegmentChecksums::Options{ .max_segments = options.max_segments }));
+  }
+  // Published files have to be received into the channel's arena
+  if (options.recent_files > 0 && options.publish_path.empty())
+    server.core().UseRecentFiles(options.recent_files);
+
+  if (!options.capture_path.empty()) {
+    auto capture = std::make_unique<CaptureWriter>(options.capture_path);
+    if (!capture->Open()) {
+      std::cerr << "Can't open capture " << options.capture_path << std::endl;
+      return 1;
+    }
+    server.UseCapture(std::move(capture));
+  }
 
-    server.OnNewFile([](const File& file, uint32_t crc32) {
-      std::cout << "Got new file with id == " << file.id()
-                << " and crc32 == " << crc32 << std::endl;
+  if (!options.publish_path.empty()) {
+    auto channel = std::make_unique<shm::Channel>(options.publish_path, options.publish);
+    if (!channel->Open()) {
+      std::cerr << "Can't open shared memory channel " << options.publish_path << std::endl;
+      return 1;
+    }
+    server.core().storage().UseSharedMemory(std::move(channel));
+  }
+
+  std::optional<OutputDirectory> output;
+  if (!options.output_path.empty()) {
+    output.emplace(options.output_path);
+    if (!output->Open()) {
+      std::cerr << "Can't open output directory " << options.output_path << std::endl;
+      return 1;
+    }
+    server.core().OnContiguousData(WriteContiguousData{ .output = &*output });
+    server.core().OnDroppedFile([&output = *output](const File& file) { output.Discard(file); });
+  }
+  server.core().OnNewFile(PrintNewFile{
+      .output = output ? &*output : nullptr,
+      .channel = server.core().storage().channel(),
+  });
+
+  if (options.admission)
+    server.core().UseAdmissionControl(*options.admission);
+  if (options.overload) {
+    server.core().UseOverloadShedding(*options.overload, [&transport = server.transport()] {
+      return transport.QueuedBytes();
     });
+  }
+  if (!options.relay_to.empty()) {
+    auto relay = std::make_unique<Relay>(options.relay_to, options.relay);
+    if (!relay->Start()) {
+      std::cerr << "Can't start relay" << std::endl;
+      return 1;
+    }
+    server.core().UseRelay(std::move(relay));
+  }
+  SetupTransport(&server.transport(), options);
+  if (options.workers > 1) {
+    server.UseWorkers(options.workers);
+    server.core().UseConcurrentInsert(options.concurrent_segments);
+  }
+
+  running_server<Transport> = &server;
+  server.Run();
+  running_server<Transport> = nullptr;
+
+  PrintStats(server);
+  return 0;
+}
+
+int RunServer(const Options& options) {
+  using namespace udp_server;
+
+  net::UDPSocket socket;
+  if (!socket.Bind(std::make_unique<net::IPv4Address>(options.port))) {
+    std::cerr << "Can't bind socket to port #" << options.port << std::endl;
+    return 1;
+  }
+
+  if (options.local_path.empty()) {
+    PrintingServer<UDPTransport> server(std::move(socket));
+    return ServeFiles(server, options);
+  }
 
-    server.Run();
-    return 0;
-  } else {
-    std::cerr << "Can't bind socket to port #" << port << std::endl;
+  PrintingServer<ShmTransport> server(std::move(socket), options.local_path, options.local);
+  if (!server.transport().Open()) {
+    std::cerr << "Can't listen for local clients on " << options.local_path << std::endl;
     return 1;
   }
+  return ServeFiles(server, options);
 }
 
-int main(int argc, const char* argv[]) {
-  if (argc != 2) {
-    const std::filesystem::path this_executable_path(argv[0]);
-    std::cerr << "Usage: " << this_executable_path.filename().string() << " PORT" << std::endl;
+int main(int argc, char* argv[]) {
+  const auto options = ParseOptions(argc, argv);
+  if (!options) {
+    PrintUsage(argv[0]);
     return 1;
   }
 
@@ -60,9 +580,8 @@ int main(int argc, const char* argv[]) {
     return 1;
   }
 
-  const auto port = std::stoi(argv[1]);
-  std::cout << "Running server on port #" << port << std::endl;
-  const auto exit_code = RunServer(port);
+  std::cout << "Running server on port #" << options->port << std::endl;
+  const auto exit_code = RunServer(*options);
   std::cout << "Done!" << std::endl << "Exit code == " << exit_code << std::endl;
 
   return exit_code;
@@ -0,0 +1,88 @@
+#include <chrono>
+#include <filesystem>
+#include <getopt.h>
+#include <iostream>
+#include <optional>
+
+#include "udp_server/capture.h"
+#include "udp_server/server_core.h"
+
+
+struct Options {
+  std::filesystem::path capture_path;
+  int repeat = 1;
+};
+
+std::optional<Options> ParseOptions(int argc, char* argv[]) {
+  enum { REPEAT = 1, };
+  const struct option long_options[] = {
+      { "repeat", required_argument, nullptr, REPEAT },
+      { nullptr,  0,                 nullptr, 0 },
+  };
+
+  Options options;
+  int option;
+  while ((option = getopt_long(argc, argv, "", long_options, nullptr)) != -1) {
+    switch (option) {
+      case REPEAT: options.repeat = std::stoi(optarg); break;
+      default:     return std::nullopt;
+    }
+  }
+
+  if (optind + 1 != argc) return std::nullopt;
+  options.capture_path = argv[optind];
+
+  return options;
+}
+
+using ReplayCore = udp_server::BasicServerCore<udp_server::FileStorage, udp_server::Crc32Hasher,
+                                               udp_server::NoCompletionHandler>;
+
+/// Feeds all datagrams of the capture into a fresh core as fast as possible.
+void ReplayOnce(udp_server::CaptureReader* capture, int run) {
+  using Clock = std::chrono::steady_clock;
+
+  ReplayCore core;
+  uint64_t datagrams = 0;
+  uint64_t bytes = 0;
+  uint64_t replies = 0;
+  std::vector<uint8_t> reply(udp_server::Packet::MAX_SIZE);
+
+  capture->Rewind();
+  const auto start = Clock::now();
+  while (const auto record = capture->Next()) {
+    const auto reply_size = core.HandleDatagram(record->from, record->data.data(), record->data.size(),
+                                                reply.data());
+    ++datagrams;
+    bytes += record->data.size();
+    replies += reply_size > 0;
+  }
+  const std::chrono::duration<double> elapsed = Clock::now() - start;
+
+  std::cout << "Run #" << run << ": " << datagrams << " datagrams, "
+            << replies << " replies, " << core.completed_files() << " files in "
+            << elapsed.count() * 1000 << "ms, "
+            << datagrams / elapsed.count() << " datagrams/s, "
+            << bytes / elapsed.count() / (1 << 20) << " MiB/s" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+  const auto options = ParseOptions(argc, argv);
+  if (!options) {
+    const std::filesystem::path this_executable_path(argv[0]);
+    std::cerr << "Usage: " << this_executable_path.filename().string()
+              << " [--repeat N] CAPTURE" << std::endl;
+    return 1;
+  }
+
+  auto capture = udp_server::CaptureReader::Open(options->capture_path);
+  if (!capture) {
+    std::cerr << "Can't open capture " << options->capture_path << std::endl;
+    return 1;
+  }
+
+  for (int run = 1; run <= options->repeat; ++run)
+    ReplayOnce(&*capture, run);
+
+  return 0;
+}
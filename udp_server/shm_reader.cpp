@@ -0,0 +1,56 @@
+#include <chrono>
+#include <csignal>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+
+#include "udp_server/base/crc32.h"
+#include "udp_server/shm/consumer.h"
+
+namespace {
+
+volatile std::sig_atomic_t stop = 0;
+
+void OnSignal(int) {
+  stop = 1;
+}
+
+} // namespace
+
+/// Example consumer of the shared memory channel: checks crc32 of every
+/// published file right in the server's memory and releases it.
+int main(int argc, char* argv[]) {
+  if (argc != 2) {
+    const std::filesystem::path this_executable_path(argv[0]);
+    std::cerr << "Usage: " << this_executable_path.filename().string() << " SOCKET_PATH" << std::endl;
+    return 1;
+  }
+
+  auto consumer = udp_server::shm::Consumer::Connect(argv[1]);
+  if (!consumer) return 1;
+
+  std::signal(SIGINT, OnSignal);
+  std::signal(SIGTERM, OnSignal);
+
+  uint64_t files = 0;
+  uint64_t bytes = 0;
+  uint64_t crc32_mismatches = 0;
+  while (!stop && consumer->connected()) {
+    const auto file = consumer->Next(std::chrono::milliseconds(100));
+    if (!file) continue;
+
+    const auto crc32 = udp_server::base::Crc32(0, file->data);
+    ++files;
+    bytes += file->data.size();
+    crc32_mismatches += crc32 != file->crc32;
+    std::cout << "File " << file->file_id << ": " << file->data.size() << " bytes, crc32 "
+              << std::hex << std::setw(8) << std::setfill('0') << crc32 << std::dec
+              << (crc32 == file->crc32 ? "" : " MISMATCH") << std::endl;
+
+    consumer->Release(*file);
+  }
+
+  std::cout << files << " files, " << bytes << " bytes, "
+            << crc32_mismatches << " crc32 mismatches" << std::endl;
+  return crc32_mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,61 @@
+#include "udp_server/server_core.h"
+
+#include "udp_server/packet.h"
+#include "udp_server/net/sock_addr.h"
+
+#include <gtest/gtest.h>
+
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace udp_server {
+namespace {
+
+// Every thread sends every segment of every file, starting at a different
+// segment, so the last segment of a file is often added without the lock
+// while another thread handles the same file under it.
+TEST(ConcurrentInsertTest, EveryFileIsCompletedOnce) {
+  const uint64_t files = 64;
+  const uint32_t segments = 32;
+  const size_t threads = 4;
+
+  ServerCore core;
+  core.UseConcurrentInsert(segments);
+  std::mutex mutex;
+  std::map<uint64_t, size_t> completions;
+  core.OnNewFile([&](const File& file, uint32_t) {
+    std::lock_guard lock(mutex);
+    ++completions[file.id()];
+  });
+
+  std::vector<std::thread> workers;
+  for (size_t thread = 0; thread < threads; ++thread) {
+    workers.emplace_back([&core, thread] {
+      ServerCore::Worker worker;
+      std::vector<uint8_t> datagram(Packet::HEADER_SIZE + Packet::MAX_DATA_SIZE, 0x5a);
+      std::vector<uint8_t> reply(Packet::MAX_SIZE);
+      for (uint32_t i = 0; i < segments; ++i) {
+        for (uint64_t file_id = 1; file_id <= files; ++file_id) {
+          const auto seq_number = static_cast<uint32_t>((i + thread * segments / threads) % segments);
+          Packet::WriteHeader(Packet::Header{ .seq_number = seq_number, .seq_total = segments,
+                                              .type = Packet::Type::PUT, .file_id = file_id },
+                              datagram.data());
+          core.HandleDatagramConcurrently(&worker, net::SockAddr(), datagram.data(),
+                                          datagram.size(), reply.data());
+        }
+      }
+    });
+  }
+  for (auto& worker : workers)
+    worker.join();
+
+  EXPECT_EQ(core.completed_files(), files);
+  ASSERT_EQ(completions.size(), files);
+  for (const auto& [file_id, count] : completions)
+    EXPECT_EQ(count, 1u) << "file " << file_id;
+}
+
+} // namespace
+} // namespace udp_server
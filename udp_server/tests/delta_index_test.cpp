@@ -0,0 +1,119 @@
+#include "udp_server/delta_index.h"
+
+#include "udp_server/file.h"
+#include "udp_server/packet.h"
+#include "udp_server/base/buffer_reader.h"
+#include "udp_server/base/buffer_writer.h"
+
+#include <gtest/gtest.h>
+
+#include <utility>
+#include <vector>
+
+namespace udp_server {
+namespace {
+
+const uint64_t BASE_ID = 1;
+const uint64_t FILE_ID = 2;
+
+/// COPY packet for segment 0 of FILE_ID made of (offset, length) pieces of the base.
+Packet MakeCopy(const std::vector<std::pair<uint64_t, uint32_t>>& pieces) {
+  base::BufferWriter data;
+  data.AppendInt(BASE_ID);
+  data.AppendInt(uint32_t{0});
+  for (const auto& [offset, length] : pieces) {
+    data.AppendInt(offset);
+    data.AppendInt(length);
+  }
+  const auto payload = data.TakeBuf();
+
+  std::vector<uint8_t> datagram(Packet::HEADER_SIZE);
+  Packet::WriteHeader(Packet::Header{ .seq_number = 0, .seq_total = 1, .type = Packet::Type::COPY,
+                                      .file_id = FILE_ID },
+                      datagram.data());
+  datagram.insert(datagram.end(), payload.begin(), payload.end());
+
+  base::BufferReader reader(datagram.data(), datagram.size());
+  return Packet(&reader);
+}
+
+std::vector<uint8_t> Bytes(size_t size, uint8_t first) {
+  std::vector<uint8_t> bytes(size);
+  for (size_t i = 0; i < size; ++i)
+    bytes[i] = static_cast<uint8_t>(first + i);
+  return bytes;
+}
+
+TEST(DeltaIndexTest, CopiesPiecesAcrossSegments) {
+  File base(BASE_ID, 2);
+  const auto first = Bytes(Packet::MAX_DATA_SIZE, 0);
+  const auto second = Bytes(100, 7);
+  ASSERT_TRUE(base.AddSegment(BASE_ID, 0, first));
+  ASSERT_TRUE(base.AddSegment(BASE_ID, 1, second));
+
+  DeltaIndex index(DeltaIndex::DEFAULT_CAPACITY);
+  const auto put = index.ResolveCopy(MakeCopy({ { Packet::MAX_DATA_SIZE - 5, 10 } }), base);
+  ASSERT_TRUE(put);
+  EXPECT_EQ(put->header().type, Packet::Type::PUT);
+  EXPECT_EQ(put->header().file_id, FILE_ID);
+
+  std::vector<uint8_t> expected(first.end() - 5, first.end());
+  expected.insert(expected.end(), second.begin(), second.begin() + 5);
+  EXPECT_EQ(put->data(), expected);
+}
+
+TEST(DeltaIndexTest, RejectsPiecesOutOfTheBase) {
+  File base(BASE_ID, 2);
+  ASSERT_TRUE(base.AddSegment(BASE_ID, 0, Bytes(Packet::MAX_DATA_SIZE, 0)));
+  ASSERT_TRUE(base.AddSegment(BASE_ID, 1, Bytes(100, 0)));
+
+  DeltaIndex index(DeltaIndex::DEFAULT_CAPACITY);
+  EXPECT_FALSE(index.ResolveCopy(MakeCopy({ { Packet::MAX_DATA_SIZE + 90, 20 } }), base));
+  EXPECT_FALSE(index.ResolveCopy(MakeCopy({ { 0, Packet::MAX_DATA_SIZE + 1 } }), base));
+  EXPECT_FALSE(index.ResolveCopy(MakeCopy({}), base));
+}
+
+// A short segment which isn't the last one leaves a gap in the base,
+// a piece in the gap used to loop forever or read past the segment
+TEST(DeltaIndexTest, RejectsPiecesInGapsOfShortSegments) {
+  File base(BASE_ID, 2);
+  const auto first = Bytes(10, 0);
+  ASSERT_TRUE(base.AddSegment(BASE_ID, 0, first));
+  ASSERT_TRUE(base.AddSegment(BASE_ID, 1, Bytes(10, 0)));
+
+  DeltaIndex index(DeltaIndex::DEFAULT_CAPACITY);
+  EXPECT_FALSE(index.ResolveCopy(MakeCopy({ { 10, 5 } }), base));
+  EXPECT_FALSE(index.ResolveCopy(MakeCopy({ { 11, 5 } }), base));
+  EXPECT_FALSE(index.ResolveCopy(MakeCopy({ { 5, 10 } }), base));
+
+  const auto put = index.ResolveCopy(MakeCopy({ { 2, 8 } }), base);
+  ASSERT_TRUE(put);
+  EXPECT_EQ(put->data(), std::vector<uint8_t>(first.begin() + 2, first.end()));
+}
+
+TEST(DeltaIndexTest, EvictsLeastRecentlyUsedSignatures) {
+  std::vector<File> files;
+  for (uint64_t file_id = 1; file_id <= 3; ++file_id) {
+    files.emplace_back(file_id, 1);
+    ASSERT_TRUE(files.back().AddSegment(file_id, 0, Bytes(10, 0)));
+  }
+  const auto blocks = [](DeltaIndex* index, uint64_t file_id) {
+    const Packet::Header request = { .seq_number = 0, .seq_total = 0, .type = Packet::Type::SIGNATURES,
+                                     .file_id = file_id };
+    return index->MakeSignaturesPacket(request).header().seq_total;
+  };
+
+  DeltaIndex index(2);
+  index.Insert(files[0], 0);
+  index.Insert(files[1], 0);
+  EXPECT_EQ(blocks(&index, 1), 1u);
+  index.Insert(files[2], 0);
+
+  EXPECT_EQ(index.size(), 2u);
+  EXPECT_EQ(blocks(&index, 1), 1u);
+  EXPECT_EQ(blocks(&index, 2), 0u);
+  EXPECT_EQ(blocks(&index, 3), 1u);
+}
+
+} // namespace
+} // namespace udp_server
@@ -0,0 +1,87 @@
+#include "udp_server/journal.h"
+
+#include "udp_server/packet.h"
+#include "udp_server/server_core.h"
+#include "udp_server/net/sock_addr.h"
+
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+#include <unistd.h>
+
+namespace udp_server {
+namespace {
+
+class JournalTest : public testing::Test {
+protected:
+  void SetUp() override {
+    directory_ = std::filesystem::temp_directory_path() /
+                 ("udp_server_journal_test_" + std::to_string(getpid()));
+    std::filesystem::remove_all(directory_);
+  }
+  void TearDown() override { std::filesystem::remove_all(directory_); }
+
+  std::filesystem::path directory_;
+};
+
+TEST_F(JournalTest, RestoresReceivedSegments) {
+  Journal journal(directory_);
+  ASSERT_TRUE(journal.Open());
+  {
+    auto file = journal.Create(7, 10);
+    ASSERT_TRUE(file);
+    EXPECT_TRUE(file->AddSegment(7, 0, std::vector<uint8_t>(Packet::MAX_DATA_SIZE, 1)));
+    EXPECT_TRUE(file->AddSegment(7, 3, std::vector<uint8_t>(Packet::MAX_DATA_SIZE, 2)));
+    EXPECT_TRUE(file->AddSegment(7, 3, std::vector<uint8_t>(Packet::MAX_DATA_SIZE, 2)));
+    EXPECT_TRUE(file->AddSegment(7, 9, std::vector<uint8_t>(100, 3)));
+  }
+
+  auto files = journal.Restore();
+  ASSERT_EQ(files.size(), 1u);
+  EXPECT_EQ(files[0].id(), 7u);
+  EXPECT_EQ(files[0].size(), 3u);
+  EXPECT_TRUE(files[0].has_segment(9));
+  EXPECT_FALSE(files[0].has_segment(1));
+}
+
+TEST_F(JournalTest, RejectsFileWithCorruptedLength) {
+  Journal journal(directory_);
+  ASSERT_TRUE(journal.Open());
+  {
+    auto file = journal.Create(7, 10);
+    ASSERT_TRUE(file);
+    EXPECT_TRUE(file->AddSegment(7, 0, std::vector<uint8_t>(100, 1)));
+  }
+
+  // Lengths of segments follow 32 bytes of metadata
+  std::fstream stream(directory_ / "7.session", std::ios::in | std::ios::out | std::ios::binary);
+  ASSERT_TRUE(stream);
+  stream.seekp(32);
+  const uint16_t length = 0xffff;
+  stream.write(reinterpret_cast<const char*>(&length), sizeof(length));
+  stream.close();
+
+  EXPECT_TRUE(journal.Restore().empty());
+}
+
+// One packet used to map memory (or a journal file) for 2^32 segments
+TEST(MaxSegmentsTest, HugeFileIsRejectedBeforeCreated) {
+  ServerCore core;
+  core.LimitSegments(1000);
+
+  std::vector<uint8_t> datagram(Packet::HEADER_SIZE + 10);
+  for (const uint32_t seq_total : { 0xfffffff0u, 1000u }) {
+    Packet::WriteHeader(Packet::Header{ .seq_number = 0, .seq_total = seq_total,
+                                        .type = Packet::Type::PUT, .file_id = seq_total },
+                        datagram.data());
+    const auto reply = core.HandleDatagram(net::SockAddr(), datagram.data(), datagram.size());
+    EXPECT_EQ(reply.has_value(), seq_total == 1000u);
+    EXPECT_EQ(core.storage().Find(seq_total) != nullptr, seq_total == 1000u);
+  }
+}
+
+} // namespace
+} // namespace udp_server
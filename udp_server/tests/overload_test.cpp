@@ -0,0 +1,66 @@
+#include "udp_server/server_core.h"
+
+#include "udp_server/packet.h"
+#include "udp_server/net/sock_addr.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace udp_server {
+namespace {
+
+std::optional<Packet::Type> Put(ServerCore* core, uint64_t file_id, uint32_t seq_number, uint32_t seq_total) {
+  std::vector<uint8_t> datagram(Packet::HEADER_SIZE + Packet::MAX_DATA_SIZE, 0x5a);
+  Packet::WriteHeader(Packet::Header{ .seq_number = seq_number, .seq_total = seq_total,
+                                      .type = Packet::Type::PUT, .file_id = file_id },
+                      datagram.data());
+
+  const auto reply = core->HandleDatagram(net::SockAddr(), datagram.data(), datagram.size());
+  if (!reply) return std::nullopt;
+  return reply->header().type;
+}
+
+// Memory is what the file has received, not what a huge seq_total reserves
+TEST(OverloadTest, AbandonedHugeFileDoesNotOverload) {
+  ServerCore core;
+  OverloadShedding::Options options;
+  options.max_queued_bytes = 0;
+  options.max_memory_bytes = 1 << 20;
+  core.UseOverloadShedding(options, {});
+
+  EXPECT_EQ(Put(&core, 1, 0, 800000), Packet::Type::ACK);
+  EXPECT_EQ(Put(&core, 2, 0, 2), Packet::Type::ACK);
+  EXPECT_FALSE(core.overload_shedding()->overloaded());
+}
+
+TEST(OverloadTest, IdleFilesAreDroppedDuringOverload) {
+  ServerCore core;
+  OverloadShedding::Options options;
+  options.max_queued_bytes = 0;
+  options.max_memory_bytes = 4 * Packet::MAX_DATA_SIZE;
+  options.sample_every = 1;
+  options.idle_timeout = std::chrono::milliseconds(1);
+  core.UseOverloadShedding(options, {});
+  std::vector<uint64_t> dropped;
+  core.OnDroppedFile([&dropped](const File& file) { dropped.push_back(file.id()); });
+
+  for (uint32_t seq_number = 0; seq_number < 8; ++seq_number)
+    EXPECT_EQ(Put(&core, 1, seq_number, 100), Packet::Type::ACK);
+  EXPECT_EQ(Put(&core, 2, 0, 2), Packet::Type::BUSY);
+  EXPECT_TRUE(core.overload_shedding()->overloaded());
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  EXPECT_EQ(Put(&core, 3, 0, 2), Packet::Type::ACK);
+  EXPECT_FALSE(core.overload_shedding()->overloaded());
+  EXPECT_EQ(core.storage().Find(1), nullptr);
+  EXPECT_EQ(core.storage().receiving_bytes(), Packet::MAX_DATA_SIZE);
+  EXPECT_EQ(core.overload_shedding()->stats().dropped_idle_files, 1u);
+  EXPECT_EQ(dropped, std::vector<uint64_t>{ 1 });
+}
+
+} // namespace
+} // namespace udp_server
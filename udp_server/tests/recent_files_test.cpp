@@ -0,0 +1,44 @@
+#include "udp_server/server_core.h"
+
+#include "udp_server/packet.h"
+#include "udp_server/net/sock_addr.h"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+namespace udp_server {
+namespace {
+
+size_t PutSingleSegment(ServerCore* core, uint64_t file_id, std::vector<uint8_t>* reply) {
+  std::vector<uint8_t> datagram(Packet::HEADER_SIZE + 100, static_cast<uint8_t>(file_id));
+  Packet::WriteHeader(Packet::Header{ .seq_number = 0, .seq_total = 1,
+                                      .type = Packet::Type::PUT, .file_id = file_id },
+                      datagram.data());
+  ServerCore::Worker worker;
+  return core->HandleDatagramConcurrently(&worker, net::SockAddr(), datagram.data(), datagram.size(),
+                                          reply->data());
+}
+
+// A retransmission after the file was pushed out of the cache used to complete it again
+TEST(RecentFilesTest, EvictedFileIsNotCompletedAgain) {
+  ServerCore core;
+  core.UseRecentFiles(1);
+  size_t completions = 0;
+  core.OnNewFile([&completions](const File&, uint32_t) { ++completions; });
+
+  std::vector<uint8_t> reply(Packet::MAX_SIZE);
+  const auto first_ack_size = PutSingleSegment(&core, 1, &reply);
+  const std::vector<uint8_t> first_ack(reply.begin(), reply.begin() + first_ack_size);
+  ASSERT_GT(first_ack_size, Packet::HEADER_SIZE);
+  ASSERT_GT(PutSingleSegment(&core, 2, &reply), Packet::HEADER_SIZE);
+  EXPECT_EQ(core.recent_files()->stats().evicted, 1u);
+
+  const auto ack_size = PutSingleSegment(&core, 1, &reply);
+  EXPECT_EQ(std::vector<uint8_t>(reply.begin(), reply.begin() + ack_size), first_ack);
+  EXPECT_EQ(completions, 2u);
+  EXPECT_EQ(core.completed_files(), 2u);
+}
+
+} // namespace
+} // namespace udp_server
@@ -0,0 +1,46 @@
+#include "udp_server/segment_checksums.h"
+
+#include "udp_server/packet.h"
+#include "udp_server/base/buffer_reader.h"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+namespace udp_server {
+namespace {
+
+Packet MakeChecksums(uint64_t file_id, uint32_t seq_total, size_t checksums) {
+  std::vector<uint8_t> datagram(Packet::HEADER_SIZE + checksums * sizeof(uint32_t));
+  Packet::WriteHeader(Packet::Header{ .seq_number = 0, .seq_total = seq_total,
+                                      .type = Packet::Type::CHECKSUMS, .file_id = file_id },
+                      datagram.data());
+  base::BufferReader reader(datagram.data(), datagram.size());
+  return Packet(&reader);
+}
+
+// One packet used to allocate checksums of 2^32 segments and throw bad_alloc
+TEST(SegmentChecksumsTest, RejectsHugeFilesBeforeAllocating) {
+  SegmentChecksums checksums(SegmentChecksums::Options{});
+  EXPECT_FALSE(checksums.Announce(MakeChecksums(1, 0xfffffff0, 1)));
+  EXPECT_EQ(checksums.bytes(), 0u);
+  EXPECT_EQ(checksums.stats().rejected_files, 1u);
+}
+
+TEST(SegmentChecksumsTest, BudgetCountsBytes) {
+  SegmentChecksums::Options options;
+  options.max_bytes = 2 * (64 * sizeof(uint32_t) + sizeof(uint64_t));
+  SegmentChecksums checksums(options);
+
+  EXPECT_TRUE(checksums.Announce(MakeChecksums(1, 64, 1)));
+  EXPECT_TRUE(checksums.Announce(MakeChecksums(2, 64, 1)));
+  EXPECT_FALSE(checksums.Announce(MakeChecksums(3, 1, 1)));
+  EXPECT_EQ(checksums.bytes(), options.max_bytes);
+
+  checksums.Forget(1);
+  EXPECT_TRUE(checksums.Announce(MakeChecksums(3, 64, 1)));
+  EXPECT_EQ(checksums.bytes(), options.max_bytes);
+}
+
+} // namespace
+} // namespace udp_server
@@ -0,0 +1,101 @@
+#include "udp_server/admission.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <netinet/in.h>
+
+namespace udp_server {
+namespace {
+
+uint64_t ClientKey(const net::SockAddr& address) {
+  if (address.family() == AF_INET) {
+    sockaddr_in in;
+    std::memcpy(&in, address.sockaddr(), sizeof(in));
+    return static_cast<uint64_t>(in.sin_addr.s_addr) << 16 | in.sin_port;
+  }
+
+  // FNV-1a of the whole address
+  uint64_t hash = 0xcbf29ce484222325;
+  const auto* bytes = reinterpret_cast<const uint8_t*>(address.sockaddr());
+  for (socklen_t i = 0; i < address.socklen(); ++i)
+    hash = (hash ^ bytes[i]) * 0x100000001b3;
+  return hash;
+}
+
+} // namespace
+
+TokenBucket::TokenBucket(double rate, double burst, Clock::time_point now)
+            : rate_(rate),
+              burst_(std::max(burst, rate)),
+              tokens_(burst_),
+              last_refill_(now) {}
+
+void TokenBucket::Refill(Clock::time_point now) {
+  if (rate_ <= 0 || now <= last_refill_) return;
+
+  const std::chrono::duration<double> elapsed = now - last_refill_;
+  tokens_ = std::min(burst_, tokens_ + elapsed.count() * rate_);
+  last_refill_ = now;
+}
+
+AdmissionControl::AdmissionControl(const Options& options)
+                 : options_(options),
+                   stats_(),
+                   global_(options.global_rate, options.global_burst, TokenBucket::Clock::now()),
+                   overflow_(options.client_rate, options.client_burst, TokenBucket::Clock::now()),
+                   clients_() {}
+
+bool AdmissionControl::Admit(const net::SockAddr& from, size_t bytes) {
+  const auto now = TokenBucket::Clock::now();
+
+  auto& client = ClientBucket(from, now);
+  client.Refill(now);
+  if (!client.Has(bytes)) {
+    ++stats_.dropped_by_client_limit;
+    return false;
+  }
+
+  global_.Refill(now);
+  if (!global_.Has(bytes)) {
+    ++stats_.dropped_by_global_limit;
+    return false;
+  }
+
+  client.Consume(bytes);
+  global_.Consume(bytes);
+  ++stats_.admitted;
+  return true;
+}
+
+AdmissionControl::Stats AdmissionControl::stats() const {
+  auto stats = stats_;
+  stats.clients = clients_.size();
+  return stats;
+}
+
+TokenBucket& AdmissionControl::ClientBucket(const net::SockAddr& from,
+                                            TokenBucket::Clock::time_point now) {
+  if (options_.client_rate <= 0) return overflow_;
+
+  const auto key = ClientKey(from);
+  auto it = clients_.find(key);
+  if (it != clients_.end()) return it->second;
+
+  if (clients_.size() >= options_.max_clients) {
+    ForgetIdleClients(now);
+    if (clients_.size() >= options_.max_clients) return overflow_;
+  }
+
+  return clients_.emplace(key, TokenBucket(options_.client_rate, options_.client_burst, now))
+      .first->second;
+}
+
+void AdmissionControl::ForgetIdleClients(TokenBucket::Clock::time_point now) {
+  for (auto it = clients_.begin(); it != clients_.end();) {
+    it->second.Refill(now);
+    it = it->second.full() ? clients_.erase(it) : std::next(it);
+  }
+}
+
+} // namespace udp_server
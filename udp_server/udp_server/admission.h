@@ -0,0 +1,82 @@
+#ifndef UDP_SERVER_ADMISSION_H_
+#define UDP_SERVER_ADMISSION_H_
+
+#include "udp_server/net/sock_addr.h"
+
+#include <chrono>
+#include <unordered_map>
+
+namespace udp_server {
+
+/**
+ * Classic token bucket: tokens are added with constant rate up to the burst size.
+ */
+class TokenBucket {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  /// @param rate tokens per second, 0 means unlimited
+  /// @param burst maximum number of tokens in the bucket
+  TokenBucket(double rate, double burst, Clock::time_point now);
+
+  void Refill(Clock::time_point now);
+  [[nodiscard]] bool Has(double tokens) const { return rate_ <= 0 || tokens_ >= tokens; }
+  void Consume(double tokens) { tokens_ -= tokens; }
+
+  /// @return bucket has not been consumed since it was refilled up to the burst
+  [[nodiscard]] bool full() const { return tokens_ >= burst_; }
+private:
+  double rate_;
+  double burst_;
+  double tokens_;
+  Clock::time_point last_refill_;
+};
+
+/**
+ * Server-side admission control: every client address has own token bucket
+ * and all clients share the global one. Bucket tokens are bytes of datagrams.
+ */
+class AdmissionControl {
+public:
+  /// Bursts which are less than a second of rate are raised to it.
+  struct Options {
+    /// Bytes per second for each client, 0 means unlimited
+    double client_rate = 0;
+    double client_burst = 0;
+    /// Bytes per second for all clients together, 0 means unlimited
+    double global_rate = 0;
+    double global_burst = 0;
+    /// Clients over this number share one bucket
+    size_t max_clients = 65536;
+  };
+
+  struct Stats {
+    uint64_t admitted = 0;
+    uint64_t dropped_by_client_limit = 0;
+    uint64_t dropped_by_global_limit = 0;
+    size_t clients = 0;
+  };
+
+  explicit AdmissionControl(const Options& options);
+
+  /// Takes tokens for a datagram from the client's and the global bucket.
+  /// @return false if the datagram is over the limit and must be dropped
+  bool Admit(const net::SockAddr& from, size_t bytes);
+
+  [[nodiscard]] Stats stats() const;
+private:
+  TokenBucket& ClientBucket(const net::SockAddr& from, TokenBucket::Clock::time_point now);
+  /// Forgets clients with full buckets, they are no different from new clients
+  void ForgetIdleClients(TokenBucket::Clock::time_point now);
+
+  const Options options_;
+  Stats stats_;
+
+  TokenBucket global_;
+  TokenBucket overflow_;
+  std::unordered_map<uint64_t, TokenBucket> clients_;
+};
+
+} // namespace udp_server
+
+#endif // UDP_SERVER_ADMISSION_H_
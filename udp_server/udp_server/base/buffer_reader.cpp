@@ -16,6 +16,10 @@ bool BufferReader::Read1(uint8_t* v) {
   return true;
 }
 
+bool BufferReader::Read2(uint16_t* v) {
+  return Read(v);
+}
+
 bool BufferReader::Read4(uint32_t* v) {
   return Read(v);
 }
@@ -32,6 +36,13 @@ bool BufferReader::ReadToVector(std::vector<uint8_t>* vec, size_t count) {
   return true;
 }
 
+bool BufferReader::Skip(size_t count) {
+  if (!HasBytes(count))
+    return false;
+  pos_ += count;
+  return true;
+}
+
 template <typename T>
 bool BufferReader::Read(T* v) {
   return ReadNBytes(v, sizeof(*v));
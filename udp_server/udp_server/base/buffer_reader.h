@@ -21,6 +21,7 @@ public:
   /// @return false if there are not enough bytes in the buffer.
   /// @{
   [[nodiscard]] bool Read1(uint8_t* v);
+  [[nodiscard]] bool Read2(uint16_t* v);
   [[nodiscard]] bool Read4(uint32_t* v);
   [[nodiscard]] bool Read8(uint64_t* v);
   /// @}
@@ -30,6 +31,9 @@ public:
   /// @param count number of elements to read
   /// @return false if there are not enough bytes in the buffer.
   [[nodiscard]] bool ReadToVector(std::vector<uint8_t>* t, size_t count);
+  /// Moves past bytes which are used in place.
+  /// @return false if there are not enough bytes in the buffer.
+  [[nodiscard]] bool Skip(size_t count);
 
   [[nodiscard]] const uint8_t* data() const { return buf_; }
   [[nodiscard]] size_t size() const { return size_; }
@@ -0,0 +1,103 @@
+#include "udp_server/base/crc32.h"
+
+#include <array>
+#include <cstring>
+#include <endian.h>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+namespace udp_server::base {
+namespace {
+
+const uint32_t POLYNOMIAL = 0x82f63b78;
+
+/// Slicing-by-8 tables: tables[k][b] is crc of byte b followed by k zero bytes
+using Tables = std::array<std::array<uint32_t, 256>, 8>;
+
+constexpr Tables MakeTables() {
+  Tables tables{};
+  for (uint32_t byte = 0; byte < 256; ++byte) {
+    uint32_t crc = byte;
+    for (int k = 0; k < 8; k++)
+      crc = crc & 1 ? (crc >> 1) ^ POLYNOMIAL : crc >> 1;
+    tables[0][byte] = crc;
+  }
+
+  for (size_t k = 1; k < tables.size(); ++k) {
+    for (uint32_t byte = 0; byte < 256; ++byte) {
+      const auto previous = tables[k - 1][byte];
+      tables[k][byte] = (previous >> 8) ^ tables[0][previous & 0xff];
+    }
+  }
+
+  return tables;
+}
+
+constexpr Tables TABLES = MakeTables();
+
+#if defined(__x86_64__)
+/// SSE4.2 crc32 instruction calculates exactly this CRC (Castagnoli)
+__attribute__((target("sse4.2")))
+uint32_t Crc32SSE42(uint32_t crc, std::span<const uint8_t> data) {
+  uint64_t crc64 = ~crc;
+
+  const uint8_t* pos = data.data();
+  size_t size = data.size();
+  while (size >= sizeof(uint64_t)) {
+    uint64_t block;
+    std::memcpy(&block, pos, sizeof(block));
+    crc64 = _mm_crc32_u64(crc64, block);
+
+    pos += sizeof(block);
+    size -= sizeof(block);
+  }
+
+  auto crc32 = static_cast<uint32_t>(crc64);
+  while (size-- > 0)
+    crc32 = _mm_crc32_u8(crc32, *pos++);
+
+  return ~crc32;
+}
+#endif
+
+} // namespace
+
+uint32_t Crc32(uint32_t crc, std::span<const uint8_t> data) {
+#if defined(__x86_64__)
+  static const bool has_sse42 = __builtin_cpu_supports("sse4.2");
+  if (has_sse42) return Crc32SSE42(crc, data);
+#endif
+
+  crc = ~crc;
+
+  const uint8_t* pos = data.data();
+  size_t size = data.size();
+
+  // Little endian load, so the first byte of the block is in the lowest bits
+  while (size >= sizeof(uint64_t)) {
+    uint64_t block;
+    std::memcpy(&block, pos, sizeof(block));
+    block = le64toh(block) ^ crc;
+
+    crc = TABLES[7][block & 0xff] ^
+          TABLES[6][(block >> 8) & 0xff] ^
+          TABLES[5][(block >> 16) & 0xff] ^
+          TABLES[4][(block >> 24) & 0xff] ^
+          TABLES[3][(block >> 32) & 0xff] ^
+          TABLES[2][(block >> 40) & 0xff] ^
+          TABLES[1][(block >> 48) & 0xff] ^
+          TABLES[0][block >> 56];
+
+    pos += sizeof(block);
+    size -= sizeof(block);
+  }
+
+  while (size-- > 0)
+    crc = (crc >> 8) ^ TABLES[0][(crc ^ *pos++) & 0xff];
+
+  return ~crc;
+}
+
+} // namespace udp_server::base
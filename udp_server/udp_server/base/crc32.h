@@ -2,6 +2,7 @@
 #define UDP_SERVER_BASE_CRC32_H_
 
 #include <bits/stdint-uintn.h>
+#include <span>
 
 namespace udp_server::base {
 
@@ -23,6 +24,11 @@ uint32_t Crc32(Iterator begin, Iterator end) {
   return Crc32(0, begin, end);
 }
 
+/// Same CRC as above computed over contiguous memory eight bytes at a time,
+/// with the SSE4.2 instruction if the CPU has it, so crc of a whole file is
+/// Crc32 of its segments chained one by one.
+uint32_t Crc32(uint32_t crc, std::span<const uint8_t> data);
+
 } // namespace udp_server::base
 
 #endif // UDP_SERVER_BASE_CRC32_H_
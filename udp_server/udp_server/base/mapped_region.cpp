@@ -0,0 +1,95 @@
+#include "udp_server/base/mapped_region.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace udp_server::base {
+
+// static
+std::optional<MappedRegion> MappedRegion::Anonymous(size_t size) {
+  void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (data == MAP_FAILED) return std::nullopt;
+  return MappedRegion(static_cast<uint8_t*>(data), size);
+}
+
+// static
+std::optional<MappedRegion> MappedRegion::CreateFile(const std::filesystem::path& path, size_t size) {
+  const int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) return std::nullopt;
+
+  std::optional<MappedRegion> region;
+  if (ftruncate(fd, static_cast<off_t>(size)) == 0) {
+    void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data != MAP_FAILED)
+      region.emplace(MappedRegion(static_cast<uint8_t*>(data), size));
+  }
+  close(fd);
+
+  return region;
+}
+
+// static
+std::optional<MappedRegion> MappedRegion::OpenFile(const std::filesystem::path& path) {
+  const int fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+  if (fd < 0) return std::nullopt;
+
+  std::optional<MappedRegion> region;
+  struct stat file_stat = {};
+  if (fstat(fd, &file_stat) == 0 && file_stat.st_size > 0) {
+    const auto size = static_cast<size_t>(file_stat.st_size);
+    void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data != MAP_FAILED)
+      region.emplace(MappedRegion(static_cast<uint8_t*>(data), size));
+  }
+  close(fd);
+
+  return region;
+}
+
+// static
+std::optional<MappedRegion> MappedRegion::MapShared(int fd, uint64_t offset, size_t size, bool writable) {
+  const auto protection = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+  void* data = mmap(nullptr, size, protection, MAP_SHARED, fd, static_cast<off_t>(offset));
+  if (data == MAP_FAILED) return std::nullopt;
+  return MappedRegion(static_cast<uint8_t*>(data), size);
+}
+
+MappedRegion::MappedRegion()
+             : MappedRegion(nullptr, 0) {}
+
+MappedRegion::MappedRegion(uint8_t* data, size_t size)
+             : data_(data),
+               size_(size) {}
+
+MappedRegion::MappedRegion(MappedRegion&& from) noexcept
+             : data_(from.data_),
+               size_(from.size_) {
+  from.data_ = nullptr;
+  from.size_ = 0;
+}
+
+MappedRegion::~MappedRegion() {
+  Unmap();
+}
+
+MappedRegion& MappedRegion::operator=(MappedRegion&& from) noexcept {
+  if (&from != this) {
+    Unmap();
+    data_ = from.data_;
+    size_ = from.size_;
+    from.data_ = nullptr;
+    from.size_ = 0;
+  }
+
+  return *this;
+}
+
+void MappedRegion::Unmap() {
+  if (data_)
+    munmap(data_, size_);
+}
+
+} // namespace udp_server::base
@@ -0,0 +1,49 @@
+#ifndef UDP_SERVER_BASE_MAPPED_REGION_H_
+#define UDP_SERVER_BASE_MAPPED_REGION_H_
+
+#include <bits/stdint-uintn.h>
+#include <cstddef>
+#include <filesystem>
+#include <optional>
+
+namespace udp_server::base {
+
+/**
+ * Owner of a memory mapping. Memory of anonymous regions and
+ * of sparse files is committed lazily on the first write to a page.
+ */
+class MappedRegion {
+public:
+  /// Maps zero-filled private memory.
+  static std::optional<MappedRegion> Anonymous(size_t size);
+  /// Creates (or truncates) file of given size and maps it shared.
+  static std::optional<MappedRegion> CreateFile(const std::filesystem::path& path, size_t size);
+  /// Maps whole existing file shared. The file is not read.
+  static std::optional<MappedRegion> OpenFile(const std::filesystem::path& path);
+  /// Maps part of the file (e.g. memfd) shared, offset must be page aligned.
+  /// The descriptor can be closed afterwards.
+  static std::optional<MappedRegion> MapShared(int fd, uint64_t offset, size_t size, bool writable);
+
+  /// Region which maps nothing, like a moved-from one.
+  MappedRegion();
+  MappedRegion(const MappedRegion&) = delete;
+  MappedRegion(MappedRegion&& from) noexcept;
+  ~MappedRegion();
+
+  MappedRegion& operator=(const MappedRegion&) = delete;
+  MappedRegion& operator=(MappedRegion&& from) noexcept;
+
+  [[nodiscard]] uint8_t* data() const { return data_; }
+  [[nodiscard]] size_t size() const { return size_; }
+private:
+  MappedRegion(uint8_t* data, size_t size);
+
+  void Unmap();
+
+  uint8_t* data_;
+  size_t size_;
+};
+
+} // namespace udp_server::base
+
+#endif // UDP_SERVER_BASE_MAPPED_REGION_H_
@@ -0,0 +1,114 @@
+#include "udp_server/base/sha256.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace udp_server::base {
+namespace {
+
+constexpr std::array<uint32_t, 64> K = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+inline uint32_t RotR(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+} // namespace
+
+Sha256::Sha256()
+       : state_{ 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 },
+         block_(),
+         block_size_(0),
+         total_size_(0) {}
+
+void Sha256::Update(const uint8_t* data, size_t size) {
+  total_size_ += size;
+
+  if (block_size_ > 0) {
+    const auto to_copy = std::min(size, BLOCK_SIZE - block_size_);
+    std::memcpy(block_.data() + block_size_, data, to_copy);
+    block_size_ += to_copy;
+    data += to_copy;
+    size -= to_copy;
+
+    if (block_size_ < BLOCK_SIZE) return;
+    Transform(block_.data());
+    block_size_ = 0;
+  }
+
+  for (; size >= BLOCK_SIZE; data += BLOCK_SIZE, size -= BLOCK_SIZE)
+    Transform(data);
+
+  std::memcpy(block_.data(), data, size);
+  block_size_ = size;
+}
+
+Sha256::Digest Sha256::Finish() {
+  const uint64_t total_bits = total_size_ * 8;
+
+  const uint8_t padding_start = 0x80;
+  Update(&padding_start, 1);
+  const uint8_t zero = 0;
+  while (block_size_ != BLOCK_SIZE - sizeof(total_bits))
+    Update(&zero, 1);
+
+  for (int i = 7; i >= 0; --i)
+    block_[block_size_++] = static_cast<uint8_t>(total_bits >> (i * 8));
+  Transform(block_.data());
+
+  Digest digest;
+  for (size_t i = 0; i < state_.size(); ++i) {
+    digest[i * 4]     = static_cast<uint8_t>(state_[i] >> 24);
+    digest[i * 4 + 1] = static_cast<uint8_t>(state_[i] >> 16);
+    digest[i * 4 + 2] = static_cast<uint8_t>(state_[i] >> 8);
+    digest[i * 4 + 3] = static_cast<uint8_t>(state_[i]);
+  }
+
+  return digest;
+}
+
+void Sha256::Transform(const uint8_t* block) {
+  std::array<uint32_t, 64> w;
+  for (size_t i = 0; i < 16; ++i) {
+    w[i] = static_cast<uint32_t>(block[i * 4]) << 24 |
+           static_cast<uint32_t>(block[i * 4 + 1]) << 16 |
+           static_cast<uint32_t>(block[i * 4 + 2]) << 8 |
+           static_cast<uint32_t>(block[i * 4 + 3]);
+  }
+  for (size_t i = 16; i < 64; ++i) {
+    const auto s0 = RotR(w[i - 15], 7) ^ RotR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+    const auto s1 = RotR(w[i - 2], 17) ^ RotR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  auto [a, b, c, d, e, f, g, h] = state_;
+  for (size_t i = 0; i < 64; ++i) {
+    const auto s1 = RotR(e, 6) ^ RotR(e, 11) ^ RotR(e, 25);
+    const auto ch = (e & f) ^ (~e & g);
+    const auto t1 = h + s1 + ch + K[i] + w[i];
+    const auto s0 = RotR(a, 2) ^ RotR(a, 13) ^ RotR(a, 22);
+    const auto maj = (a & b) ^ (a & c) ^ (b & c);
+    const auto t2 = s0 + maj;
+
+    h = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+
+  state_[0] += a; state_[1] += b; state_[2] += c; state_[3] += d;
+  state_[4] += e; state_[5] += f; state_[6] += g; state_[7] += h;
+}
+
+} // namespace udp_server::base
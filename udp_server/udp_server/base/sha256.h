@@ -0,0 +1,37 @@
+#ifndef UDP_SERVER_BASE_SHA256_H_
+#define UDP_SERVER_BASE_SHA256_H_
+
+#include <array>
+#include <bits/stdint-uintn.h>
+#include <cstddef>
+
+namespace udp_server::base {
+
+/**
+ * Incremental SHA-256 (FIPS 180-4) used as a strong content hash.
+ */
+class Sha256 {
+public:
+  static constexpr size_t DIGEST_SIZE = 32;
+  using Digest = std::array<uint8_t, DIGEST_SIZE>;
+
+  Sha256();
+
+  void Update(const uint8_t* data, size_t size);
+  /// Finishes hashing. The object must not be updated after this call.
+  /// @return digest of all data passed to Update
+  Digest Finish();
+private:
+  static constexpr size_t BLOCK_SIZE = 64;
+
+  void Transform(const uint8_t* block);
+
+  std::array<uint32_t, 8> state_;
+  std::array<uint8_t, BLOCK_SIZE> block_;
+  size_t block_size_;
+  uint64_t total_size_;
+};
+
+} // namespace udp_server::base
+
+#endif // UDP_SERVER_BASE_SHA256_H_
@@ -5,6 +5,13 @@
 
 namespace udp_server::base {
 
+inline uint16_t HostToNet16(uint16_t x) {
+  if constexpr (std::endian::native == std::endian::little) {
+    return __builtin_bswap16(x);
+  } else
+    return x;
+}
+
 inline uint32_t HostToNet32(uint32_t x) {
   if constexpr (std::endian::native == std::endian::little) {
     return __builtin_bswap32(x);
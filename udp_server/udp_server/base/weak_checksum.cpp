@@ -0,0 +1,73 @@
+#include "udp_server/base/weak_checksum.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace udp_server::base {
+namespace {
+
+uint32_t Combine(uint32_t s1, uint32_t s2) {
+  return (s1 & 0xffff) | (s2 << 16);
+}
+
+/// Sums are kept modulo 2^32, they are cut to 16 bits only at the end.
+void Update(const uint8_t* data, size_t size, uint32_t* s1, uint32_t* s2) {
+  for (size_t i = 0; i < size; ++i) {
+    *s1 += data[i];
+    *s2 += *s1;
+  }
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx2")))
+uint32_t HorizontalSum(__m256i sums) {
+  const auto half = _mm_add_epi32(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1));
+  const auto quarter = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(1, 0, 3, 2)));
+  return _mm_cvtsi128_si32(_mm_add_epi32(quarter, _mm_shuffle_epi32(quarter, _MM_SHUFFLE(2, 3, 0, 1))));
+}
+
+/// 32 bytes at a time: every chunk adds the sum of the previous bytes 32 times
+/// to s2 and its own bytes with weights 32..1.
+__attribute__((target("avx2")))
+uint32_t WeakChecksumAVX2(std::span<const uint8_t> data) {
+  const auto zero = _mm256_setzero_si256();
+  const auto ones = _mm256_set1_epi16(1);
+  const auto weights = _mm256_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17,
+                                        16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+
+  auto s1_sums = zero;
+  auto prefix_sums = zero;
+  auto s2_sums = zero;
+
+  const auto* pos = data.data();
+  const auto chunks = data.size() / 32;
+  for (size_t chunk = 0; chunk < chunks; ++chunk, pos += 32) {
+    const auto bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pos));
+    prefix_sums = _mm256_add_epi32(prefix_sums, s1_sums);
+    s1_sums = _mm256_add_epi32(s1_sums, _mm256_sad_epu8(bytes, zero));
+    s2_sums = _mm256_add_epi32(s2_sums, _mm256_madd_epi16(_mm256_maddubs_epi16(bytes, weights), ones));
+  }
+
+  auto s1 = HorizontalSum(s1_sums);
+  auto s2 = 32 * HorizontalSum(prefix_sums) + HorizontalSum(s2_sums);
+  Update(pos, data.size() - chunks * 32, &s1, &s2);
+  return Combine(s1, s2);
+}
+#endif
+
+} // namespace
+
+uint32_t WeakChecksum(std::span<const uint8_t> data) {
+#if defined(__x86_64__)
+  static const bool has_avx2 = __builtin_cpu_supports("avx2");
+  if (has_avx2) return WeakChecksumAVX2(data);
+#endif
+
+  uint32_t s1 = 0;
+  uint32_t s2 = 0;
+  Update(data.data(), data.size(), &s1, &s2);
+  return Combine(s1, s2);
+}
+
+} // namespace udp_server::base
@@ -0,0 +1,17 @@
+#ifndef UDP_SERVER_BASE_WEAK_CHECKSUM_H_
+#define UDP_SERVER_BASE_WEAK_CHECKSUM_H_
+
+#include <bits/stdint-uintn.h>
+#include <span>
+
+namespace udp_server::base {
+
+/// rsync's rolling checksum of a block x[0..n): low 16 bits are sum of x[i],
+/// high 16 bits are sum of (n - i) * x[i]. The client rolls it over every
+/// offset of a file, so it must calculate exactly the same.
+/// Uses AVX2 when the CPU has it.
+uint32_t WeakChecksum(std::span<const uint8_t> data);
+
+} // namespace udp_server::base
+
+#endif // UDP_SERVER_BASE_WEAK_CHECKSUM_H_
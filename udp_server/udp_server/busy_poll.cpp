@@ -0,0 +1,91 @@
+#include "udp_server/busy_poll.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+
+namespace udp_server {
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+} // namespace
+
+BusyPoller::BusyPoller(const Options& options)
+           : options_(options),
+             stats_() {}
+
+bool BusyPoller::Setup(net::UDPSocket* socket) const {
+  if (options_.busy_poll_usec <= 0) return true;
+
+  const auto success = socket->SetBusyPoll(options_.busy_poll_usec);
+  if (!success)
+    std::perror("setsockopt(SO_BUSY_POLL)");
+
+  return success;
+}
+
+bool BusyPoller::SetupThread() const {
+  auto success = true;
+
+  if (options_.cpu >= 0) {
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(options_.cpu, &cpu_set);
+    const auto error = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+    if (error != 0) {
+      errno = error;
+      std::perror("pthread_setaffinity_np");
+      success = false;
+    }
+  }
+
+  if (options_.fifo_priority > 0) {
+    const sched_param param = { .sched_priority = options_.fifo_priority };
+    const auto error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (error != 0) {
+      errno = error;
+      std::perror("pthread_setschedparam(SCHED_FIFO)");
+      success = false;
+    }
+  }
+
+  return success;
+}
+
+ssize_t BusyPoller::RecvFrom(net::UDPSocket* socket, uint8_t* buf, size_t len, int flags,
+                             net::SockAddr* from, const std::atomic<bool>& stop,
+                             uint32_t* drops) {
+  const auto spin_start = Clock::now();
+  auto now = spin_start;
+
+  while (!stop.load(std::memory_order_relaxed)) {
+    const auto result = socket->RecvFrom(buf, len, flags | MSG_DONTWAIT, from, drops);
+    now = Clock::now();
+
+    if (result >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+      stats_.spin_time += now - spin_start;
+      if (result >= 0) ++stats_.received_spinning;
+      return result;
+    }
+
+    ++stats_.empty_polls;
+    if (now - spin_start >= options_.idle_timeout) break;
+  }
+  stats_.spin_time += now - spin_start;
+
+  if (stop.load(std::memory_order_relaxed))
+    return -1;
+
+  // Nothing to do for a while, so let the core sleep until the next datagram
+  ++stats_.sleeps;
+  const auto result = socket->RecvFrom(buf, len, flags, from, drops);
+  stats_.sleep_time += Clock::now() - now;
+  if (result >= 0) ++stats_.received_after_sleep;
+
+  return result;
+}
+
+} // namespace udp_server
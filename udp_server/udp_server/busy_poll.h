@@ -0,0 +1,61 @@
+#ifndef UDP_SERVER_BUSY_POLL_H_
+#define UDP_SERVER_BUSY_POLL_H_
+
+#include "udp_server/net/udp_socket.h"
+
+#include <atomic>
+#include <chrono>
+
+namespace udp_server {
+
+/**
+ * Low-latency receive: spins on non-blocking receive instead of sleeping
+ * in the kernel, and falls back to blocking receive when there were
+ * no datagrams for a while.
+ */
+class BusyPoller {
+public:
+  struct Options {
+    /// SO_BUSY_POLL value, 0 doesn't enable busy polling in the kernel
+    int busy_poll_usec = 50;
+    /// Core to pin the receive thread to, -1 doesn't pin the thread
+    int cpu = -1;
+    /// SCHED_FIFO priority of the receive thread, 0 keeps the default scheduler
+    int fifo_priority = 0;
+    /// Spin this long without datagrams before falling back to blocking receive
+    std::chrono::microseconds idle_timeout = std::chrono::milliseconds(10);
+  };
+
+  /// Time spent spinning versus sleeping, which is the CPU cost of the latency.
+  struct Stats {
+    std::chrono::nanoseconds spin_time{0};
+    std::chrono::nanoseconds sleep_time{0};
+    uint64_t empty_polls = 0;
+    uint64_t received_spinning = 0;
+    uint64_t received_after_sleep = 0;
+    uint64_t sleeps = 0;
+  };
+
+  explicit BusyPoller(const Options& options);
+
+  /// Enables busy polling on the socket.
+  bool Setup(net::UDPSocket* socket) const;
+  /// Pins the calling thread to the core and switches it to SCHED_FIFO
+  /// as specified in options.
+  bool SetupThread() const;
+
+  /// Receives datagram like UDPSocket::RecvFrom.
+  /// Returns -1 if stop became true while waiting for a datagram.
+  ssize_t RecvFrom(net::UDPSocket* socket, uint8_t* buf, size_t len, int flags,
+                   net::SockAddr* from, const std::atomic<bool>& stop,
+                   uint32_t* drops = nullptr);
+
+  [[nodiscard]] const Stats& stats() const { return stats_; }
+private:
+  const Options options_;
+  Stats stats_;
+};
+
+} // namespace udp_server
+
+#endif // UDP_SERVER_BUSY_POLL_H_
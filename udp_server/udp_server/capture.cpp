@@ -0,0 +1,112 @@
+#include "udp_server/capture.h"
+
+#include <cstring>
+#include <netinet/in.h>
+
+namespace udp_server {
+namespace {
+
+const uint64_t CAPTURE_MAGIC = 0x3130504143504455; // "UDPCAP01"
+const size_t RECORD_ALIGNMENT = 8;
+const size_t WRITE_BUFFER_SIZE = 1 << 20;
+
+struct CaptureHeader {
+  uint64_t magic;
+  uint64_t reserved;
+};
+
+struct RecordHeader {
+  int64_t timestamp_ns;
+  uint32_t address;  // network byte order
+  uint16_t port;     // network byte order
+  uint16_t size;
+};
+
+size_t Padding(size_t size) {
+  return (RECORD_ALIGNMENT - size % RECORD_ALIGNMENT) % RECORD_ALIGNMENT;
+}
+
+} // namespace
+
+CaptureWriter::CaptureWriter(std::filesystem::path path)
+              : path_(std::move(path)),
+                buffer_(WRITE_BUFFER_SIZE),
+                output_(),
+                records_(0) {}
+
+bool CaptureWriter::Open() {
+  output_.rdbuf()->pubsetbuf(buffer_.data(), static_cast<std::streamsize>(buffer_.size()));
+  output_.open(path_, std::ios::binary | std::ios::trunc);
+  if (!output_.is_open()) return false;
+
+  const CaptureHeader header = { .magic = CAPTURE_MAGIC, .reserved = 0 };
+  output_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  return output_.good();
+}
+
+void CaptureWriter::Write(const net::SockAddr& from, const uint8_t* data, size_t size) {
+  if (from.family() != AF_INET) return;
+
+  sockaddr_in address;
+  std::memcpy(&address, from.sockaddr(), sizeof(address));
+
+  const auto now = std::chrono::system_clock::now().time_since_epoch();
+  const RecordHeader header = {
+      .timestamp_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now).count(),
+      .address = address.sin_addr.s_addr,
+      .port = address.sin_port,
+      .size = static_cast<uint16_t>(size),
+  };
+  const char padding[RECORD_ALIGNMENT] = {};
+
+  output_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  output_.write(reinterpret_cast<const char*>(data), header.size);
+  output_.write(padding, static_cast<std::streamsize>(Padding(header.size)));
+  ++records_;
+}
+
+// static
+std::optional<CaptureReader> CaptureReader::Open(const std::filesystem::path& path) {
+  auto region = base::MappedRegion::OpenFile(path);
+  if (!region || region->size() < sizeof(CaptureHeader)) return std::nullopt;
+
+  CaptureHeader header;
+  std::memcpy(&header, region->data(), sizeof(header));
+  if (header.magic != CAPTURE_MAGIC) return std::nullopt;
+
+  return CaptureReader(std::move(*region));
+}
+
+CaptureReader::CaptureReader(base::MappedRegion&& region)
+              : region_(std::move(region)),
+                pos_(sizeof(CaptureHeader)) {}
+
+std::optional<CaptureReader::Record> CaptureReader::Next() {
+  if (pos_ + sizeof(RecordHeader) > region_.size()) return std::nullopt;
+
+  RecordHeader header;
+  std::memcpy(&header, region_.data() + pos_, sizeof(header));
+  const auto data_pos = pos_ + sizeof(header);
+  if (data_pos + header.size > region_.size()) return std::nullopt;
+
+  const sockaddr_in address = {
+      .sin_family = AF_INET,
+      .sin_port = header.port,
+      .sin_addr = { .s_addr = header.address },
+      .sin_zero = {},
+  };
+  const Record record = {
+      .timestamp = std::chrono::nanoseconds(header.timestamp_ns),
+      .from = net::SockAddr(reinterpret_cast<const struct sockaddr*>(&address), sizeof(address)),
+      .data = { region_.data() + data_pos, header.size },
+  };
+
+  pos_ = data_pos + header.size + Padding(header.size);
+  return record;
+}
+
+void CaptureReader::Rewind() {
+  pos_ = sizeof(CaptureHeader);
+}
+
+} // namespace udp_server
@@ -0,0 +1,65 @@
+#ifndef UDP_SERVER_CAPTURE_H_
+#define UDP_SERVER_CAPTURE_H_
+
+#include "udp_server/base/mapped_region.h"
+#include "udp_server/net/sock_addr.h"
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <span>
+#include <vector>
+
+namespace udp_server {
+
+/**
+ * Capture is a compact log of received datagrams which can be mapped
+ * into memory and replayed. It is a header followed by records. Every
+ * record is a timestamp, IPv4 address and size of the datagram followed
+ * by the datagram itself padded to 8 bytes, integers are in host byte order.
+ */
+class CaptureWriter {
+public:
+  explicit CaptureWriter(std::filesystem::path path);
+
+  /// Creates (or truncates) capture file.
+  bool Open();
+  /// Records the datagram, datagrams from other than IPv4 addresses
+  /// (e.g. local clients) are not recorded.
+  void Write(const net::SockAddr& from, const uint8_t* data, size_t size);
+
+  [[nodiscard]] uint64_t records() const { return records_; }
+private:
+  const std::filesystem::path path_;
+  std::vector<char> buffer_;
+  std::ofstream output_;
+  uint64_t records_;
+};
+
+class CaptureReader {
+public:
+  struct Record {
+    /// Time since the epoch when the datagram was received
+    std::chrono::nanoseconds timestamp;
+    net::SockAddr from;
+    std::span<const uint8_t> data;
+  };
+
+  /// Maps capture file into memory.
+  static std::optional<CaptureReader> Open(const std::filesystem::path& path);
+
+  /// @return next record or nullopt if there are no more records
+  std::optional<Record> Next();
+  /// Starts reading from the first record again.
+  void Rewind();
+private:
+  explicit CaptureReader(base::MappedRegion&& region);
+
+  base::MappedRegion region_;
+  size_t pos_;
+};
+
+} // namespace udp_server
+
+#endif // UDP_SERVER_CAPTURE_H_
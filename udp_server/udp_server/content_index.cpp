@@ -0,0 +1,143 @@
+#include "udp_server/content_index.h"
+
+#include "udp_server/base/buffer_reader.h"
+#include "udp_server/base/buffer_writer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+namespace udp_server {
+namespace {
+
+const size_t RECORD_SIZE = sizeof(uint64_t) + base::Sha256::DIGEST_SIZE + sizeof(uint32_t);
+
+std::vector<uint8_t> SerializeRecord(const ContentIndex::Key& key, uint32_t crc32) {
+  base::BufferWriter writer;
+  writer.AppendInt(key.size);
+  writer.AppendArray(key.sha256.data(), key.sha256.size());
+  writer.AppendInt(crc32);
+  return writer.TakeBuf();
+}
+
+bool ParseRecord(const uint8_t* record, ContentIndex::Key* key, uint32_t* crc32) {
+  base::BufferReader reader(record, RECORD_SIZE);
+  std::vector<uint8_t> sha256;
+
+  const auto parsed =
+      reader.Read8(&key->size) &&
+      reader.ReadToVector(&sha256, key->sha256.size()) &&
+      reader.Read4(crc32);
+  if (parsed)
+    std::copy(sha256.begin(), sha256.end(), key->sha256.begin());
+
+  return parsed;
+}
+
+} // namespace
+
+size_t ContentIndex::KeyHash::operator()(const Key& key) const {
+  // sha256 is already uniformly distributed, so a prefix of it is a good hash
+  size_t hash;
+  std::memcpy(&hash, key.sha256.data(), sizeof(hash));
+  return hash ^ key.size;
+}
+
+ContentIndex::ContentIndex(std::filesystem::path path, size_t capacity)
+             : path_(std::move(path)),
+               capacity_(std::max<size_t>(capacity, 1)),
+               entries_(),
+               index_(),
+               log_(),
+               records_in_log_(0) {}
+
+bool ContentIndex::Load() {
+  if (path_.empty()) return true;
+
+  std::ifstream input(path_, std::ios::binary);
+  std::vector<uint8_t> record(RECORD_SIZE);
+  while (input.read(reinterpret_cast<char*>(record.data()), record.size())) {
+    Key key{};
+    uint32_t crc32 = 0;
+    if (ParseRecord(record.data(), &key, &crc32)) {
+      InsertInMemory(key, crc32);
+      ++records_in_log_;
+    }
+  }
+  input.close();
+
+  if (records_in_log_ > entries_.size()) {
+    Compact();
+  } else {
+    log_.open(path_, std::ios::binary | std::ios::app);
+  }
+
+  return log_.is_open();
+}
+
+std::optional<uint32_t> ContentIndex::Find(const Key& key) {
+  const auto it = index_.find(key);
+  if (it == index_.end()) return std::nullopt;
+
+  entries_.splice(entries_.begin(), entries_, it->second);
+  return it->second->second;
+}
+
+void ContentIndex::Insert(const Key& key, uint32_t crc32) {
+  if (InsertInMemory(key, crc32))
+    Append(key, crc32);
+}
+
+bool ContentIndex::InsertInMemory(const Key& key, uint32_t crc32) {
+  const auto it = index_.find(key);
+  if (it != index_.end()) {
+    entries_.splice(entries_.begin(), entries_, it->second);
+    const auto changed = it->second->second != crc32;
+    it->second->second = crc32;
+    return changed;
+  }
+
+  entries_.emplace_front(key, crc32);
+  index_.emplace(key, entries_.begin());
+
+  if (entries_.size() > capacity_) {
+    index_.erase(entries_.back().first);
+    entries_.pop_back();
+  }
+
+  return true;
+}
+
+void ContentIndex::Append(const Key& key, uint32_t crc32) {
+  if (!log_.is_open()) return;
+
+  const auto record = SerializeRecord(key, crc32);
+  log_.write(reinterpret_cast<const char*>(record.data()), record.size());
+  log_.flush();
+
+  if (++records_in_log_ > 2 * capacity_)
+    Compact();
+}
+
+void ContentIndex::Compact() {
+  log_.close();
+
+  auto tmp_path = path_;
+  tmp_path += ".tmp";
+  {
+    std::ofstream output(tmp_path, std::ios::binary | std::ios::trunc);
+    // Least recently used entries go first, so replay restores the LRU order
+    for (auto it = entries_.rbegin(); it != entries_.rend(); ++it) {
+      const auto record = SerializeRecord(it->first, it->second);
+      output.write(reinterpret_cast<const char*>(record.data()), record.size());
+    }
+  }
+
+  std::error_code error;
+  std::filesystem::rename(tmp_path, path_, error);
+  records_in_log_ = error ? records_in_log_ : entries_.size();
+
+  log_.open(path_, std::ios::binary | std::ios::app);
+}
+
+} // namespace udp_server
@@ -0,0 +1,70 @@
+#ifndef UDP_SERVER_CONTENT_INDEX_H_
+#define UDP_SERVER_CONTENT_INDEX_H_
+
+#include "udp_server/base/sha256.h"
+
+#include <filesystem>
+#include <fstream>
+#include <list>
+#include <optional>
+#include <unordered_map>
+
+namespace udp_server {
+
+/**
+ * Bounded index of completed files addressed by their content.
+ * Maps (file size, sha256) to crc32 of the file. Least recently used
+ * entries are evicted when the index is full. The index is persisted as an
+ * append-only log which is compacted when it grows twice as large as the index.
+ */
+class ContentIndex {
+public:
+  struct Key {
+    uint64_t size;
+    base::Sha256::Digest sha256;
+
+    bool operator==(const Key& other) const = default;
+  };
+
+  /// @param path file to persist the index to, empty path keeps index in memory
+  /// @param capacity maximum number of entries
+  ContentIndex(std::filesystem::path path, size_t capacity);
+  ContentIndex(const ContentIndex&) = delete;
+
+  ContentIndex& operator=(const ContentIndex&) = delete;
+
+  /// Restores entries from the log and opens it for appending.
+  /// @return false if the log can't be opened
+  bool Load();
+
+  /// @return crc32 of the file with given content if the index contains it
+  std::optional<uint32_t> Find(const Key& key);
+  void Insert(const Key& key, uint32_t crc32);
+
+  [[nodiscard]] size_t size() const { return entries_.size(); }
+  [[nodiscard]] size_t capacity() const { return capacity_; }
+private:
+  struct KeyHash {
+    size_t operator()(const Key& key) const;
+  };
+  using Entry = std::pair<Key, uint32_t>;
+
+  /// @return true if a new entry was added
+  bool InsertInMemory(const Key& key, uint32_t crc32);
+  void Append(const Key& key, uint32_t crc32);
+  void Compact();
+
+  const std::filesystem::path path_;
+  const size_t capacity_;
+
+  /// Most recently used entries are at the front.
+  std::list<Entry> entries_;
+  std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> index_;
+
+  std::ofstream log_;
+  size_t records_in_log_;
+};
+
+} // namespace udp_server
+
+#endif // UDP_SERVER_CONTENT_INDEX_H_
@@ -0,0 +1,153 @@
+#include "udp_server/delta_index.h"
+
+#include "udp_server/base/buffer_reader.h"
+#include "udp_server/base/buffer_writer.h"
+#include "udp_server/base/sha256.h"
+#include "udp_server/base/weak_checksum.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace udp_server {
+namespace {
+
+/// weak (4 bytes) and strong (8 bytes)
+const size_t SIGNATURE_SIZE = 12;
+
+uint64_t StrongChecksum(std::span<const uint8_t> block) {
+  base::Sha256 sha256;
+  sha256.Update(block.data(), block.size());
+  const auto digest = sha256.Finish();
+
+  uint64_t strong = 0;
+  for (size_t i = 0; i < sizeof(strong); ++i)
+    strong = strong << 8 | digest[i];
+  return strong;
+}
+
+} // namespace
+
+// static
+const size_t DeltaIndex::MAX_SIGNATURES = Packet::MAX_DATA_SIZE / SIGNATURE_SIZE;
+// static
+const size_t DeltaIndex::DEFAULT_CAPACITY = 1024;
+
+// static
+std::optional<uint64_t> DeltaIndex::CopyBase(const Packet& copy) {
+  uint64_t base_id;
+  base::BufferReader reader(copy.data().data(), copy.data().size());
+  if (!reader.Read8(&base_id)) return std::nullopt;
+  return base_id;
+}
+
+DeltaIndex::DeltaIndex(size_t capacity)
+           : capacity_(std::max<size_t>(capacity, 1)),
+             signatures_(),
+             lru_(),
+             expected_crc32_(),
+             stats_() {}
+
+void DeltaIndex::Insert(const File& file, uint32_t crc32) {
+  auto signatures_it = signatures_.find(file.id());
+  if (signatures_it != signatures_.end()) {
+    lru_.splice(lru_.begin(), lru_, signatures_it->second.lru_it);
+  } else {
+    lru_.push_front(file.id());
+    signatures_it = signatures_.emplace(file.id(), Signatures{ .blocks = {}, .lru_it = lru_.begin() }).first;
+  }
+
+  auto& blocks = signatures_it->second.blocks;
+  blocks.clear();
+  blocks.reserve(file.capacity());
+  for (uint32_t block = 0; block < file.capacity(); ++block) {
+    const auto data = file.segment(block);
+    blocks.push_back(BlockSignature{
+        .weak = base::WeakChecksum(data),
+        .strong = StrongChecksum(data),
+    });
+  }
+
+  const auto expected_it = expected_crc32_.find(file.id());
+  if (expected_it != expected_crc32_.end()) {
+    if (expected_it->second == crc32) {
+      ++stats_.verified_files;
+    } else {
+      ++stats_.crc32_mismatches;
+    }
+    expected_crc32_.erase(expected_it);
+  }
+
+  if (signatures_.size() > capacity_) {
+    signatures_.erase(lru_.back());
+    lru_.pop_back();
+  }
+}
+
+void DeltaIndex::Forget(uint64_t file_id) {
+  expected_crc32_.erase(file_id);
+}
+
+Packet DeltaIndex::MakeSignaturesPacket(const Packet::Header& request) {
+  ++stats_.signature_requests;
+
+  base::BufferWriter data;
+  uint32_t blocks = 0;
+  const auto signatures_it = signatures_.find(request.file_id);
+  if (signatures_it != signatures_.end()) {
+    lru_.splice(lru_.begin(), lru_, signatures_it->second.lru_it);
+    const auto& signatures = signatures_it->second.blocks;
+    blocks = static_cast<uint32_t>(signatures.size());
+
+    const auto first = std::min<size_t>(request.seq_number, signatures.size());
+    const auto last = std::min(first + MAX_SIGNATURES, signatures.size());
+    for (auto block = first; block < last; ++block) {
+      data.AppendInt(signatures[block].weak);
+      data.AppendInt(signatures[block].strong);
+    }
+  }
+
+  return Packet::Signatures(request, blocks, data.TakeBuf());
+}
+
+std::optional<Packet> DeltaIndex::ResolveCopy(const Packet& copy, const File& base) {
+  uint64_t base_id;
+  uint32_t crc32;
+  base::BufferReader reader(copy.data().data(), copy.data().size());
+  if (!reader.Read8(&base_id) || !reader.Read4(&crc32)) return std::nullopt;
+
+  // Blocks of the base are its segments and a block starts at its
+  // seq_number * MAX_DATA_SIZE. Clients send full segments but the last,
+  // a short one in between leaves a gap which no piece may touch.
+  const auto base_size = (base.capacity() - 1) * Packet::MAX_DATA_SIZE +
+                         base.segment(base.capacity() - 1).size();
+
+  std::vector<uint8_t> segment;
+  uint64_t offset;
+  uint32_t length;
+  while (reader.Read8(&offset) && reader.Read4(&length)) {
+    if (offset > base_size || length > base_size - offset ||
+        segment.size() + length > Packet::MAX_DATA_SIZE) {
+      return std::nullopt;
+    }
+
+    while (length > 0) {
+      const auto data = base.segment(offset / Packet::MAX_DATA_SIZE);
+      const auto from = offset % Packet::MAX_DATA_SIZE;
+      if (from >= data.size()) return std::nullopt;
+      const auto count = std::min<size_t>(length, data.size() - from);
+      segment.insert(segment.end(), data.begin() + from, data.begin() + from + count);
+      offset += count;
+      length -= count;
+    }
+  }
+
+  if (segment.empty()) return std::nullopt;
+
+  ++stats_.copied_segments;
+  stats_.copied_bytes += segment.size();
+  expected_crc32_[copy.header().file_id] = crc32;
+
+  return Packet::Put(copy.header(), std::move(segment));
+}
+
+} // namespace udp_server
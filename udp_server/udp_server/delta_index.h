@@ -0,0 +1,95 @@
+#ifndef UDP_SERVER_DELTA_INDEX_H_
+#define UDP_SERVER_DELTA_INDEX_H_
+
+#include "udp_server/file.h"
+#include "udp_server/packet.h"
+
+#include <cstdint>
+#include <list>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+namespace udp_server {
+
+/**
+ * Server side of rsync-style delta uploads. Completed files are split into
+ * blocks of one segment and every block gets a signature: weak rolling
+ * checksum (base/weak_checksum.h) and the first 8 bytes of its sha256.
+ * The client asks for signatures of the previous version of a file (the
+ * base), finds its blocks at any offset of the new version and sends COPY
+ * instead of PUT for segments which are made of base data only.
+ *
+ * SIGNATURES request is the first block in seq_number and the base file in
+ * file_id, the answer has number of blocks in seq_total (0 if there is no
+ * such complete file) and (weak, strong) pairs from the first block on.
+ * COPY data is the base file id, crc32 of the whole new file and
+ * (offset in the base file, length) pieces which make the segment.
+ *
+ * Signatures of the least recently used files are evicted when there are
+ * more than `capacity` of them.
+ */
+class DeltaIndex {
+public:
+  struct BlockSignature {
+    uint32_t weak;
+    uint64_t strong;
+  };
+
+  struct Stats {
+    uint64_t signature_requests = 0;
+    uint64_t copied_segments = 0;
+    uint64_t copied_bytes = 0;
+    /// Files built by COPY whose crc32 was what the client expected
+    uint64_t verified_files = 0;
+    uint64_t crc32_mismatches = 0;
+  };
+
+  /// Signatures in one SIGNATURES answer
+  static const size_t MAX_SIGNATURES;
+  /// Files with signatures by default
+  static const size_t DEFAULT_CAPACITY;
+
+  /// @return base file of the COPY packet or nullopt if it is malformed
+  static std::optional<uint64_t> CopyBase(const Packet& copy);
+
+  /// @param capacity maximum number of files with signatures
+  explicit DeltaIndex(size_t capacity);
+  DeltaIndex(const DeltaIndex&) = delete;
+
+  DeltaIndex& operator=(const DeltaIndex&) = delete;
+
+  /// Keeps signatures of the complete file and checks the crc32 of it
+  /// if it was built by COPY.
+  void Insert(const File& file, uint32_t crc32);
+  /// Forgets the crc32 expected for a file which is dropped before it completes.
+  void Forget(uint64_t file_id);
+
+  Packet MakeSignaturesPacket(const Packet::Header& request);
+  /// @param base complete file which CopyBase has named
+  /// @return PUT packet with the segment made of base data or nullopt if
+  /// pieces are out of the base file or don't fit a segment
+  std::optional<Packet> ResolveCopy(const Packet& copy, const File& base);
+
+  [[nodiscard]] size_t size() const { return signatures_.size(); }
+  [[nodiscard]] const Stats& stats() const { return stats_; }
+private:
+  struct Signatures {
+    std::vector<BlockSignature> blocks;
+    /// Position of the file in lru_
+    std::list<uint64_t>::iterator lru_it;
+  };
+
+  const size_t capacity_;
+  /// file_id => signatures of its blocks
+  std::unordered_map<uint64_t, Signatures> signatures_;
+  /// Files with signatures, most recently used are at the front
+  std::list<uint64_t> lru_;
+  /// file_id => crc32 which the client expects for a file being built by COPY
+  std::unordered_map<uint64_t, uint32_t> expected_crc32_;
+  Stats stats_;
+};
+
+} // namespace udp_server
+
+#endif // UDP_SERVER_DELTA_INDEX_H_
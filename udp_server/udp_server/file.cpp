@@ -2,69 +2,277 @@
 
 #include "udp_server/packet.h"
 
+#include <algorithm>
+#include <cstring>
+#include <new>
+
 namespace udp_server {
+namespace {
+
+const uint64_t FILE_MAGIC = 0x32454c4946504455; // "UDPFILE2"
+const size_t PAGE_SIZE = 4096;
 
-uint8_t File::ConstIterator::operator*() const {
-  return *segment_iterator_;
+size_t BitmapWords(uint32_t number_of_segments) {
+  return (static_cast<size_t>(number_of_segments) + 63) / 64;
 }
 
-File::ConstIterator& File::ConstIterator::operator++() {
-  if (++segment_iterator_ == current_segment().end()) {
-    if (current_segment_ < file_->capacity() - 1) {
-      ++current_segment_;
-      segment_iterator_ = current_segment().begin();
-    }
-  }
+size_t AlignUp(size_t value, size_t alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+struct Metadata {
+  uint64_t magic;
+  uint64_t id;
+  uint32_t number_of_segments;
+  uint32_t segment_size;
+  /// Number of segments marked in the bitmap, so restore doesn't count them
+  uint64_t received;
+};
+
+size_t BitmapOffset(uint32_t number_of_segments) {
+  return AlignUp(sizeof(Metadata) + number_of_segments * sizeof(uint16_t), alignof(uint64_t));
+}
+
+} // namespace
 
+std::span<const uint8_t> File::SpanIterator::operator*() const {
+  const auto last_in_run = run_end_ - 1;
+  const auto size = static_cast<size_t>(last_in_run - current_segment_) * Packet::MAX_DATA_SIZE +
+                    file_->lengths_[last_in_run];
+  return { file_->data_ + current_segment_ * Packet::MAX_DATA_SIZE, size };
+}
+
+File::SpanIterator& File::SpanIterator::operator++() {
+  current_segment_ = run_end_;
+  run_end_ = FindRunEnd();
   return *this;
 }
 
-File::ConstIterator File::ConstIterator::operator++(int) {
+File::SpanIterator File::SpanIterator::operator++(int) {
   auto tmp = *this;
   ++(*this);
   return tmp;
 }
 
-bool File::ConstIterator::operator==(const ConstIterator& other) const {
-  return file_             == other.file_            &&
-         current_segment_  == other.current_segment_ &&
-         segment_iterator_ == other.segment_iterator_ ;
+bool File::SpanIterator::operator==(const SpanIterator& other) const {
+  return file_            == other.file_            &&
+         current_segment_ == other.current_segment_ ;
 }
 
-bool File::ConstIterator::operator!=(const ConstIterator& other) const {
+bool File::SpanIterator::operator!=(const SpanIterator& other) const {
   return !(*this == other);
 }
 
-const std::vector<uint8_t>& File::ConstIterator::current_segment() const {
-  return file_->segments_.at(current_segment_);
+File::SpanIterator::SpanIterator(const File* file, uint32_t segment, uint32_t last)
+     : file_(file),
+       current_segment_(segment),
+       last_segment_(last),
+       run_end_(FindRunEnd()) {}
+
+uint32_t File::SpanIterator::FindRunEnd() const {
+  if (current_segment_ >= last_segment_) return current_segment_;
+
+  auto segment = current_segment_;
+  while (segment + 1 < last_segment_ && file_->lengths_[segment] == Packet::MAX_DATA_SIZE)
+    ++segment;
+
+  return segment + 1;
 }
 
-File::ConstIterator::ConstIterator(const File* file)
-     : file_(file),
-       current_segment_(0),
-       segment_iterator_(current_segment().begin()) {}
+// static
+size_t File::RegionSize(uint32_t number_of_segments) {
+  return DataOffset(number_of_segments) +
+         static_cast<size_t>(number_of_segments) * Packet::MAX_DATA_SIZE;
+}
+
+// static
+size_t File::DataOffset(uint32_t number_of_segments) {
+  return AlignUp(BitmapOffset(number_of_segments) + BitmapWords(number_of_segments) * sizeof(uint64_t),
+                 PAGE_SIZE);
+}
+
+// static
+std::optional<File> File::Restore(base::MappedRegion&& region) {
+  if (region.size() < sizeof(Metadata)) return std::nullopt;
+
+  Metadata metadata;
+  std::memcpy(&metadata, region.data(), sizeof(metadata));
+  const auto valid =
+      metadata.magic == FILE_MAGIC &&
+      metadata.segment_size == Packet::MAX_DATA_SIZE &&
+      region.size() == RegionSize(metadata.number_of_segments) &&
+      metadata.received <= metadata.number_of_segments;
+  if (!valid) return std::nullopt;
+
+  const auto* lengths = reinterpret_cast<const uint16_t*>(region.data() + sizeof(Metadata));
+  const auto too_long = [](uint16_t length) { return length > Packet::MAX_DATA_SIZE; };
+  if (std::any_of(lengths, lengths + metadata.number_of_segments, too_long)) return std::nullopt;
+
+  return File(metadata.id, metadata.number_of_segments, std::move(region), false);
+}
 
 File::File(uint64_t id, uint32_t number_of_segments)
+     : File(id, number_of_segments, [number_of_segments] {
+         auto region = base::MappedRegion::Anonymous(RegionSize(number_of_segments));
+         if (!region) throw std::bad_alloc();
+         return std::move(*region);
+       }()) {}
+
+File::File(uint64_t id, uint32_t number_of_segments, base::MappedRegion&& region)
+     : File(id, number_of_segments, std::move(region), true) {}
+
+File::File(uint64_t id, uint32_t number_of_segments, base::MappedRegion&& region, bool initialize)
      : id_(id),
        number_of_segments_(number_of_segments),
-       segments_() {}
+       region_(std::move(region)),
+       lengths_(reinterpret_cast<uint16_t*>(region_.data() + sizeof(Metadata))),
+       bitmap_(reinterpret_cast<uint64_t*>(region_.data() + BitmapOffset(number_of_segments))),
+       data_(region_.data() + DataOffset(number_of_segments)),
+       received_(0),
+       borrowed_length_(0),
+       borrowed_bitmap_(0),
+       claimed_(),
+       contiguous_(0),
+       contiguous_bytes_(0) {
+  if (initialize) {
+    const Metadata metadata = {
+        .magic = FILE_MAGIC,
+        .id = id_,
+        .number_of_segments = number_of_segments_,
+        .segment_size = static_cast<uint32_t>(Packet::MAX_DATA_SIZE),
+        .received = 0,
+    };
+    std::memcpy(region_.data(), &metadata, sizeof(metadata));
+  } else {
+    received_ = reinterpret_cast<const Metadata*>(region_.data())->received;
+  }
+}
+
+File::File(uint64_t id, std::span<const uint8_t> segment)
+     : id_(id),
+       number_of_segments_(1),
+       region_(),
+       lengths_(&borrowed_length_),
+       bitmap_(&borrowed_bitmap_),
+       // Segment is never written, it is already received
+       data_(const_cast<uint8_t*>(segment.data())),
+       received_(1),
+       borrowed_length_(static_cast<uint16_t>(segment.size())),
+       borrowed_bitmap_(1),
+       claimed_(),
+       contiguous_(0),
+       contiguous_bytes_(0) {}
+
+File::File(File&& from) noexcept
+     : id_(from.id_),
+       number_of_segments_(from.number_of_segments_),
+       region_(std::move(from.region_)),
+       lengths_(from.lengths_),
+       bitmap_(from.bitmap_),
+       data_(from.data_),
+       received_(from.received_),
+       borrowed_length_(from.borrowed_length_),
+       borrowed_bitmap_(from.borrowed_bitmap_),
+       claimed_(std::move(from.claimed_)),
+       contiguous_(from.contiguous_),
+       contiguous_bytes_(from.contiguous_bytes_) {
+  if (lengths_ == &from.borrowed_length_) {
+    lengths_ = &borrowed_length_;
+    bitmap_ = &borrowed_bitmap_;
+  }
+}
+
+bool File::AddSegment(uint64_t file_id, uint32_t segment_no, const std::vector<uint8_t>& data) {
+  if (file_id != id_ || segment_no >= number_of_segments_ || data.size() > Packet::MAX_DATA_SIZE)
+    return false;
+  const auto bit = uint64_t{1} << (segment_no % 64);
+  if (claimed_) {
+    if (claimed_[segment_no / 64].fetch_or(bit, std::memory_order_relaxed) & bit) return true;
+  } else if (has_segment(segment_no)) {
+    return true;
+  }
+
+  // Data goes before its bit in the bitmap and the bit before the stored
+  // count, so a restored journal never contains a segment which is marked
+  // as received but was not written, and never counts more than it has.
+  std::memcpy(data_ + segment_no * Packet::MAX_DATA_SIZE, data.data(), data.size());
+  lengths_[segment_no] = static_cast<uint16_t>(data.size());
+  auto& stored_received = reinterpret_cast<Metadata*>(region_.data())->received;
+  if (claimed_) {
+    std::atomic_ref(bitmap_[segment_no / 64]).fetch_or(bit, std::memory_order_release);
+    std::atomic_ref(received_).fetch_add(1, std::memory_order_acq_rel);
+    std::atomic_ref(stored_received).fetch_add(1, std::memory_order_relaxed);
+  } else {
+    bitmap_[segment_no / 64] |= bit;
+    stored_received = ++received_;
+  }
 
-bool File::AddSegment(uint64_t file_id, uint32_t segment_no, std::vector<uint8_t>&& data) {
-  if (file_id != id_ || segment_no >= number_of_segments_) return false;
-  segments_.emplace(segment_no, data);
   return true;
 }
 
 bool File::AddSegment(Packet&& packet) {
-  return AddSegment(packet.header().file_id, packet.header().seq_number, packet.TakeData());
+  return AddSegment(packet.header().file_id, packet.header().seq_number, packet.data());
+}
+
+void File::EnableConcurrentInsert() {
+  if (claimed_) return;
+
+  const auto words = BitmapWords(number_of_segments_);
+  claimed_ = std::make_unique<std::atomic<uint64_t>[]>(words);
+  for (size_t word = 0; word < words; ++word)
+    claimed_[word].store(bitmap_[word], std::memory_order_relaxed);
+}
+
+std::span<const uint8_t> File::segment(uint32_t segment_no) const {
+  return { data_ + segment_no * Packet::MAX_DATA_SIZE, lengths_[segment_no] };
+}
+
+bool File::has_segment(uint32_t segment_no) const {
+  return bitmap_word(segment_no / 64) & (uint64_t{1} << (segment_no % 64));
+}
+
+uint32_t File::FindMissing(uint32_t from) const { return Find(from, false); }
+uint32_t File::FindReceived(uint32_t from) const { return Find(from, true); }
+
+uint32_t File::Find(uint32_t from, bool received) const {
+  if (from >= number_of_segments_) return number_of_segments_;
+
+  size_t word = from / 64;
+  auto bits = received ? bitmap_word(word) : ~bitmap_word(word);
+  bits &= ~uint64_t{0} << (from % 64);
+
+  const auto words = BitmapWords(number_of_segments_);
+  while (bits == 0 && ++word < words)
+    bits = received ? bitmap_word(word) : ~bitmap_word(word);
+
+  if (word >= words) return number_of_segments_;
+  const auto found = word * 64 + std::countr_zero(bits);
+  return found < number_of_segments_ ? static_cast<uint32_t>(found) : number_of_segments_;
+}
+
+uint64_t File::bitmap_word(size_t word) const {
+  return std::atomic_ref(bitmap_[word]).load(std::memory_order_acquire);
+}
+
+File::ContiguousData File::AdvanceContiguous() {
+  const auto first = contiguous_;
+  const auto offset = contiguous_bytes_;
+  if (first < number_of_segments_ && has_segment(first)) {
+    contiguous_ = FindMissing(first);
+    for (auto segment_no = first; segment_no < contiguous_; ++segment_no)
+      contiguous_bytes_ += lengths_[segment_no];
+  }
+
+  return { .offset = offset, .data = spans(first, contiguous_) };
+}
+
+File::SpanRange File::spans(uint32_t first, uint32_t last) const {
+  return SpanRange(SpanIterator(this, first, last), SpanIterator(this, last, last));
 }
 
-File::ConstIterator File::begin() const { return ConstIterator(this); }
-File::ConstIterator File::end() const {
-  auto iterator = begin();
-  iterator.current_segment_ = capacity() - 1;
-  iterator.segment_iterator_ = segments_.at(capacity() - 1).end();
-  return iterator;
+File::SpanIterator File::begin() const { return SpanIterator(this, 0, number_of_segments_); }
+File::SpanIterator File::end() const {
+  return SpanIterator(this, number_of_segments_, number_of_segments_);
 }
 
-} // namespace udp_server
\ No newline at end of file
+} // namespace udp_server
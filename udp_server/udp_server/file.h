@@ -1,8 +1,14 @@
 #ifndef UDP_SERVER_FILE_H_
 #define UDP_SERVER_FILE_H_
 
+#include "udp_server/base/mapped_region.h"
+
+#include <atomic>
 #include <bits/stdint-uintn.h>
-#include <unordered_map>
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <span>
 #include <vector>
 
 namespace udp_server {
@@ -10,57 +16,154 @@ namespace udp_server {
 class Packet;
 
 /**
- * In-memory file which client can send to server.
+ * File which client can send to server.
+ * Segments are stored in a memory region which is either anonymous memory
+ * or a journal file, so partially received file survives server restart.
+ *
+ * Once EnableConcurrentInsert is called, AddSegment may be called by several
+ * threads at once: a thread claims the segment in a separate bitmap, writes
+ * its data and only then marks it received, so the received bitmap and
+ * size() never show a segment which is still being written. Everything
+ * else is read-only while segments are inserted concurrently.
+ *
+ * A complete file of a single segment may also borrow the segment from the
+ * caller (e.g. the receive buffer), then nothing is allocated or copied.
  */
 class File {
 public:
-  class ConstIterator {
+  /// Iterates over data of received segments as spans. Segments are stored
+  /// next to each other, so a run of full segments is a single span.
+  class SpanIterator {
   friend class File;
   public:
-    uint8_t operator*() const;
+    std::span<const uint8_t> operator*() const;
 
-    ConstIterator& operator++();
-    ConstIterator operator++(int);
+    SpanIterator& operator++();
+    SpanIterator operator++(int);
 
-    bool operator==(const ConstIterator& other) const;
-    bool operator!=(const ConstIterator& other) const;
+    bool operator==(const SpanIterator& other) const;
+    bool operator!=(const SpanIterator& other) const;
   private:
-    explicit ConstIterator(const File* file);
+    SpanIterator(const File* file, uint32_t segment, uint32_t last);
 
-    [[nodiscard]] const std::vector<uint8_t>& current_segment() const;
+    /// @return segment after the run which starts at current segment
+    uint32_t FindRunEnd() const;
 
-    const File* const file_;
-    size_t current_segment_;
-    std::vector<uint8_t>::const_iterator segment_iterator_;
+    const File* file_;
+    uint32_t current_segment_;
+    uint32_t last_segment_;
+    uint32_t run_end_;
   };
 
+  /// Segments [first, last) of the file, all of them must be received.
+  class SpanRange {
+  friend class File;
+  public:
+    SpanIterator begin() const { return begin_; }
+    SpanIterator end() const { return end_; }
+    bool empty() const { return begin_ == end_; }
+  private:
+    SpanRange(SpanIterator begin, SpanIterator end) : begin_(begin), end_(end) {}
+
+    SpanIterator begin_;
+    SpanIterator end_;
+  };
 
-  File(uint64_t id, uint32_t number_of_segments);
+  /// Data which has joined the contiguous prefix of the file.
+  struct ContiguousData {
+    /// Offset of the data from the start of the file
+    uint64_t offset;
+    SpanRange data;
+  };
 
-  bool AddSegment(uint64_t file_id, uint32_t segment_no, std::vector<uint8_t>&& data);
+  /// @return size of the memory region which can hold file with given number of segments
+  static size_t RegionSize(uint32_t number_of_segments);
+  /// @return offset of segments data in the region, it is page aligned,
+  /// so data of a full file can be mapped on its own
+  static size_t DataOffset(uint32_t number_of_segments);
+  /// Restores file from the region which was used by a file before.
+  /// Metadata and lengths of segments are read, not the bitmap or data.
+  static std::optional<File> Restore(base::MappedRegion&& region);
+
+  /// Creates file in anonymous memory.
+  File(uint64_t id, uint32_t number_of_segments);
+  /// Creates file in the region of RegionSize(number_of_segments) bytes.
+  File(uint64_t id, uint32_t number_of_segments, base::MappedRegion&& region);
+  /// Creates complete file of the single segment which stays in the caller's
+  /// memory, the memory must outlive the file.
+  File(uint64_t id, std::span<const uint8_t> segment);
+  File(File&& from) noexcept;
+
+  bool AddSegment(uint64_t file_id, uint32_t segment_no, const std::vector<uint8_t>& data);
   bool AddSegment(Packet&& packet);
 
+  /// Makes AddSegment safe to call from several threads. The file must
+  /// not be used by other threads during the call.
+  void EnableConcurrentInsert();
+  [[nodiscard]] bool concurrent() const { return claimed_ != nullptr; }
+
   uint64_t id() const { return id_; }
 
+  /// @return data of the segment, the segment must be present in this file
+  std::span<const uint8_t> segment(uint32_t segment_no) const;
+  bool has_segment(uint32_t segment_no) const;
+
+  /// @return number of the first missing segment in [from, capacity()) or capacity()
+  uint32_t FindMissing(uint32_t from) const;
+  /// @return number of the first received segment in [from, capacity()) or capacity()
+  uint32_t FindReceived(uint32_t from) const;
+
   /// @return current number of segments in this file
-  size_t size() const { return segments_.size(); }
+  size_t size() const {
+    return std::atomic_ref(const_cast<size_t&>(received_)).load(std::memory_order_acquire);
+  }
   /// @return number of segments in full file
   size_t capacity() const { return number_of_segments_; }
   /// @return file contains all necessary segments?
   bool full() const { return size() >= capacity(); }
 
-  ConstIterator begin() const;
-  ConstIterator end() const;
+  /// @return number of segments in the prefix [0, contiguous()) which
+  /// was passed by AdvanceContiguous
+  uint32_t contiguous() const { return contiguous_; }
+  /// Extends the contiguous prefix over the segments received after the
+  /// previous call, including runs which a late segment has unblocked.
+  /// @return data by which the prefix has grown, empty if it hasn't
+  ContiguousData AdvanceContiguous();
+
+  /// Data of received segments [first, last)
+  SpanRange spans(uint32_t first, uint32_t last) const;
+  /// Data of the whole file, the file must be full
+  SpanIterator begin() const;
+  SpanIterator end() const;
 private:
+  File(uint64_t id, uint32_t number_of_segments, base::MappedRegion&& region, bool initialize);
+
+  uint32_t Find(uint32_t from, bool received) const;
+  /// Word of the received bitmap, segments which are set in it are written
+  uint64_t bitmap_word(size_t word) const;
+
   const uint64_t id_;
   const uint32_t number_of_segments_;
 
-  /// Contains data segments which addressed by its `seq_number` value.
-  /// You can reconstruct entire file if you have all segments in this map
-  /// with seq_number in [0..=number_of_segments_-1] i.e. iterate int i
-  /// from 0 to (number_of_segments_ - 1) and get each segment in segments_[i].
-  /// You could do so iff you have all segments ot the file.
-  std::unordered_map<uint32_t, std::vector<uint8_t>> segments_;
+  /// Region layout is: Metadata, length of each segment, bitmap of received
+  /// segments, segments data. Segment with seq_number i is stored at
+  /// data_ + i * Packet::MAX_DATA_SIZE, so you can reconstruct entire file
+  /// by concatenation of segments with seq_number in [0..=number_of_segments_-1]
+  /// iff you have all segments of the file.
+  base::MappedRegion region_;
+  uint16_t* lengths_;
+  uint64_t* bitmap_;
+  uint8_t* data_;
+  size_t received_;
+  /// Length and bitmap of a borrowed segment, lengths_ and bitmap_ point here
+  uint16_t borrowed_length_;
+  uint64_t borrowed_bitmap_;
+  /// Segments which some thread has started to write, only in concurrent mode
+  std::unique_ptr<std::atomic<uint64_t>[]> claimed_;
+
+  /// Prefix isn't persisted, so restored file delivers its data from the start
+  uint32_t contiguous_;
+  uint64_t contiguous_bytes_;
 };
 
 } // namespace udp_server
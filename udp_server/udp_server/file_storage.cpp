@@ -0,0 +1,108 @@
+#include "udp_server/file_storage.h"
+
+#include "udp_server/packet.h"
+
+#include <algorithm>
+
+namespace udp_server {
+
+FileStorage::FileStorage()
+            : files_(),
+              journal_(),
+              channel_(),
+              completed_(),
+              receiving_bytes_(0) {}
+
+File* FileStorage::Find(uint64_t file_id) {
+  const auto entry_it = files_.find(file_id);
+  return entry_it != files_.end() ? &entry_it->second.file : nullptr;
+}
+
+const File* FileStorage::Find(uint64_t file_id) const {
+  const auto entry_it = files_.find(file_id);
+  return entry_it != files_.end() ? &entry_it->second.file : nullptr;
+}
+
+File* FileStorage::Create(uint64_t file_id, uint32_t number_of_segments) {
+  for (const auto completed_id : completed_) {
+    files_.erase(completed_id);
+    channel_->Remove(completed_id);
+  }
+  completed_.clear();
+
+  auto file = journal_ ? journal_->Create(file_id, number_of_segments)
+                       : channel_ ? channel_->Create(file_id, number_of_segments)
+                                  : std::nullopt;
+  if (!file) {
+    auto region = base::MappedRegion::Anonymous(File::RegionSize(number_of_segments));
+    if (!region) return nullptr;
+    file.emplace(file_id, number_of_segments, std::move(*region));
+  }
+
+  auto entry = Entry{ .file = std::move(*file), .counted_segments = 0, .last_segment_at = Clock::now() };
+  return &files_.emplace(file_id, std::move(entry)).first->second.file;
+}
+
+void FileStorage::OnSegmentReceived(const File& file) {
+  const auto entry_it = files_.find(file.id());
+  if (entry_it == files_.end()) return;
+
+  entry_it->second.last_segment_at = Clock::now();
+  CountSegments(&entry_it->second);
+}
+
+void FileStorage::OnCompleted(const File& file) {
+  if (const auto entry_it = files_.find(file.id()); entry_it != files_.end()) {
+    auto& entry = entry_it->second;
+    receiving_bytes_ -= std::min(receiving_bytes_, entry.counted_segments * Packet::MAX_DATA_SIZE);
+    entry.counted_segments = 0;
+  }
+  if (journal_)
+    journal_->Remove(file.id());
+  if (channel_)
+    completed_.push_back(file.id());
+}
+
+size_t FileStorage::UseJournal(std::unique_ptr<Journal> journal) {
+  journal_ = std::move(journal);
+
+  size_t restored = 0;
+  for (auto& file : journal_->Restore()) {
+    const auto file_id = file.id();
+    auto entry = Entry{ .file = std::move(file), .counted_segments = 0, .last_segment_at = Clock::now() };
+    const auto [entry_it, inserted] = files_.emplace(file_id, std::move(entry));
+    if (inserted) {
+      CountSegments(&entry_it->second);
+      ++restored;
+    }
+  }
+
+  return restored;
+}
+
+FileStorage::Entries::iterator FileStorage::Drop(Entries::iterator entry_it) {
+  const auto& entry = entry_it->second;
+  receiving_bytes_ -= std::min(receiving_bytes_, entry.counted_segments * Packet::MAX_DATA_SIZE);
+  if (journal_)
+    journal_->Remove(entry.file.id());
+  if (channel_)
+    channel_->Remove(entry.file.id());
+  return files_.erase(entry_it);
+}
+
+void FileStorage::CountSegments(Entry* entry) {
+  // Complete files are not being received any more
+  if (entry->file.full()) return;
+
+  const auto received = entry->file.size();
+  if (received > entry->counted_segments) {
+    receiving_bytes_ += (received - entry->counted_segments) * Packet::MAX_DATA_SIZE;
+    entry->counted_segments = received;
+  }
+}
+
+void FileStorage::UseSharedMemory(std::unique_ptr<shm::Channel> channel) {
+  channel_ = std::move(channel);
+}
+
+} // namespace udp_server
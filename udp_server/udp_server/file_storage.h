@@ -0,0 +1,109 @@
+#ifndef UDP_SERVER_FILE_STORAGE_H_
+#define UDP_SERVER_FILE_STORAGE_H_
+
+#include "udp_server/file.h"
+#include "udp_server/journal.h"
+#include "udp_server/shm/channel.h"
+
+#include <chrono>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace udp_server {
+
+/**
+ * Storage policy of the server: owns files which are being received.
+ * Files live in anonymous memory, or in the journal or the shared memory
+ * channel if one is used. With the channel complete files are let go,
+ * the channel keeps them for its consumers.
+ *
+ * Storage also counts memory of received segments of incomplete files and
+ * remembers when each file has got its last segment, so idle files can be
+ * dropped.
+ */
+class FileStorage {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  FileStorage();
+
+  /// @return file with the id or nullptr if there is no such file
+  /// @{
+  File* Find(uint64_t file_id);
+  const File* Find(uint64_t file_id) const;
+  /// @}
+  /// Creates empty file, there must be no file with the same id.
+  /// @return the file or nullptr if no memory could be mapped for it
+  File* Create(uint64_t file_id, uint32_t number_of_segments);
+  /// Called after a segment of the file is received, duplicates included.
+  void OnSegmentReceived(const File& file);
+  /// Called once the file is received in full and handled.
+  void OnCompleted(const File& file);
+  /// Drops incomplete files which have got no segment since `idle_since`.
+  /// Concurrent files are never dropped.
+  /// @param on_drop called as on_drop(file) before the file is dropped
+  /// @return number of dropped files
+  template <class Function>
+  size_t DropIdle(Clock::time_point idle_since, Function&& on_drop) {
+    size_t dropped = 0;
+    for (auto entry_it = files_.begin(); entry_it != files_.end();) {
+      const auto& entry = entry_it->second;
+      if (entry.file.full() || entry.file.concurrent() || entry.last_segment_at >= idle_since) {
+        ++entry_it;
+        continue;
+      }
+
+      on_drop(entry.file);
+      entry_it = Drop(entry_it);
+      ++dropped;
+    }
+    return dropped;
+  }
+
+  /// Keeps partially received files in the journal and restores
+  /// files which were left in the journal by previous run.
+  /// @return number of restored files
+  size_t UseJournal(std::unique_ptr<Journal> journal);
+  /// Receives files right into the channel's arena, so complete files
+  /// can be published without a copy. Files which don't fit the arena
+  /// are received in anonymous memory and can't be published.
+  void UseSharedMemory(std::unique_ptr<shm::Channel> channel);
+
+  /// @return memory of segments received for incomplete files, a full
+  /// segment each, reserved and not yet touched memory doesn't count
+  [[nodiscard]] size_t receiving_bytes() const { return receiving_bytes_; }
+  [[nodiscard]] shm::Channel* channel() { return channel_.get(); }
+  [[nodiscard]] const shm::Channel* channel() const { return channel_.get(); }
+
+  template <class Function>
+  void ForEach(Function&& function) {
+    for (auto& [file_id, entry] : files_)
+      function(entry.file);
+  }
+private:
+  struct Entry {
+    File file;
+    /// Segments of the file which are counted in receiving_bytes_
+    size_t counted_segments;
+    Clock::time_point last_segment_at;
+  };
+  using Entries = std::unordered_map<uint64_t, Entry>;
+
+  /// @return entry after the dropped one
+  Entries::iterator Drop(Entries::iterator entry_it);
+  /// Counts segments which the file has got since the previous call.
+  void CountSegments(Entry* entry);
+
+  Entries files_;
+  std::unique_ptr<Journal> journal_;
+  std::unique_ptr<shm::Channel> channel_;
+  /// Complete files of the channel, they are dropped on the next Create
+  /// because the file is still used right after OnCompleted
+  std::vector<uint64_t> completed_;
+  size_t receiving_bytes_;
+};
+
+} // namespace udp_server
+
+#endif // UDP_SERVER_FILE_STORAGE_H_
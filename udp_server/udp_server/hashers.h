@@ -0,0 +1,36 @@
+#ifndef UDP_SERVER_HASHERS_H_
+#define UDP_SERVER_HASHERS_H_
+
+#include "udp_server/base/crc32.h"
+#include "udp_server/file.h"
+
+namespace udp_server {
+
+/// Hasher policies calculate the checksum which is sent to the client
+/// in the final ACK. All of them produce the same CRC32C.
+
+/// Chains table driven (or SSE4.2) CRC over spans of the file.
+struct Crc32Hasher {
+  uint32_t operator()(const File& file) const {
+    uint32_t crc32 = 0;
+    for (const auto data : file)
+      crc32 = base::Crc32(crc32, data);
+
+    return crc32;
+  }
+};
+
+/// Bit by bit CRC, which is how the server used to calculate it.
+struct BitwiseCrc32Hasher {
+  uint32_t operator()(const File& file) const {
+    uint32_t crc32 = 0;
+    for (const auto data : file)
+      crc32 = base::Crc32(crc32, data.begin(), data.end());
+
+    return crc32;
+  }
+};
+
+} // namespace udp_server
+
+#endif // UDP_SERVER_HASHERS_H_
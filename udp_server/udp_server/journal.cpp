@@ -0,0 +1,56 @@
+#include "udp_server/journal.h"
+
+#include <string>
+
+namespace udp_server {
+namespace {
+
+const char JOURNAL_FILE_EXTENSION[] = ".session";
+
+} // namespace
+
+Journal::Journal(std::filesystem::path directory)
+        : directory_(std::move(directory)) {}
+
+bool Journal::Open() {
+  std::error_code error;
+  std::filesystem::create_directories(directory_, error);
+  return !error && std::filesystem::is_directory(directory_, error);
+}
+
+std::optional<File> Journal::Create(uint64_t file_id, uint32_t number_of_segments) {
+  auto region = base::MappedRegion::CreateFile(PathOf(file_id), File::RegionSize(number_of_segments));
+  if (!region) return std::nullopt;
+
+  return std::make_optional<File>(file_id, number_of_segments, std::move(*region));
+}
+
+std::vector<File> Journal::Restore() {
+  std::vector<File> files;
+
+  std::error_code error;
+  for (const auto& entry : std::filesystem::directory_iterator(directory_, error)) {
+    if (!entry.is_regular_file() || entry.path().extension() != JOURNAL_FILE_EXTENSION)
+      continue;
+
+    auto region = base::MappedRegion::OpenFile(entry.path());
+    if (!region) continue;
+
+    auto file = File::Restore(std::move(*region));
+    if (file && PathOf(file->id()) == entry.path())
+      files.push_back(std::move(*file));
+  }
+
+  return files;
+}
+
+void Journal::Remove(uint64_t file_id) {
+  std::error_code error;
+  std::filesystem::remove(PathOf(file_id), error);
+}
+
+std::filesystem::path Journal::PathOf(uint64_t file_id) const {
+  return directory_ / (std::to_string(file_id) + JOURNAL_FILE_EXTENSION);
+}
+
+} // namespace udp_server
@@ -0,0 +1,39 @@
+#ifndef UDP_SERVER_JOURNAL_H_
+#define UDP_SERVER_JOURNAL_H_
+
+#include "udp_server/file.h"
+
+#include <filesystem>
+#include <optional>
+#include <vector>
+
+namespace udp_server {
+
+/**
+ * Persistent reassembly journal. Every partially received file is
+ * a memory-mapped journal file in the journal directory, so received
+ * segments survive server restart.
+ */
+class Journal {
+public:
+  explicit Journal(std::filesystem::path directory);
+
+  /// Creates journal directory if it does not exist.
+  bool Open();
+
+  /// Creates file which is backed by the journal.
+  /// @return nullopt if the journal file can't be created
+  std::optional<File> Create(uint64_t file_id, uint32_t number_of_segments);
+  /// Maps back all files from the journal. Data of the files is not read.
+  std::vector<File> Restore();
+  /// Removes file from the journal. Mapping of the file stays valid.
+  void Remove(uint64_t file_id);
+private:
+  [[nodiscard]] std::filesystem::path PathOf(uint64_t file_id) const;
+
+  const std::filesystem::path directory_;
+};
+
+} // namespace udp_server
+
+#endif // UDP_SERVER_JOURNAL_H_
@@ -0,0 +1,54 @@
+#ifndef UDP_SERVER_NET_SOCK_ADDR_H_
+#define UDP_SERVER_NET_SOCK_ADDR_H_
+
+#include "udp_server/net/address.h"
+
+#include <algorithm>
+#include <cstring>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+namespace udp_server::net {
+
+/**
+ * Value-type socket address of any family. Unlike Address it is stored
+ * inline and never allocates, so it can be filled by every recvfrom.
+ */
+class SockAddr {
+public:
+  SockAddr() : storage_(), socklen_(sizeof(storage_)) {}
+  SockAddr(const struct sockaddr* addr, socklen_t addrlen)
+      : storage_(), socklen_(std::min<socklen_t>(addrlen, sizeof(storage_))) {
+    std::memcpy(&storage_, addr, socklen_);
+  }
+  explicit SockAddr(const Address& address)
+      : SockAddr(address.sockaddr(), address.socklen()) {}
+
+  bool operator==(const SockAddr& other) const {
+    return socklen_ == other.socklen_ && std::memcmp(&storage_, &other.storage_, socklen_) == 0;
+  }
+
+  [[nodiscard]] const struct sockaddr* sockaddr() const {
+    return reinterpret_cast<const struct sockaddr*>(&storage_);
+  }
+  [[nodiscard]] socklen_t socklen() const { return socklen_; }
+  [[nodiscard]] sa_family_t family() const { return storage_.ss_family; }
+
+  /// Pointers to pass to functions like recvfrom which fill the address.
+  /// @{
+  [[nodiscard]] struct sockaddr* mutable_sockaddr() {
+    return reinterpret_cast<struct sockaddr*>(&storage_);
+  }
+  [[nodiscard]] socklen_t* mutable_socklen() { return &socklen_; }
+  /// @}
+
+  /// Makes the address ready to be filled again.
+  void Reset() { socklen_ = sizeof(storage_); }
+private:
+  sockaddr_storage storage_;
+  socklen_t socklen_;
+};
+
+} // namespace udp_server::net
+
+#endif // UDP_SERVER_NET_SOCK_ADDR_H_
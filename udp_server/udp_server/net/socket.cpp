@@ -40,4 +40,17 @@ bool Socket::Bind(std::unique_ptr<Address> to) {
   return success;
 }
 
+void Socket::ShutdownReceive() {
+  shutdown(fd_, SHUT_RD);
+}
+
+bool Socket::SetOption(int level, int name, int value) {
+  return setsockopt(fd_, level, name, &value, sizeof(value)) == 0;
+}
+
+bool Socket::GetOption(int level, int name, int* value) const {
+  socklen_t len = sizeof(*value);
+  return getsockopt(fd_, level, name, value, &len) == 0;
+}
+
 } // namespace udp_server::net
\ No newline at end of file
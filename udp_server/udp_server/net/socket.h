@@ -23,8 +23,17 @@ public:
   Socket& operator=(Socket&& from) noexcept;
 
   bool Bind(std::unique_ptr<Address> to);
+  /// Makes receives which are blocked on the socket return, see shutdown from POSIX
+  void ShutdownReceive();
+
+  /// Sets integer socket option, works similar to setsockopt from POSIX
+  bool SetOption(int level, int name, int value);
+  /// Reads integer socket option, works similar to getsockopt from POSIX
+  bool GetOption(int level, int name, int* value) const;
 
   [[nodiscard]] const Address* bound_to() const { return bound_to_.get(); }
+  /// Descriptor to wait on with poll, the socket keeps owning it
+  [[nodiscard]] int fd() const { return fd_; }
 protected:
   [[nodiscard]] int socket_fd() const { return fd_; }
 private:
@@ -1,10 +1,55 @@
 #include "udp_server/net/udp_socket.h"
 
+#include <cstring>
+#include <linux/sock_diag.h>
+#include <linux/sockios.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69
+#endif
+
 namespace udp_server::net {
 
 UDPSocket::UDPSocket()
           : Socket(AF_INET, SOCK_DGRAM, 0) {}
 
+bool UDPSocket::SetBusyPoll(int usec) {
+  // Preference is only a hint, old kernels don't know about it
+  SetOption(SOL_SOCKET, SO_PREFER_BUSY_POLL, 1);
+  return SetOption(SOL_SOCKET, SO_BUSY_POLL, usec);
+}
+
+bool UDPSocket::EnableDropCounter() {
+  return SetOption(SOL_SOCKET, SO_RXQ_OVFL, 1);
+}
+
+bool UDPSocket::SetReceiveBufferSize(int bytes) {
+  // Only privileged processes may exceed rmem_max
+  return SetOption(SOL_SOCKET, SO_RCVBUFFORCE, bytes)
+      || SetOption(SOL_SOCKET, SO_RCVBUF, bytes);
+}
+
+int UDPSocket::ReceiveBufferSize() const {
+  int bytes;
+  return GetOption(SOL_SOCKET, SO_RCVBUF, &bytes) ? bytes : -1;
+}
+
+int UDPSocket::QueuedBytes() const {
+  // For UDP sockets SIOCINQ reports only the size of the next datagram,
+  // memory info has the whole queue
+  uint32_t meminfo[SK_MEMINFO_VARS] = {};
+  socklen_t len = sizeof(meminfo);
+  if (getsockopt(socket_fd(), SOL_SOCKET, SO_MEMINFO, meminfo, &len) == 0
+      && len > SK_MEMINFO_RMEM_ALLOC * sizeof(uint32_t)) {
+    return static_cast<int>(meminfo[SK_MEMINFO_RMEM_ALLOC]);
+  }
+
+  int bytes;
+  return ioctl(socket_fd(), SIOCINQ, &bytes) == 0 ? bytes : -1;
+}
+
 ssize_t UDPSocket::Recv(uint8_t* buf, size_t len, int flags) {
   if (bound_to()) {
     return recv(socket_fd(), buf, len, flags);
@@ -45,6 +90,37 @@ std::pair<ssize_t, std::unique_ptr<Address>>
   return RecvFrom(to->data(), to->size(), flags);
 }
 
+ssize_t UDPSocket::RecvFrom(uint8_t* buf, size_t len, int flags, SockAddr* from,
+                           uint32_t* drops) {
+  if (!bound_to()) return -1;
+
+  from->Reset();
+  if (!drops)
+    return recvfrom(socket_fd(), buf, len, flags, from->mutable_sockaddr(), from->mutable_socklen());
+
+  iovec iov = { .iov_base = buf, .iov_len = len };
+  alignas(cmsghdr) uint8_t control[CMSG_SPACE(sizeof(uint32_t))];
+  msghdr message = {};
+  message.msg_name = from->mutable_sockaddr();
+  message.msg_namelen = *from->mutable_socklen();
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+
+  const auto bytes_received = recvmsg(socket_fd(), &message, flags);
+  if (bytes_received < 0) return bytes_received;
+
+  *from->mutable_socklen() = message.msg_namelen;
+  // Kernel attaches the counter only after the first drop
+  for (auto* cmsg = CMSG_FIRSTHDR(&message); cmsg; cmsg = CMSG_NXTHDR(&message, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL)
+      std::memcpy(drops, CMSG_DATA(cmsg), sizeof(*drops));
+  }
+
+  return bytes_received;
+}
+
 ssize_t UDPSocket::SendTo(const Address& to, const uint8_t* buf, size_t len, int flags) {
   return sendto(socket_fd(), buf, len, flags, to.sockaddr(), to.socklen());
 }
@@ -53,4 +129,8 @@ ssize_t UDPSocket::SendTo(const udp_server::net::Address& to, const std::vector<
   return SendTo(to, what.data(), what.size(), flags);
 }
 
+ssize_t UDPSocket::SendTo(const SockAddr& to, const uint8_t* buf, size_t len, int flags) {
+  return sendto(socket_fd(), buf, len, flags, to.sockaddr(), to.socklen());
+}
+
 } // namespace udp_server::net
\ No newline at end of file
@@ -1,6 +1,7 @@
 #ifndef UDP_SERVER_NET_UDP_SOCKET_H_
 #define UDP_SERVER_NET_UDP_SOCKET_H_
 
+#include "udp_server/net/sock_addr.h"
 #include "udp_server/net/socket.h"
 
 namespace udp_server::net {
@@ -12,6 +13,24 @@ class UDPSocket : public Socket {
 public:
   UDPSocket();
 
+  /// Enables busy polling of the device queue for blocking and
+  /// non-blocking receive (SO_BUSY_POLL and SO_PREFER_BUSY_POLL).
+  /// @param usec approximate time in microseconds to busy poll
+  bool SetBusyPoll(int usec);
+
+  /// Makes the kernel attach the number of datagrams it has dropped on
+  /// the socket to received datagrams (SO_RXQ_OVFL), see RecvFrom.
+  bool EnableDropCounter();
+  /// Sets size of the receive buffer, above net.core.rmem_max too
+  /// if the process is allowed to (SO_RCVBUFFORCE).
+  bool SetReceiveBufferSize(int bytes);
+  /// @return size of the receive buffer as the kernel accounts it
+  /// (twice the requested size), or -1 on error
+  [[nodiscard]] int ReceiveBufferSize() const;
+  /// @return bytes which wait in the receive queue including the kernel's
+  /// overhead, or -1 on error
+  [[nodiscard]] int QueuedBytes() const;
+
   /// Group of function for data receiving from clients
   /// This function works similar to recv/recvfrom function from
   /// POSIX
@@ -21,6 +40,12 @@ public:
 
   std::pair<ssize_t, std::unique_ptr<Address>> RecvFrom(uint8_t* buf, size_t len, int flags);
   std::pair<ssize_t, std::unique_ptr<Address>> RecvFrom(std::vector<uint8_t>* to, int flags);
+  /// Receives into the address which is stored by value and does not allocate.
+  /// @param drops if not null, receives the counter of datagrams dropped
+  /// by the kernel since the socket was created, see EnableDropCounter.
+  /// It is left untouched until the first drop.
+  ssize_t RecvFrom(uint8_t* buf, size_t len, int flags, SockAddr* from,
+                   uint32_t* drops = nullptr);
   /// }@
 
   /// Group of function to send data to specific address
@@ -30,6 +55,7 @@ public:
   /// @{
   ssize_t SendTo(const Address& to, const uint8_t* buf, size_t len, int flags);
   ssize_t SendTo(const Address& to, const std::vector<uint8_t>& what, int flags);
+  ssize_t SendTo(const SockAddr& to, const uint8_t* buf, size_t len, int flags);
   /// @}
 };
 
@@ -0,0 +1,49 @@
+#include "udp_server/output_directory.h"
+
+#include <string>
+#include <system_error>
+
+namespace udp_server {
+
+OutputDirectory::OutputDirectory(std::filesystem::path path)
+                : path_(std::move(path)),
+                  files_() {}
+
+bool OutputDirectory::Open() {
+  std::error_code error;
+  std::filesystem::create_directories(path_, error);
+  return !error;
+}
+
+bool OutputDirectory::Write(const File& file, uint64_t offset, std::span<const uint8_t> data) {
+  auto file_it = files_.find(file.id());
+  if (file_it == files_.end()) {
+    // Restored file delivers its data from the start again
+    if (offset != 0) return false;
+
+    std::ofstream output(FilePath(file.id()), std::ios::binary | std::ios::trunc);
+    if (!output.is_open()) return false;
+    file_it = files_.emplace(file.id(), std::move(output)).first;
+  }
+
+  auto& output = file_it->second;
+  output.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+  return output.good();
+}
+
+void OutputDirectory::Close(const File& file) {
+  files_.erase(file.id());
+}
+
+void OutputDirectory::Discard(const File& file) {
+  if (files_.erase(file.id()) == 0) return;
+
+  std::error_code error;
+  std::filesystem::remove(FilePath(file.id()), error);
+}
+
+std::filesystem::path OutputDirectory::FilePath(uint64_t file_id) const {
+  return path_ / std::to_string(file_id);
+}
+
+} // namespace udp_server
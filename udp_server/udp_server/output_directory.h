@@ -0,0 +1,41 @@
+#ifndef UDP_SERVER_OUTPUT_DIRECTORY_H_
+#define UDP_SERVER_OUTPUT_DIRECTORY_H_
+
+#include "udp_server/file.h"
+
+#include <filesystem>
+#include <fstream>
+#include <span>
+#include <unordered_map>
+
+namespace udp_server {
+
+/**
+ * Writes files into the directory while they are being received,
+ * so only the tail of a file is left to write when it is complete.
+ * File with id N is written to <directory>/N.
+ */
+class OutputDirectory {
+public:
+  explicit OutputDirectory(std::filesystem::path path);
+
+  /// Creates the directory if there is no such directory.
+  bool Open();
+
+  /// Appends data which has joined contiguous prefix of the file.
+  bool Write(const File& file, uint64_t offset, std::span<const uint8_t> data);
+  /// Closes the output of the complete file.
+  void Close(const File& file);
+  /// Closes and removes the output of the file which was dropped before it
+  /// completed, so the file is written from scratch if it comes again.
+  void Discard(const File& file);
+private:
+  std::filesystem::path FilePath(uint64_t file_id) const;
+
+  const std::filesystem::path path_;
+  std::unordered_map<uint64_t, std::ofstream> files_;
+};
+
+} // namespace udp_server
+
+#endif // UDP_SERVER_OUTPUT_DIRECTORY_H_
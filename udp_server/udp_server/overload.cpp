@@ -0,0 +1,75 @@
+#include "udp_server/overload.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace udp_server {
+namespace {
+
+bool IsOver(size_t value, size_t limit, double fraction = 1.0) {
+  return limit > 0 && static_cast<double>(value) > static_cast<double>(limit) * fraction;
+}
+
+} // namespace
+
+OverloadShedding::OverloadShedding(const Options& options, QueueProbe queue_probe)
+                 : options_(options),
+                   queue_probe_(std::move(queue_probe)),
+                   stats_(),
+                   until_sample_(0),
+                   queued_bytes_(0),
+                   overloaded_(false),
+                   next_idle_scan_() {}
+
+bool OverloadShedding::Admit(const File* file, size_t memory_bytes) {
+  Update(memory_bytes);
+  if (!overloaded_) return true;
+
+  if (!file) {
+    ++stats_.rejected_new_files;
+    return false;
+  }
+
+  if (static_cast<double>(file->size()) >= static_cast<double>(file->capacity()) * options_.near_complete) {
+    ++stats_.near_complete_hits;
+    return true;
+  }
+
+  if (IsOver(queued_bytes_, options_.max_queued_bytes)) {
+    ++stats_.dropped_segments;
+    return false;
+  }
+  return true;
+}
+
+std::optional<std::chrono::steady_clock::time_point> OverloadShedding::IdleSince() {
+  if (!overloaded_ || options_.idle_timeout.count() == 0) return std::nullopt;
+
+  const auto now = std::chrono::steady_clock::now();
+  if (now < next_idle_scan_) return std::nullopt;
+  next_idle_scan_ = now + options_.idle_timeout / 4;
+  return now - options_.idle_timeout;
+}
+
+void OverloadShedding::Update(size_t memory_bytes) {
+  if (until_sample_ == 0) {
+    until_sample_ = options_.sample_every;
+    queued_bytes_ = queue_probe_ ? queue_probe_() : 0;
+    stats_.max_queued_bytes = std::max(stats_.max_queued_bytes, queued_bytes_);
+  }
+  --until_sample_;
+  stats_.max_memory_bytes = std::max(stats_.max_memory_bytes, memory_bytes);
+
+  if (!overloaded_) {
+    if (IsOver(queued_bytes_, options_.max_queued_bytes) ||
+        IsOver(memory_bytes, options_.max_memory_bytes)) {
+      overloaded_ = true;
+      ++stats_.overloads;
+    }
+  } else if (!IsOver(queued_bytes_, options_.max_queued_bytes, options_.resume_fraction) &&
+             !IsOver(memory_bytes, options_.max_memory_bytes, options_.resume_fraction)) {
+    overloaded_ = false;
+  }
+}
+
+} // namespace udp_server
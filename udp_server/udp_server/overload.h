@@ -0,0 +1,98 @@
+#ifndef UDP_SERVER_OVERLOAD_H_
+#define UDP_SERVER_OVERLOAD_H_
+
+#include "udp_server/file.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+
+namespace udp_server {
+
+/**
+ * Load shedding which keeps files completing when the server can't keep
+ * up. The server is overloaded once the transport has too many bytes
+ * queued or segments of files being received take too much memory, and
+ * stays so until both fall below a part of the limits. While it is overloaded:
+ *  - PUT packets of new files are shed before anything is allocated for
+ *    them;
+ *  - segments of files which have at least `near_complete` of their
+ *    segments are always accepted, they are about to free their memory;
+ *  - segments of other files are accepted only while the queue is under
+ *    its limit, i.e. when memory is the only problem;
+ *  - files which have got no segment for `idle_timeout` are dropped, so
+ *    abandoned uploads don't hold the server in overload.
+ * Shed packets are answered with BUSY, so clients put the file aside for a
+ * while instead of resending it as if the packet was lost.
+ * Progress of a file is its received and total segments, which the file
+ * in the storage keeps anyway.
+ */
+class OverloadShedding {
+public:
+  struct Options {
+    /// Bytes queued in the transport which start overload, 0 ignores the queue
+    size_t max_queued_bytes = 4 << 20;
+    /// Bytes of files being received which start overload, 0 ignores memory
+    size_t max_memory_bytes = size_t{1} << 30;
+    /// Overload ends when both are below that part of their limits
+    double resume_fraction = 0.5;
+    /// Part of segments after which a file is nearly complete
+    double near_complete = 0.9;
+    /// Queue is sampled once per that many PUT packets
+    uint32_t sample_every = 64;
+    /// Files without new segments for that long are dropped during
+    /// overload, 0 keeps them
+    std::chrono::milliseconds idle_timeout{30000};
+  };
+
+  struct Stats {
+    /// Times the server became overloaded
+    uint64_t overloads = 0;
+    /// PUT packets of new files which were shed
+    uint64_t rejected_new_files = 0;
+    /// Segments of nearly complete files accepted during overload
+    uint64_t near_complete_hits = 0;
+    /// Segments of other files shed during overload
+    uint64_t dropped_segments = 0;
+    /// Incomplete files dropped because they were idle during overload
+    uint64_t dropped_idle_files = 0;
+    size_t max_queued_bytes = 0;
+    size_t max_memory_bytes = 0;
+  };
+
+  /// Returns bytes queued in the transport, see QueuedBytes of the transports.
+  using QueueProbe = std::function<size_t()>;
+
+  OverloadShedding(const Options& options, QueueProbe queue_probe);
+
+  /// Decides on a PUT packet before it is added.
+  /// @param file file of the packet or nullptr if it starts a new file
+  /// @param memory_bytes memory of files being received
+  /// @return false if the packet must be shed
+  bool Admit(const File* file, size_t memory_bytes);
+  /// Idle files are looked for during overload, a few times per idle timeout.
+  /// @return time before which the last segment of an idle file came, or
+  /// nullopt if it isn't time to look for idle files
+  std::optional<std::chrono::steady_clock::time_point> IdleSince();
+  void OnIdleFilesDropped(size_t files) { stats_.dropped_idle_files += files; }
+
+  [[nodiscard]] bool overloaded() const { return overloaded_; }
+  [[nodiscard]] const Stats& stats() const { return stats_; }
+private:
+  void Update(size_t memory_bytes);
+
+  const Options options_;
+  const QueueProbe queue_probe_;
+  Stats stats_;
+
+  uint32_t until_sample_;
+  size_t queued_bytes_;
+  bool overloaded_;
+  std::chrono::steady_clock::time_point next_idle_scan_;
+};
+
+} // namespace udp_server
+
+#endif // UDP_SERVER_OVERLOAD_H_
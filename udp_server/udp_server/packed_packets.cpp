@@ -0,0 +1,52 @@
+#include "udp_server/packed_packets.h"
+
+#include "udp_server/base/sys_byteorder.h"
+
+#include <cstring>
+
+namespace udp_server {
+
+PackedReader::PackedReader(const uint8_t* data, size_t size)
+            : reader_(data, size) {
+  if (!reader_.Skip(Packet::HEADER_SIZE))
+    reader_.set_size(0);
+}
+
+std::optional<std::span<const uint8_t>> PackedReader::Next() {
+  uint16_t size = 0;
+  if (!reader_.Read2(&size)) return std::nullopt;
+
+  const auto* packet = reader_.data() + reader_.pos();
+  if (size < Packet::HEADER_SIZE || !reader_.Skip(size)) return std::nullopt;
+  return std::span(packet, size);
+}
+
+// static
+const size_t PackedWriter::MAX_RECORDS =
+    Packet::MAX_DATA_SIZE / (sizeof(uint16_t) + Packet::FINAL_ACK_SIZE);
+
+PackedWriter::PackedWriter(Packet::Type type, uint8_t* buf)
+            : buf_(buf),
+              size_(0),
+              records_(0) {
+  const Packet::Header header = {
+      .seq_number = 0,
+      .seq_total = 0,
+      .type = type,
+      .file_id = 0,
+  };
+  size_ = Packet::WriteHeader(header, buf_);
+}
+
+bool PackedWriter::Add(std::span<const uint8_t> packet) {
+  if (size_ + sizeof(uint16_t) + packet.size() > Packet::MAX_SIZE) return false;
+
+  const auto size = base::HostToNet16(static_cast<uint16_t>(packet.size()));
+  std::memcpy(buf_ + size_, &size, sizeof(size));
+  std::memcpy(buf_ + size_ + sizeof(size), packet.data(), packet.size());
+  size_ += sizeof(size) + packet.size();
+  ++records_;
+  return true;
+}
+
+} // namespace udp_server
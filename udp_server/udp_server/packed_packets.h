@@ -0,0 +1,58 @@
+#ifndef UDP_SERVER_PACKED_PACKETS_H_
+#define UDP_SERVER_PACKED_PACKETS_H_
+
+#include "udp_server/base/buffer_reader.h"
+#include "udp_server/packet.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+
+namespace udp_server {
+
+/**
+ * Datagram with several packets, so uploads of many small files don't
+ * take a datagram (and a syscall on both sides) per file. The header has
+ * only the type, PACKED_PUT or PACKED_ACK, the data is records of a packet
+ * size (2 bytes) followed by the packet itself. PACKED_PUT has PUT packets
+ * of any files, PACKED_ACK has the replies to them: ACK or NACK of every
+ * record which the server has accepted.
+ */
+class PackedReader {
+public:
+  /// @param data whole datagram, the header is skipped
+  PackedReader(const uint8_t* data, size_t size);
+
+  /// @return next packet or nullopt at the end of the datagram or at a broken record
+  std::optional<std::span<const uint8_t>> Next();
+private:
+  base::BufferReader reader_;
+};
+
+/**
+ * Writes records of a packed datagram into a buffer of Packet::MAX_SIZE bytes.
+ */
+class PackedWriter {
+public:
+  /// Replies to that many records always fit one PACKED_ACK, the server
+  /// ignores records of a PACKED_PUT after them
+  static const size_t MAX_RECORDS;
+
+  PackedWriter(Packet::Type type, uint8_t* buf);
+
+  /// @return false if the packet doesn't fit the datagram
+  bool Add(std::span<const uint8_t> packet);
+
+  [[nodiscard]] size_t records() const { return records_; }
+  /// @return size of the datagram, 0 if there are no records
+  [[nodiscard]] size_t size() const { return records_ > 0 ? size_ : 0; }
+private:
+  uint8_t* buf_;
+  size_t size_;
+  size_t records_;
+};
+
+} // namespace udp_server
+
+#endif // UDP_SERVER_PACKED_PACKETS_H_
@@ -2,11 +2,39 @@
 
 #include "udp_server/base/buffer_reader.h"
 #include "udp_server/base/buffer_writer.h"
+#include "udp_server/base/sys_byteorder.h"
+
+#include <cstring>
 
 namespace udp_server {
+namespace {
+
+template <typename T>
+uint8_t* Write(uint8_t* buf, T v) {
+  std::memcpy(buf, &v, sizeof(v));
+  return buf + sizeof(v);
+}
+
+uint8_t* WriteHeaderTo(const Packet::Header& header, uint8_t* buf) {
+  buf = Write(buf, base::HostToNet32(header.seq_number));
+  buf = Write(buf, base::HostToNet32(header.seq_total));
+  buf = Write(buf, static_cast<uint8_t>(header.type));
+  return Write(buf, base::HostToNet64(header.file_id));
+}
+
+} // namespace
 
 // static
 const size_t Packet::MAX_SIZE = 1472;
+// static
+const size_t Packet::HEADER_SIZE = sizeof(Header::seq_number) +
+                                   sizeof(Header::seq_total)  +
+                                   sizeof(Header::type)       +
+                                   sizeof(Header::file_id)    ;
+// static
+const size_t Packet::MAX_DATA_SIZE = MAX_SIZE - HEADER_SIZE;
+// static
+const size_t Packet::FINAL_ACK_SIZE = HEADER_SIZE + sizeof(uint32_t);
 
 // static
 Packet Packet::ACK(const Packet::Header& to_packet) {
@@ -26,6 +54,96 @@ Packet Packet::ACK(const Header& to_packet, uint32_t crc32) {
   return ack;
 }
 
+// static
+Packet Packet::Have(const Header& to_query) {
+  auto have = ACK(to_query);
+  have.header_.type = Type::HAVE;
+  return have;
+}
+
+// static
+Packet Packet::Have(const Header& to_query, uint32_t crc32) {
+  auto have = ACK(to_query, crc32);
+  have.header_.type = Type::HAVE;
+  return have;
+}
+
+// static
+Packet Packet::State(const Header& to_request, uint32_t received, std::vector<uint8_t>&& data) {
+  auto state = Packet();
+  state.header_ = to_request;
+  state.header_.type = Type::STATE;
+  state.header_.seq_total = received;
+  state.data_ = std::move(data);
+  return state;
+}
+
+// static
+Packet Packet::Signatures(const Header& to_request, uint32_t blocks, std::vector<uint8_t>&& data) {
+  auto signatures = State(to_request, blocks, std::move(data));
+  signatures.header_.type = Type::SIGNATURES;
+  return signatures;
+}
+
+// static
+Packet Packet::Put(const Header& header, std::vector<uint8_t>&& data) {
+  auto put = Packet();
+  put.header_ = header;
+  put.header_.type = Type::PUT;
+  put.data_ = std::move(data);
+  return put;
+}
+
+// static
+Packet Packet::NACK(const Header& to_packet) {
+  auto nack = ACK(to_packet);
+  nack.header_.type = Type::NACK;
+  return nack;
+}
+
+// static
+Packet Packet::Busy(const Header& to_packet) {
+  auto busy = ACK(to_packet);
+  busy.header_.type = Type::BUSY;
+  return busy;
+}
+
+// static
+Packet Packet::Checksums(const Header& to_request) {
+  auto checksums = ACK(to_request);
+  checksums.header_.type = Type::CHECKSUMS;
+  return checksums;
+}
+
+// static
+Packet Packet::Verify(const Header& to_request, uint32_t segments, std::vector<uint8_t>&& data) {
+  auto verify = State(to_request, segments, std::move(data));
+  verify.header_.type = Type::VERIFY;
+  return verify;
+}
+
+// static
+std::optional<Packet::Header> Packet::PeekHeader(const uint8_t* data, size_t size) {
+  Packet packet;
+  base::BufferReader reader(data, size);
+  if (!packet.ParseHeader(&reader)) return std::nullopt;
+  return packet.header_;
+}
+
+// static
+size_t Packet::WriteACK(const Header& to_packet, uint32_t crc32, uint8_t* buf) {
+  auto ack_header = to_packet;
+  ack_header.type = Type::ACK;
+  Write(WriteHeaderTo(ack_header, buf), base::HostToNet32(crc32));
+  return FINAL_ACK_SIZE;
+}
+
+// static
+size_t Packet::WriteHeader(const Header& header, uint8_t* buf) {
+  WriteHeaderTo(header, buf);
+  return HEADER_SIZE;
+}
+
 Packet::Packet()
        : header_(Header {
          .seq_number = 0,
@@ -63,6 +181,16 @@ void Packet::WriteTo(base::BufferWriter* writer) const {
   WriteData(writer);
 }
 
+size_t Packet::WriteTo(std::span<uint8_t> buf) const {
+  const auto size = HEADER_SIZE + data_.size();
+  if (buf.size() < size) return 0;
+
+  auto* data = WriteHeaderTo(header_, buf.data());
+  if (!data_.empty())
+    std::memcpy(data, data_.data(), data_.size());
+  return size;
+}
+
 void Packet::Clear() {
   *this = Packet();
 }
@@ -3,6 +3,8 @@
 
 #include <bits/stdint-uintn.h>
 #include <cstddef>
+#include <optional>
+#include <span>
 #include <vector>
 
 namespace udp_server {
@@ -18,7 +20,24 @@ class BufferWriter;
  */
 class Packet {
 public:
-  enum class Type : uint8_t { ACK = 0, PUT = 1, UNKNOWN = 0xff, };
+  /// QUERY asks the server whether it already has a file with given content
+  /// (data is size and sha256 of the file), HAVE is the answer to QUERY
+  /// (data is crc32 of the file if server has it, empty otherwise).
+  /// STATE asks which segments of a file starting from seq_number are missing,
+  /// the answer is STATE with seq_total equals to number of received segments
+  /// and data is the number of the segment where the scan stopped followed by
+  /// (first missing segment, count of missing segments) ranges.
+  /// SIGNATURES and COPY are delta uploads, see DeltaIndex.
+  /// CHECKSUMS, NACK and VERIFY are per-segment checksums, see SegmentChecksums.
+  /// PACKED_PUT carries PUT packets of several files, PACKED_ACK the replies
+  /// to them, see PackedReader.
+  /// BUSY answers a PUT packet which was shed by an overloaded server, see
+  /// OverloadShedding.
+  enum class Type : uint8_t {
+    ACK = 0, PUT = 1, QUERY = 2, HAVE = 3, STATE = 4, SIGNATURES = 5, COPY = 6,
+    CHECKSUMS = 7, NACK = 8, VERIFY = 9, PACKED_PUT = 10, PACKED_ACK = 11, BUSY = 12,
+    UNKNOWN = 0xff,
+  };
   struct Header {
     uint32_t seq_number;
     uint32_t seq_total;
@@ -27,9 +46,36 @@ public:
   };
 
   static const size_t MAX_SIZE;
+  static const size_t HEADER_SIZE;
+  /// Maximum size of data carried by one packet
+  static const size_t MAX_DATA_SIZE;
+  /// Size of the final ACK, which carries crc32 of the file
+  static const size_t FINAL_ACK_SIZE;
 
   static Packet ACK(const Header& to_packet);
   static Packet ACK(const Header& to_packet, uint32_t crc32);
+  static Packet Have(const Header& to_query);
+  static Packet Have(const Header& to_query, uint32_t crc32);
+  static Packet State(const Header& to_request, uint32_t received, std::vector<uint8_t>&& data);
+  static Packet Signatures(const Header& to_request, uint32_t blocks, std::vector<uint8_t>&& data);
+  static Packet Put(const Header& header, std::vector<uint8_t>&& data);
+  /// Rejects the segment of the PUT packet, the client sends it again.
+  static Packet NACK(const Header& to_packet);
+  /// Sheds the segment of the PUT packet, the client sends it again later.
+  static Packet Busy(const Header& to_packet);
+  /// Confirms that checksums of the CHECKSUMS packet are recorded.
+  static Packet Checksums(const Header& to_request);
+  static Packet Verify(const Header& to_request, uint32_t segments, std::vector<uint8_t>&& data);
+
+  /// Parses only the header of the datagram, data stays where it is.
+  static std::optional<Header> PeekHeader(const uint8_t* data, size_t size);
+  /// Writes the final ACK without building a packet, buf must have room
+  /// for FINAL_ACK_SIZE bytes.
+  /// @return FINAL_ACK_SIZE
+  static size_t WriteACK(const Header& to_packet, uint32_t crc32, uint8_t* buf);
+  /// Writes only the header, buf must have room for HEADER_SIZE bytes.
+  /// @return HEADER_SIZE
+  static size_t WriteHeader(const Header& header, uint8_t* buf);
 
   Packet();
   explicit Packet(base::BufferReader* reader);
@@ -39,7 +85,10 @@ public:
 
   bool ReadFrom(base::BufferReader* reader);
   void WriteTo(base::BufferWriter* writer) const;
+  /// @return size of the written packet or 0 if it doesn't fit the buffer
+  size_t WriteTo(std::span<uint8_t> buf) const;
 
+  [[nodiscard]] const std::vector<uint8_t>& data() const { return data_; }
   std::vector<uint8_t> TakeData() { return std::move(data_); }
   void Clear();
 
@@ -0,0 +1,77 @@
+#include "udp_server/receive_monitor.h"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace udp_server {
+
+ReceiveMonitor::ReceiveMonitor(const Options& options)
+               : options_(options),
+                 stats_(),
+                 last_drop_counter_(0),
+                 until_sample_(options.sample_every),
+                 last_grow_() {}
+
+bool ReceiveMonitor::Setup(net::UDPSocket* socket) {
+  stats_.buffer_bytes = socket->ReceiveBufferSize();
+
+  const auto success = socket->EnableDropCounter();
+  if (!success)
+    std::perror("setsockopt(SO_RXQ_OVFL)");
+
+  return success;
+}
+
+void ReceiveMonitor::OnDatagram(net::UDPSocket* socket, uint32_t drop_counter) {
+  auto should_grow = false;
+
+  // Counter is 32 bit and wraps around, and with several receiving threads
+  // a datagram can bring an older value of it than the previous one
+  const auto drops = static_cast<int32_t>(drop_counter - last_drop_counter_);
+  if (drops > 0) {
+    last_drop_counter_ = drop_counter;
+    stats_.drops += drops;
+    ++stats_.drop_events;
+    should_grow = true;
+  }
+
+  if (--until_sample_ == 0) {
+    until_sample_ = options_.sample_every;
+
+    const auto queued_bytes = socket->QueuedBytes();
+    if (queued_bytes >= 0) {
+      stats_.queued_bytes = queued_bytes;
+      stats_.max_queued_bytes = std::max(stats_.max_queued_bytes, queued_bytes);
+      if (queued_bytes > stats_.buffer_bytes * options_.burst_fraction) {
+        ++stats_.bursts;
+        should_grow = true;
+      }
+    }
+  }
+
+  if (should_grow && stats_.buffer_bytes < options_.max_buffer_bytes) {
+    const auto now = Clock::now();
+    if (now - last_grow_ >= options_.grow_interval)
+      Grow(socket, now);
+  }
+}
+
+void ReceiveMonitor::Grow(net::UDPSocket* socket, Clock::time_point now) {
+  last_grow_ = now;
+
+  // Kernel doubles the requested size for its own overhead
+  const auto target = std::min(stats_.buffer_bytes * 2, options_.max_buffer_bytes);
+  if (!socket->SetReceiveBufferSize(target / 2)) {
+    std::perror("setsockopt(SO_RCVBUF)");
+    return;
+  }
+
+  // Without CAP_NET_ADMIN the size is capped by net.core.rmem_max
+  const auto buffer_bytes = socket->ReceiveBufferSize();
+  if (buffer_bytes > stats_.buffer_bytes) {
+    stats_.buffer_bytes = buffer_bytes;
+    ++stats_.buffer_grows;
+  }
+}
+
+} // namespace udp_server
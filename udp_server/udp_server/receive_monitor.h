@@ -0,0 +1,67 @@
+#ifndef UDP_SERVER_RECEIVE_MONITOR_H_
+#define UDP_SERVER_RECEIVE_MONITOR_H_
+
+#include "udp_server/net/udp_socket.h"
+
+#include <chrono>
+#include <cstdint>
+
+namespace udp_server {
+
+/**
+ * Watches datagrams which the kernel drops because the receive queue is full
+ * and how deep the queue gets, and grows the socket receive buffer when
+ * either shows that the server falls behind.
+ */
+class ReceiveMonitor {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  struct Options {
+    /// Receive buffer is never grown above that, as the kernel accounts it,
+    /// 0 only counts drops
+    int max_buffer_bytes = 8 << 20;
+    /// Queue depth is sampled once per that many datagrams
+    uint32_t sample_every = 64;
+    /// Queue which is fuller than that part of the buffer is a burst
+    double burst_fraction = 0.5;
+    /// Drops right after growing the buffer are still from the same burst
+    std::chrono::milliseconds grow_interval = std::chrono::milliseconds(100);
+  };
+
+  struct Stats {
+    /// Datagrams dropped by the kernel since the monitor was set up
+    uint64_t drops = 0;
+    /// Receives which reported new drops
+    uint64_t drop_events = 0;
+    int queued_bytes = 0;
+    int max_queued_bytes = 0;
+    /// Samples with the queue over the burst threshold
+    uint64_t bursts = 0;
+    int buffer_bytes = 0;
+    uint64_t buffer_grows = 0;
+  };
+
+  explicit ReceiveMonitor(const Options& options);
+
+  /// Enables the drop counter on the socket.
+  bool Setup(net::UDPSocket* socket);
+
+  /// Takes the drop counter received with a datagram and samples the queue.
+  void OnDatagram(net::UDPSocket* socket, uint32_t drop_counter);
+
+  [[nodiscard]] const Stats& stats() const { return stats_; }
+private:
+  void Grow(net::UDPSocket* socket, Clock::time_point now);
+
+  const Options options_;
+  Stats stats_;
+
+  uint32_t last_drop_counter_;
+  uint32_t until_sample_;
+  Clock::time_point last_grow_;
+};
+
+} // namespace udp_server
+
+#endif // UDP_SERVER_RECEIVE_MONITOR_H_
@@ -0,0 +1,43 @@
+#include "udp_server/recent_files.h"
+
+#include <algorithm>
+#include <bit>
+
+namespace udp_server {
+
+RecentFiles::RecentFiles(size_t capacity)
+            : slots_(std::bit_ceil(std::max<size_t>(capacity, 1)), Slot{}),
+              stats_() {}
+
+std::optional<std::pair<uint64_t, uint32_t>> RecentFiles::Insert(uint64_t file_id, uint32_t crc32) {
+  auto& slot = slots_[SlotOf(file_id)];
+  std::optional<std::pair<uint64_t, uint32_t>> evicted;
+  if (slot.used && slot.file_id != file_id) {
+    evicted.emplace(slot.file_id, slot.crc32);
+    ++stats_.evicted;
+  }
+
+  slot = Slot{ .file_id = file_id, .crc32 = crc32, .used = true };
+  ++stats_.files;
+  return evicted;
+}
+
+std::optional<uint32_t> RecentFiles::FindDuplicate(uint64_t file_id) {
+  if (!contains(file_id)) return std::nullopt;
+
+  ++stats_.duplicates;
+  return slots_[SlotOf(file_id)].crc32;
+}
+
+bool RecentFiles::contains(uint64_t file_id) const {
+  const auto& slot = slots_[SlotOf(file_id)];
+  return slot.used && slot.file_id == file_id;
+}
+
+size_t RecentFiles::SlotOf(uint64_t file_id) const {
+  // Fibonacci hashing, so ids which go with a power of two stride spread too
+  const auto hash = file_id * 0x9e3779b97f4a7c15;
+  return (hash >> 32) & (slots_.size() - 1);
+}
+
+} // namespace udp_server
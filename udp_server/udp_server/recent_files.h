@@ -0,0 +1,54 @@
+#ifndef UDP_SERVER_RECENT_FILES_H_
+#define UDP_SERVER_RECENT_FILES_H_
+
+#include <cstdint>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace udp_server {
+
+/**
+ * crc32 of files which the server has completed without keeping them,
+ * so retransmissions of their segments get the final ACK again. It is
+ * a direct mapped cache: a file pushes out the one with the same slot,
+ * and the caller has to remember that one elsewhere, otherwise a
+ * retransmission which comes after that makes a new file.
+ */
+class RecentFiles {
+public:
+  struct Stats {
+    uint64_t files = 0;
+    /// Retransmissions which were answered from the cache
+    uint64_t duplicates = 0;
+    /// Files which were pushed out by other files
+    uint64_t evicted = 0;
+  };
+
+  /// @param capacity number of slots, it is rounded up to a power of two
+  explicit RecentFiles(size_t capacity);
+
+  /// @return id and crc32 of the file which was pushed out
+  std::optional<std::pair<uint64_t, uint32_t>> Insert(uint64_t file_id, uint32_t crc32);
+  /// Looks up the file for a retransmitted segment.
+  /// @return crc32 of the file or nullopt if it isn't in the cache
+  std::optional<uint32_t> FindDuplicate(uint64_t file_id);
+  [[nodiscard]] bool contains(uint64_t file_id) const;
+
+  [[nodiscard]] const Stats& stats() const { return stats_; }
+private:
+  struct Slot {
+    uint64_t file_id;
+    uint32_t crc32;
+    bool used;
+  };
+
+  size_t SlotOf(uint64_t file_id) const;
+
+  std::vector<Slot> slots_;
+  Stats stats_;
+};
+
+} // namespace udp_server
+
+#endif // UDP_SERVER_RECENT_FILES_H_
@@ -0,0 +1,364 @@
+#include "udp_server/relay.h"
+
+#include "udp_server/base/buffer_reader.h"
+#include "udp_server/base/buffer_writer.h"
+#include "udp_server/net/ipv4_address.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace udp_server {
+namespace {
+
+using std::chrono::duration_cast;
+
+const auto MIN_RTO = std::chrono::milliseconds(10);
+/// RTO is never closer than that to SRTT
+const auto CLOCK_GRANULARITY = std::chrono::milliseconds(1);
+
+} // namespace
+
+Relay::Relay(std::vector<net::SockAddr> downstream, const Options& options)
+     : options_(options),
+       socket_(),
+       wakeup_fd_(-1),
+       downstream_(),
+       unpublished_(),
+       mutex_(),
+       queue_(),
+       files_(),
+       abandoned_(downstream.size(), false),
+       stats_(),
+       sleeping_(false),
+       stop_(false),
+       thread_() {
+  for (auto& address : downstream) {
+    downstream_.push_back(Downstream{
+        .address = address,
+        .pending = {},
+        .in_flight = {},
+        .timers = {},
+        .srtt = std::nullopt,
+        .rttvar = Clock::duration::zero(),
+        .rto = duration_cast<Clock::duration>(options.initial_rto),
+        .waiting_since = {},
+        .abandoned = false,
+    });
+  }
+}
+
+Relay::~Relay() {
+  Stop();
+  if (wakeup_fd_ >= 0)
+    close(wakeup_fd_);
+}
+
+bool Relay::Start() {
+  if (!socket_.Bind(std::make_unique<net::IPv4Address>(0))) {
+    std::perror("bind");
+    return false;
+  }
+
+  wakeup_fd_ = eventfd(0, EFD_NONBLOCK);
+  if (wakeup_fd_ < 0) {
+    std::perror("eventfd");
+    return false;
+  }
+
+  thread_ = std::thread([this] { Run(); });
+  return true;
+}
+
+void Relay::Stop() {
+  if (!thread_.joinable()) return;
+
+  stop_.store(true);
+  const uint64_t one = 1;
+  [[maybe_unused]] const auto written = write(wakeup_fd_, &one, sizeof(one));
+  thread_.join();
+}
+
+void Relay::Forward(const Packet::Header& header, std::span<const uint8_t> data) {
+  {
+    std::lock_guard lock(mutex_);
+    queue_.push_back(Segment{ .header = header, .data = data });
+    ++stats_.forwarded;
+  }
+
+  // Relay thread checks the queue after it has announced the sleep
+  if (sleeping_.load()) {
+    const uint64_t one = 1;
+    [[maybe_unused]] const auto written = write(wakeup_fd_, &one, sizeof(one));
+  }
+}
+
+void Relay::OnFileCompleted(uint64_t file_id, uint32_t crc32) {
+  std::lock_guard lock(mutex_);
+  const auto file_it = files_.try_emplace(file_id).first;
+  auto& file = file_it->second;
+  file.crc32 = crc32;
+  stats_.crc32_mismatches += std::count_if(
+      file.downstream_crc32.begin(), file.downstream_crc32.end(),
+      [&](const auto& downstream_crc32) { return downstream_crc32 && *downstream_crc32 != crc32; });
+  UpdateConfirmed(file_it);
+}
+
+bool Relay::Confirmed(uint64_t file_id) const {
+  std::lock_guard lock(mutex_);
+  const auto file_it = files_.find(file_id);
+  return file_it != files_.end() && file_it->second.confirmed;
+}
+
+void Relay::Forget(uint64_t file_id) {
+  std::lock_guard lock(mutex_);
+  files_.erase(file_id);
+}
+
+Relay::Stats Relay::stats() const {
+  std::lock_guard lock(mutex_);
+  return stats_;
+}
+
+void Relay::Run() {
+  while (!stop_.load(std::memory_order_relaxed)) {
+    TakeQueued();
+    for (auto& downstream : downstream_) {
+      Retransmit(&downstream);
+      SendWindow(&downstream);
+    }
+
+    ReceiveACKs();
+    Wait(NextTimeout());
+  }
+}
+
+void Relay::TakeQueued() {
+  std::vector<Segment> queue;
+  {
+    std::lock_guard lock(mutex_);
+    queue.swap(queue_);
+
+    stats_.sent += unpublished_.sent;
+    stats_.retransmitted += unpublished_.retransmitted;
+    stats_.acked += unpublished_.acked;
+    unpublished_ = Stats();
+
+    for (const auto& downstream : downstream_) {
+      if (downstream.abandoned) stats_.abandoned_segments += queue.size();
+    }
+  }
+
+  for (auto& downstream : downstream_) {
+    if (!downstream.abandoned)
+      downstream.pending.insert(downstream.pending.end(), queue.begin(), queue.end());
+  }
+}
+
+void Relay::SendWindow(Downstream* downstream) {
+  while (!downstream->pending.empty() && downstream->in_flight.size() < options_.window) {
+    Send(downstream, downstream->pending.front(), false);
+    downstream->pending.pop_front();
+  }
+}
+
+void Relay::Send(Downstream* downstream, const Segment& segment, bool retransmitted) {
+  base::BufferWriter writer;
+  writer.AppendInt(segment.header.seq_number);
+  writer.AppendInt(segment.header.seq_total);
+  writer.AppendInt(static_cast<uint8_t>(Packet::Type::PUT));
+  writer.AppendInt(segment.header.file_id);
+  writer.AppendArray(segment.data.data(), segment.data.size());
+  const auto datagram = writer.TakeBuf();
+
+  // Lost datagram is no different from the one which couldn't be sent
+  socket_.SendTo(downstream->address, datagram.data(), datagram.size(), 0);
+
+  const SegmentKey key(segment.header.file_id, segment.header.seq_number);
+  const auto now = Clock::now();
+  if (downstream->in_flight.empty()) downstream->waiting_since = now;
+  downstream->in_flight.insert_or_assign(key, InFlight{
+      .segment = segment,
+      .sent_at = now,
+      .retransmitted = retransmitted,
+  });
+  downstream->timers.emplace_back(key, now);
+
+  ++unpublished_.sent;
+  if (retransmitted) ++unpublished_.retransmitted;
+}
+
+void Relay::Retransmit(Downstream* downstream) {
+  const auto now = Clock::now();
+  auto backed_off = false;
+
+  while (!downstream->timers.empty()) {
+    const auto [key, sent_at] = downstream->timers.front();
+    const auto in_flight_it = downstream->in_flight.find(key);
+    if (in_flight_it == downstream->in_flight.end() || in_flight_it->second.sent_at != sent_at) {
+      downstream->timers.pop_front();
+      continue;
+    }
+    if (sent_at + downstream->rto > now) break;
+
+    // Segments which time out together are one timeout for the backoff
+    if (!backed_off) {
+      if (options_.give_up_after > Clock::duration::zero() &&
+          now - downstream->waiting_since >= options_.give_up_after) {
+        Abandon(downstream);
+        return;
+      }
+      downstream->rto = std::min(downstream->rto * 2,
+                                 duration_cast<Clock::duration>(options_.max_rto));
+      backed_off = true;
+    }
+
+    downstream->timers.pop_front();
+    Send(downstream, in_flight_it->second.segment, true);
+  }
+}
+
+void Relay::Abandon(Downstream* downstream) {
+  const auto segments = downstream->pending.size() + downstream->in_flight.size();
+  downstream->abandoned = true;
+  downstream->pending.clear();
+  downstream->in_flight.clear();
+  downstream->timers.clear();
+
+  std::lock_guard lock(mutex_);
+  abandoned_[downstream - downstream_.data()] = true;
+  ++stats_.abandoned_downstreams;
+  stats_.abandoned_segments += segments;
+  // Files which were waiting only for this server are confirmed now
+  for (auto file_it = files_.begin(); file_it != files_.end();)
+    file_it = UpdateConfirmed(file_it);
+}
+
+void Relay::Wait(std::optional<Clock::duration> timeout) {
+  sleeping_.store(true);
+  {
+    // Segment could be queued right before the sleep was announced
+    std::lock_guard lock(mutex_);
+    if (!queue_.empty()) timeout = Clock::duration::zero();
+  }
+  for (const auto& downstream : downstream_) {
+    if (!downstream.pending.empty() && downstream.in_flight.size() < options_.window)
+      timeout = Clock::duration::zero();
+  }
+
+  pollfd fds[] = {
+      { .fd = socket_.fd(), .events = POLLIN, .revents = 0 },
+      { .fd = wakeup_fd_,   .events = POLLIN, .revents = 0 },
+  };
+  timespec timeout_spec;
+  if (timeout) {
+    const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(*timeout).count();
+    timeout_spec = { .tv_sec = ns / 1000000000, .tv_nsec = ns % 1000000000 };
+  }
+  ppoll(fds, std::size(fds), timeout ? &timeout_spec : nullptr, nullptr);
+  sleeping_.store(false);
+
+  if (fds[1].revents & POLLIN) {
+    uint64_t count;
+    [[maybe_unused]] const auto read_bytes = read(wakeup_fd_, &count, sizeof(count));
+  }
+}
+
+void Relay::ReceiveACKs() {
+  std::vector<uint8_t> datagram(Packet::MAX_SIZE);
+  net::SockAddr from;
+
+  while (true) {
+    const auto bytes_received = socket_.RecvFrom(datagram.data(), datagram.size(), MSG_DONTWAIT, &from);
+    if (bytes_received < 0) break;
+
+    Packet packet;
+    base::BufferReader reader(datagram.data(), bytes_received);
+    if (!packet.ReadFrom(&reader) || packet.header().type != Packet::Type::ACK) continue;
+
+    const auto downstream_it = std::find_if(downstream_.begin(), downstream_.end(),
+        [&](const Downstream& downstream) { return downstream.address == from; });
+    if (downstream_it != downstream_.end())
+      OnACK(downstream_it - downstream_.begin(), packet);
+  }
+}
+
+void Relay::OnACK(size_t downstream_no, const Packet& ack) {
+  auto& downstream = downstream_[downstream_no];
+  const auto header = ack.header();
+
+  // Duplicate ACKs come after the file may be forgotten, they must not bring it back
+  const auto in_flight_it = downstream.in_flight.find(SegmentKey(header.file_id, header.seq_number));
+  if (in_flight_it == downstream.in_flight.end()) return;
+
+  // Karn's algorithm: ACK of a retransmitted segment can belong to any copy
+  if (!in_flight_it->second.retransmitted) {
+    const auto rtt = Clock::now() - in_flight_it->second.sent_at;
+    if (!downstream.srtt) {
+      downstream.srtt = rtt;
+      downstream.rttvar = rtt / 2;
+    } else {
+      const auto deviation = *downstream.srtt > rtt ? *downstream.srtt - rtt : rtt - *downstream.srtt;
+      downstream.rttvar = downstream.rttvar * 3 / 4 + deviation / 4;
+      downstream.srtt = *downstream.srtt * 7 / 8 + rtt / 8;
+    }
+
+    const auto rto = *downstream.srtt + std::max<Clock::duration>(CLOCK_GRANULARITY, downstream.rttvar * 4);
+    downstream.rto = std::clamp<Clock::duration>(rto, MIN_RTO, options_.max_rto);
+  }
+
+  downstream.in_flight.erase(in_flight_it);
+  downstream.waiting_since = Clock::now();
+  ++unpublished_.acked;
+
+  // Final ACK carries crc32 of the file
+  uint32_t crc32;
+  base::BufferReader reader(ack.data().data(), ack.data().size());
+  if (!reader.Read4(&crc32)) return;
+
+  std::lock_guard lock(mutex_);
+  const auto file_it = files_.try_emplace(header.file_id).first;
+  auto& file = file_it->second;
+  file.downstream_crc32.resize(downstream_.size());
+  if (file.downstream_crc32[downstream_no] == crc32) return;
+
+  file.downstream_crc32[downstream_no] = crc32;
+  if (file.crc32 && *file.crc32 != crc32) ++stats_.crc32_mismatches;
+  UpdateConfirmed(file_it);
+}
+
+std::optional<Relay::Clock::duration> Relay::NextTimeout() const {
+  std::optional<Clock::time_point> earliest;
+  for (const auto& downstream : downstream_) {
+    if (downstream.timers.empty()) continue;
+
+    // Stale timers only make the wait shorter
+    const auto expires_at = downstream.timers.front().second + downstream.rto;
+    earliest = earliest ? std::min(*earliest, expires_at) : expires_at;
+  }
+
+  if (!earliest) return std::nullopt;
+  return std::max(*earliest - Clock::now(), Clock::duration::zero());
+}
+
+Relay::Files::iterator Relay::UpdateConfirmed(Files::iterator file_it) {
+  auto& file = file_it->second;
+  if (file.confirmed || !file.crc32) return std::next(file_it);
+
+  file.downstream_crc32.resize(downstream_.size());
+  file.confirmed = true;
+  for (size_t downstream_no = 0; downstream_no < downstream_.size(); ++downstream_no) {
+    if (!abandoned_[downstream_no] && file.downstream_crc32[downstream_no] != file.crc32)
+      file.confirmed = false;
+  }
+  if (!file.confirmed) return std::next(file_it);
+
+  ++stats_.confirmed_files;
+  // Nobody asks about the file, its final ACK doesn't wait
+  if (!options_.wait_for_downstream) return files_.erase(file_it);
+  return std::next(file_it);
+}
+
+} // namespace udp_server
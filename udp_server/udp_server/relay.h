@@ -0,0 +1,177 @@
+#ifndef UDP_SERVER_RELAY_H_
+#define UDP_SERVER_RELAY_H_
+
+#include "udp_server/packet.h"
+#include "udp_server/net/sock_addr.h"
+#include "udp_server/net/udp_socket.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace udp_server {
+
+/**
+ * Cut-through replication: PUT segments are forwarded to downstream servers
+ * as soon as they are accepted, not after the whole file is received.
+ * Segments are sent by the relay's own thread over its own socket with
+ * the same protocol, each downstream server has a window of segments in
+ * flight which are retransmitted until the server ACKs them.
+ *
+ * Segment data is not copied: it must stay where Forward found it,
+ * which holds for files in FileStorage.
+ *
+ * A downstream server which ACKs nothing for give_up_after while segments
+ * are in flight is given up on: its segments are dropped and files are
+ * confirmed without it.
+ */
+class Relay {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  struct Options {
+    /// Segments in flight to each downstream server
+    size_t window = 128;
+    /// Retransmission timeout until the round trip time is measured
+    std::chrono::microseconds initial_rto = std::chrono::milliseconds(200);
+    /// Timeout backs off up to that while a server doesn't answer
+    std::chrono::microseconds max_rto = std::chrono::seconds(1);
+    /// Upstream final ACK waits until all downstream servers have the file
+    bool wait_for_downstream = false;
+    /// Downstream server which ACKs nothing for that long is given up on,
+    /// zero never gives up
+    std::chrono::microseconds give_up_after = std::chrono::seconds(30);
+  };
+
+  struct Stats {
+    uint64_t forwarded = 0;
+    uint64_t sent = 0;
+    uint64_t retransmitted = 0;
+    uint64_t acked = 0;
+    uint64_t confirmed_files = 0;
+    uint64_t crc32_mismatches = 0;
+    /// Downstream servers which were given up on
+    uint64_t abandoned_downstreams = 0;
+    /// Segments which were never sent or ACKed to them
+    uint64_t abandoned_segments = 0;
+  };
+
+  Relay(std::vector<net::SockAddr> downstream, const Options& options);
+  Relay(const Relay&) = delete;
+  ~Relay();
+
+  Relay& operator=(const Relay&) = delete;
+
+  /// Opens the socket and starts the sending thread.
+  bool Start();
+  /// Stops the sending thread, segments which are not ACKed yet are abandoned.
+  void Stop();
+
+  /// Queues the segment for all downstream servers.
+  void Forward(const Packet::Header& header, std::span<const uint8_t> data);
+  /// Tells crc32 of the file, downstream servers have to report the same.
+  void OnFileCompleted(uint64_t file_id, uint32_t crc32);
+  /// @return all downstream servers have reported the file complete
+  /// with the crc32 passed to OnFileCompleted
+  [[nodiscard]] bool Confirmed(uint64_t file_id) const;
+  /// Forgets the confirmed file once its final ACK is sent upstream. Without
+  /// wait_for_downstream files are forgotten as soon as they are confirmed.
+  void Forget(uint64_t file_id);
+
+  [[nodiscard]] const Options& options() const { return options_; }
+  [[nodiscard]] Stats stats() const;
+private:
+  struct Segment {
+    Packet::Header header;
+    std::span<const uint8_t> data;
+  };
+
+  /// (file_id, seq_number)
+  using SegmentKey = std::pair<uint64_t, uint32_t>;
+  struct SegmentKeyHash {
+    size_t operator()(const SegmentKey& key) const {
+      return std::hash<uint64_t>()(key.first * 0x9e3779b97f4a7c15 + key.second);
+    }
+  };
+
+  struct InFlight {
+    Segment segment;
+    Clock::time_point sent_at;
+    bool retransmitted;
+  };
+
+  /// Sender state of one downstream server, owned by the relay thread.
+  struct Downstream {
+    net::SockAddr address;
+    std::deque<Segment> pending;
+    std::unordered_map<SegmentKey, InFlight, SegmentKeyHash> in_flight;
+    /// Segments in the order they were sent, entries of segments which
+    /// are ACKed or sent again are skipped
+    std::deque<std::pair<SegmentKey, Clock::time_point>> timers;
+
+    std::optional<Clock::duration> srtt;
+    Clock::duration rttvar;
+    Clock::duration rto;
+    /// Last ACK, or the first send since nothing was in flight
+    Clock::time_point waiting_since;
+    bool abandoned;
+  };
+
+  /// Completion state of a file, guarded by mutex_
+  struct FileState {
+    std::optional<uint32_t> crc32;
+    /// crc32 reported by each downstream server
+    std::vector<std::optional<uint32_t>> downstream_crc32;
+    bool confirmed = false;
+  };
+
+  void Run();
+  /// Moves forwarded segments to every downstream server and publishes stats.
+  void TakeQueued();
+  void SendWindow(Downstream* downstream);
+  void Send(Downstream* downstream, const Segment& segment, bool retransmitted);
+  void Retransmit(Downstream* downstream);
+  /// Gives up on the server which doesn't answer.
+  void Abandon(Downstream* downstream);
+  /// Waits for ACKs or new segments up to the timeout.
+  void Wait(std::optional<Clock::duration> timeout);
+  void ReceiveACKs();
+  void OnACK(size_t downstream_no, const Packet& ack);
+  /// @return time until the earliest retransmission, nothing if there is nothing in flight
+  std::optional<Clock::duration> NextTimeout() const;
+
+  using Files = std::unordered_map<uint64_t, FileState>;
+  /// Updates confirmation of the file, mutex_ must be held.
+  /// @return iterator of the next file, the file may be forgotten
+  Files::iterator UpdateConfirmed(Files::iterator file_it);
+
+  const Options options_;
+  net::UDPSocket socket_;
+  int wakeup_fd_;
+  std::vector<Downstream> downstream_;
+  /// Counters of the relay thread which are not published yet
+  Stats unpublished_;
+
+  mutable std::mutex mutex_;
+  std::vector<Segment> queue_;
+  Files files_;
+  /// Downstream servers which were given up on, files don't wait for them
+  std::vector<bool> abandoned_;
+  Stats stats_;
+
+  std::atomic<bool> sleeping_;
+  std::atomic<bool> stop_;
+  std::thread thread_;
+};
+
+} // namespace udp_server
+
+#endif // UDP_SERVER_RELAY_H_
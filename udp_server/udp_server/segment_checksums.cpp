@@ -0,0 +1,111 @@
+#include "udp_server/segment_checksums.h"
+
+#include "udp_server/base/buffer_reader.h"
+#include "udp_server/base/buffer_writer.h"
+#include "udp_server/base/crc32.h"
+
+#include <algorithm>
+
+namespace udp_server {
+
+// static
+const size_t SegmentChecksums::MAX_CHECKSUMS = Packet::MAX_DATA_SIZE / sizeof(uint32_t);
+
+SegmentChecksums::SegmentChecksums(const Options& options)
+                : options_(options),
+                  files_(),
+                  bytes_(0),
+                  stats_() {}
+
+// static
+size_t SegmentChecksums::ExpectedSize(uint32_t segments) {
+  return size_t{segments} * sizeof(uint32_t) + (size_t{segments} + 63) / 64 * sizeof(uint64_t);
+}
+
+std::optional<Packet> SegmentChecksums::Announce(const Packet& checksums) {
+  const auto header = checksums.header();
+  const auto& data = checksums.data();
+  if (header.seq_total == 0 || header.seq_number >= header.seq_total ||
+      data.size() % sizeof(uint32_t) != 0 ||
+      data.size() / sizeof(uint32_t) > header.seq_total - header.seq_number) {
+    return std::nullopt;
+  }
+
+  auto expected_it = files_.find(header.file_id);
+  if (expected_it == files_.end()) {
+    // Checked before anything is allocated, seq_total comes from the client
+    const auto size = ExpectedSize(header.seq_total);
+    if (header.seq_total > options_.max_segments || bytes_ + size > options_.max_bytes) {
+      ++stats_.rejected_files;
+      return std::nullopt;
+    }
+
+    bytes_ += size;
+    expected_it = files_.emplace(header.file_id, Expected{
+        .crc32 = std::vector<uint32_t>(header.seq_total),
+        .announced = std::vector<uint64_t>((header.seq_total + 63) / 64),
+    }).first;
+    ++stats_.announced_files;
+  }
+
+  auto& expected = expected_it->second;
+  if (expected.crc32.size() != header.seq_total) return std::nullopt;
+
+  base::BufferReader reader(data.data(), data.size());
+  uint32_t crc32;
+  for (auto segment_no = header.seq_number; reader.Read4(&crc32); ++segment_no) {
+    expected.crc32[segment_no] = crc32;
+    expected.announced[segment_no / 64] |= uint64_t{1} << (segment_no % 64);
+  }
+
+  return Packet::Checksums(header);
+}
+
+bool SegmentChecksums::Verify(const Packet::Header& header, std::span<const uint8_t> data) {
+  const auto expected_it = files_.find(header.file_id);
+  if (expected_it == files_.end()) return true;
+
+  const auto& expected = expected_it->second;
+  const auto segment_no = header.seq_number;
+  if (segment_no >= expected.crc32.size() ||
+      !(expected.announced[segment_no / 64] & (uint64_t{1} << (segment_no % 64)))) {
+    return true;
+  }
+
+  if (base::Crc32(0, data) != expected.crc32[segment_no]) {
+    ++stats_.corrupted_segments;
+    return false;
+  }
+
+  ++stats_.verified_segments;
+  return true;
+}
+
+void SegmentChecksums::Forget(uint64_t file_id) {
+  const auto expected_it = files_.find(file_id);
+  if (expected_it == files_.end()) return;
+
+  bytes_ -= ExpectedSize(static_cast<uint32_t>(expected_it->second.crc32.size()));
+  files_.erase(expected_it);
+}
+
+Packet SegmentChecksums::MakeVerifyPacket(const File* file, const Packet::Header& request) {
+  ++stats_.verify_requests;
+
+  base::BufferWriter data;
+  uint32_t segments = 0;
+  if (file) {
+    segments = static_cast<uint32_t>(file->capacity());
+    const auto first = std::min(request.seq_number, segments);
+    const auto last = static_cast<uint32_t>(std::min<size_t>(first + MAX_CHECKSUMS, segments));
+    for (auto segment_no = first; segment_no < last; ++segment_no) {
+      // Segment which hasn't arrived yet is reported as 0
+      const auto crc32 = file->has_segment(segment_no) ? base::Crc32(0, file->segment(segment_no)) : 0;
+      data.AppendInt(crc32);
+    }
+  }
+
+  return Packet::Verify(request, segments, data.TakeBuf());
+}
+
+} // namespace udp_server
@@ -0,0 +1,86 @@
+#ifndef UDP_SERVER_SEGMENT_CHECKSUMS_H_
+#define UDP_SERVER_SEGMENT_CHECKSUMS_H_
+
+#include "udp_server/file.h"
+#include "udp_server/packet.h"
+
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+namespace udp_server {
+
+/**
+ * Per-segment crc32c, so a corrupted segment is caught when it arrives
+ * rather than by crc32 of the whole file. A PUT has no room for the
+ * checksum, so the client announces checksums of a file in CHECKSUMS
+ * packets before the data: seq_number is the first segment, seq_total is
+ * the number of segments of the file and data is crc32c of segments from
+ * the first on. The answer is CHECKSUMS with the same header and no data.
+ * A segment which doesn't match its checksum is not stored and gets NACK,
+ * so the client sends it again at once.
+ *
+ * VERIFY asks for crc32c of segments of the server's copy from seq_number
+ * on, the answer has number of segments in seq_total (0 if there is no
+ * such file), so the client can tell which segments of a file with wrong
+ * crc32 differ.
+ */
+class SegmentChecksums {
+public:
+  struct Options {
+    /// Files of more segments can't announce checksums
+    uint32_t max_segments = 1 << 20;
+    /// Memory of announced checksums of all files, files which don't fit
+    /// aren't verified
+    size_t max_bytes = 64 << 20;
+  };
+
+  struct Stats {
+    uint64_t announced_files = 0;
+    uint64_t verified_segments = 0;
+    uint64_t corrupted_segments = 0;
+    uint64_t verify_requests = 0;
+    /// CHECKSUMS of files which are too large or don't fit into max_bytes
+    uint64_t rejected_files = 0;
+  };
+
+  /// Checksums which fit into a CHECKSUMS or VERIFY packet
+  static const size_t MAX_CHECKSUMS;
+
+  explicit SegmentChecksums(const Options& options);
+
+  /// Records checksums from the CHECKSUMS packet.
+  /// @return the answer or nullopt if the packet is invalid or there is no room
+  std::optional<Packet> Announce(const Packet& checksums);
+  /// @return false if the segment doesn't match its announced checksum,
+  /// segments without one are accepted
+  bool Verify(const Packet::Header& header, std::span<const uint8_t> data);
+  /// Drops checksums of the complete file.
+  void Forget(uint64_t file_id);
+
+  /// @param file file with the id from the request or nullptr if there is no such file
+  Packet MakeVerifyPacket(const File* file, const Packet::Header& request);
+
+  [[nodiscard]] size_t bytes() const { return bytes_; }
+  [[nodiscard]] const Stats& stats() const { return stats_; }
+private:
+  /// @return memory of checksums of a file with that many segments
+  static size_t ExpectedSize(uint32_t segments);
+
+  struct Expected {
+    std::vector<uint32_t> crc32;
+    /// Bitmap of segments with announced checksums
+    std::vector<uint64_t> announced;
+  };
+
+  const Options options_;
+  std::unordered_map<uint64_t, Expected> files_;
+  size_t bytes_;
+  Stats stats_;
+};
+
+} // namespace udp_server
+
+#endif // UDP_SERVER_SEGMENT_CHECKSUMS_H_
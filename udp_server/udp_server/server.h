@@ -1,37 +1,137 @@
 #ifndef UDP_SERVER_SERVER_H_
 #define UDP_SERVER_SERVER_H_
 
-#include "udp_server/file.h"
+#include "udp_server/capture.h"
 #include "udp_server/packet.h"
-#include "udp_server/net/udp_socket.h"
+#include "udp_server/server_core.h"
+#include "udp_server/udp_transport.h"
+#include "udp_server/net/sock_addr.h"
 
-#include <functional>
-#include <unordered_map>
+#include <atomic>
+#include <csignal>
+#include <memory>
+#include <pthread.h>
+#include <thread>
+#include <utility>
+#include <vector>
 
 namespace udp_server {
 
-class Server {
+/**
+ * Server which feeds datagrams from the Transport into the core.
+ * Transport has to provide:
+ *  - void SetupThread();
+ *  - ssize_t Receive(uint8_t* buf, size_t len, net::SockAddr* from, const std::atomic<bool>& stop);
+ *  - void Send(const net::SockAddr& to, const uint8_t* buf, size_t len);
+ *  - void Shutdown(), which makes Receive return in all threads;
+ * see UDPTransport. Other policies are described in BasicServerCore.
+ *
+ * With several workers every worker thread receives from the transport
+ * and feeds the core concurrently, so datagrams of one upload are spread
+ * over all of them.
+ */
+template <class Transport, class Storage, class Hasher, class CompletionHandler,
+          class ContiguousDataHandler = NoContiguousDataHandler>
+class BasicServer {
 public:
-  explicit Server(net::UDPSocket&& socket);
+  using Core = BasicServerCore<Storage, Hasher, CompletionHandler, ContiguousDataHandler>;
 
-  void Run();
+  template <class... TransportArgs>
+  explicit BasicServer(TransportArgs&&... transport_args)
+      : transport_(std::forward<TransportArgs>(transport_args)...),
+        capture_(),
+        workers_(1),
+        stop_(false),
+        core_() {}
 
-  void OnNewFile(const std::function<void(const File& file, uint32_t crc32)>& handler);
+  void Run() {
+    transport_.SetupThread();
+
+    // Files which were completed just before previous run had finished
+    core_.CompleteRestoredFiles();
+
+    if (workers_ <= 1) {
+      ReceiveLoop();
+      return;
+    }
+
+    std::vector<std::thread> threads;
+    for (size_t worker_no = 1; worker_no < workers_; ++worker_no) {
+      threads.emplace_back([this] {
+        // Signals are handled by the thread which has called Run
+        sigset_t signals;
+        sigfillset(&signals);
+        pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+        transport_.SetupThread();
+        ReceiveLoopConcurrently();
+      });
+    }
+
+    ReceiveLoopConcurrently();
+    Stop();
+    transport_.Shutdown();
+    for (auto& thread : threads)
+      thread.join();
+  }
+  /// Makes Run return. It is safe to call from a signal handler.
+  void Stop() { stop_.store(true, std::memory_order_relaxed); }
+
+  /// Records every received datagram into the capture.
+  void UseCapture(std::unique_ptr<CaptureWriter> capture) { capture_ = std::move(capture); }
+  /// Receives with that many threads, capture isn't written with more than one.
+  void UseWorkers(size_t workers) { workers_ = workers; }
+
+  [[nodiscard]] Transport& transport() { return transport_; }
+  [[nodiscard]] const Transport& transport() const { return transport_; }
+  [[nodiscard]] Core& core() { return core_; }
+  [[nodiscard]] const Core& core() const { return core_; }
 private:
-  std::pair<ssize_t, std::unique_ptr<net::Address>> ReceivePacket(Packet* receive_into);
-  void AddPacket(Packet&& packet);
+  void ReceiveLoop() {
+    std::vector<uint8_t> datagram(Packet::MAX_SIZE);
+    std::vector<uint8_t> reply(Packet::MAX_SIZE);
+    net::SockAddr from;
+    while (!stop_.load(std::memory_order_relaxed)) {
+      const auto bytes_received = transport_.Receive(datagram.data(), datagram.size(), &from, stop_);
+      if (bytes_received < 0) break;
+
+      if (capture_)
+        capture_->Write(from, datagram.data(), bytes_received);
+
+      const auto reply_size = core_.HandleDatagram(from, datagram.data(), bytes_received, reply.data());
+      if (reply_size > 0)
+        transport_.Send(from, reply.data(), reply_size);
+    }
+  }
 
-  void SendACK(const net::Address& to, const Packet::Header& header);
-  Packet MakeACKPacket(const Packet::Header& header);
-  uint32_t CalculateCrc32(const File& file);
+  void ReceiveLoopConcurrently() {
+    typename Core::Worker worker;
+    std::vector<uint8_t> datagram(Packet::MAX_SIZE);
+    std::vector<uint8_t> reply(Packet::MAX_SIZE);
+    net::SockAddr from;
+    while (!stop_.load(std::memory_order_relaxed)) {
+      const auto bytes_received = transport_.Receive(datagram.data(), datagram.size(), &from, stop_);
+      if (bytes_received < 0) break;
 
-  net::UDPSocket socket_;
-  std::unordered_map<uint64_t, File> files_;
-  std::unordered_map<uint64_t, uint32_t> crc32_;
+      const auto reply_size = core_.HandleDatagramConcurrently(&worker, from, datagram.data(),
+                                                               bytes_received, reply.data());
+      if (reply_size > 0)
+        transport_.Send(from, reply.data(), reply_size);
+    }
+  }
 
-  std::function<void(const File& file, uint32_t crc32)> on_new_file_;
+  Transport transport_;
+  std::unique_ptr<CaptureWriter> capture_;
+  size_t workers_;
+  std::atomic<bool> stop_;
+
+  Core core_;
 };
 
+/// UDP server with handlers which can be set at runtime.
+using Server =
+    BasicServer<UDPTransport, FileStorage, Crc32Hasher, NewFileHandler, ContiguousDataHandler>;
+
 } // namespace udp_server
 
 #endif // UDP_SERVER_SERVER_H_
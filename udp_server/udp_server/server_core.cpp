@@ -0,0 +1,80 @@
+#include "udp_server/server_core.h"
+
+#include "udp_server/base/buffer_writer.h"
+#include "udp_server/base/sha256.h"
+
+namespace udp_server::internal {
+namespace {
+
+/// Each missing range in STATE packet takes two uint32_t
+const size_t MAX_MISSING_RANGES =
+    (Packet::MAX_DATA_SIZE - sizeof(uint32_t)) / (2 * sizeof(uint32_t));
+
+} // namespace
+
+ContentIndex::Key MakeContentKey(const File& file) {
+  ContentIndex::Key key{};
+  base::Sha256 sha256;
+  for (const auto data : file) {
+    sha256.Update(data.data(), data.size());
+    key.size += data.size();
+  }
+  key.sha256 = sha256.Finish();
+
+  return key;
+}
+
+bool ParseContentKey(const Packet& query, ContentIndex::Key* key) {
+  base::BufferReader reader(query.data().data(), query.data().size());
+  std::vector<uint8_t> sha256;
+
+  const auto parsed =
+      reader.Read8(&key->size) &&
+      reader.ReadToVector(&sha256, key->sha256.size());
+  if (parsed)
+    std::copy(sha256.begin(), sha256.end(), key->sha256.begin());
+
+  return parsed;
+}
+
+Packet MakeStatePacket(const File* file, const Packet::Header& request) {
+  base::BufferWriter ranges;
+  uint32_t received = 0;
+  uint32_t scanned_until = request.seq_total;
+
+  if (!file) {
+    if (request.seq_number < request.seq_total) {
+      ranges.AppendInt(request.seq_number);
+      ranges.AppendInt(request.seq_total - request.seq_number);
+    }
+  } else {
+    received = file->size();
+    scanned_until = file->capacity();
+
+    auto missing = file->FindMissing(request.seq_number);
+    for (size_t count = 0; missing < file->capacity(); ++count) {
+      if (count == MAX_MISSING_RANGES) {
+        scanned_until = missing;
+        break;
+      }
+
+      const auto next_received = file->FindReceived(missing);
+      ranges.AppendInt(missing);
+      ranges.AppendInt(next_received - missing);
+      missing = file->FindMissing(next_received);
+    }
+  }
+
+  base::BufferWriter data;
+  data.AppendInt(scanned_until);
+  data.AppendVector(ranges.TakeBuf());
+  return Packet::State(request, received, data.TakeBuf());
+}
+
+Packet MakeCompleteStatePacket(const Packet::Header& request) {
+  base::BufferWriter data;
+  data.AppendInt(request.seq_total);
+  return Packet::State(request, request.seq_total, data.TakeBuf());
+}
+
+} // namespace udp_server::internal
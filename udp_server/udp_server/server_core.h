@@ -0,0 +1,623 @@
+#ifndef UDP_SERVER_SERVER_CORE_H_
+#define UDP_SERVER_SERVER_CORE_H_
+
+#include "udp_server/admission.h"
+#include "udp_server/content_index.h"
+#include "udp_server/delta_index.h"
+#include "udp_server/file.h"
+#include "udp_server/file_storage.h"
+#include "udp_server/hashers.h"
+#include "udp_server/journal.h"
+#include "udp_server/overload.h"
+#include "udp_server/packed_packets.h"
+#include "udp_server/packet.h"
+#include "udp_server/recent_files.h"
+#include "udp_server/relay.h"
+#include "udp_server/segment_checksums.h"
+#include "udp_server/base/buffer_reader.h"
+#include "udp_server/net/sock_addr.h"
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+namespace udp_server {
+
+/// Completion handler which does nothing, for cores which don't need
+/// to know about new files (e.g. replay).
+struct NoCompletionHandler {
+  void operator()(const File& /* file */, uint32_t /* crc32 */) const {}
+};
+
+/// Contiguous data handler which isn't interested in data, the core
+/// doesn't even track contiguous prefixes of files for it.
+struct NoContiguousDataHandler {
+  void operator()(const File& /* file */, uint64_t /* offset */,
+                  std::span<const uint8_t> /* data */) const {}
+};
+
+namespace internal {
+
+/// Parts of the core which don't depend on its policies.
+/// @{
+ContentIndex::Key MakeContentKey(const File& file);
+bool ParseContentKey(const Packet& query, ContentIndex::Key* key);
+/// @param file file with the id from the request or nullptr if there is no such file
+Packet MakeStatePacket(const File* file, const Packet::Header& request);
+/// State of a complete file which the storage doesn't have any more
+Packet MakeCompleteStatePacket(const Packet::Header& request);
+/// @}
+
+/// @return false if the handler is an empty std::function or alike
+template <class Handler>
+bool IsCallable(const Handler& handler) {
+  if constexpr (std::is_constructible_v<bool, const Handler&>) {
+    return static_cast<bool>(handler);
+  } else {
+    return true;
+  }
+}
+
+} // namespace internal
+
+/**
+ * Protocol logic of the server: sessions, file reassembly and replies.
+ * It knows nothing about a transport, so it can be fed with datagrams
+ * from a socket as well as from a capture.
+ *
+ * Policies are resolved at compile time:
+ *  - Storage owns files, see FileStorage;
+ *  - Hasher calculates crc32 of a complete file, see hashers.h;
+ *  - CompletionHandler is called as handler(file, crc32) for every new file;
+ *  - ContiguousDataHandler is called as handler(file, offset, data) whenever
+ *    contiguous prefix of a file grows, so data can be consumed in order
+ *    while the rest of the file is still being received. It is called
+ *    for all data of the file before the completion handler.
+ *
+ * Files of a single segment may be completed right from the datagram,
+ * see UseRecentFiles; handlers get a file which borrows the datagram then.
+ *
+ * The core is single-threaded, except HandleDatagramConcurrently.
+ */
+template <class Storage, class Hasher, class CompletionHandler,
+          class ContiguousDataHandler = NoContiguousDataHandler>
+class BasicServerCore {
+public:
+  /// State of a thread which calls HandleDatagramConcurrently: the last
+  /// concurrent file it has added to, its segments are added without the lock.
+  struct Worker {
+    uint64_t file_id = 0;
+    File* file = nullptr;
+  };
+  /// Files of more segments are rejected by default, see LimitSegments
+  static constexpr uint32_t DEFAULT_MAX_SEGMENTS = 1 << 22;
+
+  struct PackedStats {
+    /// PACKED_PUT datagrams
+    uint64_t datagrams = 0;
+    /// PUT packets which came in them
+    uint64_t records = 0;
+  };
+
+  BasicServerCore()
+      : mutex_(),
+        concurrent_min_segments_(0),
+        max_segments_(DEFAULT_MAX_SEGMENTS),
+        admission_control_(),
+        overload_shedding_(),
+        storage_(),
+        hasher_(),
+        crc32_(),
+        content_index_(),
+        delta_index_(),
+        recent_files_(),
+        segment_checksums_(),
+        relay_(),
+        awaiting_downstream_(),
+        packed_stats_(),
+        record_reply_(Packet::MAX_SIZE),
+        on_new_file_(),
+        on_contiguous_data_(),
+        on_dropped_file_() {}
+
+  /// Handles one datagram received from the client.
+  /// @return packet to send back to the client
+  std::optional<Packet> HandleDatagram(const net::SockAddr& from, const uint8_t* data, size_t size) {
+    Packet packet;
+    base::BufferReader buffer_reader(data, size);
+    if (!packet.ReadFrom(&buffer_reader)) return std::nullopt;
+
+    return HandlePacket(from, std::move(packet));
+  }
+  /// HandleDatagram which writes the reply into `reply` of Packet::MAX_SIZE
+  /// bytes, so the final ACK of a single segment file needs no Packet.
+  /// It handles PACKED_PUT as well.
+  /// @return size of the reply, 0 if there is nothing to send back
+  size_t HandleDatagram(const net::SockAddr& from, const uint8_t* data, size_t size, uint8_t* reply) {
+    const auto header = Packet::PeekHeader(data, size);
+    if (!header) return 0;
+    if (header->type == Packet::Type::PACKED_PUT) return HandlePackedPut(from, data, size, reply);
+    if (const auto ack_size = CompleteSingleSegment(*header, from, data, size, reply))
+      return *ack_size;
+
+    return WriteReply(HandleDatagram(from, data, size), reply);
+  }
+  /// HandleDatagram which may be called by several threads, each with its
+  /// own worker. PUT segments of the worker's concurrent file go straight
+  /// into the file, everything else is handled under the lock.
+  /// @return size of the reply which is written into `reply`, 0 if there is none
+  size_t HandleDatagramConcurrently(Worker* worker, const net::SockAddr& from,
+                                    const uint8_t* data, size_t size, uint8_t* reply) {
+    const auto header = Packet::PeekHeader(data, size);
+    if (!header) return 0;
+    if (header->type == Packet::Type::PACKED_PUT) {
+      std::lock_guard lock(mutex_);
+      return HandlePackedPut(from, data, size, reply);
+    }
+    if (IsSingleSegmentPut(*header)) {
+      std::lock_guard lock(mutex_);
+      if (const auto ack_size = CompleteSingleSegment(*header, from, data, size, reply))
+        return *ack_size;
+    }
+
+    return WriteReply(HandlePacketConcurrently(worker, from, data, size), reply);
+  }
+  /// Completes files which were received in full before the core was fed,
+  /// e.g. files restored from the journal, and relays their segments.
+  void CompleteRestoredFiles() {
+    std::vector<File*> completed;
+    storage_.ForEach([&](File& file) {
+      if (relay_) RelayReceivedSegments(file);
+      if (file.full() && !crc32_.contains(file.id()))
+        completed.push_back(&file);
+    });
+
+    for (auto* file : completed) {
+      DeliverContiguousData(file);
+      OnFileCompleted(*file);
+    }
+  }
+
+  void OnNewFile(CompletionHandler handler) { on_new_file_ = std::move(handler); }
+  void OnContiguousData(ContiguousDataHandler handler) { on_contiguous_data_ = std::move(handler); }
+  /// Called as handler(file) before an incomplete file is dropped, so
+  /// whatever was made of its data can be discarded.
+  void OnDroppedFile(std::function<void(const File& file)> handler) {
+    on_dropped_file_ = std::move(handler);
+  }
+  /// Enables QUERY packets handling: completed files are recorded in the index,
+  /// and clients can skip upload of files with content which is in the index.
+  void UseContentIndex(std::unique_ptr<ContentIndex> index) { content_index_ = std::move(index); }
+  /// Enables delta uploads: completed files get block signatures which
+  /// clients can ask for, and COPY packets build segments from them.
+  /// Storage must keep complete files, they are the bases.
+  void UseDeltaIndex(std::unique_ptr<DeltaIndex> index) { delta_index_ = std::move(index); }
+  /// Drops PUT packets of clients which send faster than the limits.
+  void UseAdmissionControl(const AdmissionControl::Options& options) {
+    admission_control_.emplace(options);
+  }
+  /// Sheds PUT packets of new files and of files which are far from
+  /// complete while the server is overloaded, and drops idle incomplete
+  /// files then, see OverloadShedding. Segments of concurrent files are
+  /// never shed and the files are never dropped. Nothing is dropped while
+  /// the relay is used, it sends segments right from the files.
+  void UseOverloadShedding(const OverloadShedding::Options& options,
+                           OverloadShedding::QueueProbe queue_probe) {
+    overload_shedding_.emplace(options, std::move(queue_probe));
+  }
+  /// Files of at least that many segments are received concurrently by
+  /// all threads which call HandleDatagramConcurrently, so a single huge
+  /// upload isn't limited by one core. Storage must never move or drop
+  /// files, and concurrent files don't go through admission control,
+  /// segment checksums, the relay or the contiguous data handler, so the
+  /// core makes files concurrent only without them.
+  void UseConcurrentInsert(uint32_t min_segments) { concurrent_min_segments_ = min_segments; }
+  /// PUT packets of files with more segments are dropped before anything
+  /// is allocated: the number of segments comes from the client, and memory
+  /// (or a journal file) of that size is mapped for a new file.
+  void LimitSegments(uint32_t max_segments) { max_segments_ = max_segments; }
+  /// Completes files of a single segment right from the datagram: no file
+  /// is created in the storage, and the cache of `capacity` recent files
+  /// answers retransmissions. Files pushed out of the cache keep their
+  /// crc32 with other complete files. Files which the storage must keep
+  /// (relay, delta bases) are received as usual.
+  void UseRecentFiles(size_t capacity) { recent_files_ = std::make_unique<RecentFiles>(capacity); }
+  /// Verifies segments against checksums which clients announce and
+  /// NACKs corrupted ones, see SegmentChecksums.
+  void UseSegmentChecksums(std::unique_ptr<SegmentChecksums> checksums) {
+    segment_checksums_ = std::move(checksums);
+  }
+  /// Forwards every accepted segment to the relay's downstream servers.
+  /// The relay must be started.
+  void UseRelay(std::unique_ptr<Relay> relay) { relay_ = std::move(relay); }
+
+  [[nodiscard]] Storage& storage() { return storage_; }
+  [[nodiscard]] const Storage& storage() const { return storage_; }
+  [[nodiscard]] const AdmissionControl* admission_control() const {
+    return admission_control_ ? &*admission_control_ : nullptr;
+  }
+  [[nodiscard]] const OverloadShedding* overload_shedding() const {
+    return overload_shedding_ ? &*overload_shedding_ : nullptr;
+  }
+  [[nodiscard]] const Relay* relay() const { return relay_.get(); }
+  [[nodiscard]] const DeltaIndex* delta_index() const { return delta_index_.get(); }
+  [[nodiscard]] const RecentFiles* recent_files() const { return recent_files_.get(); }
+  [[nodiscard]] const SegmentChecksums* segment_checksums() const { return segment_checksums_.get(); }
+  [[nodiscard]] const PackedStats& packed_stats() const { return packed_stats_; }
+  [[nodiscard]] size_t completed_files() const {
+    if (!recent_files_) return crc32_.size();
+    const auto& stats = recent_files_->stats();
+    return crc32_.size() + stats.files - stats.evicted;
+  }
+private:
+  std::optional<Packet> HandlePacketConcurrently(Worker* worker, const net::SockAddr& from,
+                                                 const uint8_t* data, size_t size) {
+    Packet packet;
+    base::BufferReader buffer_reader(data, size);
+    if (!packet.ReadFrom(&buffer_reader)) return std::nullopt;
+
+    const Packet::Header header = packet.header();
+    auto* file = worker->file;
+    if (header.type == Packet::Type::PUT && file && header.file_id == worker->file_id &&
+        !file->full()) {
+      if (!file->AddSegment(std::move(packet))) return std::nullopt;
+
+      auto ack_header = header;
+      ack_header.seq_total = file->size();
+      if (ack_header.seq_total < file->capacity()) return Packet::ACK(ack_header);
+
+      // Whichever thread sees the file full first completes it
+      std::lock_guard lock(mutex_);
+      if (!crc32_.contains(file->id()))
+        OnFileCompleted(*file);
+      return MakeACKPacket(*file, header);
+    }
+
+    std::lock_guard lock(mutex_);
+    auto reply = HandlePacket(from, std::move(packet));
+    if (header.type == Packet::Type::PUT || header.type == Packet::Type::COPY) {
+      file = storage_.Find(header.file_id);
+      if (file && file->concurrent()) {
+        worker->file_id = header.file_id;
+        worker->file = file;
+      }
+    }
+    return reply;
+  }
+
+  std::optional<Packet> HandlePacket(const net::SockAddr& from, Packet&& packet) {
+    switch (packet.header().type) {
+      case Packet::Type::COPY: {
+        // Before the segment is copied from the base, so a client over its
+        // rate costs no more than a dropped PUT
+        const auto datagram_size = Packet::HEADER_SIZE + packet.data().size();
+        if (admission_control_ && !admission_control_->Admit(from, datagram_size))
+          return std::nullopt;
+
+        // A late COPY of a complete file is answered without the base, so
+        // the delta index doesn't expect a crc32 for it again
+        if (const auto crc_it = crc32_.find(packet.header().file_id); crc_it != crc32_.end()) {
+          const auto* file = storage_.Find(crc_it->first);
+          return file ? MakeACKPacket(*file, packet.header()) : Packet::ACK(packet.header(), crc_it->second);
+        }
+        auto put = ResolveCopy(packet);
+        if (!put) return std::nullopt;
+        return HandlePut(std::move(*put));
+      }
+      case Packet::Type::PUT: {
+        const auto datagram_size = Packet::HEADER_SIZE + packet.data().size();
+        if (admission_control_ && !admission_control_->Admit(from, datagram_size))
+          return std::nullopt;
+        return HandlePut(std::move(packet));
+      }
+      case Packet::Type::CHECKSUMS:
+        if (!segment_checksums_) return std::nullopt;
+        return segment_checksums_->Announce(packet);
+      case Packet::Type::VERIFY:
+        if (!segment_checksums_) return std::nullopt;
+        return segment_checksums_->MakeVerifyPacket(storage_.Find(packet.header().file_id),
+                                                   packet.header());
+      case Packet::Type::QUERY:
+        return MakeHavePacket(packet);
+      case Packet::Type::SIGNATURES:
+        if (!delta_index_) return std::nullopt;
+        return delta_index_->MakeSignaturesPacket(packet.header());
+      case Packet::Type::STATE: {
+        const auto* file = storage_.Find(packet.header().file_id);
+        const auto complete = crc32_.contains(packet.header().file_id) ||
+                              (recent_files_ && recent_files_->contains(packet.header().file_id));
+        if (!file && complete)
+          return internal::MakeCompleteStatePacket(packet.header());
+        return internal::MakeStatePacket(file, packet.header());
+      }
+      default:
+        return std::nullopt;
+    }
+  }
+
+  /// Adds the segment of an admitted PUT packet, or of a resolved COPY.
+  std::optional<Packet> HandlePut(Packet&& packet) {
+    const Packet::Header header = packet.header();
+    // Storage may let go of complete files, crc32 is enough to answer
+    if (const auto crc_it = crc32_.find(header.file_id);
+        crc_it != crc32_.end() && !storage_.Find(header.file_id)) {
+      return Packet::ACK(header, crc_it->second);
+    }
+
+    // Before the file is created, so a new file costs nothing when it is shed
+    if (overload_shedding_) {
+      DropIdleFiles();
+      if (!overload_shedding_->Admit(storage_.Find(header.file_id), storage_.receiving_bytes()))
+        return Packet::Busy(header);
+    }
+
+    if (segment_checksums_ && !segment_checksums_->Verify(header, packet.data()))
+      return Packet::NACK(header);
+
+    const auto* file = AddPacket(std::move(packet));
+    if (!file) return std::nullopt;
+    return MakeACKPacket(*file, header);
+  }
+
+  /// Handles PUT packets of a PACKED_PUT one by one as if each came in
+  /// a datagram of its own and packs the replies into a PACKED_ACK.
+  size_t HandlePackedPut(const net::SockAddr& from, const uint8_t* data, size_t size, uint8_t* reply) {
+    ++packed_stats_.datagrams;
+    PackedReader reader(data, size);
+    PackedWriter writer(Packet::Type::PACKED_ACK, reply);
+    for (size_t records = 0; records < PackedWriter::MAX_RECORDS; ++records) {
+      const auto record = reader.Next();
+      if (!record) break;
+      const auto header = Packet::PeekHeader(record->data(), record->size());
+      if (!header || header->type != Packet::Type::PUT) continue;
+
+      ++packed_stats_.records;
+      const auto reply_size = HandleDatagram(from, record->data(), record->size(), record_reply_.data());
+      if (reply_size > 0)
+        writer.Add(std::span(record_reply_.data(), reply_size));
+    }
+
+    return writer.size();
+  }
+
+  static bool IsSingleSegmentPut(const Packet::Header& header) {
+    return header.type == Packet::Type::PUT && header.seq_total == 1 && header.seq_number == 0;
+  }
+
+  /// Fast path of HandleDatagram for a PUT of a single segment file.
+  /// @return size of the final ACK in `reply`, 0 if the datagram is dropped,
+  /// or nullopt if it has to be handled as usual
+  std::optional<size_t> CompleteSingleSegment(const Packet::Header& header, const net::SockAddr& from,
+                                              const uint8_t* data, size_t size, uint8_t* reply) {
+    if (!recent_files_ || !IsSingleSegmentPut(header) || relay_ || delta_index_) return std::nullopt;
+    const std::span<const uint8_t> segment(data + Packet::HEADER_SIZE, size - Packet::HEADER_SIZE);
+    if (segment.size() > Packet::MAX_DATA_SIZE) return std::nullopt;
+
+    auto crc32 = recent_files_->FindDuplicate(header.file_id);
+    // Another upload with the same id has got into the storage
+    if (!crc32 && (storage_.Find(header.file_id) || crc32_.contains(header.file_id)))
+      return std::nullopt;
+    if (admission_control_ && !admission_control_->Admit(from, size)) return 0;
+
+    if (!crc32) {
+      if (segment_checksums_ && !segment_checksums_->Verify(header, segment))
+        return WriteReply(Packet::NACK(header), reply);
+
+      const File file(header.file_id, segment);
+      crc32 = hasher_(file);
+      // A pushed out file joins other complete files, so its late
+      // retransmission is answered and never completes it again
+      if (const auto evicted = recent_files_->Insert(file.id(), *crc32))
+        crc32_.insert(*evicted);
+      if constexpr (!std::is_same_v<ContiguousDataHandler, NoContiguousDataHandler>) {
+        if (internal::IsCallable(on_contiguous_data_))
+          on_contiguous_data_(file, 0, segment);
+      }
+      NotifyCompleted(file, *crc32);
+    }
+
+    return Packet::WriteACK(header, *crc32, reply);
+  }
+
+  static size_t WriteReply(const std::optional<Packet>& packet, uint8_t* reply) {
+    return packet ? packet->WriteTo(std::span(reply, Packet::MAX_SIZE)) : 0;
+  }
+
+  /// @return file the packet was added to or nullptr if the packet is rejected
+  const File* AddPacket(Packet&& packet) {
+    const auto header = packet.header();
+    if (header.seq_number >= header.seq_total) return nullptr;
+
+    auto* file = storage_.Find(header.file_id);
+    if (!file) {
+      if (header.seq_total > max_segments_) return nullptr;
+      file = storage_.Create(header.file_id, header.seq_total);
+      if (!file) return nullptr;
+    }
+    if (!file->concurrent() && CanInsertConcurrently(*file))
+      file->EnableConcurrentInsert();
+    const auto is_new = header.seq_number < file->capacity() && !file->has_segment(header.seq_number);
+    if (!file->AddSegment(std::move(packet))) return nullptr;
+    storage_.OnSegmentReceived(*file);
+    if (relay_ && is_new) RelaySegment(*file, header.seq_number);
+    DeliverContiguousData(file);
+
+    if (file->full() && !crc32_.contains(header.file_id)) {
+      // Client gets no final ACK before downstream servers have the file
+      if (relay_ && relay_->options().wait_for_downstream)
+        awaiting_downstream_.emplace(file->id(), header.seq_number);
+      OnFileCompleted(*file);
+    }
+
+    return file;
+  }
+
+  /// Drops files which clients have abandoned while the server is
+  /// overloaded, so their memory is freed for files which are completing.
+  void DropIdleFiles() {
+    if (relay_) return;
+    const auto idle_since = overload_shedding_->IdleSince();
+    if (!idle_since) return;
+
+    const auto dropped = storage_.DropIdle(*idle_since, [this](const File& file) {
+      if (segment_checksums_)
+        segment_checksums_->Forget(file.id());
+      if (delta_index_)
+        delta_index_->Forget(file.id());
+      if (on_dropped_file_)
+        on_dropped_file_(file);
+    });
+    overload_shedding_->OnIdleFilesDropped(dropped);
+  }
+
+  /// @return PUT packet with the segment the COPY packet is made of
+  std::optional<Packet> ResolveCopy(const Packet& copy) {
+    if (!delta_index_) return std::nullopt;
+
+    const auto base_id = DeltaIndex::CopyBase(copy);
+    const auto* base = base_id ? storage_.Find(*base_id) : nullptr;
+    if (!base || !crc32_.contains(*base_id)) return std::nullopt;
+
+    return delta_index_->ResolveCopy(copy, *base);
+  }
+
+  bool CanInsertConcurrently(const File& file) const {
+    if (concurrent_min_segments_ == 0 || file.capacity() < concurrent_min_segments_) return false;
+    if (admission_control_ || segment_checksums_ || relay_) return false;
+    if constexpr (!std::is_same_v<ContiguousDataHandler, NoContiguousDataHandler>) {
+      if (internal::IsCallable(on_contiguous_data_)) return false;
+    }
+    return true;
+  }
+
+  void RelaySegment(const File& file, uint32_t seq_number) {
+    const Packet::Header header = {
+        .seq_number = seq_number,
+        .seq_total = static_cast<uint32_t>(file.capacity()),
+        .type = Packet::Type::PUT,
+        .file_id = file.id(),
+    };
+    relay_->Forward(header, file.segment(seq_number));
+  }
+
+  void RelayReceivedSegments(const File& file) {
+    for (auto seq_number = file.FindReceived(0); seq_number < file.capacity();
+         seq_number = file.FindReceived(seq_number + 1)) {
+      RelaySegment(file, seq_number);
+    }
+  }
+
+  void DeliverContiguousData(File* file) {
+    if constexpr (!std::is_same_v<ContiguousDataHandler, NoContiguousDataHandler>) {
+      if (!internal::IsCallable(on_contiguous_data_)) return;
+
+      auto [offset, data] = file->AdvanceContiguous();
+      for (const auto span : data) {
+        on_contiguous_data_(*file, offset, span);
+        offset += span.size();
+      }
+    }
+  }
+
+  void OnFileCompleted(const File& file) {
+    NotifyCompleted(file, CalculateCrc32(file));
+    storage_.OnCompleted(file);
+  }
+
+  void NotifyCompleted(const File& file, uint32_t crc32) {
+    if (segment_checksums_)
+      segment_checksums_->Forget(file.id());
+    if (content_index_)
+      content_index_->Insert(internal::MakeContentKey(file), crc32);
+    if (delta_index_)
+      delta_index_->Insert(file, crc32);
+    if (relay_)
+      relay_->OnFileCompleted(file.id(), crc32);
+    if (internal::IsCallable(on_new_file_))
+      on_new_file_(file, crc32);
+  }
+
+  Packet MakeHavePacket(const Packet& query) {
+    ContentIndex::Key key{};
+    if (!content_index_ || !internal::ParseContentKey(query, &key)) {
+      return Packet::Have(query.header());
+    }
+
+    const auto crc32 = content_index_->Find(key);
+    return crc32 ? Packet::Have(query.header(), *crc32) : Packet::Have(query.header());
+  }
+
+  std::optional<Packet> MakeACKPacket(const File& file, const Packet::Header& header) {
+    auto ack_header = header;
+    ack_header.seq_total = file.size();
+
+    if (!file.full()) return Packet::ACK(ack_header);
+
+    const auto awaiting_it = awaiting_downstream_.find(file.id());
+    if (awaiting_it != awaiting_downstream_.end()) {
+      if (!relay_->Confirmed(file.id())) {
+        // Client retransmits the segment which has completed the file
+        // until the final ACK comes, other segments are ACKed as usual
+        if (header.seq_number == awaiting_it->second) return std::nullopt;
+        return Packet::ACK(ack_header);
+      }
+      awaiting_downstream_.erase(awaiting_it);
+      relay_->Forget(file.id());
+    }
+
+    // A concurrent file may get full between AddPacket's check and here,
+    // while its last segment is added without the lock. The thread which
+    // added that segment finds the file completed then, so it's done here.
+    if (!crc32_.contains(file.id())) OnFileCompleted(file);
+    return Packet::ACK(ack_header, crc32_.at(file.id()));
+  }
+
+  uint32_t CalculateCrc32(const File& file) {
+    auto crc_it = crc32_.find(file.id());
+    if (crc_it == crc32_.end()) {
+      crc_it = crc32_.emplace(file.id(), hasher_(file)).first;
+    }
+
+    return crc_it->second;
+  }
+
+  /// Guards the core in HandleDatagramConcurrently
+  std::mutex mutex_;
+  uint32_t concurrent_min_segments_;
+  uint32_t max_segments_;
+
+  std::optional<AdmissionControl> admission_control_;
+  std::optional<OverloadShedding> overload_shedding_;
+  Storage storage_;
+  Hasher hasher_;
+  std::unordered_map<uint64_t, uint32_t> crc32_;
+  std::unique_ptr<ContentIndex> content_index_;
+  std::unique_ptr<DeltaIndex> delta_index_;
+  std::unique_ptr<RecentFiles> recent_files_;
+  std::unique_ptr<SegmentChecksums> segment_checksums_;
+  std::unique_ptr<Relay> relay_;
+  /// file_id => seq_number of the segment which has completed the file
+  std::unordered_map<uint64_t, uint32_t> awaiting_downstream_;
+  PackedStats packed_stats_;
+  /// Reply to a record of PACKED_PUT before it goes into PACKED_ACK
+  std::vector<uint8_t> record_reply_;
+
+  CompletionHandler on_new_file_;
+  ContiguousDataHandler on_contiguous_data_;
+  std::function<void(const File& file)> on_dropped_file_;
+};
+
+using NewFileHandler = std::function<void(const File& file, uint32_t crc32)>;
+using ContiguousDataHandler =
+    std::function<void(const File& file, uint64_t offset, std::span<const uint8_t> data)>;
+/// Core with handlers which can be set at runtime.
+using ServerCore = BasicServerCore<FileStorage, Crc32Hasher, NewFileHandler, ContiguousDataHandler>;
+
+} // namespace udp_server
+
+#endif // UDP_SERVER_SERVER_CORE_H_
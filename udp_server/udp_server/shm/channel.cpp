@@ -0,0 +1,390 @@
+#include "udp_server/shm/channel.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <new>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace udp_server::shm {
+namespace {
+
+/// Pending publications are retried that often while nothing else happens
+const int ACCEPT_POLL_TIMEOUT_MS = 100;
+
+bool SendHello(int fd, const Hello& hello, int memfd) {
+  iovec iov = { .iov_base = const_cast<Hello*>(&hello), .iov_len = sizeof(hello) };
+  alignas(cmsghdr) uint8_t control[CMSG_SPACE(sizeof(int))] = {};
+
+  msghdr message = {};
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+
+  auto* cmsg = CMSG_FIRSTHDR(&message);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  std::memcpy(CMSG_DATA(cmsg), &memfd, sizeof(memfd));
+
+  return sendmsg(fd, &message, MSG_NOSIGNAL) == static_cast<ssize_t>(sizeof(hello));
+}
+
+} // namespace
+
+Channel::Channel(std::filesystem::path socket_path, const Options& options)
+        : socket_path_(std::move(socket_path)),
+          options_(options),
+          memfd_(-1),
+          listen_fd_(-1),
+          stop_fd_(-1),
+          control_region_(),
+          control_(nullptr),
+          mutex_(),
+          free_(),
+          blocks_(),
+          files_(),
+          free_holder_slots_(),
+          pending_(),
+          consumer_fds_(),
+          active_consumers_(0),
+          stats_(),
+          accept_thread_() {}
+
+Channel::~Channel() {
+  if (accept_thread_.joinable()) {
+    const uint64_t one = 1;
+    [[maybe_unused]] const auto written = write(stop_fd_, &one, sizeof(one));
+    accept_thread_.join();
+  }
+
+  for (const auto& [consumer_slot, fd] : consumer_fds_)
+    close(fd);
+  if (listen_fd_ >= 0) {
+    close(listen_fd_);
+    std::error_code error;
+    std::filesystem::remove(socket_path_, error);
+  }
+  if (stop_fd_ >= 0) close(stop_fd_);
+  if (memfd_ >= 0) close(memfd_);
+}
+
+bool Channel::Open() {
+  const auto control_size = ControlSize(options_.ring_capacity, options_.holder_slots);
+  const auto arena_size = AlignToPage(options_.arena_size);
+
+  memfd_ = memfd_create("udp_server_shm", MFD_CLOEXEC);
+  if (memfd_ < 0 || ftruncate(memfd_, static_cast<off_t>(control_size + arena_size)) != 0) {
+    std::perror("memfd_create");
+    return false;
+  }
+
+  control_region_ = base::MappedRegion::MapShared(memfd_, 0, control_size, true);
+  if (!control_region_) {
+    std::perror("mmap");
+    return false;
+  }
+
+  // Fresh memfd is zero-filled, so the ring and the holders are empty
+  control_ = new (control_region_->data()) ControlBlock();
+  control_->magic = CHANNEL_MAGIC;
+  control_->ring_capacity = options_.ring_capacity;
+  control_->holder_slots = options_.holder_slots;
+  control_->control_size = control_size;
+  control_->arena_size = arena_size;
+
+  free_.emplace(control_size, arena_size);
+  for (auto slot = options_.holder_slots; slot > 0; --slot)
+    free_holder_slots_.push_back(slot - 1);
+
+  listen_fd_ = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  if (socket_path_.native().size() >= sizeof(address.sun_path)) return false;
+  std::strcpy(address.sun_path, socket_path_.c_str());
+
+  std::error_code error;
+  std::filesystem::remove(socket_path_, error);
+  if (listen_fd_ < 0 ||
+      bind(listen_fd_, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 ||
+      listen(listen_fd_, static_cast<int>(MAX_CONSUMERS)) != 0) {
+    std::perror("bind");
+    return false;
+  }
+
+  stop_fd_ = eventfd(0, EFD_CLOEXEC);
+  if (stop_fd_ < 0) {
+    std::perror("eventfd");
+    return false;
+  }
+
+  accept_thread_ = std::thread([this] { AcceptLoop(); });
+  return true;
+}
+
+std::optional<File> Channel::Create(uint64_t file_id, uint32_t number_of_segments) {
+  std::lock_guard lock(mutex_);
+  Reclaim();
+
+  const auto size = AlignToPage(File::RegionSize(number_of_segments));
+  const auto offset = free_holder_slots_.empty() ? std::nullopt : Allocate(size);
+  if (!offset) {
+    ++stats_.allocation_failures;
+    return std::nullopt;
+  }
+
+  auto region = base::MappedRegion::MapShared(memfd_, *offset, size, true);
+  if (!region) {
+    Free(*offset, size);
+    ++stats_.allocation_failures;
+    return std::nullopt;
+  }
+
+  const auto holder_slot = free_holder_slots_.back();
+  free_holder_slots_.pop_back();
+  Holders(control_)[holder_slot].store(SERVER_HOLDER, std::memory_order_relaxed);
+
+  blocks_.emplace(*offset, Block{ .size = size, .holder_slot = holder_slot, .removed = false });
+  files_[file_id] = *offset;
+  stats_.arena_used += size;
+
+  return std::make_optional<File>(file_id, number_of_segments, std::move(*region));
+}
+
+bool Channel::Publish(const File& file, uint32_t crc32) {
+  std::lock_guard lock(mutex_);
+
+  const auto file_it = files_.find(file.id());
+  if (file_it == files_.end()) return false;
+
+  // Segments are where the client put them, so a short segment before
+  // the last one leaves a hole which the descriptor can't describe
+  auto span_it = file.begin();
+  const uint64_t length = (*span_it).size();
+  if (++span_it != file.end()) {
+    ++stats_.not_contiguous;
+    return false;
+  }
+
+  pending_.push_back(Publication{
+      .block = file_it->second,
+      .file_id = file.id(),
+      .offset = file_it->second + File::DataOffset(file.capacity()),
+      .length = length,
+      .crc32 = crc32,
+  });
+  PublishPending();
+
+  return true;
+}
+
+void Channel::Remove(uint64_t file_id) {
+  std::lock_guard lock(mutex_);
+
+  const auto file_it = files_.find(file_id);
+  if (file_it == files_.end()) return;
+
+  const auto offset = file_it->second;
+  auto& block = blocks_.at(offset);
+  files_.erase(file_it);
+
+  const auto is_pending = std::any_of(pending_.begin(), pending_.end(),
+      [&](const Publication& publication) { return publication.block == offset; });
+  if (is_pending) {
+    block.removed = true;
+  } else {
+    Holders(control_)[block.holder_slot].fetch_and(~SERVER_HOLDER, std::memory_order_release);
+  }
+
+  Reclaim();
+}
+
+Channel::Stats Channel::stats() const {
+  std::lock_guard lock(mutex_);
+
+  auto stats = stats_;
+  stats.pending = pending_.size();
+  stats.consumers = consumer_fds_.size();
+  return stats;
+}
+
+std::optional<uint64_t> Channel::Allocate(size_t size) {
+  for (auto extent_it = free_.begin(); extent_it != free_.end(); ++extent_it) {
+    const auto [offset, extent_size] = *extent_it;
+    if (extent_size < size) continue;
+
+    free_.erase(extent_it);
+    if (extent_size > size)
+      free_.emplace(offset + size, extent_size - size);
+    return offset;
+  }
+
+  return std::nullopt;
+}
+
+void Channel::Free(uint64_t offset, size_t size) {
+  // Gives the memory back, the next file in the extent starts from zeroes
+  fallocate(memfd_, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+            static_cast<off_t>(offset), static_cast<off_t>(size));
+
+  auto extent_it = free_.emplace(offset, size).first;
+  const auto next_it = std::next(extent_it);
+  if (next_it != free_.end() && extent_it->first + extent_it->second == next_it->first) {
+    extent_it->second += next_it->second;
+    free_.erase(next_it);
+  }
+  if (extent_it != free_.begin()) {
+    const auto prev_it = std::prev(extent_it);
+    if (prev_it->first + prev_it->second == extent_it->first) {
+      prev_it->second += extent_it->second;
+      free_.erase(extent_it);
+    }
+  }
+}
+
+void Channel::Reclaim() {
+  auto* holders = Holders(control_);
+  for (auto block_it = blocks_.begin(); block_it != blocks_.end();) {
+    const auto& block = block_it->second;
+    if (holders[block.holder_slot].load(std::memory_order_acquire) != 0) {
+      ++block_it;
+      continue;
+    }
+
+    Free(block_it->first, block.size);
+    free_holder_slots_.push_back(block.holder_slot);
+    stats_.arena_used -= block.size;
+    ++stats_.reclaimed;
+    block_it = blocks_.erase(block_it);
+  }
+}
+
+void Channel::PublishPending() {
+  auto* ring = Ring(control_);
+  auto* holders = Holders(control_);
+
+  while (!pending_.empty()) {
+    const auto head = control_->head.load(std::memory_order_relaxed);
+    auto min_position = head;
+    for (uint32_t consumer_slot = 0; consumer_slot < MAX_CONSUMERS; ++consumer_slot) {
+      if (active_consumers_ & (uint64_t{1} << consumer_slot)) {
+        min_position = std::min(
+            min_position, control_->consumers[consumer_slot].position.load(std::memory_order_acquire));
+      }
+    }
+    if (head - min_position >= control_->ring_capacity) break;
+
+    const auto& publication = pending_.front();
+    auto& block = blocks_.at(publication.block);
+
+    // Consumers hold the file before they can see it
+    holders[block.holder_slot].fetch_or(active_consumers_, std::memory_order_relaxed);
+    if (block.removed)
+      holders[block.holder_slot].fetch_and(~SERVER_HOLDER, std::memory_order_relaxed);
+
+    auto& descriptor = ring[head % control_->ring_capacity];
+    descriptor.file_id = publication.file_id;
+    descriptor.offset = publication.offset;
+    descriptor.length = publication.length;
+    descriptor.crc32 = publication.crc32;
+    descriptor.holder_slot = block.holder_slot;
+    descriptor.sequence.store(head + 1, std::memory_order_release);
+    control_->head.store(head + 1, std::memory_order_release);
+
+    control_->notify.fetch_add(1, std::memory_order_release);
+    if (control_->waiters.load(std::memory_order_acquire) > 0)
+      FutexWakeAll(&control_->notify);
+
+    pending_.pop_front();
+    ++stats_.published;
+  }
+}
+
+void Channel::AddConsumer(int fd) {
+  uint32_t consumer_slot = 0;
+  while (consumer_slot < MAX_CONSUMERS && consumer_fds_.contains(consumer_slot))
+    ++consumer_slot;
+  if (consumer_slot == MAX_CONSUMERS) {
+    close(fd);
+    return;
+  }
+
+  ucred credentials = {};
+  socklen_t credentials_size = sizeof(credentials);
+  getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &credentials_size);
+
+  // Consumer sees files which are published from now on
+  auto& slot = control_->consumers[consumer_slot];
+  slot.position.store(control_->head.load(std::memory_order_relaxed), std::memory_order_relaxed);
+  slot.pid.store(credentials.pid, std::memory_order_release);
+  active_consumers_ |= uint64_t{1} << consumer_slot;
+  consumer_fds_.emplace(consumer_slot, fd);
+
+  const Hello hello = { .magic = CHANNEL_MAGIC, .consumer_slot = consumer_slot, .reserved = 0 };
+  if (!SendHello(fd, hello, memfd_))
+    RemoveConsumer(consumer_slot);
+}
+
+void Channel::RemoveConsumer(uint32_t consumer_slot) {
+  const auto consumer_bit = uint64_t{1} << consumer_slot;
+  active_consumers_ &= ~consumer_bit;
+  control_->consumers[consumer_slot].pid.store(0, std::memory_order_release);
+
+  // Files the consumer has not released
+  auto* holders = Holders(control_);
+  for (uint32_t holder_slot = 0; holder_slot < control_->holder_slots; ++holder_slot)
+    holders[holder_slot].fetch_and(~consumer_bit, std::memory_order_release);
+
+  close(consumer_fds_.at(consumer_slot));
+  consumer_fds_.erase(consumer_slot);
+
+  Reclaim();
+  PublishPending();
+}
+
+void Channel::AcceptLoop() {
+  std::vector<pollfd> fds;
+  std::vector<uint32_t> consumer_slots;
+
+  while (true) {
+    fds.clear();
+    consumer_slots.clear();
+    fds.push_back({ .fd = stop_fd_,   .events = POLLIN, .revents = 0 });
+    fds.push_back({ .fd = listen_fd_, .events = POLLIN, .revents = 0 });
+    {
+      std::lock_guard lock(mutex_);
+      for (const auto& [consumer_slot, fd] : consumer_fds_) {
+        fds.push_back({ .fd = fd, .events = POLLIN, .revents = 0 });
+        consumer_slots.push_back(consumer_slot);
+      }
+    }
+
+    poll(fds.data(), fds.size(), ACCEPT_POLL_TIMEOUT_MS);
+    if (fds[0].revents & POLLIN) break;
+
+    std::lock_guard lock(mutex_);
+    // Consumers never send anything, so readable connection is a closed one
+    for (size_t idx = 2; idx < fds.size(); ++idx) {
+      if (fds[idx].revents != 0)
+        RemoveConsumer(consumer_slots[idx - 2]);
+    }
+
+    if (fds[1].revents & POLLIN) {
+      const int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+      if (fd >= 0) AddConsumer(fd);
+    }
+
+    // Consumers could have released files and moved on in the ring
+    Reclaim();
+    PublishPending();
+  }
+}
+
+} // namespace udp_server::shm
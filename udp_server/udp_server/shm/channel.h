@@ -0,0 +1,129 @@
+#ifndef UDP_SERVER_SHM_CHANNEL_H_
+#define UDP_SERVER_SHM_CHANNEL_H_
+
+#include "udp_server/file.h"
+#include "udp_server/base/mapped_region.h"
+#include "udp_server/shm/layout.h"
+
+#include <deque>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace udp_server::shm {
+
+/**
+ * Server side of the shared memory channel, see layout.h. Files are
+ * reassembled right in the channel's arena, so publishing a complete
+ * file is only a descriptor in the ring. Consumers connect to the Unix
+ * socket and get the channel memfd from it; the connection tells the
+ * channel when a consumer is gone, so files it holds are released.
+ */
+class Channel {
+public:
+  struct Options {
+    /// Virtual size of the arena, memory is committed by received data
+    size_t arena_size = size_t{1} << 30;
+    /// Descriptors which consumers may lag behind the server
+    uint32_t ring_capacity = 1024;
+    /// Files which may be held at once
+    uint32_t holder_slots = 4096;
+  };
+
+  struct Stats {
+    uint64_t published = 0;
+    uint64_t reclaimed = 0;
+    uint64_t allocation_failures = 0;
+    /// Files which were not published because their data has holes
+    uint64_t not_contiguous = 0;
+    /// Files waiting for a free ring slot
+    size_t pending = 0;
+    size_t consumers = 0;
+    size_t arena_used = 0;
+  };
+
+  Channel(std::filesystem::path socket_path, const Options& options);
+  Channel(const Channel&) = delete;
+  ~Channel();
+
+  Channel& operator=(const Channel&) = delete;
+
+  /// Creates the memfd and starts accepting consumers on the socket.
+  bool Open();
+
+  /// Creates file which is backed by the arena.
+  /// @return nullopt if there is no room in the arena
+  std::optional<File> Create(uint64_t file_id, uint32_t number_of_segments);
+  /// Tells consumers about the complete file. The file must be created
+  /// by this channel.
+  /// @return false if the file is not in the arena, or if a segment other
+  /// than the last one is short, consumers get a single span of data
+  bool Publish(const File& file, uint32_t crc32);
+  /// Server doesn't use the file any more, its region is reclaimed
+  /// once consumers release it too.
+  void Remove(uint64_t file_id);
+
+  [[nodiscard]] Stats stats() const;
+private:
+  struct Block {
+    size_t size;
+    uint32_t holder_slot;
+    /// Server has removed the file while it was waiting for the ring
+    bool removed;
+  };
+
+  struct Publication {
+    /// Offset of the file's block
+    uint64_t block;
+    uint64_t file_id;
+    uint64_t offset;
+    uint64_t length;
+    uint32_t crc32;
+  };
+
+  /// All private functions but AcceptLoop expect mutex_ to be held.
+  /// @{
+  std::optional<uint64_t> Allocate(size_t size);
+  void Free(uint64_t offset, size_t size);
+  /// Frees blocks which nobody holds any more.
+  void Reclaim();
+  /// Writes pending publications into the ring while it has room.
+  void PublishPending();
+  void AddConsumer(int fd);
+  void RemoveConsumer(uint32_t consumer_slot);
+  /// @}
+  void AcceptLoop();
+
+  const std::filesystem::path socket_path_;
+  const Options options_;
+
+  int memfd_;
+  int listen_fd_;
+  int stop_fd_;
+  std::optional<base::MappedRegion> control_region_;
+  ControlBlock* control_;
+
+  mutable std::mutex mutex_;
+  /// offset => size of free extents of the arena
+  std::map<uint64_t, size_t> free_;
+  /// offset => block of every file which is held by someone
+  std::map<uint64_t, Block> blocks_;
+  /// file_id => offset of the block while the server holds the file
+  std::unordered_map<uint64_t, uint64_t> files_;
+  std::vector<uint32_t> free_holder_slots_;
+  std::deque<Publication> pending_;
+  /// consumer slot => connection
+  std::unordered_map<uint32_t, int> consumer_fds_;
+  uint64_t active_consumers_;
+  Stats stats_;
+
+  std::thread accept_thread_;
+};
+
+} // namespace udp_server::shm
+
+#endif // UDP_SERVER_SHM_CHANNEL_H_
@@ -0,0 +1,157 @@
+#include "udp_server/shm/consumer.h"
+
+#include <cstdio>
+#include <cstring>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+namespace udp_server::shm {
+namespace {
+
+/// @return memfd of the channel or -1
+int ReceiveHello(int fd, Hello* hello) {
+  iovec iov = { .iov_base = hello, .iov_len = sizeof(*hello) };
+  alignas(cmsghdr) uint8_t control[CMSG_SPACE(sizeof(int))] = {};
+
+  msghdr message = {};
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+
+  if (recvmsg(fd, &message, MSG_CMSG_CLOEXEC) != static_cast<ssize_t>(sizeof(*hello))) return -1;
+
+  const auto* cmsg = CMSG_FIRSTHDR(&message);
+  if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) return -1;
+
+  int memfd;
+  std::memcpy(&memfd, CMSG_DATA(cmsg), sizeof(memfd));
+  return memfd;
+}
+
+} // namespace
+
+// static
+std::optional<Consumer> Consumer::Connect(const std::filesystem::path& socket_path) {
+  sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  if (socket_path.native().size() >= sizeof(address.sun_path)) return std::nullopt;
+  std::strcpy(address.sun_path, socket_path.c_str());
+
+  const int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (fd < 0 || connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0) {
+    std::perror("connect");
+    if (fd >= 0) close(fd);
+    return std::nullopt;
+  }
+
+  Hello hello;
+  const int memfd = ReceiveHello(fd, &hello);
+  if (memfd < 0 || hello.magic != CHANNEL_MAGIC) {
+    std::fprintf(stderr, "Not a channel: %s\n", socket_path.c_str());
+    if (memfd >= 0) close(memfd);
+    close(fd);
+    return std::nullopt;
+  }
+
+  // Sizes are read from the first page before the whole control area is mapped
+  void* header = mmap(nullptr, PAGE_SIZE, PROT_READ, MAP_SHARED, memfd, 0);
+  if (header == MAP_FAILED) {
+    std::perror("mmap");
+    close(memfd);
+    close(fd);
+    return std::nullopt;
+  }
+  const auto control_size = static_cast<const ControlBlock*>(header)->control_size;
+  const auto arena_size = static_cast<const ControlBlock*>(header)->arena_size;
+  munmap(header, PAGE_SIZE);
+
+  void* control = mmap(nullptr, control_size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+  void* arena = mmap(nullptr, arena_size, PROT_READ, MAP_SHARED, memfd, static_cast<off_t>(control_size));
+  close(memfd);
+  if (control == MAP_FAILED || arena == MAP_FAILED) {
+    std::perror("mmap");
+    if (control != MAP_FAILED) munmap(control, control_size);
+    if (arena != MAP_FAILED) munmap(arena, arena_size);
+    close(fd);
+    return std::nullopt;
+  }
+
+  return Consumer(fd, hello.consumer_slot, static_cast<ControlBlock*>(control),
+                  static_cast<const uint8_t*>(arena), arena_size);
+}
+
+Consumer::Consumer(int fd, uint32_t consumer_slot, ControlBlock* control,
+                   const uint8_t* arena, size_t arena_size)
+        : fd_(fd),
+          consumer_slot_(consumer_slot),
+          control_(control),
+          arena_(arena),
+          arena_size_(arena_size) {}
+
+Consumer::Consumer(Consumer&& from) noexcept
+        : fd_(from.fd_),
+          consumer_slot_(from.consumer_slot_),
+          control_(from.control_),
+          arena_(from.arena_),
+          arena_size_(from.arena_size_) {
+  from.fd_ = -1;
+  from.control_ = nullptr;
+  from.arena_ = nullptr;
+}
+
+Consumer::~Consumer() {
+  if (control_) munmap(control_, control_->control_size);
+  if (arena_) munmap(const_cast<uint8_t*>(arena_), arena_size_);
+  if (fd_ >= 0) close(fd_);
+}
+
+std::optional<Consumer::PublishedFile> Consumer::Next(std::chrono::milliseconds timeout) {
+  auto& slot = control_->consumers[consumer_slot_];
+  const auto position = slot.position.load(std::memory_order_relaxed);
+
+  if (control_->head.load(std::memory_order_acquire) == position) {
+    control_->waiters.fetch_add(1, std::memory_order_seq_cst);
+    const auto notify = control_->notify.load(std::memory_order_seq_cst);
+    // Publication could happen before the waiter was counted
+    if (control_->head.load(std::memory_order_acquire) == position) {
+      const timespec timeout_spec = {
+          .tv_sec = timeout.count() / 1000,
+          .tv_nsec = timeout.count() % 1000 * 1000000,
+      };
+      FutexWait(&control_->notify, notify, &timeout_spec);
+    }
+    control_->waiters.fetch_sub(1, std::memory_order_relaxed);
+
+    if (control_->head.load(std::memory_order_acquire) == position) return std::nullopt;
+  }
+
+  const auto& descriptor = Ring(control_)[position % control_->ring_capacity];
+  if (descriptor.sequence.load(std::memory_order_acquire) != position + 1) return std::nullopt;
+
+  const auto arena_offset = descriptor.offset - control_->control_size;
+  PublishedFile file = {
+      .file_id = descriptor.file_id,
+      .crc32 = descriptor.crc32,
+      .data = std::span<const uint8_t>(arena_ + arena_offset, descriptor.length),
+      .holder_slot = descriptor.holder_slot,
+  };
+
+  // Server may reuse the descriptor from now on
+  slot.position.store(position + 1, std::memory_order_release);
+  return file;
+}
+
+void Consumer::Release(const PublishedFile& file) {
+  Holders(control_)[file.holder_slot].fetch_and(~(uint64_t{1} << consumer_slot_), std::memory_order_release);
+}
+
+bool Consumer::connected() const {
+  pollfd fds = { .fd = fd_, .events = POLLIN, .revents = 0 };
+  // Server never sends anything after hello, so readable socket is a closed one
+  return poll(&fds, 1, 0) == 0;
+}
+
+} // namespace udp_server::shm
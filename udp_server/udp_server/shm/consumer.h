@@ -0,0 +1,61 @@
+#ifndef UDP_SERVER_SHM_CONSUMER_H_
+#define UDP_SERVER_SHM_CONSUMER_H_
+
+#include "udp_server/shm/layout.h"
+
+#include <chrono>
+#include <filesystem>
+#include <optional>
+#include <span>
+
+namespace udp_server::shm {
+
+/**
+ * Reader of files which the server publishes to the shared memory channel.
+ * Data of a file is mapped read-only, nothing is copied. A file stays
+ * valid until Release; if the consumer exits without releasing, the
+ * server notices the closed connection and releases for it.
+ *
+ * Consumer depends only on layout.h, so it can be built on its own.
+ */
+class Consumer {
+public:
+  struct PublishedFile {
+    uint64_t file_id;
+    uint32_t crc32;
+    std::span<const uint8_t> data;
+    uint32_t holder_slot;
+  };
+
+  /// Connects to the channel's socket and maps the channel.
+  static std::optional<Consumer> Connect(const std::filesystem::path& socket_path);
+
+  Consumer(const Consumer&) = delete;
+  Consumer(Consumer&& from) noexcept;
+  ~Consumer();
+
+  Consumer& operator=(const Consumer&) = delete;
+
+  /// Waits for the next published file up to the timeout.
+  /// @return nullopt if nothing was published in time
+  std::optional<PublishedFile> Next(std::chrono::milliseconds timeout);
+  /// Tells the server the file is not used any more, its data must not
+  /// be touched afterwards.
+  void Release(const PublishedFile& file);
+
+  /// @return the server hasn't closed the channel
+  [[nodiscard]] bool connected() const;
+private:
+  Consumer(int fd, uint32_t consumer_slot, ControlBlock* control,
+           const uint8_t* arena, size_t arena_size);
+
+  int fd_;
+  uint32_t consumer_slot_;
+  ControlBlock* control_;
+  const uint8_t* arena_;
+  size_t arena_size_;
+};
+
+} // namespace udp_server::shm
+
+#endif // UDP_SERVER_SHM_CONSUMER_H_
@@ -0,0 +1,123 @@
+#ifndef UDP_SERVER_SHM_LAYOUT_H_
+#define UDP_SERVER_SHM_LAYOUT_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/**
+ * Layout of the shared memory channel which is common for the server
+ * and consumers. The channel is one memfd: control area (ControlBlock,
+ * descriptor ring and holders table) followed by the arena with files.
+ *
+ * The server is the only producer. It writes a descriptor into the ring
+ * slot, then advances head. Every consumer has its own position in the
+ * ring and the server never overwrites descriptors which some consumer
+ * has not read yet.
+ *
+ * Each file region in the arena has an entry in the holders table with
+ * one bit per holder: the server while it reassembles the file, and every
+ * consumer which was connected when the file was published. A holder
+ * clears its bit when it is done with the file and the server reclaims
+ * the region once no bits are left.
+ */
+namespace udp_server::shm {
+
+constexpr uint64_t CHANNEL_MAGIC = 0x31304d4853504455; // "UDPSHM01"
+constexpr size_t PAGE_SIZE = 4096;
+
+/// Bits 0..MAX_CONSUMERS-1 of a holders entry are consumers
+constexpr uint32_t MAX_CONSUMERS = 63;
+constexpr uint64_t SERVER_HOLDER = uint64_t{1} << MAX_CONSUMERS;
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free);
+static_assert(std::atomic<uint32_t>::is_always_lock_free);
+
+struct Descriptor {
+  /// Number of the descriptor + 1 once it is written
+  std::atomic<uint64_t> sequence;
+  /// Session the file was received in
+  uint64_t file_id;
+  /// Data of the file in the channel
+  uint64_t offset;
+  uint64_t length;
+  uint32_t crc32;
+  /// Entry of the file in the holders table
+  uint32_t holder_slot;
+};
+
+struct ConsumerSlot {
+  /// Number of the next descriptor to read
+  std::atomic<uint64_t> position;
+  /// Process of the consumer, 0 if the slot is free
+  std::atomic<pid_t> pid;
+};
+
+struct alignas(64) ControlBlock {
+  uint64_t magic;
+  uint32_t ring_capacity;
+  uint32_t holder_slots;
+  /// Size of the control area, the arena starts there
+  uint64_t control_size;
+  uint64_t arena_size;
+
+  /// Number of published descriptors
+  alignas(64) std::atomic<uint64_t> head;
+  /// Futex word which changes on every publication
+  alignas(64) std::atomic<uint32_t> notify;
+  std::atomic<uint32_t> waiters;
+
+  alignas(64) ConsumerSlot consumers[MAX_CONSUMERS];
+};
+
+/// The server sends it with the memfd to every connected consumer.
+struct Hello {
+  uint64_t magic;
+  uint32_t consumer_slot;
+  uint32_t reserved;
+};
+
+inline size_t AlignToPage(size_t size) {
+  return (size + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+}
+
+inline size_t RingOffset() {
+  return sizeof(ControlBlock);
+}
+
+inline size_t HoldersOffset(uint32_t ring_capacity) {
+  return RingOffset() + ring_capacity * sizeof(Descriptor);
+}
+
+inline size_t ControlSize(uint32_t ring_capacity, uint32_t holder_slots) {
+  return AlignToPage(HoldersOffset(ring_capacity) + holder_slots * sizeof(std::atomic<uint64_t>));
+}
+
+inline Descriptor* Ring(ControlBlock* control) {
+  return reinterpret_cast<Descriptor*>(reinterpret_cast<uint8_t*>(control) + RingOffset());
+}
+
+inline std::atomic<uint64_t>* Holders(ControlBlock* control) {
+  return reinterpret_cast<std::atomic<uint64_t>*>(
+      reinterpret_cast<uint8_t*>(control) + HoldersOffset(control->ring_capacity));
+}
+
+/// Futex operations on the shared word, they work across processes.
+/// @{
+inline void FutexWait(std::atomic<uint32_t>* word, uint32_t expected, const timespec* timeout) {
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAIT, expected, timeout, nullptr, 0);
+}
+
+inline void FutexWakeAll(std::atomic<uint32_t>* word) {
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE, INT32_MAX, nullptr, nullptr, 0);
+}
+/// @}
+
+} // namespace udp_server::shm
+
+#endif // UDP_SERVER_SHM_LAYOUT_H_
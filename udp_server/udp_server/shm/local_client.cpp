@@ -0,0 +1,136 @@
+#include "udp_server/shm/local_client.h"
+
+#include <cstdio>
+#include <cstring>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+namespace udp_server::shm {
+namespace {
+
+/// Receives the hello with memfd, eventfd of the server and eventfd of the client.
+bool ReceiveHello(int fd, RingsHello* hello, int (&fds)[3]) {
+  iovec iov = { .iov_base = hello, .iov_len = sizeof(*hello) };
+  alignas(cmsghdr) uint8_t control[CMSG_SPACE(sizeof(fds))] = {};
+
+  msghdr message = {};
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+
+  if (recvmsg(fd, &message, MSG_CMSG_CLOEXEC) != static_cast<ssize_t>(sizeof(*hello))) return false;
+
+  const auto* cmsg = CMSG_FIRSTHDR(&message);
+  if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+      cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) {
+    return false;
+  }
+
+  std::memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+  return true;
+}
+
+} // namespace
+
+// static
+std::optional<LocalClient> LocalClient::Connect(const std::filesystem::path& socket_path) {
+  sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  if (socket_path.native().size() >= sizeof(address.sun_path)) return std::nullopt;
+  std::strcpy(address.sun_path, socket_path.c_str());
+
+  const int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (fd < 0 || connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0) {
+    std::perror("connect");
+    if (fd >= 0) close(fd);
+    return std::nullopt;
+  }
+
+  RingsHello hello;
+  int fds[3] = { -1, -1, -1 };
+  if (!ReceiveHello(fd, &hello, fds) || hello.magic != RINGS_MAGIC ||
+      hello.size != RingsSize(hello.capacity)) {
+    std::fprintf(stderr, "Not a shared memory transport: %s\n", socket_path.c_str());
+    for (const int received_fd : fds)
+      if (received_fd >= 0) close(received_fd);
+    close(fd);
+    return std::nullopt;
+  }
+
+  const auto [memfd, server_wake_fd, wake_fd] = fds;
+  void* block = mmap(nullptr, hello.size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+  close(memfd);
+  if (block == MAP_FAILED) {
+    std::perror("mmap");
+    close(server_wake_fd);
+    close(wake_fd);
+    close(fd);
+    return std::nullopt;
+  }
+
+  return LocalClient(fd, server_wake_fd, wake_fd, static_cast<RingsBlock*>(block), hello.size);
+}
+
+LocalClient::LocalClient(int fd, int server_wake_fd, int wake_fd, RingsBlock* block, size_t size)
+        : fd_(fd),
+          server_wake_fd_(server_wake_fd),
+          wake_fd_(wake_fd),
+          block_(block),
+          size_(size),
+          to_server_(&block->to_server, ToServerFrames(block), block->capacity),
+          to_client_(&block->to_client, ToClientFrames(block), block->capacity) {}
+
+LocalClient::LocalClient(LocalClient&& from) noexcept
+        : fd_(from.fd_),
+          server_wake_fd_(from.server_wake_fd_),
+          wake_fd_(from.wake_fd_),
+          block_(from.block_),
+          size_(from.size_),
+          to_server_(from.to_server_),
+          to_client_(from.to_client_) {
+  from.fd_ = -1;
+  from.server_wake_fd_ = -1;
+  from.wake_fd_ = -1;
+  from.block_ = nullptr;
+}
+
+LocalClient::~LocalClient() {
+  if (block_) munmap(block_, size_);
+  if (wake_fd_ >= 0) close(wake_fd_);
+  if (server_wake_fd_ >= 0) close(server_wake_fd_);
+  if (fd_ >= 0) close(fd_);
+}
+
+bool LocalClient::Send(const uint8_t* data, size_t size) {
+  if (!to_server_.Push(data, size)) return false;
+  to_server_.WakeConsumer(server_wake_fd_);
+  return true;
+}
+
+ssize_t LocalClient::Receive(uint8_t* buf, size_t len, std::chrono::milliseconds timeout) {
+  if (const auto size = to_client_.Pop(buf, len)) return static_cast<ssize_t>(*size);
+
+  if (to_client_.PrepareToSleep()) {
+    pollfd fds[2] = {
+        { .fd = wake_fd_, .events = POLLIN, .revents = 0 },
+        { .fd = fd_,      .events = POLLIN, .revents = 0 },
+    };
+    poll(fds, 2, static_cast<int>(timeout.count()));
+    to_client_.WakeUp();
+
+    uint64_t wakeups;
+    if (fds[0].revents & POLLIN) {
+      [[maybe_unused]] const auto bytes_read = read(wake_fd_, &wakeups, sizeof(wakeups));
+    }
+    // Server never sends anything after hello, so readable socket is a closed one
+    if (fds[1].revents != 0) return -1;
+  }
+
+  if (const auto size = to_client_.Pop(buf, len)) return static_cast<ssize_t>(*size);
+  return 0;
+}
+
+} // namespace udp_server::shm
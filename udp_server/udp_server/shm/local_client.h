@@ -0,0 +1,52 @@
+#ifndef UDP_SERVER_SHM_LOCAL_CLIENT_H_
+#define UDP_SERVER_SHM_LOCAL_CLIENT_H_
+
+#include "udp_server/shm/rings.h"
+
+#include <chrono>
+#include <filesystem>
+#include <optional>
+#include <sys/types.h>
+
+namespace udp_server::shm {
+
+/**
+ * Client side of ShmTransport: sends datagrams to the server and receives
+ * its replies over the rings in shared memory instead of a UDP socket.
+ * Datagrams are the same as over UDP, so a client only replaces the socket.
+ * One thread sends and one thread receives.
+ *
+ * LocalClient depends only on rings.h, so it can be built on its own.
+ */
+class LocalClient {
+public:
+  /// Connects to the Unix socket of the server and maps the rings.
+  static std::optional<LocalClient> Connect(const std::filesystem::path& socket_path);
+
+  LocalClient(const LocalClient&) = delete;
+  LocalClient(LocalClient&& from) noexcept;
+  ~LocalClient();
+
+  LocalClient& operator=(const LocalClient&) = delete;
+
+  /// @return false if the ring to the server is full, the datagram is lost then
+  bool Send(const uint8_t* data, size_t size);
+  /// Waits for a reply up to the timeout.
+  /// @return size of the reply, 0 on timeout or -1 if the server has gone
+  ssize_t Receive(uint8_t* buf, size_t len, std::chrono::milliseconds timeout);
+private:
+  LocalClient(int fd, int server_wake_fd, int wake_fd, RingsBlock* block, size_t size);
+
+  /// Connection which tells the server the client is alive
+  int fd_;
+  int server_wake_fd_;
+  int wake_fd_;
+  RingsBlock* block_;
+  size_t size_;
+  FrameRing to_server_;
+  FrameRing to_client_;
+};
+
+} // namespace udp_server::shm
+
+#endif // UDP_SERVER_SHM_LOCAL_CLIENT_H_
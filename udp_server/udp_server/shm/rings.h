@@ -0,0 +1,169 @@
+#ifndef UDP_SERVER_SHM_RINGS_H_
+#define UDP_SERVER_SHM_RINGS_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <unistd.h>
+
+/**
+ * Layout of the shared memory rings between the server and a client on
+ * the same host, see ShmTransport. Every client gets its own memfd:
+ * RingsBlock followed by frames of the ring to the server and frames of
+ * the ring to the client. Each ring has one producer and one consumer,
+ * so head and tail are the only synchronization.
+ *
+ * A consumer which runs out of frames sets `consumer_idle`, checks the
+ * ring once more and sleeps on its eventfd; the producer writes the eventfd
+ * after a push only if the flag is set, so nobody makes syscalls while
+ * both sides are busy.
+ *
+ * Offsets are fixed (see the static_asserts), clients in other languages
+ * map the same layout.
+ */
+namespace udp_server::shm {
+
+constexpr uint64_t RINGS_MAGIC = 0x31304752504455; // "UDPRG01"
+/// Same as Packet::MAX_SIZE, the layout doesn't depend on the server
+constexpr uint32_t MAX_FRAME_SIZE = 1472;
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free);
+static_assert(std::atomic<uint32_t>::is_always_lock_free);
+
+struct alignas(64) Frame {
+  uint32_t size;
+  uint8_t data[MAX_FRAME_SIZE];
+};
+
+struct RingControl {
+  /// Number of frames pushed by the producer
+  alignas(64) std::atomic<uint64_t> head;
+  /// Number of frames popped by the consumer
+  alignas(64) std::atomic<uint64_t> tail;
+  /// Consumer sleeps on its eventfd
+  alignas(64) std::atomic<uint32_t> consumer_idle;
+};
+
+struct alignas(64) RingsBlock {
+  uint64_t magic;
+  /// Frames in each ring, a power of two
+  uint32_t capacity;
+  uint32_t reserved;
+
+  RingControl to_server;
+  RingControl to_client;
+};
+
+static_assert(sizeof(Frame) == 1536);
+static_assert(offsetof(RingsBlock, to_server) == 64);
+static_assert(offsetof(RingsBlock, to_client) == 256);
+static_assert(sizeof(RingsBlock) == 448);
+
+/// The server sends it to a connected client with three descriptors:
+/// the memfd, eventfd of the server and eventfd of the client.
+struct RingsHello {
+  uint64_t magic;
+  uint32_t capacity;
+  uint32_t reserved;
+  /// Size of the memfd
+  uint64_t size;
+};
+
+inline size_t RingsSize(uint32_t capacity) {
+  return sizeof(RingsBlock) + 2 * size_t{capacity} * sizeof(Frame);
+}
+
+inline Frame* ToServerFrames(RingsBlock* block) {
+  return reinterpret_cast<Frame*>(reinterpret_cast<uint8_t*>(block) + sizeof(RingsBlock));
+}
+
+inline Frame* ToClientFrames(RingsBlock* block) {
+  return ToServerFrames(block) + block->capacity;
+}
+
+/**
+ * One side of a ring: the producer only pushes, the consumer only pops.
+ */
+class FrameRing {
+public:
+  FrameRing(RingControl* control, Frame* frames, uint32_t capacity)
+      : control_(control), frames_(frames), mask_(capacity - 1) {}
+
+  /// @return false if the ring is full or the frame is too big
+  bool Push(const uint8_t* data, size_t size) {
+    const auto head = control_->head.load(std::memory_order_relaxed);
+    if (size > MAX_FRAME_SIZE || head - control_->tail.load(std::memory_order_acquire) > mask_)
+      return false;
+
+    auto& frame = frames_[head & mask_];
+    frame.size = static_cast<uint32_t>(size);
+    std::memcpy(frame.data, data, size);
+    control_->head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// Copies the next frame into the buffer, longer frames are truncated.
+  /// @return size of the frame or nullopt if the ring is empty
+  std::optional<size_t> Pop(uint8_t* buf, size_t len) {
+    const auto tail = control_->tail.load(std::memory_order_relaxed);
+    if (tail == control_->head.load(std::memory_order_acquire)) return std::nullopt;
+
+    const auto& frame = frames_[tail & mask_];
+    const size_t size = std::min<size_t>(frame.size, len);
+    std::memcpy(buf, frame.data, size);
+    control_->tail.store(tail + 1, std::memory_order_release);
+    return size;
+  }
+
+  /// @return frames in the ring, frames being pushed or popped meanwhile
+  /// may be counted or not
+  [[nodiscard]] size_t size() const {
+    // Tail first, so it never overtakes the head it is compared with
+    const auto tail = control_->tail.load(std::memory_order_acquire);
+    return control_->head.load(std::memory_order_acquire) - tail;
+  }
+  [[nodiscard]] bool empty() const {
+    return control_->tail.load(std::memory_order_relaxed) ==
+           control_->head.load(std::memory_order_acquire);
+  }
+
+  /// Producer side: wakes the consumer after a push if it sleeps. The flag
+  /// is cleared here, so a burst of pushes writes the eventfd once.
+  /// @return true if the eventfd was written
+  bool WakeConsumer(int eventfd) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (control_->consumer_idle.load(std::memory_order_relaxed) == 0 ||
+        control_->consumer_idle.exchange(0, std::memory_order_relaxed) == 0) {
+      return false;
+    }
+
+    const uint64_t one = 1;
+    [[maybe_unused]] const auto written = write(eventfd, &one, sizeof(one));
+    return true;
+  }
+
+  /// Consumer side: announces that it goes to sleep.
+  /// @return false if a frame has come meanwhile, then it mustn't sleep
+  bool PrepareToSleep() {
+    control_->consumer_idle.store(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!empty()) {
+      control_->consumer_idle.store(0, std::memory_order_relaxed);
+      return false;
+    }
+    return true;
+  }
+
+  void WakeUp() { control_->consumer_idle.store(0, std::memory_order_relaxed); }
+private:
+  RingControl* control_;
+  Frame* frames_;
+  uint64_t mask_;
+};
+
+} // namespace udp_server::shm
+
+#endif // UDP_SERVER_SHM_RINGS_H_
@@ -0,0 +1,348 @@
+#include "udp_server/shm_transport.h"
+
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace udp_server {
+namespace {
+
+/// Stop flag is checked that often while nothing happens
+const int POLL_TIMEOUT_MS = 100;
+/// Frames which are taken from the rings in a row before the socket gets
+/// a chance, so busy local clients don't starve remote ones
+const uint32_t MAX_RING_FRAMES_IN_ROW = 64;
+/// Size of the abstract Unix address which stands for a local client
+const socklen_t CLIENT_ADDRESS_SIZE = offsetof(sockaddr_un, sun_path) + 1 + sizeof(uint64_t);
+
+bool SendHello(int fd, const shm::RingsHello& hello, const int (&fds)[3]) {
+  iovec iov = { .iov_base = const_cast<shm::RingsHello*>(&hello), .iov_len = sizeof(hello) };
+  alignas(cmsghdr) uint8_t control[CMSG_SPACE(sizeof(fds))] = {};
+
+  msghdr message = {};
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+
+  auto* cmsg = CMSG_FIRSTHDR(&message);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+  std::memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+  return sendmsg(fd, &message, MSG_NOSIGNAL) == static_cast<ssize_t>(sizeof(hello));
+}
+
+} // namespace
+
+ShmTransport::ShmTransport(net::UDPSocket&& socket, std::filesystem::path socket_path,
+                           const Options& options)
+            : socket_(std::move(socket)),
+              socket_path_(std::move(socket_path)),
+              options_(Options{ .ring_capacity = std::bit_ceil(std::max<uint32_t>(options.ring_capacity, 2)) }),
+              listen_fd_(-1),
+              wake_fd_(-1),
+              stop_fd_(-1),
+              mutex_(),
+              clients_(),
+              next_client_(0),
+              next_client_id_(1),
+              ring_frames_in_row_(0),
+              stats_(),
+              accept_thread_() {}
+
+ShmTransport::~ShmTransport() {
+  if (accept_thread_.joinable()) {
+    Shutdown();
+    accept_thread_.join();
+  }
+
+  while (!clients_.empty())
+    RemoveClient(clients_.size() - 1);
+  if (listen_fd_ >= 0) {
+    close(listen_fd_);
+    std::error_code error;
+    std::filesystem::remove(socket_path_, error);
+  }
+  if (wake_fd_ >= 0) close(wake_fd_);
+  if (stop_fd_ >= 0) close(stop_fd_);
+}
+
+bool ShmTransport::Open() {
+  wake_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  stop_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (wake_fd_ < 0 || stop_fd_ < 0) {
+    std::perror("eventfd");
+    return false;
+  }
+
+  listen_fd_ = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  if (socket_path_.native().size() >= sizeof(address.sun_path)) return false;
+  std::strcpy(address.sun_path, socket_path_.c_str());
+
+  std::error_code error;
+  std::filesystem::remove(socket_path_, error);
+  if (listen_fd_ < 0 ||
+      bind(listen_fd_, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 ||
+      listen(listen_fd_, SOMAXCONN) != 0) {
+    std::perror("bind");
+    return false;
+  }
+
+  accept_thread_ = std::thread([this] { AcceptLoop(); });
+  return true;
+}
+
+ssize_t ShmTransport::Receive(uint8_t* buf, size_t len, net::SockAddr* from,
+                              const std::atomic<bool>& stop) {
+  while (!stop.load(std::memory_order_relaxed)) {
+    {
+      std::lock_guard lock(mutex_);
+      if (ring_frames_in_row_ < MAX_RING_FRAMES_IN_ROW) {
+        if (const auto size = PopFrame(buf, len, from)) {
+          ++ring_frames_in_row_;
+          return static_cast<ssize_t>(*size);
+        }
+      }
+      ring_frames_in_row_ = 0;
+    }
+
+    const auto bytes_received = socket_.RecvFrom(buf, len, MSG_DONTWAIT, from);
+    if (bytes_received >= 0) return bytes_received;
+    if (errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+
+    // The socket is empty, but rings may be not after a run of frames
+    std::unique_lock lock(mutex_);
+    if (const auto size = PopFrame(buf, len, from)) {
+      ++ring_frames_in_row_;
+      return static_cast<ssize_t>(*size);
+    }
+    lock.unlock();
+    Wait();
+  }
+
+  return -1;
+}
+
+void ShmTransport::Send(const net::SockAddr& to, const uint8_t* buf, size_t len) {
+  const auto client_id = ClientId(to);
+  if (!client_id) {
+    socket_.SendTo(to, buf, len, 0);
+    return;
+  }
+
+  std::lock_guard lock(mutex_);
+  const auto client_it = std::find_if(clients_.begin(), clients_.end(),
+                                      [&](const Client& client) { return client.id == *client_id; });
+  if (client_it == clients_.end()) return;
+
+  if (!client_it->to_client.Push(buf, len)) {
+    ++stats_.dropped;
+    return;
+  }
+  ++stats_.sent;
+  if (client_it->to_client.WakeConsumer(client_it->wake_fd))
+    ++stats_.client_wakeups;
+}
+
+void ShmTransport::Shutdown() {
+  const uint64_t one = 1;
+  [[maybe_unused]] const auto written = write(stop_fd_, &one, sizeof(one));
+}
+
+size_t ShmTransport::QueuedBytes() const {
+  size_t queued_bytes = static_cast<size_t>(std::max(socket_.QueuedBytes(), 0));
+  std::lock_guard lock(mutex_);
+  for (const auto& client : clients_)
+    queued_bytes += client.to_server.size() * shm::MAX_FRAME_SIZE;
+  return queued_bytes;
+}
+
+ShmTransport::Stats ShmTransport::stats() const {
+  std::lock_guard lock(mutex_);
+  return stats_;
+}
+
+// static
+net::SockAddr ShmTransport::ClientAddress(uint64_t client_id) {
+  // Abstract name which no real socket has: zero byte and the id
+  sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  std::memcpy(address.sun_path + 1, &client_id, sizeof(client_id));
+  return net::SockAddr(reinterpret_cast<const sockaddr*>(&address), CLIENT_ADDRESS_SIZE);
+}
+
+// static
+std::optional<uint64_t> ShmTransport::ClientId(const net::SockAddr& address) {
+  if (address.family() != AF_UNIX || address.socklen() != CLIENT_ADDRESS_SIZE) return std::nullopt;
+
+  uint64_t client_id = 0;
+  std::memcpy(&client_id, reinterpret_cast<const sockaddr_un*>(address.sockaddr())->sun_path + 1,
+              sizeof(client_id));
+  return client_id;
+}
+
+std::optional<size_t> ShmTransport::PopFrame(uint8_t* buf, size_t len, net::SockAddr* from) {
+  for (size_t n = 0; n < clients_.size(); ++n) {
+    const auto idx = (next_client_ + n) % clients_.size();
+    auto& client = clients_[idx];
+    if (const auto size = client.to_server.Pop(buf, len)) {
+      next_client_ = idx + 1;
+      *from = ClientAddress(client.id);
+      ++stats_.received;
+      return size;
+    }
+  }
+
+  return std::nullopt;
+}
+
+bool ShmTransport::PrepareToSleep() {
+  for (auto& client : clients_) {
+    if (!client.to_server.PrepareToSleep()) {
+      for (auto& awake : clients_)
+        awake.to_server.WakeUp();
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void ShmTransport::AddClient(int fd) {
+  const auto size = shm::RingsSize(options_.ring_capacity);
+  const int memfd = memfd_create("udp_server_rings", MFD_CLOEXEC);
+  if (memfd < 0 || ftruncate(memfd, static_cast<off_t>(size)) != 0) {
+    std::perror("memfd_create");
+    if (memfd >= 0) close(memfd);
+    close(fd);
+    return;
+  }
+
+  auto region = base::MappedRegion::MapShared(memfd, 0, size, true);
+  const int client_wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (!region || client_wake_fd < 0) {
+    std::perror("mmap");
+    if (client_wake_fd >= 0) close(client_wake_fd);
+    close(memfd);
+    close(fd);
+    return;
+  }
+
+  // Fresh memfd is zero-filled, so both rings are empty
+  auto* block = new (region->data()) shm::RingsBlock();
+  block->magic = shm::RINGS_MAGIC;
+  block->capacity = options_.ring_capacity;
+
+  const shm::RingsHello hello = {
+      .magic = shm::RINGS_MAGIC,
+      .capacity = options_.ring_capacity,
+      .reserved = 0,
+      .size = size,
+  };
+  const int fds[3] = { memfd, wake_fd_, client_wake_fd };
+  const auto sent = SendHello(fd, hello, fds);
+  close(memfd);
+  if (!sent) {
+    close(client_wake_fd);
+    close(fd);
+    return;
+  }
+
+  clients_.push_back(Client{
+      .id = next_client_id_++,
+      .fd = fd,
+      .wake_fd = client_wake_fd,
+      .to_server = shm::FrameRing(&block->to_server, shm::ToServerFrames(block), block->capacity),
+      .to_client = shm::FrameRing(&block->to_client, shm::ToClientFrames(block), block->capacity),
+      .region = std::move(*region),
+  });
+  ++stats_.clients;
+}
+
+void ShmTransport::RemoveClient(size_t idx) {
+  close(clients_[idx].fd);
+  close(clients_[idx].wake_fd);
+  clients_.erase(clients_.begin() + static_cast<ptrdiff_t>(idx));
+}
+
+void ShmTransport::Wait() {
+  {
+    std::lock_guard lock(mutex_);
+    if (!PrepareToSleep()) return;
+    ++stats_.sleeps;
+  }
+
+  pollfd fds[] = {
+      { .fd = stop_fd_,     .events = POLLIN, .revents = 0 },
+      { .fd = socket_.fd(), .events = POLLIN, .revents = 0 },
+      { .fd = wake_fd_,     .events = POLLIN, .revents = 0 },
+  };
+  poll(fds, std::size(fds), POLL_TIMEOUT_MS);
+
+  std::lock_guard lock(mutex_);
+  for (auto& client : clients_)
+    client.to_server.WakeUp();
+
+  uint64_t wakeups = 0;
+  if (fds[2].revents & POLLIN) {
+    [[maybe_unused]] const auto bytes_read = read(wake_fd_, &wakeups, sizeof(wakeups));
+  }
+}
+
+void ShmTransport::AcceptLoop() {
+  std::vector<pollfd> fds;
+  std::vector<uint64_t> client_ids;
+
+  while (true) {
+    fds.clear();
+    client_ids.clear();
+    fds.push_back({ .fd = stop_fd_,   .events = POLLIN, .revents = 0 });
+    fds.push_back({ .fd = listen_fd_, .events = POLLIN, .revents = 0 });
+    {
+      std::lock_guard lock(mutex_);
+      for (const auto& client : clients_) {
+        fds.push_back({ .fd = client.fd, .events = POLLIN, .revents = 0 });
+        client_ids.push_back(client.id);
+      }
+    }
+
+    poll(fds.data(), fds.size(), POLL_TIMEOUT_MS);
+    if (fds[0].revents & POLLIN) break;
+
+    std::lock_guard lock(mutex_);
+    // Clients never send anything after they connect, so readable connection is a closed one
+    for (size_t idx = 2; idx < fds.size(); ++idx) {
+      if (fds[idx].revents == 0) continue;
+      const auto client_it = std::find_if(clients_.begin(), clients_.end(),
+          [&](const Client& client) { return client.id == client_ids[idx - 2]; });
+      if (client_it != clients_.end())
+        RemoveClient(client_it - clients_.begin());
+    }
+
+    if (fds[1].revents & POLLIN) {
+      const int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+      if (fd >= 0) {
+        AddClient(fd);
+        // A sleeping receiver doesn't watch the new client's ring yet
+        const uint64_t one = 1;
+        [[maybe_unused]] const auto written = write(wake_fd_, &one, sizeof(one));
+      }
+    }
+  }
+}
+
+} // namespace udp_server
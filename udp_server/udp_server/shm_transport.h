@@ -0,0 +1,126 @@
+#ifndef UDP_SERVER_SHM_TRANSPORT_H_
+#define UDP_SERVER_SHM_TRANSPORT_H_
+
+#include "udp_server/base/mapped_region.h"
+#include "udp_server/net/sock_addr.h"
+#include "udp_server/net/udp_socket.h"
+#include "udp_server/shm/rings.h"
+
+#include <atomic>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace udp_server {
+
+/**
+ * Transport policy of the server for clients on the same host: they
+ * connect to the Unix socket and exchange datagrams with the server over
+ * a pair of rings in shared memory (see shm/rings.h) instead of the UDP
+ * stack, everybody else is served by the UDP socket as in UDPTransport.
+ * A local client is seen by the core as an address of its own, so
+ * sessions and reassembly don't know where datagrams come from.
+ *
+ * Receive takes frames from the rings first, then tries the socket, and
+ * only sleeps in poll when there is nothing anywhere; clients wake it
+ * through the eventfd only then. Several threads may receive at once,
+ * rings are taken under the lock. Clients are accepted and removed by
+ * a thread of their own, so they come and go while the socket keeps the
+ * receiving threads busy.
+ */
+class ShmTransport {
+public:
+  struct Options {
+    /// Frames in each ring of a client, rounded up to a power of two
+    uint32_t ring_capacity = 1024;
+  };
+
+  struct Stats {
+    uint64_t clients = 0;
+    /// Datagrams from the rings
+    uint64_t received = 0;
+    /// Replies to the rings
+    uint64_t sent = 0;
+    /// Replies which didn't fit a full ring and are lost like datagrams
+    uint64_t dropped = 0;
+    /// Times the server slept in poll
+    uint64_t sleeps = 0;
+    /// Eventfd writes which woke sleeping clients
+    uint64_t client_wakeups = 0;
+  };
+
+  ShmTransport(net::UDPSocket&& socket, std::filesystem::path socket_path, const Options& options);
+  ShmTransport(const ShmTransport&) = delete;
+  ~ShmTransport();
+
+  ShmTransport& operator=(const ShmTransport&) = delete;
+
+  /// Starts the thread which accepts clients on the Unix socket.
+  bool Open();
+
+  void SetupThread() {}
+  /// Receives one datagram from a ring or from the socket.
+  /// @return size of the datagram or -1 if there is an error or stop became true
+  ssize_t Receive(uint8_t* buf, size_t len, net::SockAddr* from, const std::atomic<bool>& stop);
+  void Send(const net::SockAddr& to, const uint8_t* buf, size_t len);
+  /// Makes Receive return in all threads.
+  void Shutdown();
+
+  /// @return bytes of datagrams waiting in the socket and in the rings
+  [[nodiscard]] size_t QueuedBytes() const;
+  [[nodiscard]] Stats stats() const;
+private:
+  struct Client {
+    uint64_t id;
+    /// Connection which the client keeps open while it is alive
+    int fd;
+    int wake_fd;
+    shm::FrameRing to_server;
+    shm::FrameRing to_client;
+    base::MappedRegion region;
+  };
+
+  /// @return address which stands for the client in the core
+  static net::SockAddr ClientAddress(uint64_t client_id);
+  static std::optional<uint64_t> ClientId(const net::SockAddr& address);
+
+  /// Functions below expect mutex_ to be held.
+  /// @{
+  std::optional<size_t> PopFrame(uint8_t* buf, size_t len, net::SockAddr* from);
+  /// @return false if a frame came while the rings were being marked
+  bool PrepareToSleep();
+  void AddClient(int fd);
+  void RemoveClient(size_t idx);
+  /// @}
+  /// Sleeps until a client or the socket has something, a client
+  /// connects, or the timeout passes.
+  void Wait();
+  /// Accepts clients and removes the ones which have gone away until stop.
+  void AcceptLoop();
+
+  net::UDPSocket socket_;
+  const std::filesystem::path socket_path_;
+  const Options options_;
+
+  int listen_fd_;
+  /// Clients write it to wake the server
+  int wake_fd_;
+  int stop_fd_;
+
+  mutable std::mutex mutex_;
+  std::vector<Client> clients_;
+  /// Client whose ring is looked at first, so nobody is starved
+  size_t next_client_;
+  uint64_t next_client_id_;
+  /// Frames taken from the rings since the socket was tried
+  uint32_t ring_frames_in_row_;
+  Stats stats_;
+
+  std::thread accept_thread_;
+};
+
+} // namespace udp_server
+
+#endif // UDP_SERVER_SHM_TRANSPORT_H_
@@ -0,0 +1,63 @@
+#include "udp_server/udp_transport.h"
+
+#include <algorithm>
+
+namespace udp_server {
+namespace {
+
+const auto SOCK_SEND_FLAGS = MSG_WAITALL;
+const auto SOCK_RECV_FLAGS = MSG_WAITALL;
+
+} // namespace
+
+UDPTransport::UDPTransport(net::UDPSocket&& socket)
+             : socket_(std::move(socket)),
+               busy_poller_(),
+               receive_monitor_(),
+               receive_monitor_mutex_() {}
+
+void UDPTransport::SetupThread() {
+  if (busy_poller_)
+    busy_poller_->SetupThread();
+}
+
+ssize_t UDPTransport::Receive(uint8_t* buf, size_t len, net::SockAddr* from,
+                              const std::atomic<bool>& stop) {
+  uint32_t drop_counter = 0;
+  auto* drops = receive_monitor_ ? &drop_counter : nullptr;
+  const auto bytes_received = busy_poller_
+      ? busy_poller_->RecvFrom(&socket_, buf, len, SOCK_RECV_FLAGS, from, stop, drops)
+      : socket_.RecvFrom(buf, len, SOCK_RECV_FLAGS, from, drops);
+
+  if (receive_monitor_ && bytes_received >= 0) {
+    std::unique_lock lock(receive_monitor_mutex_, std::try_to_lock);
+    if (lock.owns_lock())
+      receive_monitor_->OnDatagram(&socket_, drop_counter);
+  }
+
+  return bytes_received;
+}
+
+void UDPTransport::Send(const net::SockAddr& to, const uint8_t* buf, size_t len) {
+  socket_.SendTo(to, buf, len, SOCK_SEND_FLAGS);
+}
+
+void UDPTransport::Shutdown() {
+  socket_.ShutdownReceive();
+}
+
+size_t UDPTransport::QueuedBytes() const {
+  return static_cast<size_t>(std::max(socket_.QueuedBytes(), 0));
+}
+
+bool UDPTransport::UseBusyPoll(const BusyPoller::Options& options) {
+  busy_poller_.emplace(options);
+  return busy_poller_->Setup(&socket_);
+}
+
+bool UDPTransport::UseReceiveMonitor(const ReceiveMonitor::Options& options) {
+  receive_monitor_.emplace(options);
+  return receive_monitor_->Setup(&socket_);
+}
+
+} // namespace udp_server
@@ -0,0 +1,62 @@
+#ifndef UDP_SERVER_UDP_TRANSPORT_H_
+#define UDP_SERVER_UDP_TRANSPORT_H_
+
+#include "udp_server/busy_poll.h"
+#include "udp_server/receive_monitor.h"
+#include "udp_server/net/sock_addr.h"
+#include "udp_server/net/udp_socket.h"
+
+#include <atomic>
+#include <mutex>
+#include <optional>
+
+namespace udp_server {
+
+/**
+ * Transport policy of the server which receives and sends datagrams
+ * over the UDP socket. Several threads may receive at once, unless busy
+ * polling is used.
+ */
+class UDPTransport {
+public:
+  explicit UDPTransport(net::UDPSocket&& socket);
+
+  /// Prepares the calling thread for receiving.
+  void SetupThread();
+  /// Receives one datagram into the buffer.
+  /// @return size of the datagram or -1 if there is an error or stop became true
+  ssize_t Receive(uint8_t* buf, size_t len, net::SockAddr* from, const std::atomic<bool>& stop);
+  void Send(const net::SockAddr& to, const uint8_t* buf, size_t len);
+  /// Makes Receive return in all threads.
+  void Shutdown();
+
+  /// Spins on non-blocking receive instead of sleeping in the kernel.
+  /// @return false if busy polling can't be enabled on the socket
+  bool UseBusyPoll(const BusyPoller::Options& options);
+
+  /// Counts datagrams dropped by the kernel and grows the receive buffer
+  /// when the server falls behind.
+  /// @return false if the kernel doesn't report drops
+  bool UseReceiveMonitor(const ReceiveMonitor::Options& options);
+
+  /// @return bytes of datagrams waiting in the socket
+  [[nodiscard]] size_t QueuedBytes() const;
+
+  [[nodiscard]] const BusyPoller* busy_poller() const {
+    return busy_poller_ ? &*busy_poller_ : nullptr;
+  }
+  [[nodiscard]] const ReceiveMonitor* receive_monitor() const {
+    return receive_monitor_ ? &*receive_monitor_ : nullptr;
+  }
+private:
+  net::UDPSocket socket_;
+  std::optional<BusyPoller> busy_poller_;
+  std::optional<ReceiveMonitor> receive_monitor_;
+  /// Monitor sees datagrams of whichever thread gets it, the drop counter
+  /// is cumulative, so datagrams it misses lose no drops
+  std::mutex receive_monitor_mutex_;
+};
+
+} // namespace udp_server
+
+#endif // UDP_SERVER_UDP_TRANSPORT_H_